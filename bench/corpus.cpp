@@ -0,0 +1,181 @@
+#include "corpus.hpp"
+#include <turbojpeg.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+namespace blutography::bench {
+
+namespace {
+    // Photo-like content: smooth gradients, a few hard edges and sensor-style
+    // noise, so the encoder does a realistic amount of work per block.
+    std::vector<unsigned char> syntheticPixels(int width, int height) {
+        std::vector<unsigned char> rgb(static_cast<size_t>(width) * height * 3);
+        uint32_t state = 0x9E3779B9u;
+        for (int y = 0; y < height; ++y) {
+            unsigned char* row = rgb.data() + static_cast<size_t>(y) * width * 3;
+            for (int x = 0; x < width; ++x) {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                int noise = static_cast<int>(state & 15) - 8;
+                bool block = ((x / 257) + (y / 193)) % 3 == 0;
+                int r = 40 + 160 * x / width + (block ? 50 : 0) + noise;
+                int g = 60 + 120 * y / height + noise;
+                int b = 90 + static_cast<int>(60 * std::sin(x * 0.01) * std::cos(y * 0.013)) + noise;
+                row[x * 3] = static_cast<unsigned char>(std::clamp(r, 0, 255));
+                row[x * 3 + 1] = static_cast<unsigned char>(std::clamp(g, 0, 255));
+                row[x * 3 + 2] = static_cast<unsigned char>(std::clamp(b, 0, 255));
+            }
+        }
+        return rgb;
+    }
+
+    struct TiffWriter {
+        std::string out;
+        void u16(uint16_t v) { out.push_back(static_cast<char>(v & 0xFF)); out.push_back(static_cast<char>(v >> 8)); }
+        void u32(uint32_t v) { for (int i = 0; i < 4; ++i) out.push_back(static_cast<char>((v >> (8 * i)) & 0xFF)); }
+        void entry(uint16_t tag, uint16_t type, uint32_t count, uint32_t value) { u16(tag); u16(type); u32(count); u32(value); }
+    };
+
+    // A little-endian EXIF block shaped like a camera's: the fields the gallery
+    // reads, a 4 KB MakerNote and a 16 KB IFD1 thumbnail for the sanitiser to drop.
+    std::string cameraExifSegment(int width, int height) {
+        const std::string model = "Bench Camera 1";
+        const std::string date = "2026:01:20 21:57:00";
+        const std::string lens = "Bench 24-70mm F2.8";
+        const uint32_t makerNoteSize = 4096, thumbnailSize = 16384;
+
+        // Layout: header | IFD0 (4) | Exif IFD (9) | IFD1 (2) | values
+        const uint32_t ifd0 = 8, ifd0Size = 2 + 4 * 12 + 4;
+        const uint32_t exifIfd = ifd0 + ifd0Size, exifSize = 2 + 9 * 12 + 4;
+        const uint32_t ifd1 = exifIfd + exifSize, ifd1Size = 2 + 2 * 12 + 4;
+        uint32_t cursor = ifd1 + ifd1Size;
+        auto place = [&cursor](uint32_t size) { uint32_t at = cursor; cursor += size + (size & 1); return at; };
+        const uint32_t modelAt = place(static_cast<uint32_t>(model.size() + 1));
+        const uint32_t dateAt = place(static_cast<uint32_t>(date.size() + 1));
+        const uint32_t dateOrigAt = place(static_cast<uint32_t>(date.size() + 1));
+        const uint32_t exposureAt = place(8), fnumberAt = place(8), focalAt = place(8);
+        const uint32_t lensAt = place(static_cast<uint32_t>(lens.size() + 1));
+        const uint32_t makerAt = place(makerNoteSize);
+        const uint32_t thumbAt = place(thumbnailSize);
+
+        TiffWriter t;
+        t.out = "II";
+        t.u16(42);
+        t.u32(ifd0);
+
+        t.u16(4);
+        t.entry(0x0110, 2, static_cast<uint32_t>(model.size() + 1), modelAt);
+        t.entry(0x0112, 3, 1, 1);
+        t.entry(0x0132, 2, static_cast<uint32_t>(date.size() + 1), dateAt);
+        t.entry(0x8769, 4, 1, exifIfd);
+        t.u32(ifd1);
+
+        t.u16(9);
+        t.entry(0x829A, 5, 1, exposureAt);
+        t.entry(0x829D, 5, 1, fnumberAt);
+        t.entry(0x8827, 3, 1, 400);
+        t.entry(0x9003, 2, static_cast<uint32_t>(date.size() + 1), dateOrigAt);
+        t.entry(0x920A, 5, 1, focalAt);
+        t.entry(0x927C, 7, makerNoteSize, makerAt);
+        t.entry(0xA002, 4, 1, static_cast<uint32_t>(width));
+        t.entry(0xA003, 4, 1, static_cast<uint32_t>(height));
+        t.entry(0xA434, 2, static_cast<uint32_t>(lens.size() + 1), lensAt);
+        t.u32(0);
+
+        t.u16(2);
+        t.entry(0x0201, 4, 1, thumbAt);
+        t.entry(0x0202, 4, 1, thumbnailSize);
+        t.u32(0);
+
+        auto pad = [&t](uint32_t at) { if (t.out.size() < at) t.out.resize(at, '\0'); };
+        pad(modelAt); t.out += model; t.out.push_back('\0');
+        pad(dateAt); t.out += date; t.out.push_back('\0');
+        pad(dateOrigAt); t.out += date; t.out.push_back('\0');
+        pad(exposureAt); t.u32(1); t.u32(250);
+        pad(fnumberAt); t.u32(28); t.u32(10);
+        pad(focalAt); t.u32(50); t.u32(1);
+        pad(lensAt); t.out += lens; t.out.push_back('\0');
+        pad(makerAt); t.out.append(makerNoteSize, 'M');
+        pad(thumbAt); t.out.append(thumbnailSize, 'T');
+
+        size_t length = 2 + 6 + t.out.size();
+        std::string segment;
+        segment.push_back(static_cast<char>(0xFF));
+        segment.push_back(static_cast<char>(0xE1));
+        segment.push_back(static_cast<char>(length >> 8));
+        segment.push_back(static_cast<char>(length & 0xFF));
+        segment.append("Exif\0\0", 6);
+        segment += t.out;
+        return segment;
+    }
+
+    std::string generate(const CorpusSpec& spec) {
+        int width = static_cast<int>(std::lround(std::sqrt(spec.megapixels * 1e6 * 1.5)));
+        int height = width * 2 / 3;
+        std::vector<unsigned char> rgb = syntheticPixels(width, height);
+
+        tjhandle compressor = tjInitCompress();
+        if (!compressor) throw std::runtime_error("tjInitCompress failed");
+        unsigned char* jpeg = nullptr;
+        unsigned long size = 0;
+        int rc = tjCompress2(compressor, rgb.data(), width, 0, height, TJPF_RGB, &jpeg, &size, spec.subsamp, 92, 0);
+        tjDestroy(compressor);
+        if (rc < 0) throw std::runtime_error("tjCompress2 failed for the corpus");
+
+        std::string result;
+        std::string exif = spec.exif ? cameraExifSegment(width, height) : std::string();
+        result.reserve(size + exif.size());
+        result.append(reinterpret_cast<const char*>(jpeg), 2);
+        result += exif;
+        result.append(reinterpret_cast<const char*>(jpeg) + 2, size - 2);
+        tjFree(jpeg);
+        return result;
+    }
+}
+
+std::string corpusFileName(const CorpusSpec& spec) {
+    std::ostringstream name;
+    name << spec.megapixels << "mp_" << (spec.subsamp == TJSAMP_444 ? "444" : "420") << "_" << (spec.exif ? "exif" : "noexif") << ".jpg";
+    return name.str();
+}
+
+const std::string& corpusImage(const CorpusSpec& spec) {
+    static std::mutex mutex;
+    static std::map<std::tuple<int, int, bool>, std::string> cache;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto key = std::make_tuple(spec.megapixels, spec.subsamp, spec.exif);
+    auto it = cache.find(key);
+    if (it != cache.end()) return it->second;
+
+    const char* dir = std::getenv("BLUTOGRAPHY_BENCH_CORPUS");
+    std::filesystem::path path = dir ? std::filesystem::path(dir) / corpusFileName(spec) : std::filesystem::path();
+    std::string data;
+    if (dir && std::filesystem::exists(path)) {
+        std::ifstream in(path, std::ios::binary);
+        std::ostringstream buffer;
+        buffer << in.rdbuf();
+        data = buffer.str();
+    } else {
+        data = generate(spec);
+        if (dir) {
+            std::filesystem::create_directories(dir);
+            std::ofstream out(path, std::ios::binary);
+            out.write(data.data(), static_cast<std::streamsize>(data.size()));
+        }
+    }
+    return cache.emplace(key, std::move(data)).first->second;
+}
+
+}
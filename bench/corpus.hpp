@@ -0,0 +1,27 @@
+#ifndef BLUTOGRAPHY_BENCH_CORPUS_HPP
+#define BLUTOGRAPHY_BENCH_CORPUS_HPP
+
+#include <string>
+
+namespace blutography::bench {
+    /// One corpus image: a 3:2 JPEG of roughly `megapixels` MP.
+    struct CorpusSpec {
+        int megapixels = 12;
+        int subsamp = 2;   // TJSAMP_420 (2) or TJSAMP_444 (0)
+        bool exif = false; // camera-style APP1: IFD0, Exif IFD with MakerNote, IFD1 thumbnail
+    };
+
+    /// File name used for the spec in a corpus directory, e.g. "45mp_420_exif.jpg".
+    std::string corpusFileName(const CorpusSpec& spec);
+
+    /**
+     * @brief The JPEG bytes for a spec, generated once per process.
+     *
+     * If BLUTOGRAPHY_BENCH_CORPUS names a directory, files in it are used as-is
+     * (so real camera files can be dropped in under the same names) and generated
+     * images are written there for the next run.
+     */
+    const std::string& corpusImage(const CorpusSpec& spec);
+}
+
+#endif // BLUTOGRAPHY_BENCH_CORPUS_HPP
@@ -0,0 +1,253 @@
+// Read-path contention benchmarks for GalleryStorage.
+//
+// Every benchmark runs at 1, 2, 4, ... threads up to the core count, standing in
+// for Drogon IO threads ("number_of_threads": 0 in config.json starts one per
+// core), so the items_per_second column shows how lookups and full /gallery/data
+// scans scale as IO threads are added. The *UnderWrites variants keep a writer
+// updating items in the background for the whole run. BM_GalleryStartup times
+// loading the same gallery from the JSON and from the binary snapshot, and
+// BM_GalleryDecode the part of the binary load spent mapping and decoding items,
+// the rest being the id maps and the indexes built over them;
+// BM_GalleryQuery answers /gallery/query shapes from the sorted indexes and
+// BM_GallerySearch answers /gallery/search from the inverted word index.
+// BM_GalleryPublish times one edit's copy-and-publish at growing gallery sizes,
+// on an engine that stores nothing, so only the snapshot's own cost is left.
+#include <support/gallery_file.hpp>
+#include <support/gallery_storage.hpp>
+#include "test_support.hpp"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <thread>
+
+namespace {
+    using blutography::GalleryStorage;
+    using blutography::testing::TempDirectory;
+
+    constexpr int galleryItems = 10000;
+
+    std::string itemId(int index) {
+        char id[16];
+        std::snprintf(id, sizeof(id), "%012x", index * 2654435761u);
+        return id;
+    }
+
+    // A gallery of `galleryItems` items in a private directory, removed at exit.
+    struct BenchGallery {
+        TempDirectory directory{"gallery_bench"};
+        std::unique_ptr<GalleryStorage> storage;
+        std::vector<std::string> ids;
+
+        BenchGallery() {
+            Json::Value root(Json::arrayValue);
+            for (int i = 0; i < galleryItems; ++i) {
+                Json::Value item;
+                item["id"] = itemId(i);
+                item["name"] = "Frame " + std::to_string(i);
+                item["quote"] = "A quote long enough to look like a real caption, number " + std::to_string(i);
+                item["fileName"] = "IMG_" + std::to_string(i) + ".jpg";
+                item["previewName"] = "IMG_" + std::to_string(i) + ".jpg";
+                // Spread over a few years and the usual ISO and shutter stops, so the indexes have something to sort
+                char dateTime[20];
+                std::snprintf(dateTime, sizeof(dateTime), "20%02d:%02d:%02d %02d:%02d:00",
+                              20 + i % 6, 1 + i % 12, 1 + i % 28, i % 24, i % 60);
+                item["metadata"]["dateTime"] = dateTime;
+                item["metadata"]["model"] = i % 3 ? "Canon EOS R5" : "Canon EOS 5D Mark III";
+                item["metadata"]["exposure"] = "1/" + std::to_string(30 << (i % 8));
+                item["metadata"]["iso"] = std::to_string(100 << (i % 7));
+                item["metadata"]["width"] = 8192;
+                item["metadata"]["height"] = 5464;
+                root.append(item);
+                ids.push_back(itemId(i));
+            }
+            std::ofstream(directory.file("gallery_data.json")) << Json::writeString(Json::StreamWriterBuilder(), root);
+            // Starts from the JSON and writes gallery_data.bin, as a first start after upgrading would
+            storage = std::make_unique<GalleryStorage>(directory.file("gallery_data.bin"), directory.file("gallery_data.log"),
+                                                       directory.file("gallery_data.json"));
+        }
+    };
+
+    BenchGallery& gallery() {
+        static BenchGallery inst;
+        return inst;
+    }
+
+    // Renames items in a loop on its own thread while thread 0 of a benchmark is running.
+    class BackgroundWriter {
+    public:
+        explicit BackgroundWriter(bool enabled) {
+            if (!enabled) return;
+            thread_ = std::thread([this] {
+                auto& bench = gallery();
+                for (size_t i = 0; !stop_; ++i) {
+                    bench.storage->updateDetails(bench.ids[i % bench.ids.size()], "Renamed " + std::to_string(i), std::nullopt);
+                    ++writes_;
+                }
+            });
+        }
+
+        ~BackgroundWriter() {
+            stop_ = true;
+            if (thread_.joinable()) thread_.join();
+        }
+
+        size_t writes() const { return writes_; }
+
+    private:
+        std::atomic<bool> stop_{false};
+        std::atomic<size_t> writes_{0};
+        std::thread thread_;
+    };
+
+    void getItem(benchmark::State& state, bool underWrites) {
+        auto& bench = gallery();
+        BackgroundWriter writer(underWrites && state.thread_index() == 0);
+        size_t index = static_cast<size_t>(state.thread_index()) * 7919;
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(bench.storage->getItem(bench.ids[index++ % bench.ids.size()]));
+        }
+        state.SetItemsProcessed(state.iterations());
+        if (underWrites && state.thread_index() == 0) state.counters["writes"] = static_cast<double>(writer.writes());
+    }
+
+    // What GET /gallery/data does: take one snapshot and walk every item.
+    void scan(benchmark::State& state, bool underWrites) {
+        auto& bench = gallery();
+        BackgroundWriter writer(underWrites && state.thread_index() == 0);
+        size_t items = 0;
+        for (auto _ : state) {
+            auto snapshot = bench.storage->snapshot();
+            int64_t pixels = 0;
+            for (const auto& item : snapshot->items) pixels += item->metadata.width * static_cast<int64_t>(item->metadata.height);
+            benchmark::DoNotOptimize(pixels);
+            items += snapshot->items.size();
+        }
+        state.SetItemsProcessed(static_cast<int64_t>(items));
+    }
+
+    void BM_GalleryGetItem(benchmark::State& state) { getItem(state, false); }
+    void BM_GalleryGetItemUnderWrites(benchmark::State& state) { getItem(state, true); }
+    void BM_GallerySnapshotScan(benchmark::State& state) { scan(state, false); }
+    void BM_GallerySnapshotScanUnderWrites(benchmark::State& state) { scan(state, true); }
+
+    // /gallery/query shapes: 0 = newest 100, 1 = newest 100 at ISO 400-800, 2 = lowest ISO within one month.
+    void BM_GalleryQuery(benchmark::State& state) {
+        auto& bench = gallery();
+        blutography::GalleryQuery query;
+        query.descending = state.range(0) != 2;
+        if (state.range(0) == 1) {
+            query.ranges[static_cast<size_t>(blutography::IndexField::Iso)] = {400, 800};
+        } else if (state.range(0) == 2) {
+            query.sort = blutography::IndexField::Iso;
+            query.ranges[static_cast<size_t>(blutography::IndexField::DateTime)] = {
+                *blutography::parseCaptureTime("2022-03-01"), *blutography::parseCaptureTime("2022-03-31")};
+        }
+        size_t items = 0;
+        for (auto _ : state) {
+            auto result = bench.storage->snapshot()->query(query);
+            items += result.size();
+            benchmark::DoNotOptimize(result);
+        }
+        state.SetItemsProcessed(static_cast<int64_t>(items));
+    }
+
+    // /gallery/search shapes: 0 = one rare word, 1 = a prefix of many words, 2 = two words, one of them in every quote.
+    void BM_GallerySearch(benchmark::State& state) {
+        auto& bench = gallery();
+        const char* queries[] = {"4242", "frame 12", "caption 77"};
+        const char* text = queries[state.range(0)];
+        size_t items = 0;
+        for (auto _ : state) {
+            auto result = bench.storage->snapshot()->search(text, 20);
+            items += result.size();
+            benchmark::DoNotOptimize(result);
+        }
+        state.SetItemsProcessed(static_cast<int64_t>(items));
+        state.SetLabel(text);
+    }
+
+    // An engine that keeps nothing: starts from `items` generated items and commits every write at once
+    class MemoryEngine : public blutography::GalleryEngine {
+    public:
+        explicit MemoryEngine(int items) : items_(items) {}
+        const char* name() const override { return "memory"; }
+        std::vector<std::shared_ptr<const blutography::GalleryItem>> load() override {
+            std::vector<std::shared_ptr<const blutography::GalleryItem>> items;
+            for (int i = 0; i < items_; ++i) {
+                blutography::GalleryItem item;
+                item.id = itemId(i);
+                item.contentHash = item.id + "0000000000000000000000000000";
+                item.name = "Frame " + std::to_string(i);
+                item.quote = "A quote long enough to look like a real caption, number " + std::to_string(i);
+                item.metadata.iso = std::to_string(100 << (i % 7));
+                item.metadata.model = i % 3 ? "Canon EOS R5" : "Canon EOS 5D Mark III";
+                items.push_back(std::make_shared<const blutography::GalleryItem>(std::move(item)));
+            }
+            return items;
+        }
+        void start(std::function<std::shared_ptr<const blutography::GallerySnapshot>()>) override {}
+        uint64_t write(const blutography::GalleryItem&) override { return ++ticket_; }
+        bool wait(uint64_t) override { return true; }
+
+    private:
+        int items_;
+        uint64_t ticket_ = 0;
+    };
+
+    // One rename of a gallery of state.range(0) items: copy the snapshot, change one item, publish
+    void BM_GalleryPublish(benchmark::State& state) {
+        auto items = static_cast<int>(state.range(0));
+        GalleryStorage storage(std::make_unique<MemoryEngine>(items));
+        size_t i = 0;
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(storage.updateDetails(itemId(static_cast<int>(i * 7919 % items)), "Renamed " + std::to_string(i), std::nullopt));
+            ++i;
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+
+    // What main() waits for before the server starts: state.range(0) is 0 for JSON, 1 for binary.
+    void BM_GalleryStartup(benchmark::State& state) {
+        auto& bench = gallery();
+        std::string snapshot = bench.directory.file(state.range(0) ? "gallery_data.bin" : "gallery_data.json");
+        std::string log = bench.directory.file("startup.log");
+        for (auto _ : state) {
+            GalleryStorage storage(snapshot, log);
+            benchmark::DoNotOptimize(storage.snapshot()->items.size());
+        }
+        std::filesystem::remove(log);
+        state.SetItemsProcessed(state.iterations() * galleryItems);
+        state.SetLabel(state.range(0) ? "binary" : "json");
+    }
+
+    // The binary snapshot alone, read into heap items as the engine's load() does
+    void BM_GalleryDecode(benchmark::State& state) {
+        std::string snapshot = gallery().directory.file("gallery_data.bin");
+        for (auto _ : state) {
+            std::vector<std::shared_ptr<const blutography::GalleryItem>> items;
+            std::string error;
+            if (!blutography::readGalleryFile(snapshot, items, error)) state.SkipWithError(error.c_str());
+            benchmark::DoNotOptimize(items.data());
+        }
+        state.SetItemsProcessed(state.iterations() * galleryItems);
+    }
+
+    void ioThreads(benchmark::internal::Benchmark* b) {
+        b->ThreadRange(1, std::max(1, static_cast<int>(std::thread::hardware_concurrency())));
+        b->UseRealTime();
+    }
+}
+
+BENCHMARK(BM_GalleryGetItem)->Apply(ioThreads);
+BENCHMARK(BM_GalleryGetItemUnderWrites)->Apply(ioThreads);
+BENCHMARK(BM_GallerySnapshotScan)->Apply(ioThreads)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_GallerySnapshotScanUnderWrites)->Apply(ioThreads)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_GalleryQuery)->DenseRange(0, 2)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_GallerySearch)->DenseRange(0, 2)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_GalleryStartup)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_GalleryDecode)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_GalleryPublish)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMicrosecond);
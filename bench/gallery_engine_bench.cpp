@@ -0,0 +1,113 @@
+// GalleryStorage engine comparison: the snapshot + log files against SQLite.
+//
+// Each benchmark runs at 1k, 10k and 100k items. BM_GalleryEngineLoad times a
+// start (what main() waits for before the server runs); BM_GalleryEngineWrite
+// times durable edits, one writer and eight at once, the latter showing how
+// well each engine shares a commit between concurrent writers. Reads are left
+// out on purpose: both engines serve them from the same in-memory snapshot.
+//
+// The SQLite runs need Drogon built with SQLite3.
+#include <support/gallery_storage.hpp>
+#include <support/gallery_file.hpp>
+#include <support/gallery_log_engine.hpp>
+#include <support/gallery_sqlite_engine.hpp>
+#include <support/durable.hpp>
+#include "test_support.hpp"
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace {
+    using namespace blutography;
+
+    enum Engine { Log, Sqlite };
+
+    const char* engineName(int64_t engine) { return engine == Sqlite ? "sqlite" : "log"; }
+
+    // A gallery of `count` items on one engine, in a private directory removed at exit.
+    struct EngineGallery {
+        testing::TempDirectory directory;
+        int64_t engine;
+        std::vector<std::string> ids;
+        std::unique_ptr<GalleryStorage> storage; // for the write benchmarks
+
+        EngineGallery(int64_t engine, int64_t count)
+            : directory("engine_bench", std::string(engineName(engine)) + "_" + std::to_string(count)), engine(engine) {
+
+            std::vector<std::shared_ptr<const GalleryItem>> items;
+            for (int64_t i = 0; i < count; ++i) {
+                auto item = std::make_shared<GalleryItem>();
+                char id[16];
+                std::snprintf(id, sizeof(id), "%012x", static_cast<unsigned>(i * 2654435761u));
+                item->id = id;
+                item->name = "Frame " + std::to_string(i);
+                item->quote = "A quote long enough to look like a real caption, number " + std::to_string(i);
+                item->fileName = item->previewName = "IMG_" + std::to_string(i) + ".jpg";
+                item->contentHash = item->id + "0123456789abcdef0123456789ab";
+                item->metadata.dateTime = "2024:06:28 05:07:50";
+                item->metadata.model = "Canon EOS R5";
+                item->metadata.width = 8192;
+                item->metadata.height = 5464;
+                ids.push_back(item->id);
+                items.push_back(std::move(item));
+            }
+            // The log engine starts from this; the SQLite one imports it into an empty database
+            writeFileAtomically(path("gallery_data.bin"), encodeGallery(items));
+            open().reset();
+        }
+
+        std::string path(const char* name) const { return directory.file(name); }
+
+        std::unique_ptr<GalleryStorage> open() const {
+            auto log = std::make_unique<LogGalleryEngine>(path("gallery_data.bin"), path("gallery_data.log"));
+            if (engine == Log) return std::make_unique<GalleryStorage>(std::move(log));
+            return std::make_unique<GalleryStorage>(std::make_unique<SqliteGalleryEngine>(path("gallery.db"), std::move(log)));
+        }
+    };
+
+    EngineGallery& engineGallery(int64_t engine, int64_t count) {
+        static std::mutex mutex;
+        static std::map<std::pair<int64_t, int64_t>, std::unique_ptr<EngineGallery>> galleries;
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& gallery = galleries[{engine, count}];
+        if (!gallery) gallery = std::make_unique<EngineGallery>(engine, count);
+        return *gallery;
+    }
+
+    // state.range(0) is the Engine, state.range(1) the number of items.
+    void BM_GalleryEngineLoad(benchmark::State& state) {
+        auto& gallery = engineGallery(state.range(0), state.range(1));
+        for (auto _ : state) {
+            auto storage = gallery.open();
+            benchmark::DoNotOptimize(storage->snapshot()->items.size());
+        }
+        state.SetItemsProcessed(state.iterations() * state.range(1));
+        state.SetLabel(engineName(state.range(0)));
+    }
+
+    void BM_GalleryEngineWrite(benchmark::State& state) {
+        auto& gallery = engineGallery(state.range(0), state.range(1));
+        static std::atomic<size_t> counter{0};
+        if (state.thread_index() == 0 && !gallery.storage) gallery.storage = gallery.open();
+        // Google Benchmark starts every thread's loop together, after the setup above
+        for (auto _ : state) {
+            size_t i = counter++;
+            gallery.storage->updateDetails(gallery.ids[i % gallery.ids.size()], "Renamed " + std::to_string(i), std::nullopt);
+        }
+        state.SetItemsProcessed(state.iterations());
+        state.SetLabel(engineName(state.range(0)));
+    }
+
+    void engines(benchmark::internal::Benchmark* b) {
+        for (int64_t engine : {Log, Sqlite}) {
+            for (int64_t count : {1000, 10000, 100000}) b->Args({engine, count});
+        }
+        b->ArgNames({"engine", "items"});
+    }
+}
+
+BENCHMARK(BM_GalleryEngineLoad)->Apply(engines)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_GalleryEngineWrite)->Apply(engines)->Threads(1)->Threads(8)->UseRealTime()->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,151 @@
+// Benchmarks for the ingest pipeline. For a machine-readable report:
+//
+//   blutography_bench --benchmark_out=bench.json --benchmark_out_format=json
+//
+// Every benchmark reports MP/s (source megapixels processed per second),
+// alloc_bytes (heap bytes allocated per iteration) and peak_rss_mb (process
+// high-water mark so far, so run a single filter to attribute it).
+#include "corpus.hpp"
+#include <support/image_utils.hpp>
+#include <support/resample.hpp>
+#include <benchmark/benchmark.h>
+#include <turbojpeg.h>
+#include <sys/resource.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Counting allocator: every operator new in the process goes through here.
+static std::atomic<uint64_t> allocatedBytes{0};
+
+void* operator new(std::size_t size) {
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) { return operator new(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept { return operator new(size, tag); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+    using blutography::bench::CorpusSpec;
+    using blutography::bench::corpusImage;
+    namespace image = blutography::image;
+
+    CorpusSpec specFrom(const benchmark::State& state) {
+        return {static_cast<int>(state.range(0)), state.range(1) == 444 ? TJSAMP_444 : TJSAMP_420, state.range(2) != 0};
+    }
+
+    double peakRssMb() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        return usage.ru_maxrss / (1024.0 * 1024.0); // bytes
+#else
+        return usage.ru_maxrss / 1024.0; // kilobytes
+#endif
+    }
+
+    // Runs `body` once per iteration and attaches the common counters.
+    template <typename Body>
+    void measure(benchmark::State& state, double megapixels, Body&& body) {
+        body(); // warm the thread's workspace so steady-state allocations are measured
+        uint64_t before = allocatedBytes.load();
+        for (auto _ : state) {
+            body();
+        }
+        uint64_t allocated = allocatedBytes.load() - before;
+        state.counters["MP/s"] = benchmark::Counter(megapixels * state.iterations(), benchmark::Counter::kIsRate);
+        state.counters["alloc_bytes"] = benchmark::Counter(static_cast<double>(allocated), benchmark::Counter::kAvgIterations);
+        state.counters["peak_rss_mb"] = peakRssMb();
+    }
+
+    double sourceMegapixels(const std::string& jpeg) {
+        image::Metadata meta = image::extractMetadata(jpeg);
+        return meta.width * static_cast<double>(meta.height) / 1e6;
+    }
+
+    void BM_ExtractMetadata(benchmark::State& state) {
+        const std::string& jpeg = corpusImage(specFrom(state));
+        measure(state, sourceMegapixels(jpeg), [&] {
+            benchmark::DoNotOptimize(image::extractMetadata(jpeg));
+        });
+    }
+
+    void BM_Analyze(benchmark::State& state) {
+        const std::string& jpeg = corpusImage(specFrom(state));
+        measure(state, sourceMegapixels(jpeg), [&] {
+            benchmark::DoNotOptimize(image::analyze(jpeg).pixels);
+        });
+    }
+
+    void BM_CreateGalleryPreview(benchmark::State& state) {
+        const std::string& jpeg = corpusImage(specFrom(state));
+        measure(state, sourceMegapixels(jpeg), [&] {
+            benchmark::DoNotOptimize(image::createGalleryPreview(jpeg, "bench.jpg"));
+        });
+    }
+
+    // The upload path: one analysis, then preview, ladder and placeholder
+    // (alternates off so optional encoders do not skew the comparison).
+    void BM_CreatePreviewSet(benchmark::State& state) {
+        const std::string& jpeg = corpusImage(specFrom(state));
+        image::PreviewOptions options;
+        options.avif.enabled = false;
+        options.webp.enabled = false;
+        measure(state, sourceMegapixels(jpeg), [&] {
+            image::Analysis analysis = image::analyze(jpeg, options.maxEdge);
+            benchmark::DoNotOptimize(image::createPreviewSet(analysis, jpeg, "bench.jpg", options));
+        });
+    }
+
+    // A capped preview: DCT pre-scaling plus Lanczos to an exact 1600 px edge.
+    void BM_CreatePreviewSet1600(benchmark::State& state) {
+        const std::string& jpeg = corpusImage(specFrom(state));
+        image::PreviewOptions options;
+        options.maxEdge = 1600;
+        options.avif.enabled = false;
+        options.webp.enabled = false;
+        measure(state, sourceMegapixels(jpeg), [&] {
+            image::Analysis analysis = image::analyze(jpeg, options.maxEdge);
+            benchmark::DoNotOptimize(image::createPreviewSet(analysis, jpeg, "bench.jpg", options));
+        });
+    }
+
+    void BM_ResampleLanczos(benchmark::State& state) {
+        const int width = static_cast<int>(state.range(0));
+        const int height = width * 2 / 3;
+        std::vector<unsigned char> src(static_cast<size_t>(width) * height * 3, 128);
+        std::vector<unsigned char> dst(1600 * 1067 * 3);
+        image::ScratchBuffer temp;
+        state.SetLabel(image::resampleKernel());
+        measure(state, width * static_cast<double>(height) / 1e6, [&] {
+            image::resampleRgb(src.data(), width, height, dst.data(), 1600, 1067, temp);
+            benchmark::DoNotOptimize(dst.data());
+        });
+    }
+
+    // megapixels x chroma subsampling x EXIF
+    void corpusArgs(benchmark::internal::Benchmark* b) {
+        b->ArgNames({"mp", "subsamp", "exif"});
+        b->ArgsProduct({{12, 24, 45, 100}, {420, 444}, {0, 1}});
+        b->Unit(benchmark::kMillisecond);
+        b->UseRealTime();
+    }
+}
+
+BENCHMARK(BM_ExtractMetadata)->Apply(corpusArgs)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_Analyze)->Apply(corpusArgs);
+BENCHMARK(BM_CreateGalleryPreview)->Apply(corpusArgs);
+BENCHMARK(BM_CreatePreviewSet)->Apply(corpusArgs);
+BENCHMARK(BM_CreatePreviewSet1600)->Apply(corpusArgs);
+BENCHMARK(BM_ResampleLanczos)->ArgName("width")->Arg(4000)->Arg(8000)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
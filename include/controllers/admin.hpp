@@ -11,6 +11,9 @@ namespace blutography {
             ADD_METHOD_TO(Admin_Controller::login, "/login", drogon::Post);
             ADD_METHOD_TO(Admin_Controller::uploadPage, "/upload", drogon::Get, "blutography::AdminAuthFilter");
             ADD_METHOD_TO(Admin_Controller::uploadImage, "/upload", drogon::Post, "blutography::AdminAuthFilter");
+            ADD_METHOD_TO(Admin_Controller::uploadStatus, "/upload/status", drogon::Get, "blutography::AdminAuthFilter");
+            ADD_METHOD_TO(Admin_Controller::uploadJob, "/upload/jobs/{1}", drogon::Get, "blutography::AdminAuthFilter");
+            ADD_METHOD_TO(Admin_Controller::uploadJobEvents, "/upload/jobs/{1}/events", drogon::Get, "blutography::AdminAuthFilter");
             ADD_METHOD_TO(Admin_Controller::b2Test, "/b2_test", drogon::Get, "blutography::AdminAuthFilter");
         METHOD_LIST_END
 
@@ -18,6 +21,9 @@ namespace blutography {
         void login(const drogon::HttpRequestPtr &req, std::function<void(const drogon::HttpResponsePtr &)> &&callback);
         void uploadPage(const drogon::HttpRequestPtr &req, std::function<void(const drogon::HttpResponsePtr &)> &&callback);
         void uploadImage(const drogon::HttpRequestPtr &req, std::function<void(const drogon::HttpResponsePtr &)> &&callback);
+        void uploadStatus(const drogon::HttpRequestPtr &req, std::function<void(const drogon::HttpResponsePtr &)> &&callback);
+        void uploadJob(const drogon::HttpRequestPtr &req, std::function<void(const drogon::HttpResponsePtr &)> &&callback, const std::string &jobId);
+        void uploadJobEvents(const drogon::HttpRequestPtr &req, std::function<void(const drogon::HttpResponsePtr &)> &&callback, const std::string &jobId);
         void b2Test(const drogon::HttpRequestPtr &req, std::function<void(const drogon::HttpResponsePtr &)> &&callback);
     };
 }
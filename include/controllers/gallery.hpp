@@ -15,17 +15,26 @@ namespace blutography {
     METHOD_LIST_BEGIN
     ADD_METHOD_TO(GalleryController::get, "/gallery", drogon::Get);
     ADD_METHOD_TO(GalleryController::get_data, "/gallery/data", drogon::Get);
+    ADD_METHOD_TO(GalleryController::get_query, "/gallery/query", drogon::Get);
+    ADD_METHOD_TO(GalleryController::get_search, "/gallery/search", drogon::Get);
     ADD_METHOD_TO(GalleryController::get_previews_bundle, "/gallery/previews", drogon::Get);
     ADD_METHOD_TO(GalleryController::get_preview_image, "/gallery/preview/{1}", drogon::Get);
     ADD_METHOD_TO(GalleryController::get_image, "/gallery/image/{1}", drogon::Get);
+    ADD_METHOD_TO(GalleryController::get_tile_info, "/gallery/tiles/{1}/info", drogon::Get);
+    ADD_METHOD_TO(GalleryController::get_tile, "/gallery/tiles/{1}/{2}/{3}", drogon::Get);
     ADD_METHOD_TO(GalleryController::download_bundle, "/gallery/download", drogon::Post);
     METHOD_LIST_END
 
     void get(const drogon::HttpRequestPtr& req, Callback_t callback);
     void get_data(const drogon::HttpRequestPtr& req, Callback_t callback);
+    void get_query(const drogon::HttpRequestPtr& req, Callback_t callback);
+    void get_search(const drogon::HttpRequestPtr& req, Callback_t callback);
     void get_previews_bundle(const drogon::HttpRequestPtr& req, Callback_t callback);
     void get_preview_image(const drogon::HttpRequestPtr& req, Callback_t callback, const std::string& filename);
     void get_image(const drogon::HttpRequestPtr& req, Callback_t callback, const std::string& imageId);
+    void get_tile_info(const drogon::HttpRequestPtr& req, Callback_t callback, const std::string& imageId);
+    void get_tile(const drogon::HttpRequestPtr& req, Callback_t callback, const std::string& imageId,
+                  const std::string& level, const std::string& tile);
     void download_bundle(const drogon::HttpRequestPtr& req, Callback_t callback);
     };
 }
@@ -2,12 +2,17 @@
 #define BLUTOGRAPHY_B2SERVICE_HPP
 
 #include <drogon/drogon.h>
+#include <support/spool.hpp>
+#include <support/http_client_pool.hpp>
 #include <string>
 #include <functional>
 #include <memory>
 
 #include <mutex>
 #include <chrono>
+#include <optional>
+#include <vector>
+#include <trantor/utils/ConcurrentTaskQueue.h>
 
 namespace blutography {
 
@@ -25,28 +30,49 @@ struct B2UploadData {
     std::chrono::steady_clock::time_point lastUpdated;
 };
 
+/// Multi-part uploads through the large-file API, for originals too big for one b2_upload_file.
+struct B2LargeFileOptions {
+    size_t threshold = 32 * 1024 * 1024;  // files at least this large (and spanning two parts) go multi-part; never below partSize
+    size_t partSize = 16 * 1024 * 1024;   // B2 accepts 5 MB - 5 GB per part (raised to 5 MB); each part is copied into its request
+    size_t concurrency = 4;               // parts in flight, each on its own part URL
+    int partAttempts = 3;                 // tries per part, each on a fresh part URL
+};
+
+/// Sends one request to a B2 host and hands back the reply; the connection pool unless a test stands in for it.
+using B2Transport = std::function<void(const std::string& host, const drogon::HttpRequestPtr& req, drogon::HttpReqCallback&& callback)>;
+
 class B2Service : public std::enable_shared_from_this<B2Service> {
 public:
     static std::shared_ptr<B2Service> instance();
-    B2Service(std::string keyId, std::string applicationKey, std::string bucketName);
+    B2Service(std::string keyId, std::string applicationKey, std::string bucketName,
+              B2LargeFileOptions largeFile = {}, HttpClientPoolOptions connections = {}, B2Transport transport = {});
 
     // Runs Ping (Authorize), Upload, and Delete sequence
     void runTestSequence(std::function<void(bool success, std::string message)>&& callback);
 
-    // High-level upload method with caching
+    // High-level upload method with caching. The request body is copied from the
+    // spooled file once per upload (once per part above the large-file threshold).
     void upload(const std::string& fileName, 
-                std::string&& content, 
+                std::shared_ptr<const SpooledFile> content, 
                 std::function<void(bool success, std::string fileId)>&& callback);
 
     // High-level download method
     void download(const std::string& fileName,
                   std::function<void(bool success, std::string&& content)>&& callback);
 
+    // The keep-alive connections every B2 call goes through, with their handshake and reuse counters
+    const HttpClientPool& clients() const { return *clients_; }
+
 private:
     std::string keyId_;
     std::string applicationKey_;
     std::string bucketName_;
 
+    B2LargeFileOptions largeFile_;
+    std::shared_ptr<HttpClientPool> clients_;
+    B2Transport transport_;
+    trantor::ConcurrentTaskQueue partQueue_; // hashes and stages large-file parts off the IO loops
+
     // Caching
     std::mutex mutex_;
     std::optional<B2AuthResponse> authCache_;
@@ -65,8 +91,32 @@ private:
                     const std::string& uploadAuthToken, 
                     const std::string& fileName, 
                     std::string&& content, 
-                    std::function<void(bool success, std::string fileId)>&& callback);
+                    std::function<void(bool success, std::string fileId)>&& callback,
+                    std::string contentSha1 = ""); // computed from `content` when empty
+
+    // A b2_upload_file request without its URL and token, which sendFile() fills in per attempt,
+    // so a retry on a fresh upload URL resends the same body instead of copying it again.
+    static drogon::HttpRequestPtr fileRequest(const std::string& fileName, std::string&& content, std::string contentSha1);
+    void sendFile(const B2UploadData& uploadData, const drogon::HttpRequestPtr& req,
+                  std::function<void(bool success, std::string fileId)>&& callback);
     
+    void send(const std::string& host, const drogon::HttpRequestPtr& req, drogon::HttpReqCallback&& callback);
+
+    // POSTs a JSON body to {apiUrl}/b2api/v2/{call} and hands back the JSON reply.
+    void apiCall(const B2AuthResponse& auth, const std::string& call, const Json::Value& body,
+                 std::function<void(bool success, Json::Value reply)>&& callback);
+
+    // Large-file API: start, then `concurrency` lanes each pulling parts off a shared
+    // counter with their own part URL, then finish (or cancel if a part gave up).
+    struct LargeUpload;
+    void uploadLarge(const B2AuthResponse& auth, const std::string& fileName,
+                     std::shared_ptr<const SpooledFile> content,
+                     std::function<void(bool success, std::string fileId)>&& callback);
+    void startPartLane(std::shared_ptr<LargeUpload> upload);
+    void uploadNextPart(std::shared_ptr<LargeUpload> upload, B2UploadData partUrl);
+    void uploadPart(std::shared_ptr<LargeUpload> upload, B2UploadData partUrl, size_t index, int attempt);
+    void endPartLane(std::shared_ptr<LargeUpload> upload);
+
     void deleteFile(const B2AuthResponse& auth, 
                     const std::string& fileName, 
                     const std::string& fileId, 
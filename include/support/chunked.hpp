@@ -0,0 +1,182 @@
+#ifndef BLUTOGRAPHY_CHUNKED_HPP
+#define BLUTOGRAPHY_CHUNKED_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace blutography {
+
+namespace detail {
+    // The chunk `slot` points to, copied first if any other container shares it
+    template <typename Chunk>
+    Chunk& writable(std::shared_ptr<Chunk>& slot) {
+        if (slot.use_count() > 1) {
+            slot = std::make_shared<Chunk>(*slot);
+        } else {
+            // The last other owner may have just let go; its reads happen before our writes
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        return *slot;
+    }
+}
+
+/**
+ * @brief A vector whose copies share their elements, in chunks of `ChunkSize`.
+ *
+ * Copying one copies a table of size() / ChunkSize chunk pointers; changing an
+ * element copies the one chunk holding it, unless no other copy shares it. A
+ * snapshot can so be copied and changed in O(N / ChunkSize + ChunkSize) instead
+ * of O(N). Copies are independent: one can be read on any thread while another
+ * is being changed.
+ */
+template <typename T, size_t ChunkSize = 512>
+class ChunkedVector {
+    using Chunk = std::vector<T>;
+
+public:
+    class const_iterator {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        const_iterator() = default;
+        const_iterator(const ChunkedVector* vector, size_t index) : vector_(vector), index_(index) {}
+
+        reference operator*() const { return (*vector_)[index_]; }
+        pointer operator->() const { return &(*vector_)[index_]; }
+        reference operator[](difference_type n) const { return (*vector_)[index_ + n]; }
+        const_iterator& operator++() { ++index_; return *this; }
+        const_iterator operator++(int) { auto copy = *this; ++index_; return copy; }
+        const_iterator& operator--() { --index_; return *this; }
+        const_iterator operator--(int) { auto copy = *this; --index_; return copy; }
+        const_iterator& operator+=(difference_type n) { index_ += n; return *this; }
+        const_iterator& operator-=(difference_type n) { index_ -= n; return *this; }
+        friend const_iterator operator+(const_iterator it, difference_type n) { return it += n; }
+        friend const_iterator operator+(difference_type n, const_iterator it) { return it += n; }
+        friend const_iterator operator-(const_iterator it, difference_type n) { return it -= n; }
+        friend difference_type operator-(const const_iterator& a, const const_iterator& b) {
+            return static_cast<difference_type>(a.index_) - static_cast<difference_type>(b.index_);
+        }
+        friend bool operator==(const const_iterator& a, const const_iterator& b) { return a.index_ == b.index_; }
+        friend auto operator<=>(const const_iterator& a, const const_iterator& b) { return a.index_ <=> b.index_; }
+
+    private:
+        const ChunkedVector* vector_ = nullptr;
+        size_t index_ = 0;
+    };
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const T& operator[](size_t i) const { return (*chunks_[i / ChunkSize])[i % ChunkSize]; }
+    const T& back() const { return (*this)[size_ - 1]; }
+    const_iterator begin() const { return {this, 0}; }
+    const_iterator end() const { return {this, size_}; }
+
+    void push_back(T value) {
+        if (size_ % ChunkSize == 0) {
+            chunks_.push_back(std::make_shared<Chunk>());
+            chunks_.back()->reserve(ChunkSize);
+        }
+        detail::writable(chunks_.back()).push_back(std::move(value));
+        ++size_;
+    }
+
+    void set(size_t i, T value) { detail::writable(chunks_[i / ChunkSize])[i % ChunkSize] = std::move(value); }
+
+    /// Grows to `size` elements, the new ones value-initialised.
+    void resize(size_t size) {
+        while (size_ < size) push_back(T());
+    }
+
+    void clear() {
+        chunks_.clear();
+        size_ = 0;
+    }
+
+private:
+    std::vector<std::shared_ptr<Chunk>> chunks_; // all full but the last
+    size_t size_ = 0;
+};
+
+/**
+ * @brief A hash map whose copies share their entries, in shards.
+ *
+ * Keys are spread over a power-of-two number of shards, kept near the square
+ * root of the size, so copying the map and changing one key costs O(sqrt N):
+ * the shard table plus the one shard, unless no other copy shares it.
+ */
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class ChunkedMap {
+    using Shard = std::unordered_map<Key, Value, Hash>;
+
+public:
+    ChunkedMap() : shards_(minShards) {}
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    /// The value stored under `key`, or null.
+    const Value* find(const Key& key) const {
+        const auto& shard = shards_[shardOf(key)];
+        if (!shard) return nullptr;
+        auto it = shard->find(key);
+        return it == shard->end() ? nullptr : &it->second;
+    }
+
+    void insert_or_assign(const Key& key, Value value) {
+        auto& slot = shards_[shardOf(key)];
+        if (!slot) slot = std::make_shared<Shard>();
+        if (detail::writable(slot).insert_or_assign(key, std::move(value)).second && ++size_ > shards_.size() * shards_.size()) {
+            reshard(shards_.size() * 2);
+        }
+    }
+
+    bool erase(const Key& key) {
+        auto& slot = shards_[shardOf(key)];
+        if (!slot || !slot->contains(key)) return false;
+        detail::writable(slot).erase(key);
+        --size_;
+        return true;
+    }
+
+    /// Shards for `size` keys up front, so filling the map does not reshard on the way.
+    void reserve(size_t size) {
+        size_t shards = shards_.size();
+        while (size > shards * shards) shards *= 2;
+        if (shards != shards_.size()) reshard(shards);
+    }
+
+private:
+    static constexpr size_t minShards = 16;
+
+    size_t shardOf(const Key& key) const { return Hash{}(key) & (shards_.size() - 1); }
+
+    void reshard(size_t shards) {
+        std::vector<std::shared_ptr<Shard>> old(shards, nullptr);
+        old.swap(shards_);
+        for (const auto& shard : old) {
+            if (!shard) continue;
+            for (const auto& [key, value] : *shard) {
+                auto& slot = shards_[shardOf(key)];
+                if (!slot) slot = std::make_shared<Shard>();
+                slot->emplace(key, value);
+            }
+        }
+    }
+
+    std::vector<std::shared_ptr<Shard>> shards_; // null until a key lands there
+    size_t size_ = 0;
+};
+
+}
+
+#endif // BLUTOGRAPHY_CHUNKED_HPP
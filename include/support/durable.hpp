@@ -0,0 +1,22 @@
+#ifndef BLUTOGRAPHY_DURABLE_HPP
+#define BLUTOGRAPHY_DURABLE_HPP
+
+#include <string>
+#include <string_view>
+
+namespace blutography {
+
+/**
+ * @brief Replaces `path` with `data` so that a crash leaves either the old or the new file.
+ *
+ * Writes a sibling temp file, fsyncs it, renames it over `path` and fsyncs the
+ * directory, so the new contents are on disk when this returns true.
+ */
+bool writeFileAtomically(const std::string& path, std::string_view data);
+
+/// Flushes a directory's entries (creations, renames, unlinks) to disk.
+bool syncDirectory(const std::string& directory);
+
+}
+
+#endif // BLUTOGRAPHY_DURABLE_HPP
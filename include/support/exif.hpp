@@ -0,0 +1,59 @@
+#ifndef BLUTOGRAPHY_EXIF_HPP
+#define BLUTOGRAPHY_EXIF_HPP
+
+#include <support/image_utils.hpp>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace blutography::image::exif {
+    /// Metadata fields the parser knows how to emit. Combine into a FieldMask.
+    enum Field : uint32_t {
+        Model              = 1u << 0,
+        Orientation        = 1u << 1,
+        DateTimeOriginal   = 1u << 2,
+        SubSecTimeOriginal = 1u << 3,
+        ExposureTime       = 1u << 4,
+        FNumber            = 1u << 5,
+        Iso                = 1u << 6,
+        FocalLength        = 1u << 7,
+        LensModel          = 1u << 8,
+        GpsPosition        = 1u << 9,
+    };
+    using FieldMask = uint32_t;
+
+    inline constexpr FieldMask kAllFields = (1u << 10) - 1;
+
+    /**
+     * @brief The TIFF payload of an APP1 EXIF segment.
+     * @param segment A whole APP segment including its FF Ex marker and length.
+     * @return A view without the "Exif\0\0" header, or an empty view if the segment is not EXIF.
+     */
+    std::string_view payload(std::string_view segment);
+
+    /**
+     * @brief Parses a TIFF-structured EXIF payload into `meta`.
+     *
+     * Works on views of the input and allocates only when a field is emitted. Tags are
+     * looked up in a constexpr table; sub-IFDs are followed only when they can still
+     * contribute a wanted field, and parsing stops as soon as every wanted field is found.
+     *
+     * @param wanted The fields to look for.
+     * @return The fields that were found.
+     */
+    FieldMask parse(std::string_view tiff, Metadata& meta, FieldMask wanted = kAllFields);
+
+    /**
+     * @brief Rebuilds an APP1 EXIF segment without the IFD1 thumbnail and the MakerNote.
+     *
+     * Exif and GPS IFDs are taken only from IFD0 and Interop only from Exif, each IFD at
+     * most once. A segment whose rebuild would outgrow the original is treated as malformed.
+     *
+     * @param resetOrientation Set Orientation to 1 (the pixels were turned upright).
+     * @param swapDimensions Swap PixelXDimension/PixelYDimension (the pixels were rotated by 90 degrees).
+     * @return The new segment including marker and length, or an empty string if the input is malformed.
+     */
+    std::string sanitize(std::string_view segment, bool resetOrientation, bool swapDimensions);
+}
+
+#endif // BLUTOGRAPHY_EXIF_HPP
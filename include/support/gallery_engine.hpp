@@ -0,0 +1,59 @@
+#ifndef BLUTOGRAPHY_GALLERY_ENGINE_HPP
+#define BLUTOGRAPHY_GALLERY_ENGINE_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace blutography {
+
+struct GalleryItem;
+struct GallerySnapshot;
+
+/**
+ * @brief Where GalleryStorage keeps its items between runs.
+ *
+ * GalleryStorage answers every read from its in-memory snapshot; an engine only
+ * loads the items once at startup and makes each change durable afterwards.
+ * Changes arrive as whole items, so writing one is an upsert by id.
+ */
+class GalleryEngine {
+public:
+    virtual ~GalleryEngine() = default;
+
+    /// Short name for logs and configuration ("log", "sqlite").
+    virtual const char* name() const = 0;
+
+    /**
+     * @brief Every item stored by earlier runs, in insertion order; a later item with an id seen before replaces it.
+     * @throws std::runtime_error If the stored items cannot be read; starting empty would hide them.
+     */
+    virtual std::vector<std::shared_ptr<const GalleryItem>> load() = 0;
+
+    /**
+     * @brief Called once the loaded items are published; `current` returns the newest snapshot from then on.
+     *
+     * A snapshot holds the writes up to its `ticket` that committed (see GallerySnapshot::ticket).
+     */
+    virtual void start(std::function<std::shared_ptr<const GallerySnapshot>()> current) = 0;
+
+    /**
+     * @brief Queues an item for writing and returns a ticket for wait().
+     *
+     * Called under GalleryStorage's writer lock, so tickets are increasing in call
+     * order. The item is published only once wait() has reported it committed.
+     * Must not block on I/O.
+     */
+    virtual uint64_t write(const GalleryItem& item) = 0;
+
+    /**
+     * @brief Blocks until the write with this ticket, and every one before it, has been settled.
+     * @return Whether this ticket's write committed. Each ticket is waited for once.
+     */
+    virtual bool wait(uint64_t ticket) = 0;
+};
+
+}
+
+#endif // BLUTOGRAPHY_GALLERY_ENGINE_HPP
@@ -0,0 +1,149 @@
+#ifndef BLUTOGRAPHY_GALLERY_FEED_HPP
+#define BLUTOGRAPHY_GALLERY_FEED_HPP
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <support/chunked.hpp>
+#include <support/gallery_storage.hpp>
+#include <support/rcu.hpp>
+
+namespace blutography {
+
+/// One page of GET /gallery/data: the items after `after` (from the start if empty), at most `limit` (0 = all).
+struct FeedQuery {
+    std::string after;
+    size_t limit = 0;
+    uint32_t fields = 0; // bit mask over GalleryFeed::fieldNames; 0 = every field
+};
+
+/// A serialised response body, shared by every request for the same query and gallery version.
+struct FeedBody {
+    std::string etag;       // weak; the same for every encoding
+    std::string json;
+    std::string gzip;       // empty if the body is too small to be worth compressing
+    std::string brotli;     // empty as well when this build has no brotli encoder
+    std::string nextCursor; // id to pass as `after` for the next page; empty on the last one
+};
+
+/// What a response needs before its body: the ETag to revalidate against and the next page's cursor.
+struct FeedHead {
+    std::string etag;
+    std::string nextCursor;
+};
+
+/**
+ * @brief Serves the gallery as the JSON array /gallery/data returns, without rebuilding it per request.
+ *
+ * Every field of every item is serialised once into a fragment and the fragments are
+ * kept for as long as the item is. A builder thread follows the storage: for each
+ * published snapshot it re-serialises only the items that changed, splices and
+ * compresses (gzip, brotli) the bodies asked for under the previous version, and then
+ * publishes the snapshot, its fragments and those bodies together as one state.
+ * Requests read the published state without a lock; a query it holds no body for is
+ * built on the builder thread too, never on the caller's. Until a new state is
+ * published, requests see the previous one, bodies and ETags alike.
+ */
+class GalleryFeed {
+public:
+    /// Top-level keys of an item, in the order they are written; `fields=` selects among them.
+    static constexpr std::array<const char*, 14> fieldNames = {
+        "id", "name", "quote", "fileName", "previewName", "previewUrl", "imageUrl",
+        "placeholder", "dominantColor", "metadata", "variants", "srcset", "sources", "tilesUrl"};
+
+    using BodyCallback = std::function<void(std::shared_ptr<const FeedBody>)>;
+
+    static GalleryFeed& instance();
+
+    /// Serialises `storage`'s current snapshot, then follows it from the builder thread.
+    explicit GalleryFeed(GalleryStorage& storage);
+    ~GalleryFeed();
+    GalleryFeed(const GalleryFeed&) = delete;
+    GalleryFeed& operator=(const GalleryFeed&) = delete;
+
+    /**
+     * @brief Parses a comma-separated `fields=` value into a FeedQuery::fields mask.
+     * @return False, with the offending name in `unknown`, if a name is not in fieldNames.
+     */
+    static bool parseFields(std::string_view names, uint32_t& mask, std::string& unknown);
+
+    /// If-None-Match against a weak ETag: any listed tag equal to it once "W/" is dropped, or "*".
+    static bool etagMatches(std::string_view ifNoneMatch, std::string_view etag);
+
+    /**
+     * @brief The bytes of `body` to send for an Accept-Encoding header: brotli, else gzip, else the JSON.
+     * @param contentEncoding Set to "br" or "gzip", or to null for the JSON.
+     */
+    static const std::string& encoded(const FeedBody& body, std::string_view acceptEncoding, const char*& contentEncoding);
+
+    /// The ETag and cursor `query` answers with now, without building its body; nothing if `query.after` is not an item id.
+    std::optional<FeedHead> head(const FeedQuery& query) const;
+
+    /**
+     * @brief Hands `done` the body for `query`; nullptr if `query.after` is not an item id or the body failed to build.
+     *
+     * A body already built is handed over on the calling thread; any other is built on
+     * the builder thread and handed over there, once, to everyone who asked for it.
+     */
+    void body(const FeedQuery& query, BodyCallback done);
+
+    /// `items` as a JSON array of the same objects, for results that are not a page of the gallery. Not cached.
+    std::string render(const std::vector<std::shared_ptr<const GalleryItem>>& items, uint32_t fields) const;
+
+private:
+    struct Fragments {
+        std::shared_ptr<const GalleryItem> item;
+        std::array<std::string, fieldNames.size()> fields; // `"key":value`, empty if the item has no such field
+    };
+
+    struct CachedBody {
+        FeedQuery query;
+        std::shared_ptr<const FeedBody> body;
+        mutable std::atomic<bool> used{false}; // asked for under this state, so rebuilt for the next one
+    };
+
+    // Everything a request reads, published at once
+    struct State {
+        std::shared_ptr<const GallerySnapshot> snapshot;
+        ChunkedVector<std::shared_ptr<const Fragments>> fragments; // by position in snapshot->items
+        std::unordered_map<std::string, CachedBody> bodies;        // by key()
+    };
+
+    static std::string key(const FeedQuery& query);
+    static std::shared_ptr<const Fragments> serialise(std::shared_ptr<const GalleryItem> item);
+    static std::string splice(const std::vector<std::shared_ptr<const Fragments>>& page, uint32_t mask);
+    std::string etag(uint64_t version, const std::string& key) const;
+    std::shared_ptr<const FeedBody> build(const State& state, const FeedQuery& query) const;
+    std::shared_ptr<const State> advance(const State& previous, std::shared_ptr<const GallerySnapshot> snapshot,
+                                         const std::vector<FeedQuery>& hot) const;
+    void run();
+
+    GalleryStorage& storage_;
+    size_t watch_;
+    std::string epoch_;                 // tells this process's ETags from a previous one's, whose versions restart at 0
+    Rcu<State> state_;
+    size_t maxBodies_ = 64;
+
+    std::mutex mutex_;                  // guards what follows
+    std::condition_variable wake_;
+    bool stale_ = true;                 // the storage may have published since state_ was built
+    bool stopping_ = false;
+    // Bodies built on demand for state_, and the queries still waiting for one
+    std::unordered_map<std::string, std::pair<FeedQuery, std::shared_ptr<const FeedBody>>> built_;
+    std::unordered_map<std::string, std::pair<FeedQuery, std::vector<BodyCallback>>> waiting_;
+    std::thread builder_;
+};
+
+}
+
+#endif // BLUTOGRAPHY_GALLERY_FEED_HPP
@@ -0,0 +1,61 @@
+#ifndef BLUTOGRAPHY_GALLERY_FILE_HPP
+#define BLUTOGRAPHY_GALLERY_FILE_HPP
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <json/json.h>
+#include <support/gallery_storage.hpp>
+
+namespace blutography {
+
+/**
+ * On-disk forms of the gallery snapshot.
+ *
+ * The binary form is what GalleryStorage writes: a fixed header, a table of
+ * fixed-size item records, a table of preview-variant records and a pool of
+ * de-duplicated strings that the records point into by offset and length.
+ * Integers are stored in host byte order; the header records which, so a file
+ * from a host of the other endianness is rejected rather than misread.
+ *
+ * The JSON form is the array `gallery_data.json` has always held. It is still
+ * read at startup when no binary snapshot exists yet, and gallery_convert
+ * turns one form into the other.
+ */
+
+/// Magic and format version at the start of a binary snapshot.
+inline constexpr char galleryFileMagic[8] = {'B', 'L', 'U', 'G', 'A', 'L', 'L', 'Y'};
+inline constexpr uint32_t galleryFileVersion = 1;
+
+/// One item as it appears in the JSON snapshot and in log records.
+Json::Value toJson(const GalleryItem& item);
+GalleryItem fromJson(const Json::Value& jItem);
+
+/// Serialises items, in order, into the binary format.
+std::string encodeGallery(const std::vector<std::shared_ptr<const GalleryItem>>& items);
+
+/// Serialises items, in order, into the JSON format.
+std::string encodeGalleryJson(const std::vector<std::shared_ptr<const GalleryItem>>& items);
+
+/// Whether `data` starts like a binary snapshot (of any version).
+bool isBinaryGallery(std::string_view data);
+
+/**
+ * @brief Decodes a binary snapshot held in memory, typically a mapping of the file.
+ * @return False, with `error` set, if the data is truncated, inconsistent or of another version.
+ */
+bool decodeGallery(std::string_view data, std::vector<std::shared_ptr<const GalleryItem>>& items, std::string& error);
+
+/**
+ * @brief Maps a snapshot file and decodes it in place, whichever form it is in.
+ *
+ * Items are copied out of the mapping, which is gone once this returns; the copy
+ * is a small part of a start next to building the indexes (see BM_GalleryDecode).
+ * @return False, with `error` set, if the file cannot be read or decoded. A missing file is an error too.
+ */
+bool readGalleryFile(const std::string& path, std::vector<std::shared_ptr<const GalleryItem>>& items, std::string& error);
+
+}
+
+#endif // BLUTOGRAPHY_GALLERY_FILE_HPP
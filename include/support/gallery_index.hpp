@@ -0,0 +1,255 @@
+#ifndef BLUTOGRAPHY_GALLERY_INDEX_HPP
+#define BLUTOGRAPHY_GALLERY_INDEX_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <support/chunked.hpp>
+
+namespace blutography {
+
+struct GalleryItem;
+
+/// A gallery's items in insertion order, shared chunk by chunk between snapshots.
+using GalleryItems = ChunkedVector<std::shared_ptr<const GalleryItem>>;
+
+/// Metadata the gallery keeps sorted indexes on. The numeric ones come first.
+enum class IndexField { DateTime, Iso, Exposure, Megapixels, Aspect, Model };
+inline constexpr size_t numericIndexFields = 5;
+
+const char* toString(IndexField field);
+bool indexFieldFromString(std::string_view name, IndexField& field);
+
+/// "2025:06:28 05:07:50" (EXIF) or "2025-06-28[T05:07:50]" as milliseconds since 1970, reading the wall clock as UTC.
+std::optional<double> parseCaptureTime(std::string_view dateTime, std::string_view subSecTime = {});
+
+/// "1/800", "0.5" or "2" as seconds.
+std::optional<double> parseExposure(std::string_view exposure);
+
+/// "1250" as 1250.
+std::optional<double> parseIso(std::string_view iso);
+
+/// The values an item is indexed under, parsed once from its metadata strings.
+struct ItemKeys {
+    std::array<double, numericIndexFields> numbers; // by IndexField; NaN when missing or unparseable
+    std::string_view model;                         // views into the item; empty when unknown
+
+    static ItemKeys of(const GalleryItem& item);
+};
+
+/**
+ * @brief Gallery positions sorted by one key, ties in position order.
+ *
+ * A sorted sequence cut into chunks of about sqrt(N) entries, which copies of
+ * the index share: lookups are two binary searches and a range is contiguous,
+ * and a change copies the chunk table and the one chunk it lands in. Copying
+ * the index and changing an item so costs O(sqrt N), not O(N).
+ */
+template <typename Key>
+class SortedIndex {
+public:
+    using Entry = std::pair<Key, uint32_t>;
+
+    class const_iterator {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = Entry;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Entry*;
+        using reference = const Entry&;
+
+        const_iterator() = default;
+
+        reference operator*() const { return (*index_->chunks_[chunk_])[position_ - index_->starts_[chunk_]]; }
+        pointer operator->() const { return &**this; }
+        reference operator[](difference_type n) const { return *(*this + n); }
+        const_iterator& operator++() {
+            if (++position_ == index_->starts_[chunk_ + 1]) ++chunk_;
+            return *this;
+        }
+        const_iterator operator++(int) { auto copy = *this; ++*this; return copy; }
+        const_iterator& operator--() {
+            if (position_-- == index_->starts_[chunk_]) --chunk_;
+            return *this;
+        }
+        const_iterator operator--(int) { auto copy = *this; --*this; return copy; }
+        const_iterator& operator+=(difference_type n) { return *this = index_->at(position_ + n); }
+        const_iterator& operator-=(difference_type n) { return *this = index_->at(position_ - n); }
+        friend const_iterator operator+(const_iterator it, difference_type n) { return it += n; }
+        friend const_iterator operator+(difference_type n, const_iterator it) { return it += n; }
+        friend const_iterator operator-(const_iterator it, difference_type n) { return it -= n; }
+        friend difference_type operator-(const const_iterator& a, const const_iterator& b) {
+            return static_cast<difference_type>(a.position_) - static_cast<difference_type>(b.position_);
+        }
+        friend bool operator==(const const_iterator& a, const const_iterator& b) { return a.position_ == b.position_; }
+        friend auto operator<=>(const const_iterator& a, const const_iterator& b) { return a.position_ <=> b.position_; }
+
+    private:
+        friend class SortedIndex;
+        const_iterator(const SortedIndex* index, size_t chunk, size_t position) : index_(index), chunk_(chunk), position_(position) {}
+
+        const SortedIndex* index_ = nullptr;
+        size_t chunk_ = 0;    // the chunk holding position_; chunks_.size() at the end
+        size_t position_ = 0; // in the whole index
+    };
+
+    void assign(std::vector<Entry> entries) {
+        if (!std::is_sorted(entries.begin(), entries.end())) std::sort(entries.begin(), entries.end());
+        chunks_.clear();
+        starts_.assign(1, 0);
+        size_t chunkSize = chunkTarget(entries.size());
+        for (size_t begin = 0; begin < entries.size(); begin += chunkSize) {
+            size_t end = std::min(entries.size(), begin + chunkSize);
+            chunks_.push_back(std::make_shared<Chunk>(entries.begin() + begin, entries.begin() + end));
+            starts_.push_back(end);
+        }
+    }
+
+    void insert(const Key& key, uint32_t position) {
+        Entry entry(key, position);
+        if (chunks_.empty()) {
+            chunks_.push_back(std::make_shared<Chunk>(1, entry));
+            starts_.push_back(1);
+            return;
+        }
+        // The first chunk that ends at or past the entry; past every one, the last
+        size_t chunk = std::min(chunkOf(entry), chunks_.size() - 1);
+        Chunk& entries = detail::writable(chunks_[chunk]);
+        entries.insert(std::lower_bound(entries.begin(), entries.end(), entry), entry);
+        for (size_t i = chunk + 1; i < starts_.size(); ++i) ++starts_[i];
+
+        if (entries.size() >= 2 * chunkTarget(size())) {
+            size_t half = entries.size() / 2;
+            auto upper = std::make_shared<Chunk>(entries.begin() + half, entries.end());
+            entries.resize(half);
+            chunks_.insert(chunks_.begin() + chunk + 1, std::move(upper));
+            starts_.insert(starts_.begin() + chunk + 1, starts_[chunk] + half);
+        }
+    }
+
+    void erase(const Key& key, uint32_t position) {
+        Entry entry(key, position);
+        size_t chunk = chunkOf(entry);
+        if (chunk == chunks_.size()) return;
+        auto it = std::lower_bound(chunks_[chunk]->begin(), chunks_[chunk]->end(), entry);
+        if (it == chunks_[chunk]->end() || *it != entry) return;
+        size_t offset = static_cast<size_t>(it - chunks_[chunk]->begin());
+        Chunk& entries = detail::writable(chunks_[chunk]);
+        entries.erase(entries.begin() + offset);
+        for (size_t i = chunk + 1; i < starts_.size(); ++i) --starts_[i];
+        if (entries.empty()) {
+            chunks_.erase(chunks_.begin() + chunk);
+            starts_.erase(starts_.begin() + chunk + 1);
+        }
+    }
+
+    /**
+     * @brief The first entry for which `before` is false.
+     *
+     * `before` must hold for a prefix of the entries and fail for the rest, like
+     * std::partition_point; the chunk is found by its last entry, then the entry in it.
+     */
+    template <typename Predicate>
+    const_iterator partition(Predicate before) const {
+        auto chunk = std::partition_point(chunks_.begin(), chunks_.end(),
+                                          [&before](const std::shared_ptr<Chunk>& entries) { return before(entries->back()); });
+        size_t index = static_cast<size_t>(chunk - chunks_.begin());
+        if (index == chunks_.size()) return end();
+        auto it = std::partition_point((*chunk)->begin(), (*chunk)->end(), before);
+        return const_iterator(this, index, starts_[index] + static_cast<size_t>(it - (*chunk)->begin()));
+    }
+
+    /// Entries with min <= key <= max; none when max < min.
+    std::pair<const_iterator, const_iterator> range(const Key& min, const Key& max) const {
+        auto begin = partition([&min](const Entry& entry) { return entry.first < min; });
+        if (max < min) return {begin, begin};
+        auto end = partition([&max](const Entry& entry) { return !(max < entry.first); });
+        return {begin, end};
+    }
+
+    const_iterator begin() const { return const_iterator(this, 0, 0); }
+    const_iterator end() const { return const_iterator(this, chunks_.size(), size()); }
+    size_t size() const { return starts_.back(); }
+
+private:
+    using Chunk = std::vector<Entry>;
+
+    // About sqrt(size) entries a chunk, so a change copies about as many chunk pointers as entries;
+    // a chunk splits in two at twice this
+    static size_t chunkTarget(size_t size) { return std::max<size_t>(256, static_cast<size_t>(std::sqrt(static_cast<double>(size)))); }
+
+    // The chunk whose last entry is the first not below `entry`; chunks_.size() if none
+    size_t chunkOf(const Entry& entry) const {
+        auto chunk = std::partition_point(chunks_.begin(), chunks_.end(),
+                                          [&entry](const std::shared_ptr<Chunk>& entries) { return entries->back() < entry; });
+        return static_cast<size_t>(chunk - chunks_.begin());
+    }
+
+    const_iterator at(size_t position) const {
+        auto chunk = std::upper_bound(starts_.begin(), starts_.end(), position) - starts_.begin() - 1;
+        return const_iterator(this, static_cast<size_t>(chunk), position);
+    }
+
+    std::vector<std::shared_ptr<Chunk>> chunks_; // sorted, none empty, each shared with the copies that have not changed it
+    std::vector<size_t> starts_{0};              // where each chunk starts in the whole index, then size()
+};
+
+/// Filters, order and size of a /gallery/query result.
+struct GalleryQuery {
+    struct Range {
+        double min = -std::numeric_limits<double>::infinity();
+        double max = std::numeric_limits<double>::infinity();
+        bool active() const { return min > -std::numeric_limits<double>::infinity() || max < std::numeric_limits<double>::infinity(); }
+    };
+
+    std::array<Range, numericIndexFields> ranges; // by IndexField
+    std::string model;                            // exact match; empty matches any
+    IndexField sort = IndexField::DateTime;       // items without a value for it are left out
+    bool descending = false;
+    size_t limit = 100;
+};
+
+/**
+ * @brief Sorted indexes over every item of one GallerySnapshot.
+ *
+ * Immutable once published with a snapshot; writers copy it, change the
+ * entries of the one item they replaced or added, and publish the copy. The
+ * copy shares every chunk the change did not touch.
+ */
+class GalleryIndexes {
+public:
+    void rebuild(const GalleryItems& items);
+
+    /// Indexes the item at `position`; `previous` is the item it replaced there, if any.
+    void put(const GalleryItem* previous, const GalleryItem& item, size_t position);
+
+    /**
+     * @brief Positions of the matching items, in the requested order, at most query.limit.
+     *
+     * Walks the narrowest of the candidate ranges: the sort index in order when it is as
+     * narrow as any filter, so the walk stops at the limit; otherwise the narrowest
+     * filter's range, keeping the best `limit` matches by the sort key. Either way the
+     * cost is two binary searches per filter plus the walk over that one range.
+     */
+    std::vector<size_t> query(const GalleryQuery& query) const;
+
+private:
+    bool matches(size_t position, const GalleryQuery& query) const;
+
+    ChunkedVector<ItemKeys> keys_; // by position
+    std::array<SortedIndex<double>, numericIndexFields> numeric_;
+    SortedIndex<std::string_view> model_;
+};
+
+}
+
+#endif // BLUTOGRAPHY_GALLERY_INDEX_HPP
@@ -0,0 +1,84 @@
+#ifndef BLUTOGRAPHY_GALLERY_LOG_ENGINE_HPP
+#define BLUTOGRAPHY_GALLERY_LOG_ENGINE_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <support/gallery_engine.hpp>
+
+namespace blutography {
+
+struct LogEngineOptions {
+    std::chrono::milliseconds groupCommitWindow{2}; // how long a commit waits for more records to share its fsync
+    size_t compactMinRecords = 1024;                // the log is never compacted while shorter than this
+};
+
+/**
+ * @brief Keeps the gallery as a snapshot file plus an append-only log.
+ *
+ * Every insert or edit appends one JSON line to the log. A writer thread gathers
+ * the records that arrive within a couple of milliseconds and commits them with
+ * one write and one fsync; a batch that fails is cut back off the log and each of
+ * its writers is told so by wait(). When the log has grown past the number of items, a
+ * background thread rotates it and rewrites the binary snapshot (see
+ * gallery_file.hpp) through an atomic rename. Loading maps the snapshot, decodes
+ * it in place and replays the log on top; records are whole items, so replaying
+ * twice is harmless. A tree that only has the older JSON snapshot is read from
+ * that once and migrated.
+ */
+class LogGalleryEngine : public GalleryEngine {
+public:
+    /// `legacyPath` is a JSON snapshot to start from when `snapshotPath` does not exist yet.
+    LogGalleryEngine(std::string snapshotPath, std::string logPath, std::string legacyPath = {}, LogEngineOptions options = {});
+    ~LogGalleryEngine() override;
+    LogGalleryEngine(const LogGalleryEngine&) = delete;
+    LogGalleryEngine& operator=(const LogGalleryEngine&) = delete;
+
+    const char* name() const override { return "log"; }
+    std::vector<std::shared_ptr<const GalleryItem>> load() override;
+    void start(std::function<std::shared_ptr<const GallerySnapshot>()> current) override;
+    uint64_t write(const GalleryItem& item) override;
+    bool wait(uint64_t ticket) override;
+
+private:
+    void replay(const std::string& path, std::vector<std::shared_ptr<const GalleryItem>>& items);
+    bool writeSnapshot(const GallerySnapshot& snapshot);
+
+    // Group commit: write() queues a record, commitLoop() writes and fsyncs
+    // everything queued so far in one go, wait() blocks until a record is on disk
+    void commitLoop();
+    void compact();
+
+    std::string snapshotPath_;
+    std::string logPath_;
+    std::string legacyPath_;
+    bool migrated_ = false; // load() read legacyPath_
+    std::function<std::shared_ptr<const GallerySnapshot>()> current_;
+
+    std::mutex logMutex_;                // pendingLog_ and the sequence numbers
+    std::condition_variable logWake_;    // records queued, or stopping
+    std::condition_variable logDurable_; // settledSequence_ advanced
+    std::string pendingLog_;
+    size_t pendingRecords_ = 0;
+    uint64_t queuedSequence_ = 0;
+    uint64_t settledSequence_ = 0;       // every record up to here was committed or failed
+    std::unordered_set<uint64_t> failed_; // settled records whose batch did not commit, until waited for
+    size_t logRecords_ = 0;              // records in the live log since the last compaction
+    bool compacting_ = false;
+    bool stopping_ = false;
+
+    std::mutex fileMutex_;               // logFd_; held while a batch is written or the log rotated
+    int logFd_ = -1;
+    uint64_t writtenSequence_ = 0;       // the last record handed to the live log, committed or not
+
+    std::thread writer_;
+    std::thread compactor_;
+    LogEngineOptions options_;
+};
+
+}
+
+#endif // BLUTOGRAPHY_GALLERY_LOG_ENGINE_HPP
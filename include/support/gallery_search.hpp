@@ -0,0 +1,65 @@
+#ifndef BLUTOGRAPHY_GALLERY_SEARCH_HPP
+#define BLUTOGRAPHY_GALLERY_SEARCH_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <support/gallery_index.hpp>
+
+namespace blutography {
+
+struct GalleryItem;
+
+/**
+ * @brief The distinct words of `text`, lower-cased.
+ *
+ * A word is a run of ASCII letters and digits or of non-ASCII (UTF-8) bytes;
+ * only ASCII is case-folded. Everything else separates words.
+ */
+std::vector<std::string> tokenize(std::string_view text);
+
+/**
+ * @brief Inverted index over the words of every item's name and quote.
+ *
+ * One sorted (word, posting) list, so a word and every word it prefixes sit in
+ * one contiguous range found by a binary search. Immutable once published with
+ * a snapshot; writers copy it and change the postings of the one item they
+ * replaced or added, sharing every chunk the change did not touch. The words
+ * live in per-item lists shared between copies, which the index's entries view
+ * into; a name and a quote each keep theirs until they change.
+ */
+class GalleryTextIndex {
+public:
+    void rebuild(const GalleryItems& items);
+
+    /// Indexes the item at `position`; `previous` is the item it replaced there, if any.
+    void put(const GalleryItem* previous, const GalleryItem& item, size_t position);
+
+    /**
+     * @brief Positions of the items holding every word of `query`, best first, at most `limit`.
+     *
+     * Each query word matches the words it is a prefix of. Whole-word matches rank
+     * above prefix matches and names above quotes; ties go to the newer item.
+     */
+    std::vector<size_t> search(std::string_view query, size_t limit) const;
+
+private:
+    // Posting: position << 1, plus 1 when the word is in the name
+    using Words = std::vector<std::string>;
+    struct ItemWords {
+        std::shared_ptr<const Words> name; // null for a position not indexed yet
+        std::shared_ptr<const Words> quote;
+    };
+
+    void add(const Words& words, uint32_t posting);
+    void remove(const Words& words, uint32_t posting);
+
+    ChunkedVector<ItemWords> words_; // by position; a rename keeps the quote's list, and its postings
+    SortedIndex<std::string_view> postings_;
+};
+
+}
+
+#endif // BLUTOGRAPHY_GALLERY_SEARCH_HPP
@@ -0,0 +1,68 @@
+#ifndef BLUTOGRAPHY_GALLERY_SQLITE_ENGINE_HPP
+#define BLUTOGRAPHY_GALLERY_SQLITE_ENGINE_HPP
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <drogon/orm/DbClient.h>
+#include <support/gallery_engine.hpp>
+
+namespace blutography {
+
+/**
+ * @brief Keeps the gallery in an SQLite database, one row per item.
+ *
+ * Rows hold the item's JSON next to its id and content hash, which are indexed;
+ * the integer primary key keeps insertion order. The database runs in WAL mode
+ * with synchronous=FULL, so a committed write survives a power cut.
+ *
+ * Writes go through an asynchronous Drogon client: write() queues the row, and
+ * whatever is queued while a transaction is in flight goes out together as the
+ * next one, so a burst of edits shares a commit. Every statement is one of two
+ * fixed strings, which the client prepares once per connection and reuses.
+ *
+ * Needs Drogon built with SQLite3 support.
+ */
+class SqliteGalleryEngine : public GalleryEngine {
+public:
+    /// `seed` is loaded once, into a database holding no items yet; it may be null.
+    explicit SqliteGalleryEngine(std::string databasePath, std::unique_ptr<GalleryEngine> seed = nullptr);
+    ~SqliteGalleryEngine() override;
+    SqliteGalleryEngine(const SqliteGalleryEngine&) = delete;
+    SqliteGalleryEngine& operator=(const SqliteGalleryEngine&) = delete;
+
+    const char* name() const override { return "sqlite"; }
+    std::vector<std::shared_ptr<const GalleryItem>> load() override;
+    void start(std::function<std::shared_ptr<const GallerySnapshot>()>) override {}
+    uint64_t write(const GalleryItem& item) override;
+    bool wait(uint64_t ticket) override;
+
+private:
+    struct Row {
+        std::string id;
+        std::string contentHash;
+        std::string data;
+    };
+
+    bool open();
+    std::vector<std::shared_ptr<const GalleryItem>> import();
+    void send(std::vector<Row> rows, uint64_t sequence); // one transaction; call without mutex_
+    void settle(uint64_t sequence, size_t rows, bool committed);
+
+    std::string databasePath_;
+    std::unique_ptr<GalleryEngine> seed_;
+    drogon::orm::DbClientPtr client_; // null if the database could not be opened
+
+    std::mutex mutex_;                // everything below
+    std::condition_variable durable_; // settledSequence_ advanced
+    std::vector<Row> pending_;
+    uint64_t queuedSequence_ = 0;
+    uint64_t settledSequence_ = 0;          // every row up to here was committed or rolled back
+    std::unordered_set<uint64_t> failed_;   // settled rows whose transaction rolled back, until waited for
+    bool sending_ = false;            // a transaction is in flight; its callback sends pending_
+};
+
+}
+
+#endif // BLUTOGRAPHY_GALLERY_SQLITE_ENGINE_HPP
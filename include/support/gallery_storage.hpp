@@ -5,7 +5,21 @@
 #include <vector>
 #include <json/json.h>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <cstdint>
+#include <optional>
+#include <memory>
+#include <string_view>
 #include <support/image_utils.hpp>
+#include <support/tiles.hpp>
+#include <support/chunked.hpp>
+#include <support/gallery_index.hpp>
+#include <support/gallery_search.hpp>
+#include <support/gallery_engine.hpp>
+#include <support/rcu.hpp>
 
 namespace blutography {
 
@@ -16,24 +30,118 @@ struct GalleryItem {
     std::string fileName;
     std::string previewName;
     image::Metadata metadata;
+    std::vector<image::PreviewVariant> variants; // preview ladder, smallest first
+    std::string placeholder;                     // BlurHash painted before the preview loads
+    std::string dominantColor;                   // "#rrggbb"
+    std::string contentHash;                     // SHA-1 (hex) of the original; `id` is its first 12 digits
+    image::TileLayout tiles;                     // deep-zoom pyramid; tileSize 0 = not tiled
 };
 
+/**
+ * @brief An immutable view of the whole gallery at one point in time.
+ *
+ * Successive snapshots share their items, and the chunks of the containers
+ * holding them, so publishing a change copies the chunk tables and the chunks
+ * it touched: O(sqrt N) rather than the whole gallery. Index keys view into the
+ * items the snapshot holds.
+ */
+struct GallerySnapshot {
+    uint64_t version = 0;                                  // bumped on every published change
+    uint64_t ticket = 0;                                   // the last engine write settled into it, committed or not
+    GalleryItems items;                                    // insertion order
+    ChunkedMap<std::string_view, size_t> byId;             // id -> position in items
+    ChunkedMap<std::string_view, size_t> byHash;           // contentHash -> position in items
+    std::shared_ptr<const GalleryIndexes> indexes;          // sorted metadata indexes over items
+    std::shared_ptr<const GalleryTextIndex> text;           // words of the items' names and quotes
+
+    std::shared_ptr<const GalleryItem> find(std::string_view id) const;
+
+    /// The items matching `query`, in its order; see GalleryIndexes::query().
+    std::vector<std::shared_ptr<const GalleryItem>> query(const GalleryQuery& query) const;
+
+    /// The items matching the words of `text`, best first; see GalleryTextIndex::search().
+    std::vector<std::shared_ptr<const GalleryItem>> search(std::string_view text, size_t limit) const;
+};
+
+/**
+ * @brief The gallery's items, kept in memory and persisted by a GalleryEngine.
+ *
+ * Readers load the current GallerySnapshot atomically and never take mutex_. Writers
+ * hand the changed item to the engine under mutex_ and wait for it outside; a change
+ * is published, in the order it was written, only once the engine reports it
+ * committed, so no snapshot ever shows an item the engine lost. No read ever waits
+ * on the engine.
+ *
+ * instance() picks the engine from custom_config.gallery.engine: "log" (the default,
+ * see LogGalleryEngine) or "sqlite" (see SqliteGalleryEngine).
+ */
 class GalleryStorage {
 public:
     static GalleryStorage& instance();
 
-    void addItem(const GalleryItem& item);
-    std::vector<GalleryItem> getAllItems();
-    std::optional<GalleryItem> getItem(const std::string& id);
+    /// Loads the gallery from `engine` and keeps it there.
+    explicit GalleryStorage(std::unique_ptr<GalleryEngine> engine);
+
+    /**
+     * @brief Storage on a LogGalleryEngine over the given files.
+     * @param legacyPath A JSON snapshot to start from when `storagePath` does not exist yet.
+     */
+    GalleryStorage(std::string storagePath, std::string logPath, std::string legacyPath = {});
+    ~GalleryStorage();
+    GalleryStorage(const GalleryStorage&) = delete;
+    GalleryStorage& operator=(const GalleryStorage&) = delete;
+
+    /// @return Whether the item was stored; when not, it is not published either.
+    bool addItem(const GalleryItem& item);
+
+    /// The current snapshot. Lock-free; hold on to it for a consistent view across several reads.
+    std::shared_ptr<const GallerySnapshot> snapshot() const;
+
+    std::shared_ptr<const GalleryItem> getItem(const std::string& id) const;
+
+    /// The item whose original has this SHA-1, if any.
+    std::shared_ptr<const GalleryItem> findByHash(const std::string& contentHash) const;
+
+    /**
+     * @brief Changes an item's name and/or quote without touching its images.
+     *
+     * Applies to the newest version of the item, including one still being written.
+     * @return The updated item, or nothing if `id` is unknown or the change could not be stored.
+     */
+    std::shared_ptr<const GalleryItem> updateDetails(const std::string& id, const std::optional<std::string>& name,
+                                                     const std::optional<std::string>& quote);
+
+    /**
+     * @brief Calls `listener` after every snapshot this storage publishes, until unwatch().
+     *
+     * It runs on the publishing writer's thread with the writers' lock held, so it should
+     * only pass the news on; it must not write to the gallery.
+     * @return The id to unwatch() it by.
+     */
+    size_t watch(std::function<void()> listener);
+    void unwatch(size_t id);
 
 private:
-    GalleryStorage();
-    void load();
-    void save();
+    // A change handed to the engine and not yet published
+    struct PendingWrite {
+        enum class State { Waiting, Committed, Failed };
+        uint64_t ticket;
+        std::shared_ptr<const GalleryItem> item;
+        State state = State::Waiting;
+    };
+
+    static void place(GallerySnapshot& draft, std::shared_ptr<const GalleryItem> item);
+    void publish(std::shared_ptr<const GallerySnapshot> next);
+    uint64_t write(std::shared_ptr<const GalleryItem> item);
+    bool settle(uint64_t ticket, bool committed);
 
-    std::vector<GalleryItem> items_;
-    std::mutex mutex_;
-    std::string storagePath_ = "gallery_data.json";
+    Rcu<GallerySnapshot> snapshot_;
+    std::mutex mutex_;                                 // serialises writers; guards pending_
+    std::condition_variable published_;                // snapshot_'s ticket advanced
+    std::deque<PendingWrite> pending_;                 // in ticket order
+    std::map<size_t, std::function<void()>> watchers_; // by id; guarded by mutex_
+    size_t nextWatcher_ = 0;
+    std::unique_ptr<GalleryEngine> engine_;            // last, so it stops before the snapshot it reads goes
 };
 
 }
@@ -0,0 +1,96 @@
+#ifndef BLUTOGRAPHY_HTTP_CLIENT_POOL_HPP
+#define BLUTOGRAPHY_HTTP_CLIENT_POOL_HPP
+
+#include <drogon/HttpClient.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace blutography {
+
+struct HttpClientPoolOptions {
+    size_t maxPerHost = 8;                  // connections per host and event loop before GETs are pipelined and POSTs wait
+    size_t pipelining = 4;                  // GETs in flight on one connection; 1 = no pipelining
+    std::chrono::seconds idleTimeout{30};   // connections unused this long are closed
+};
+
+/**
+ * @brief Keep-alive HTTP connections, pooled per host and event loop.
+ *
+ * Each pooled drogon::HttpClient holds one connection. A request takes an idle
+ * connection to its host on the event loop it was sent from (or on one of the
+ * IO loops when sent from elsewhere) and opens a new one only when none is
+ * free, so TCP and TLS handshakes are paid once per connection, not once per
+ * request. Once maxPerHost connections are busy, a GET or HEAD is pipelined
+ * behind other GETs and HEADs on the least busy one instead. A POST always
+ * gets a connection to itself and nothing is pipelined behind it: if the
+ * connection dropped, whether B2 acted on it would be unknown. Once maxPerHost
+ * connections are busy, further POSTs wait in order for one to come free.
+ * Connections idle for longer than idleTimeout are closed by a sweep on the
+ * main loop.
+ */
+class HttpClientPool : public std::enable_shared_from_this<HttpClientPool> {
+public:
+    explicit HttpClientPool(HttpClientPoolOptions options = {});
+    HttpClientPool(const HttpClientPool&) = delete;
+    HttpClientPool& operator=(const HttpClientPool&) = delete;
+
+    /// Sends `req` to `host` ("https://example.com[:port]") over a pooled connection.
+    void send(const std::string& host, const drogon::HttpRequestPtr& req, drogon::HttpReqCallback&& callback);
+
+    uint64_t requests() const { return requests_.load(); }
+    uint64_t handshakes() const { return handshakes_.load(); }   // connections opened, reconnects included
+    uint64_t pipelined() const { return pipelined_.load(); }     // requests sent behind another in flight
+    uint64_t queued() const { return queued_.load(); }           // POSTs that waited for a connection to come free
+    uint64_t evicted() const { return evicted_.load(); }         // connections closed for idling
+    size_t connections() const;
+
+    /// Share of requests that went over an already open connection.
+    double reuseRatio() const;
+
+private:
+    using Key = std::pair<std::string, trantor::EventLoop*>;
+
+    struct Connection {
+        Key key;
+        drogon::HttpClientPtr client;
+        trantor::EventLoop* loop = nullptr;
+        size_t inFlight = 0;
+        bool unsafeInFlight = false;        // a non-idempotent request is in flight
+        std::chrono::steady_clock::time_point lastUsed;
+    };
+    struct Waiting {
+        drogon::HttpRequestPtr req;
+        drogon::HttpReqCallback callback;
+    };
+
+    // A connection for the request, or null once it has been queued behind the busy ones
+    std::shared_ptr<Connection> acquire(const std::string& host, const drogon::HttpRequestPtr& req, drogon::HttpReqCallback& callback);
+    void dispatch(const std::shared_ptr<Connection>& connection, const drogon::HttpRequestPtr& req, drogon::HttpReqCallback&& callback);
+    void release(const std::shared_ptr<Connection>& connection);
+    void sweep();
+    static trantor::EventLoop* pickLoop();
+
+    HttpClientPoolOptions options_;
+    mutable std::mutex mutex_;
+    std::map<Key, std::vector<std::shared_ptr<Connection>>> connections_;
+    std::map<Key, std::deque<Waiting>> waiting_;   // POSTs over the cap, oldest first
+    bool sweeping_ = false;                 // the idle sweep timer is running
+
+    std::atomic<uint64_t> requests_{0};
+    std::atomic<uint64_t> handshakes_{0};
+    std::atomic<uint64_t> pipelined_{0};
+    std::atomic<uint64_t> queued_{0};
+    std::atomic<uint64_t> evicted_{0};
+};
+
+}
+
+#endif // BLUTOGRAPHY_HTTP_CLIENT_POOL_HPP
@@ -0,0 +1,40 @@
+#ifndef BLUTOGRAPHY_IMAGE_DECODERS_HPP
+#define BLUTOGRAPHY_IMAGE_DECODERS_HPP
+
+#include <support/image_utils.hpp>
+#include <support/image_workspace.hpp>
+#include <string_view>
+
+namespace blutography::image {
+    /// Detects the container from its magic bytes.
+    Container sniffContainer(std::string_view data);
+
+    /// Whether this build can decode the container to pixels.
+    bool canDecode(Container container);
+
+    /**
+     * @brief Decodes a non-JPEG image into the workspace.
+     *
+     * The RGB pixels land in `ws.pixels`, alpha composited onto white. A PNG eXIf
+     * chunk or HEIF Exif block is re-wrapped as an APP1 segment in `ws.exif` (empty
+     * otherwise) so the JPEG preview keeps it; a TIFF's own tags describe its strips
+     * and are not carried over.
+     *
+     * PNG and TIFF pixels come back as stored, with `meta.orientation` taken from the
+     * container, and are turned upright later like a JPEG's (which also resets the
+     * orientation in `ws.exif`). libheif applies the HEIF transforms while decoding,
+     * so there `meta.orientation` is 1 and `ws.exif` already says so.
+     *
+     * @param data The raw bytes of the image.
+     * @param meta Receives width, height and any EXIF fields found in the container.
+     * @return False if the container is unsupported or the data is corrupt.
+     */
+    bool decodeImage(Container container, std::string_view data, Workspace& ws, Metadata& meta);
+
+    /**
+     * @brief Reads dimensions and EXIF fields without decoding pixels, where the container allows it.
+     */
+    bool readImageInfo(Container container, std::string_view data, Metadata& meta);
+}
+
+#endif // BLUTOGRAPHY_IMAGE_DECODERS_HPP
@@ -0,0 +1,23 @@
+#ifndef BLUTOGRAPHY_IMAGE_ENCODERS_HPP
+#define BLUTOGRAPHY_IMAGE_ENCODERS_HPP
+
+#include <support/image_utils.hpp>
+#include <string>
+#include <string_view>
+
+namespace blutography::image {
+    /**
+     * @brief Encodes packed RGB pixels as AVIF.
+     * @param exif Optional TIFF-structured EXIF payload (without the "Exif\0\0" header) to embed.
+     * @return The encoded file, or an empty string if AVIF support is not compiled in or encoding failed.
+     */
+    std::string encodeAvif(const unsigned char* rgb, int width, int height, const AvifOptions& options, std::string_view exif = {});
+
+    /**
+     * @brief Encodes packed RGB pixels as lossy WebP.
+     * @return The encoded file, or an empty string if WebP support is not compiled in or encoding failed.
+     */
+    std::string encodeWebp(const unsigned char* rgb, int width, int height, const WebpOptions& options);
+}
+
+#endif // BLUTOGRAPHY_IMAGE_ENCODERS_HPP
@@ -0,0 +1,91 @@
+#ifndef BLUTOGRAPHY_IMAGE_EXECUTOR_HPP
+#define BLUTOGRAPHY_IMAGE_EXECUTOR_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace blutography {
+
+struct ExecutorOptions {
+    size_t threads = 0;    // 0 = one per core
+    size_t maxQueue = 64;  // admitted (queued + running) tasks before reserve() refuses
+    int retryAfter = 5;    // seconds, sent with 429 when saturated
+};
+
+/**
+ * @brief Fixed pool of workers for CPU-bound image work (decode, previews, tiles).
+ *
+ * Each worker owns a deque: it takes its own newest task first and, when empty,
+ * steals the oldest task of another worker. Work is admitted in two steps so a
+ * request can be refused as a whole before anything has started: reserve() claims
+ * slots against the queue limit, submit() fills one, cancel() hands unused ones back.
+ */
+class ImageExecutor {
+public:
+    /// The process-wide executor, sized from the "executor" custom config on first use.
+    static ImageExecutor& instance();
+
+    explicit ImageExecutor(const ExecutorOptions& options);
+    ~ImageExecutor();
+    ImageExecutor(const ImageExecutor&) = delete;
+    ImageExecutor& operator=(const ImageExecutor&) = delete;
+
+    /// Claims `count` slots, all or none. False when saturated or draining.
+    bool reserve(size_t count);
+
+    /// Returns reserved slots that will not be submitted.
+    void cancel(size_t count);
+
+    /**
+     * @brief Runs `work` on a worker, using one reserved slot.
+     *
+     * `done` (optional) then runs on the event loop of the submitting thread, or on
+     * the worker if the caller is not on an event loop. It runs even if `work` throws,
+     * and is told whether `work` returned normally.
+     */
+    void submit(std::function<void()> work, std::function<void(bool)> done = {});
+
+    /// Refuses new work, waits for everything admitted to finish and joins the workers.
+    void drain();
+
+    size_t threads() const { return workers_.size(); }
+    size_t queued() const { return queued_.load(); }
+    size_t running() const { return running_.load(); }
+    size_t admitted() const { return admitted_.load(); }
+    const ExecutorOptions& options() const { return options_; }
+
+private:
+    using Task = std::function<void()>;
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::thread thread;
+    };
+
+    void run(size_t index);
+    bool take(size_t index, Task& task);
+
+    ExecutorOptions options_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<size_t> admitted_{0};
+    std::atomic<size_t> queued_{0};
+    std::atomic<size_t> running_{0};
+    std::atomic<size_t> next_{0};
+    std::atomic<bool> draining_{false};
+    std::mutex sleepMutex_;
+    std::condition_variable wake_;
+    std::condition_variable idle_;
+    bool stopping_ = false;
+};
+
+}
+
+#endif // BLUTOGRAPHY_IMAGE_EXECUTOR_HPP
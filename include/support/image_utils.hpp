@@ -2,7 +2,11 @@
 #define BLUTOGRAPHY_IMAGE_UTILS_HPP
 
 #include <string>
+#include <string_view>
 #include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <support/placeholder.hpp>
 
 namespace blutography::image {
     struct Metadata {
@@ -12,22 +16,189 @@ namespace blutography::image {
         std::string iso;
         int width = 0;
         int height = 0;
+        int orientation = 1; // EXIF orientation, 1 = upright
+        std::string aperture;    // "f/2.8", empty if unknown
+        std::string focalLength; // "50mm", empty if unknown
+        std::string lensModel;
+        std::string subSecTime;  // SubSecTimeOriginal, refines dateTime
+        bool hasGps = false;
+        double latitude = 0.0;   // decimal degrees, south negative
+        double longitude = 0.0;  // decimal degrees, west negative
     };
 
+    /// One rung of the preview ladder as recorded on a gallery item. The file's
+    /// extension gives its format; see formatOf().
+    struct PreviewVariant {
+        std::string fileName;
+        int width = 0;
+        int height = 0;
+        size_t bytes = 0;
+    };
+
+    /// An encoded ladder rung together with its bytes.
+    struct PreviewRendition {
+        PreviewVariant variant;
+        std::string data;
+    };
+
+    /// Preview formats served to clients, in order of server preference.
+    enum class Format { Avif, WebP, Jpeg };
+
+    /// MIME type and file extension (without dot) for a preview format.
+    const char* mimeType(Format format);
+    const char* extension(Format format);
+
+    /// The format a preview file name's extension stands for; JPEG unless it is AVIF or WebP.
+    Format formatOf(std::string_view fileName);
+
+    /// Whether this build was linked against an encoder for the format.
+    bool canEncode(Format format);
+
+    /// Containers accepted at ingest. Everything but JPEG is decoded and re-encoded as JPEG.
+    enum class Container { Unknown, Jpeg, Png, Tiff, Heif };
+
+    /// The full-size preview re-encoded in a modern format.
+    struct AlternatePreview {
+        Format format = Format::Jpeg;
+        std::string data;
+    };
+
+    /// How the full-size JPEG preview was produced.
+    enum class PreviewPath {
+        None,      // the input could not be decoded; no preview was produced
+        Reencoded, // decoded and compressed again
+        Lossless   // tjTransform: Huffman optimisation/rotation, no DCT round trip
+    };
+
+    const char* toString(PreviewPath path);
+
+    /// Everything generated for the gallery from a single decode of the original.
+    struct PreviewSet {
+        std::string preview;                     // full-size JPEG preview, EXIF preserved
+        PreviewPath path = PreviewPath::None;
+        int width = 0;                            // pixel size of `preview`; a lossless rotation
+        int height = 0;                           //   may have trimmed partial MCUs off the edges
+        int quality = 0;                          // JPEG quality of a re-encoded preview
+        std::vector<AlternatePreview> alternates; // AVIF/WebP encodings of the preview
+        std::vector<PreviewRendition> ladder;     // downscaled JPEG rungs, smallest first
+        std::vector<PreviewRendition> ladderAlternates; // AVIF/WebP encodings of the rungs, smallest first
+        Placeholder placeholder;                  // BlurHash + dominant colour for instant paint
+    };
+
+    struct AvifOptions {
+        bool enabled = true;
+        int quality = 60; // 0-100
+        int speed = 8;    // 0 (slowest, smallest) - 10 (fastest)
+    };
+
+    struct WebpOptions {
+        bool enabled = true;
+        int quality = 80; // 0-100
+        int method = 4;   // 0 (fastest) - 6 (slowest, smallest)
+    };
+
+    /// Lossless preview: the original's coefficients re-packed by tjTransform.
+    struct LosslessOptions {
+        bool enabled = true;
+        int maxEdge = 8000;              // originals larger than this are always downscaled
+        size_t maxBytes = 5 * 1024 * 1024; // re-encode instead if the lossless result is larger
+                                           // (or larger than quality.targetBytes, when that is set)
+    };
+
+    /**
+     * @brief JPEG quality of the re-encoded preview: fixed, or searched to meet a byte budget
+     *        or an SSIM floor. The search runs trial encodes on a downscaled probe, then
+     *        encodes the full-size preview once at the chosen quality.
+     */
+    struct QualityOptions {
+        int fixed = 90;          // used when neither target is set
+        size_t targetBytes = 0;  // > 0: highest quality whose preview fits in this many bytes
+        double targetSsim = 0.0; // > 0: lowest quality whose probe reaches this SSIM (if no byte target)
+        int minQuality = 50;
+        int maxQuality = 95;
+        int probeEdge = 640;     // long edge (px) of the probe
+    };
+
+    /// Deep-zoom tile pyramid for originals too large to preview at full resolution.
+    struct TileOptions {
+        bool enabled = true;
+        int minEdge = 4096;  // originals with a shorter long edge get no pyramid
+        int tileSize = 512;  // px, rounded down to a multiple of 16 (the largest MCU)
+        int quality = 85;    // JPEG quality of re-encoded (downscaled) levels
+    };
+
+    /// Knobs for preview generation, usually filled from the "previews" custom config.
+    struct PreviewOptions {
+        std::vector<int> ladder = {320, 800, 1600, 2560}; // long-edge sizes (px) of the ladder
+        int maxEdge = 0;                                  // long edge (px) of the full-size preview, 0 = as decoded
+        LosslessOptions lossless;
+        QualityOptions quality;
+        AvifOptions avif;
+        WebpOptions webp;
+        TileOptions tiles;
+    };
+
+    /**
+     * @brief Result of the single ingest pass over an image: metadata plus the decoded pixels.
+     *
+     * `pixels` and `appSegments` are views; the pixels live in the calling thread's
+     * workspace and stay valid until the next analyze() on the same thread, the
+     * segments point into the input data (or, for PNG/HEIF, into the workspace).
+     */
+    struct Analysis {
+        Metadata metadata;
+        Container container = Container::Unknown;
+        bool decoded = false;
+        int width = 0;  // decoded (possibly DCT-scaled) width
+        int height = 0; // decoded (possibly DCT-scaled) height
+        int subsamp = 0;
+        const unsigned char* pixels = nullptr; // packed RGB
+        std::vector<std::string_view> appSegments;
+    };
+
+    /**
+     * @brief Re-encodes an image as a full-size JPEG preview, preserving EXIF.
+     * @param inputData The raw bytes of the original image (JPEG, PNG, TIFF or HEIF).
+     * @param fileName The name of the file (used in log messages).
+     * @return The compressed JPEG data, or an empty string if the input could not be decoded.
+     */
+    std::string createGalleryPreview(std::string_view inputData, const std::string& fileName);
+
+    /**
+     * @brief Parses the header and APP segments and decodes the image, once.
+     *
+     * JPEGs are decoded at the smallest DCT scaling factor whose long edge still
+     * reaches `targetEdge`, so a 1600 px preview of a 45 MP frame decodes at 1/4 or so.
+     *
+     * @param inputData The raw bytes of the original image.
+     * @param targetEdge Long edge (px) the caller will resample to; 0 decodes as large as allowed.
+     * @param exifFields The exif::Field bits to read from a JPEG's EXIF; the walk stops once they are found.
+     * @return The analysis; `decoded` is false for unsupported or corrupt input.
+     */
+    Analysis analyze(std::string_view inputData, int targetEdge = 0, uint32_t exifFields = ~0u);
+
+    /**
+     * @brief Decodes the original once and derives the full-size preview and every ladder rung from it.
+     * @param inputData The raw bytes of the original image.
+     * @param fileName The name of the file (used to name the rungs).
+     * @param options Preview size, ladder sizes (rungs not smaller than the preview are skipped) and alternate encoders.
+     * @return The preview set. Empty if the input could not be decoded.
+     */
+    PreviewSet createPreviewSet(std::string_view inputData, const std::string& fileName,
+                                const PreviewOptions& options = {});
+
     /**
-     * @brief Compresses an image to JPEG format aiming for a 3-5 MB size, preserving EXIF.
-     * @param inputData The raw bytes of the original image (JPEG, PNG, etc).
-     * @param fileName The name of the file (used to detect format).
-     * @return The compressed JPEG data as a string.
+     * @brief Same as above, but encodes from an existing analysis instead of decoding again.
      */
-    std::string createGalleryPreview(const std::string& inputData, const std::string& fileName);
+    PreviewSet createPreviewSet(const Analysis& analysis, std::string_view inputData, const std::string& fileName,
+                                const PreviewOptions& options = {});
 
     /**
-     * @brief Extracts EXIF metadata from a JPEG image.
-     * @param inputData The raw bytes of the JPEG image.
+     * @brief Extracts dimensions and EXIF metadata without decoding pixels.
+     * @param inputData The raw bytes of the image (JPEG, PNG, TIFF or HEIF).
      * @return Metadata struct with extracted fields.
      */
-    Metadata extractMetadata(const std::string& inputData);
+    Metadata extractMetadata(std::string_view inputData);
 }
 
 #endif // BLUTOGRAPHY_IMAGE_UTILS_HPP
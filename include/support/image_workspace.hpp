@@ -0,0 +1,62 @@
+#ifndef BLUTOGRAPHY_IMAGE_WORKSPACE_HPP
+#define BLUTOGRAPHY_IMAGE_WORKSPACE_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+typedef void* tjhandle;
+
+namespace blutography::image {
+    /**
+     * @brief Grow-only byte buffer. Unlike std::vector it never zero-fills, so
+     *        re-using it for successive images costs nothing once it is large enough.
+     */
+    class ScratchBuffer {
+    public:
+        unsigned char* reserve(size_t size);
+        unsigned char* data() const { return data_.get(); }
+        size_t capacity() const { return capacity_; }
+
+    private:
+        std::unique_ptr<unsigned char[]> data_;
+        size_t capacity_ = 0;
+    };
+
+    /**
+     * @brief TurboJPEG handles and pixel/output buffers reused across images.
+     *
+     * Each thread borrows one workspace from a process-wide pool on first use and
+     * hands it back when the thread exits, so short-lived ingest threads still
+     * reuse handles and buffers that earlier threads already grew.
+     */
+    struct Workspace {
+        Workspace();
+        ~Workspace();
+        Workspace(const Workspace&) = delete;
+        Workspace& operator=(const Workspace&) = delete;
+
+        /// Output buffer large enough for a worst-case JPEG of the given geometry,
+        /// suitable for tjCompress2 with TJFLAG_NOREALLOC.
+        unsigned char* jpegBuffer(int width, int height, int subsamp, unsigned long& capacity);
+
+        tjhandle decompressor = nullptr;
+        tjhandle compressor = nullptr;
+        tjhandle transformer = nullptr;
+        ScratchBuffer pixels;  // decoded RGB of the current image
+        ScratchBuffer oriented; // decoded RGB turned upright per EXIF orientation
+        ScratchBuffer preview;  // decoded RGB resampled to the preview's max edge
+        ScratchBuffer scratch[2]; // resize targets, used ping-pong
+        ScratchBuffer resample; // intermediate rows of resampleRgb()
+        std::string exif;         // APP1 segment rebuilt from a PNG/HEIF container's EXIF
+
+    private:
+        unsigned char* jpeg_ = nullptr;
+        unsigned long jpegCapacity_ = 0;
+    };
+
+    /// The calling thread's workspace.
+    Workspace& workspace();
+}
+
+#endif // BLUTOGRAPHY_IMAGE_WORKSPACE_HPP
@@ -0,0 +1,80 @@
+#ifndef BLUTOGRAPHY_INGEST_HPP
+#define BLUTOGRAPHY_INGEST_HPP
+
+#include <support/image_utils.hpp>
+#include <support/ingest_journal.hpp>
+#include <support/spool.hpp>
+#include <support/upload_jobs.hpp>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace blutography {
+
+class B2Service;
+
+/// An original on its way to becoming a gallery item.
+struct IngestFile {
+    std::string imageId;     // first 12 digits of contentHash
+    std::string contentHash; // SHA-1 (hex) of the original
+    std::string name;
+    std::string quote;
+    std::string fileName;
+    std::shared_ptr<SpooledFile> content;
+};
+
+/// How often a failed B2 upload is tried again before its original is left for the next start.
+struct UploadRetryOptions {
+    int attempts = 5;                     // tries in all, the first included
+    std::chrono::seconds firstDelay{5};   // before the second try; doubled before each one after
+    std::chrono::seconds maxDelay{300};
+};
+
+/// Reads the "previews" section of custom_config; missing keys keep the defaults.
+image::PreviewOptions previewOptionsFromConfig();
+
+/// Reads upload_attempts, retry_delay and retry_max_delay from the "journal" section of custom_config.
+UploadRetryOptions uploadRetryFromConfig();
+
+/**
+ * @brief Uploads a journaled original to B2, trying again with backoff while it fails.
+ *
+ * Once B2 has it, the original's journal entry is completed. If every attempt
+ * fails the entry is left for the next start to resume. Retries are scheduled on
+ * the main loop.
+ *
+ * @param done Told the outcome once, after the last attempt.
+ */
+void uploadOriginal(std::shared_ptr<B2Service> b2Service, const std::string& fileName, std::shared_ptr<const SpooledFile> content,
+                    std::function<void(bool success, std::string fileId)> done);
+
+/**
+ * @brief Decodes the original once, writes its previews, ladder and tiles, and stores the gallery item.
+ *
+ * CPU-bound; runs on the image executor.
+ *
+ * @param onStage Told when the file moves on to UploadStage::Storage (optional).
+ * @return How the full-size preview was produced.
+ * @throws std::runtime_error If the gallery engine could not store the item.
+ */
+image::PreviewPath ingestOriginal(const IngestFile& file, const image::PreviewOptions& options,
+                                  const std::function<void(UploadStage)>& onStage = {});
+
+/**
+ * @brief Finishes what the ingest journal says an earlier process left undone.
+ *
+ * Originals whose gallery item was never stored are ingested again; the rest
+ * are only uploaded to B2. At most journal.resume_concurrency run at a time.
+ * Call once the event loop is running.
+ *
+ * @param entries What IngestJournal::recover() returned. Recover before the
+ *        listeners open: it deletes spool files it has no entry for, which
+ *        would include those of uploads already under way.
+ */
+void resumeJournaledIngests(std::vector<JournalEntry> entries);
+
+}
+
+#endif // BLUTOGRAPHY_INGEST_HPP
@@ -0,0 +1,58 @@
+#ifndef BLUTOGRAPHY_INGEST_CLAIMS_HPP
+#define BLUTOGRAPHY_INGEST_CLAIMS_HPP
+
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <utility>
+
+namespace blutography {
+
+/**
+ * @brief Content hashes whose ingest is running, so concurrent uploads of the same
+ *        bytes are caught before the first one has reached GalleryStorage.
+ *
+ * A hash is held by a Claim and freed when the claim is released or destroyed,
+ * so an ingest that throws or is dropped never leaves its hash claimed.
+ */
+class IngestClaims {
+public:
+    /// A held hash; empty when another ingest already held it.
+    class Claim {
+    public:
+        Claim() = default;
+        Claim(Claim&& other) noexcept;
+        Claim& operator=(Claim&& other) noexcept;
+        Claim(const Claim&) = delete;
+        Claim& operator=(const Claim&) = delete;
+        ~Claim() { release(); }
+
+        explicit operator bool() const { return owner_ != nullptr; }
+
+        /// Frees the hash early; a no-op on an empty claim.
+        void release();
+
+    private:
+        friend class IngestClaims;
+        Claim(IngestClaims* owner, std::string contentHash) : owner_(owner), contentHash_(std::move(contentHash)) {}
+
+        IngestClaims* owner_ = nullptr;
+        std::string contentHash_;
+    };
+
+    /// The process-wide set used by uploads.
+    static IngestClaims& instance();
+
+    /// Claims `contentHash`; the claim is empty if it is already held.
+    Claim claim(const std::string& contentHash);
+
+    bool held(const std::string& contentHash) const;
+
+private:
+    mutable std::mutex mutex_;
+    std::unordered_set<std::string> held_;
+};
+
+}
+
+#endif // BLUTOGRAPHY_INGEST_CLAIMS_HPP
@@ -0,0 +1,61 @@
+#ifndef BLUTOGRAPHY_INGEST_JOURNAL_HPP
+#define BLUTOGRAPHY_INGEST_JOURNAL_HPP
+
+#include <support/spool.hpp>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace blutography {
+
+/// How far a journaled original got. Entries are dropped once B2 has confirmed the original.
+enum class JournalStage { Spooled, Stored };
+
+struct JournalEntry {
+    std::string spoolPath;   // the original, kept on disk until B2 confirms it
+    std::string fileName;
+    std::string name;
+    std::string quote;
+    std::string contentHash; // SHA-1 (hex) of the original
+    JournalStage stage = JournalStage::Spooled;
+};
+
+/**
+ * @brief Durable record of uploads that have not reached B2 yet.
+ *
+ * Each entry is a small JSON file next to its spool file (`<uuid>.journal` beside
+ * `<uuid>.part`), replaced atomically on every stage change. A process that dies
+ * mid-ingest leaves both behind, and recover() hands them to the next one.
+ */
+class IngestJournal {
+public:
+    /// The journal of the server's spool directory.
+    static IngestJournal& instance();
+
+    /// A journal over the spool files in `directory`.
+    explicit IngestJournal(std::string directory);
+
+    /// Records a spooled original and keeps its spool file across restarts. False if it could not be written.
+    bool begin(SpooledFile& content, JournalEntry entry);
+
+    /// Notes that the entry's gallery item is stored; a resumed ingest then only uploads.
+    void advance(const std::string& spoolPath, JournalStage stage);
+
+    /// B2 has the original: forgets the entry and removes its spool file.
+    void complete(const std::string& spoolPath);
+
+    /// Entries an earlier process left unfinished. Spool files without an entry are deleted.
+    std::vector<JournalEntry> recover();
+
+private:
+    bool write(const JournalEntry& entry);
+
+    std::string directory_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, JournalEntry> entries_; // by spool path
+};
+
+}
+
+#endif // BLUTOGRAPHY_INGEST_JOURNAL_HPP
@@ -0,0 +1,26 @@
+#ifndef BLUTOGRAPHY_PLACEHOLDER_HPP
+#define BLUTOGRAPHY_PLACEHOLDER_HPP
+
+#include <string>
+
+namespace blutography::image {
+    /// What the gallery grid paints before the preview itself arrives.
+    struct Placeholder {
+        std::string blurHash;      // https://blurha.sh, 4x3 components
+        std::string dominantColor; // "#rrggbb"
+    };
+
+    /**
+     * @brief Computes a BlurHash and the dominant colour of an image.
+     *
+     * The image is first reduced to a 32px thumbnail with a single streaming pass
+     * over the rows (plain accumulate loops the compiler vectorises); everything
+     * after that works on the thumbnail and is negligible.
+     *
+     * @param rgb Packed RGB pixels.
+     * @return The placeholder, or empty strings for an empty image.
+     */
+    Placeholder computePlaceholder(const unsigned char* rgb, int width, int height);
+}
+
+#endif // BLUTOGRAPHY_PLACEHOLDER_HPP
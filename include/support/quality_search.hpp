@@ -0,0 +1,43 @@
+#ifndef BLUTOGRAPHY_QUALITY_SEARCH_HPP
+#define BLUTOGRAPHY_QUALITY_SEARCH_HPP
+
+#include <support/image_utils.hpp>
+#include <cstddef>
+#include <vector>
+
+namespace blutography::image {
+    /// One trial encode of the probe image.
+    struct QualityTrial {
+        int quality = 0;
+        size_t bytes = 0;  // JPEG size of the probe at this quality
+        double ssim = 0.0; // luma SSIM of the decoded probe against the probe, if measured
+    };
+
+    /**
+     * @brief Encodes the probe at every quality level in `options`' range, on the calling thread.
+     *
+     * Only the JPEG output buffer and `scratch[1]` of the thread's workspace are touched.
+     *
+     * @param measureSsim Also decode each trial and score it against the probe.
+     * @return One trial per quality, highest quality first.
+     */
+    std::vector<QualityTrial> runQualityTrials(const unsigned char* rgb, int width, int height, int subsamp,
+                                               const QualityOptions& options, bool measureSsim);
+
+    /**
+     * @brief Picks the quality for the full-size encode from the probe trials.
+     *
+     * Byte budgets assume the JPEG size grows with the pixel count (`bytesScale` =
+     * full pixels / probe pixels), which overestimates slightly because the probe
+     * holds more detail per pixel. SSIM is scale-independent enough to use as is.
+     *
+     * @param overhead Bytes added to the encoder output (the APP segments).
+     */
+    int pickQuality(const std::vector<QualityTrial>& trials, const QualityOptions& options,
+                    double bytesScale, size_t overhead);
+
+    /// Mean SSIM of the luma of two packed RGB images, over 8x8 blocks.
+    double lumaSsim(const unsigned char* a, const unsigned char* b, int width, int height);
+}
+
+#endif // BLUTOGRAPHY_QUALITY_SEARCH_HPP
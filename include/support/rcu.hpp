@@ -0,0 +1,52 @@
+#ifndef BLUTOGRAPHY_RCU_HPP
+#define BLUTOGRAPHY_RCU_HPP
+
+#include <atomic>
+#include <memory>
+#include <utility>
+
+namespace blutography {
+
+/**
+ * @brief A pointer to an immutable value that readers load and a writer replaces (read-copy-update).
+ *
+ * Readers take a reference with load() and keep the value alive for as long as
+ * they hold it; a writer builds the next value aside and store()s it. The old one
+ * goes when its last reader lets go. Uses std::atomic<std::shared_ptr> where the
+ * standard library has it, and the free atomic functions it replaces elsewhere.
+ */
+template <typename T>
+class Rcu {
+public:
+    Rcu() = default;
+    explicit Rcu(std::shared_ptr<const T> value) : value_(std::move(value)) {}
+    Rcu(const Rcu&) = delete;
+    Rcu& operator=(const Rcu&) = delete;
+
+    std::shared_ptr<const T> load() const {
+#if defined(__cpp_lib_atomic_shared_ptr)
+        return value_.load(std::memory_order_acquire);
+#else
+        return std::atomic_load_explicit(&value_, std::memory_order_acquire);
+#endif
+    }
+
+    void store(std::shared_ptr<const T> value) {
+#if defined(__cpp_lib_atomic_shared_ptr)
+        value_.store(std::move(value), std::memory_order_release);
+#else
+        std::atomic_store_explicit(&value_, std::move(value), std::memory_order_release);
+#endif
+    }
+
+private:
+#if defined(__cpp_lib_atomic_shared_ptr)
+    std::atomic<std::shared_ptr<const T>> value_;
+#else
+    std::shared_ptr<const T> value_;
+#endif
+};
+
+}
+
+#endif // BLUTOGRAPHY_RCU_HPP
@@ -0,0 +1,37 @@
+#ifndef BLUTOGRAPHY_RESAMPLE_HPP
+#define BLUTOGRAPHY_RESAMPLE_HPP
+
+#include <support/image_workspace.hpp>
+#include <string_view>
+
+namespace blutography::image {
+    enum class ResampleFilter {
+        Area,    // box filter widened to the scale factor; cheap, fine for large reductions
+        Lanczos3 // sharp, for final output sizes
+    };
+
+    /**
+     * @brief Resizes packed RGB to exactly `dstWidth` x `dstHeight`.
+     *
+     * Separable: a horizontal pass into `temp`, then a vertical pass into `dst`, both
+     * with fixed-point weights precomputed per output row/column. The vertical pass,
+     * where most of the arithmetic is, uses AVX2 or NEON when the CPU has them.
+     *
+     * @param temp Holds the intermediate image (dstWidth x srcHeight); grown as needed.
+     */
+    void resampleRgb(const unsigned char* src, int srcWidth, int srcHeight,
+                     unsigned char* dst, int dstWidth, int dstHeight,
+                     ScratchBuffer& temp, ResampleFilter filter = ResampleFilter::Lanczos3);
+
+    /// Which vertical kernel resampleRgb() dispatches to on this machine ("avx2", "neon" or "scalar").
+    const char* resampleKernel();
+
+    /**
+     * @brief Forces the vertical kernel: "scalar", "avx2", "neon", or "native" for the default choice.
+     *        For tests and benchmarks comparing kernels; process-wide.
+     * @return false, leaving the kernel unchanged, if this machine cannot run it.
+     */
+    bool setResampleKernel(std::string_view name);
+}
+
+#endif // BLUTOGRAPHY_RESAMPLE_HPP
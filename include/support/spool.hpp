@@ -0,0 +1,65 @@
+#ifndef BLUTOGRAPHY_SPOOL_HPP
+#define BLUTOGRAPHY_SPOOL_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace blutography {
+
+/**
+ * @brief An uploaded original parked on disk and mapped read-only.
+ *
+ * The bytes are written to the spool directory and synced, then the file is
+ * memory-mapped. The caller hashes the upload first, so content the gallery
+ * already has never reaches the disk, and hands the hash over. Decoders and the B2 upload read
+ * the mapping, so the original is never held on the heap; the kernel pages it
+ * in and out as needed. The file is removed when the last reference goes away,
+ * unless it has been handed to the ingest journal with persist().
+ */
+class SpooledFile {
+public:
+    /// Directory spooled originals are written to, relative to the working directory.
+    static constexpr const char* directory = "spool";
+
+    /**
+     * @brief Copies `data` into a new spool file.
+     * @param sha1 The SHA-1 of `data` as upper-case hex, computed by the caller.
+     * @param in The directory to spool into.
+     * @return The mapped file, or nullptr if it could not be written or mapped.
+     */
+    static std::shared_ptr<SpooledFile> create(std::string_view data, std::string sha1, const std::string& in = directory);
+
+    /// Maps a spool file left by an earlier process; `sha1` is the hash recorded for it.
+    static std::shared_ptr<SpooledFile> open(const std::string& path, std::string sha1);
+
+    ~SpooledFile();
+    SpooledFile(const SpooledFile&) = delete;
+    SpooledFile& operator=(const SpooledFile&) = delete;
+
+    /// The mapped contents; valid for the lifetime of this object.
+    std::string_view data() const { return {data_, size_}; }
+    size_t size() const { return size_; }
+
+    /// SHA-1 of the contents as upper-case hex, like drogon::utils::getSha1().
+    const std::string& sha1() const { return sha1_; }
+    const std::string& path() const { return path_; }
+
+    /// Keeps the file on disk after the last reference goes; whoever calls this removes it.
+    void persist() { persistent_ = true; }
+
+private:
+    SpooledFile() = default;
+    bool map();
+
+    std::string path_;
+    std::string sha1_;
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    bool persistent_ = false;
+};
+
+}
+
+#endif // BLUTOGRAPHY_SPOOL_HPP
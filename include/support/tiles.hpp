@@ -0,0 +1,38 @@
+#ifndef BLUTOGRAPHY_TILES_HPP
+#define BLUTOGRAPHY_TILES_HPP
+
+#include <support/image_utils.hpp>
+#include <cstddef>
+#include <functional>
+#include <string_view>
+
+namespace blutography::image {
+    /// Geometry of a Deep Zoom (DZI) pyramid: level `maxLevel` is the original, level 0 is 1x1.
+    struct TileLayout {
+        int width = 0;
+        int height = 0;
+        int tileSize = 0;
+        int overlap = 0;
+        int maxLevel = 0;
+    };
+
+    /// Receives one encoded tile. Returning false aborts the build.
+    using TileSink = std::function<bool(int level, int column, int row, const unsigned char* data, size_t size)>;
+
+    /**
+     * @brief Cuts a JPEG original into a DZI tile pyramid without decoding it at full resolution.
+     *
+     * The full-resolution level is cropped losslessly out of the original's DCT
+     * coefficients, one tile row per tjTransform() call. The next level down is a
+     * 1/2 DCT-scaled decode, and every smaller level is an area-filtered halving of
+     * the one above it, so peak memory is a quarter of the original's pixels.
+     *
+     * @param analysis The original's analysis; only upright JPEGs are tiled.
+     * @param layout Filled with the pyramid's geometry on success.
+     * @return False if the image is not eligible, could not be decoded, or the sink gave up.
+     */
+    bool buildTilePyramid(std::string_view inputData, const Analysis& analysis, const TileOptions& options,
+                          TileLayout& layout, const TileSink& sink);
+}
+
+#endif // BLUTOGRAPHY_TILES_HPP
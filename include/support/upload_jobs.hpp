@@ -0,0 +1,90 @@
+#ifndef BLUTOGRAPHY_UPLOAD_JOBS_HPP
+#define BLUTOGRAPHY_UPLOAD_JOBS_HPP
+
+#include <drogon/HttpResponse.h>
+#include <json/json.h>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace blutography {
+
+/// Where a file of an upload job currently is, in pipeline order.
+enum class UploadStage { Queued, Hashing, Preview, Storage, B2, Done };
+
+const char* toString(UploadStage stage);
+
+/**
+ * @brief Progress of one POST /upload, reported after the request has been answered with 202.
+ *
+ * Every stage transition and finished file is recorded as a server-sent event. A
+ * subscriber first gets the events recorded so far and then live ones, so a page
+ * that connects late (or reconnects) still sees the whole job. All methods are
+ * thread-safe; the pipeline reports from executor workers and event loops alike.
+ */
+class UploadJob {
+public:
+    UploadJob(std::string id, std::vector<std::string> fileNames);
+
+    const std::string& id() const { return id_; }
+
+    /// Moves file `file` to `stage`, timing the stage it leaves.
+    void stage(size_t file, UploadStage stage);
+
+    /// Records the file's final result; the last file to finish completes the job.
+    void finish(size_t file, Json::Value result);
+
+    /// Replays the job so far to `stream`, then keeps it for live events until the job completes.
+    void subscribe(drogon::ResponseStreamPtr stream);
+
+    /// Current state of every file, for clients that poll instead of streaming.
+    Json::Value snapshot() const;
+
+    bool done() const;
+    std::chrono::steady_clock::time_point finishedAt() const;
+
+private:
+    struct File {
+        std::string fileName;
+        UploadStage stage = UploadStage::Queued;
+        std::chrono::steady_clock::time_point stageStart;
+        Json::Value timings{Json::objectValue}; // stage name -> milliseconds spent in it
+        Json::Value result;
+    };
+
+    Json::Value describe(size_t file) const;
+    void publish(const char* event, const Json::Value& data);
+
+    std::string id_;
+    std::chrono::steady_clock::time_point created_;
+    mutable std::mutex mutex_;
+    std::vector<File> files_;
+    size_t remaining_;
+    std::chrono::steady_clock::time_point finishedAt_;
+    std::vector<std::string> events_; // formatted SSE frames, replayed to new subscribers
+    std::vector<std::shared_ptr<drogon::ResponseStream>> subscribers_;
+};
+
+/// Live and recently finished upload jobs, by id.
+class UploadJobs {
+public:
+    static UploadJobs& instance();
+
+    std::shared_ptr<UploadJob> create(std::vector<std::string> fileNames);
+    std::shared_ptr<UploadJob> find(const std::string& id);
+
+private:
+    UploadJobs() = default;
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<UploadJob>> jobs_;
+    std::chrono::seconds retain_{600}; // finished jobs stay queryable this long
+};
+
+}
+
+#endif // BLUTOGRAPHY_UPLOAD_JOBS_HPP
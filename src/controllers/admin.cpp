@@ -3,14 +3,17 @@
 #include <support/b2service.hpp>
 #include <support/image_utils.hpp>
 #include <support/gallery_storage.hpp>
+#include <support/image_executor.hpp>
+#include <support/spool.hpp>
+#include <support/upload_jobs.hpp>
+#include <support/ingest.hpp>
+#include <support/ingest_journal.hpp>
+#include <support/ingest_claims.hpp>
 #include <drogon/HttpAppFramework.h>
 #include <drogon/MultiPart.h>
 #include <drogon/utils/Utilities.h>
-#include <atomic>
-#include <mutex>
 #include <algorithm>
-#include <fstream>
-#include <thread>
+#include <optional>
 
 namespace blutography {
     static std::string trim(const std::string& s) {
@@ -66,8 +69,10 @@ namespace blutography {
     }
 
     void Admin_Controller::uploadImage(const drogon::HttpRequestPtr &req, std::function<void(const drogon::HttpResponsePtr &)> &&callback) {
-        drogon::MultiPartParser fileUpload;
-        if (fileUpload.parse(req) != 0 || fileUpload.getFiles().empty()) {
+        // Shared with the executor tasks: the parsed files view the request body (or the temp file
+        // Drogon spilled a large body to), so both have to outlive the request handler
+        auto fileUpload = std::make_shared<drogon::MultiPartParser>();
+        if (fileUpload->parse(req) != 0 || fileUpload->getFiles().empty()) {
             auto resp = drogon::HttpResponse::newHttpResponse();
             resp->setStatusCode(drogon::k400BadRequest);
             resp->setBody("Invalid upload request");
@@ -84,86 +89,200 @@ namespace blutography {
             return;
         }
 
-        auto &files = fileUpload.getFiles();
-        auto &params = fileUpload.getParameters();
+        auto &files = fileUpload->getFiles();
+        auto &params = fileUpload->getParameters();
+
+        // Admit the whole batch or none of it, before any file has been touched
+        auto &executor = ImageExecutor::instance();
+        if (!executor.reserve(files.size())) {
+            auto resp = drogon::HttpResponse::newHttpResponse();
+            resp->setStatusCode(drogon::k429TooManyRequests);
+            resp->addHeader("Retry-After", std::to_string(executor.options().retryAfter));
+            resp->setBody("Image processing queue is full");
+            callback(resp);
+            return;
+        }
         
         std::string reqName = params.count("name") ? params.at("name") : "";
         std::string reqQuote = params.count("quote") ? params.at("quote") : "";
 
-        auto shared_callback = std::make_shared<std::function<void(const drogon::HttpResponsePtr &)>>(std::move(callback));
-        auto results = std::make_shared<Json::Value>();
-        results->resize(0);
-        auto remaining = std::make_shared<std::atomic<size_t>>(files.size());
-
-        for (auto &file : files) {
-            std::string fileName = file.getFileName();
-            // Copy data to a shared buffer for background processing
-            auto fileContent = std::make_shared<std::string>(file.fileData(), file.fileLength());
-            
-            // Generate unique ID (hash)
-            std::string imageId = drogon::utils::getSha1(*fileContent).substr(0, 12);
-            std::string name = reqName.empty() ? fileName : reqName;
-            std::string quote = reqQuote;
-
-            // Offload CPU-intensive compression to a background thread to keep IO loop free
-            std::thread([imageId, name, quote, fileName, fileContent, b2Service, results, remaining, shared_callback]() {
-                // 1. Extract Metadata
-                image::Metadata metadata = image::extractMetadata(*fileContent);
-
-                // 2. Generate and save preview locally for the server-side gallery
-                std::string previewName = fileName;
-                try {
-                    std::string previewData = image::createGalleryPreview(*fileContent, fileName);
-                    if (!previewData.empty()) {
-                        size_t lastDot = previewName.find_last_of(".");
-                        if (lastDot != std::string::npos) {
-                            previewName = previewName.substr(0, lastDot) + ".jpg";
-                        } else {
-                            previewName += ".jpg";
-                        }
-
-                        std::string previewPath = "gallery_previews/" + previewName;
-                        std::ofstream out(previewPath, std::ios::binary);
-                        if (out) {
-                            out.write(previewData.data(), previewData.size());
-                            LOG_DEBUG << "Gallery preview saved: " << previewPath;
-                        }
+        auto previewOptions = std::make_shared<const image::PreviewOptions>(previewOptionsFromConfig());
+
+        std::vector<std::string> fileNames;
+        for (const auto &file : files) fileNames.push_back(file.getFileName());
+        auto job = UploadJobs::instance().create(std::move(fileNames));
+
+        for (size_t index = 0; index < files.size(); ++index) {
+            // Filled in by the task on the executor, read by its completion on this event loop
+            struct PendingIngest {
+                IngestFile file;
+                image::PreviewPath previewPath = image::PreviewPath::None;
+                bool reported = false; // the task already finished the job's entry (duplicate, spool failure)
+            };
+            auto pending = std::make_shared<PendingIngest>();
+            std::string fileName = files[index].getFileName();
+
+            // Hashing, spooling and the fsync are all disk and CPU work; none of it runs on the IO loop
+            executor.submit([fileUpload, req, pending, previewOptions, reqName, reqQuote, fileName, job, index]() {
+                const auto &file = fileUpload->getFiles()[index];
+                std::string_view data(file.fileData(), file.fileLength());
+                job->stage(index, UploadStage::Hashing);
+
+                // Hash before spooling, so known content never reaches the disk
+                std::string contentHash = drogon::utils::getSha1(data.data(), data.size());
+                std::string imageId = contentHash.substr(0, 12);
+
+                // Known content: no decode, no preview, no B2 upload. A new name or
+                // quote on the re-upload is applied to the existing item. The claim is
+                // freed when this task ends, however it ends.
+                IngestClaims::Claim claim = IngestClaims::instance().claim(contentHash);
+                auto existing = claim ? GalleryStorage::instance().findByHash(contentHash) : nullptr;
+                if (!claim || existing) {
+                    Json::Value res;
+                    res["fileName"] = fileName;
+                    res["id"] = imageId;
+                    res["duplicate"] = true;
+                    res["success"] = true;
+                    if (existing) {
+                        std::optional<std::string> newName, newQuote;
+                        if (!reqName.empty()) newName = reqName;
+                        if (!reqQuote.empty()) newQuote = reqQuote;
+                        auto updated = GalleryStorage::instance().updateDetails(existing->id, newName, newQuote);
+                        res["updated"] = updated && (updated->name != existing->name || updated->quote != existing->quote);
+                        res["name"] = updated ? updated->name : existing->name;
+                    } else {
+                        res["inProgress"] = true; // the same bytes are being ingested by another request
                     }
-                } catch (const std::exception& e) {
-                    LOG_ERROR << "Gallery preview generation failed for " << fileName << ": " << e.what();
+                    pending->reported = true;
+                    job->finish(index, std::move(res));
+                    return;
                 }
 
-                // 3. Store in GalleryStorage
-                GalleryItem item;
-                item.id = imageId;
-                item.name = name;
-                item.quote = quote;
-                item.fileName = fileName;
-                item.previewName = previewName;
-                item.metadata = metadata;
-                GalleryStorage::instance().addItem(item);
-
-                // 4. Upload original (lossless) to Backblaze B2 database
-                b2Service->upload(fileName, std::move(*fileContent), [fileName, results, remaining, shared_callback](bool success, std::string fileId) {
+                // Park the original on disk so nothing below holds it on the heap
+                auto fileContent = SpooledFile::create(data, contentHash);
+                if (!fileContent) {
+                    Json::Value res;
+                    res["fileName"] = fileName;
+                    res["success"] = false;
+                    res["error"] = "Failed to spool upload";
+                    pending->reported = true;
+                    job->finish(index, std::move(res));
+                    return;
+                }
+
+                std::string name = reqName.empty() ? fileName : reqName;
+
+                // From here on the original survives a crash until B2 has it
+                JournalEntry entry;
+                entry.fileName = fileName;
+                entry.name = name;
+                entry.quote = reqQuote;
+                if (!IngestJournal::instance().begin(*fileContent, entry)) {
+                    LOG_WARN << "Could not journal " << fileName << "; it will not be resumed after a crash";
+                }
+
+                IngestFile &ingestFile = pending->file;
+                ingestFile.imageId = imageId;
+                ingestFile.contentHash = contentHash;
+                ingestFile.name = name;
+                ingestFile.quote = reqQuote;
+                ingestFile.fileName = fileName;
+                ingestFile.content = fileContent;
+
+                job->stage(index, UploadStage::Preview);
+                pending->previewPath = ingestOriginal(ingestFile, *previewOptions, [job, index](UploadStage stage) { job->stage(index, stage); });
+                IngestJournal::instance().advance(fileContent->path(), JournalStage::Stored);
+            }, [pending, b2Service, fileName, job, index](bool stored) {
+                if (pending->reported) return;
+                const IngestFile &ingestFile = pending->file;
+                // Nothing was stored: no B2 object to orphan. The journal keeps the original for the next start.
+                if (!stored) {
+                    Json::Value res;
+                    res["fileName"] = fileName;
+                    res["id"] = ingestFile.imageId;
+                    res["success"] = false;
+                    res["error"] = "Failed to process image";
+                    job->finish(index, std::move(res));
+                    return;
+                }
+                // Upload original (lossless) to Backblaze B2 database
+                job->stage(index, UploadStage::B2);
+                auto previewPath = pending->previewPath;
+                // Retried with backoff; if it still fails, the journal keeps the original for the next start
+                uploadOriginal(b2Service, fileName, ingestFile.content, [fileName, imageId = ingestFile.imageId, previewPath, job, index](bool success, std::string fileId) {
                     Json::Value res;
                     res["fileName"] = fileName;
+                    res["id"] = imageId;
+                    res["previewPath"] = image::toString(previewPath);
                     res["success"] = success;
                     res["fileId"] = fileId;
-                    
-                    static std::mutex resultsMutex;
-                    {
-                        std::lock_guard<std::mutex> lock(resultsMutex);
-                        results->append(res);
-                    }
-
-                    if (--(*remaining) == 0) {
-                        // All files in this batch processed
-                        auto resp = drogon::HttpResponse::newHttpJsonResponse(*results);
-                        (*shared_callback)(resp);
-                    }
+                    job->finish(index, std::move(res));
                 });
-            }).detach();
+            });
+        }
+
+        // Every file is admitted; the rest is reported through the job instead of holding this request open
+        Json::Value accepted;
+        accepted["jobId"] = job->id();
+        accepted["statusUrl"] = "/upload/jobs/" + job->id();
+        accepted["eventsUrl"] = "/upload/jobs/" + job->id() + "/events";
+        auto resp = drogon::HttpResponse::newHttpJsonResponse(accepted);
+        resp->setStatusCode(drogon::k202Accepted);
+        callback(resp);
+    }
+
+    void Admin_Controller::uploadJob(const drogon::HttpRequestPtr &req, std::function<void(const drogon::HttpResponsePtr &)> &&callback, const std::string &jobId) {
+        auto job = UploadJobs::instance().find(jobId);
+        if (!job) {
+            auto resp = drogon::HttpResponse::newHttpResponse();
+            resp->setStatusCode(drogon::k404NotFound);
+            resp->setBody("Upload job not found");
+            callback(resp);
+            return;
+        }
+        callback(drogon::HttpResponse::newHttpJsonResponse(job->snapshot()));
+    }
+
+    void Admin_Controller::uploadJobEvents(const drogon::HttpRequestPtr &req, std::function<void(const drogon::HttpResponsePtr &)> &&callback, const std::string &jobId) {
+        auto job = UploadJobs::instance().find(jobId);
+        if (!job) {
+            auto resp = drogon::HttpResponse::newHttpResponse();
+            resp->setStatusCode(drogon::k404NotFound);
+            resp->setBody("Upload job not found");
+            callback(resp);
+            return;
+        }
+
+        // Server-sent events; the stream may sit quiet for minutes during a B2 upload, so no idle kick-off
+        auto resp = drogon::HttpResponse::newAsyncStreamResponse([job](drogon::ResponseStreamPtr stream) {
+            job->subscribe(std::move(stream));
+        }, true);
+        resp->setContentTypeString("text/event-stream");
+        resp->addHeader("Cache-Control", "no-cache");
+        resp->addHeader("X-Accel-Buffering", "no");
+        callback(resp);
+    }
+
+    void Admin_Controller::uploadStatus(const drogon::HttpRequestPtr &req, std::function<void(const drogon::HttpResponsePtr &)> &&callback) {
+        auto &executor = ImageExecutor::instance();
+        Json::Value status;
+        status["threads"] = static_cast<Json::UInt64>(executor.threads());
+        status["queued"] = static_cast<Json::UInt64>(executor.queued());
+        status["running"] = static_cast<Json::UInt64>(executor.running());
+        status["admitted"] = static_cast<Json::UInt64>(executor.admitted());
+        status["maxQueue"] = static_cast<Json::UInt64>(executor.options().maxQueue);
+        if (auto b2Service = B2Service::instance()) {
+            const auto &clients = b2Service->clients();
+            Json::Value b2;
+            b2["requests"] = static_cast<Json::UInt64>(clients.requests());
+            b2["handshakes"] = static_cast<Json::UInt64>(clients.handshakes());
+            b2["reuseRatio"] = clients.reuseRatio();
+            b2["pipelined"] = static_cast<Json::UInt64>(clients.pipelined());
+            b2["evicted"] = static_cast<Json::UInt64>(clients.evicted());
+            b2["connections"] = static_cast<Json::UInt64>(clients.connections());
+            status["b2"] = b2;
         }
+        callback(drogon::HttpResponse::newHttpJsonResponse(status));
     }
 
     void Admin_Controller::b2Test(const drogon::HttpRequestPtr &req, std::function<void(const drogon::HttpResponsePtr &)> &&callback) {
@@ -3,40 +3,253 @@
 //
 #include <controllers/gallery.hpp>
 #include <support/gallery_storage.hpp>
+#include <support/gallery_feed.hpp>
 #include <support/b2service.hpp>
+#include <support/image_utils.hpp>
 #include <drogon/HttpAppFramework.h>
 #include <fstream>
 #include <filesystem>
 #include <chrono>
 #include <algorithm>
+#include <cstdlib>
+#include <cctype>
+#include <cmath>
+#include <optional>
 
 namespace blutography {
+    // Picks the preview format for an Accept header: highest q-value wins, ties go
+    // to the smaller format (AVIF, then WebP, then JPEG). Wildcards only ever match
+    // JPEG so that clients which never mention a modern format keep getting JPEG.
+    static std::vector<image::Format> acceptedFormats(const std::string& accept) {
+        double qAvif = 0.0, qWebp = 0.0;
+        size_t start = 0;
+        while (start < accept.size()) {
+            size_t end = accept.find(',', start);
+            if (end == std::string::npos) end = accept.size();
+            std::string range = accept.substr(start, end - start);
+            start = end + 1;
+
+            double q = 1.0;
+            size_t semi = range.find(';');
+            std::string type = range.substr(0, semi);
+            type.erase(0, type.find_first_not_of(" \t"));
+            type.erase(type.find_last_not_of(" \t") + 1);
+            if (semi != std::string::npos) {
+                size_t qPos = range.find("q=", semi);
+                if (qPos != std::string::npos) q = std::atof(range.c_str() + qPos + 2);
+            }
+            std::transform(type.begin(), type.end(), type.begin(), ::tolower);
+            if (type == "image/avif") qAvif = q;
+            else if (type == "image/webp") qWebp = q;
+        }
+
+        std::vector<std::pair<double, image::Format>> ranked;
+        if (qAvif > 0.0 && image::canEncode(image::Format::Avif)) ranked.emplace_back(qAvif, image::Format::Avif);
+        if (qWebp > 0.0 && image::canEncode(image::Format::WebP)) ranked.emplace_back(qWebp, image::Format::WebP);
+        std::stable_sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+        std::vector<image::Format> formats;
+        for (const auto& entry : ranked) formats.push_back(entry.second);
+        return formats;
+    }
+
+    // Parses a non-negative decimal with nothing else around it.
+    static bool parseIndex(const std::string& text, int& value) {
+        if (text.empty() || text.size() > 6) return false;
+        value = 0;
+        for (char c : text) {
+            if (!std::isdigit(static_cast<unsigned char>(c))) return false;
+            value = value * 10 + (c - '0');
+        }
+        return true;
+    }
+
+    // Largest page /gallery/data hands out when a limit is given
+    static constexpr int maxPageItems = 1000;
+
+    // The headers of a /gallery/data page, sent with its body or with a 304 in its place.
+    static drogon::HttpResponsePtr feedResponse(const std::string& etag, const std::string& nextCursor,
+                                                const FeedQuery& query, const std::string& fields) {
+        // Clients revalidate every time; an unchanged gallery costs them a 304 and no body
+        auto resp = drogon::HttpResponse::newHttpResponse();
+        resp->addHeader("ETag", etag);
+        resp->addHeader("Cache-Control", "no-cache");
+        resp->addHeader("Vary", "Accept-Encoding");
+        if (!nextCursor.empty()) {
+            std::string next = "/gallery/data?after=" + nextCursor + "&limit=" + std::to_string(query.limit);
+            if (!fields.empty()) next += "&fields=" + drogon::utils::urlEncodeComponent(fields);
+            resp->addHeader("Link", "<" + next + ">; rel=\"next\"");
+        }
+        return resp;
+    }
+
+    // A /gallery/query bound for `field`: capture times as "2025-06-28[T05:07:50]" or in EXIF form, exposures
+    // as "1/800", aspect ratios as "3:2" or a decimal, everything else as a plain number. A date-only upper
+    // bound takes in the whole day.
+    static bool parseBound(IndexField field, const std::string& text, bool upper, double& value) {
+        std::optional<double> parsed;
+        switch (field) {
+            case IndexField::DateTime:
+                parsed = parseCaptureTime(text);
+                if (parsed && upper && text.size() == 10) *parsed += 86400000.0 - 1.0;
+                break;
+            case IndexField::Exposure:
+                parsed = parseExposure(text);
+                break;
+            case IndexField::Aspect: {
+                std::string ratio = text;
+                std::replace(ratio.begin(), ratio.end(), ':', '/');
+                parsed = parseExposure(ratio);
+                break;
+            }
+            default: {
+                char* end = nullptr;
+                double number = std::strtod(text.c_str(), &end);
+                if (!text.empty() && *end == '\0' && std::isfinite(number)) parsed = number;
+                break;
+            }
+        }
+        if (!parsed) return false;
+        value = *parsed;
+        return true;
+    }
+
+    static drogon::HttpResponsePtr tileNotFound() {
+        auto resp = drogon::HttpResponse::newHttpResponse();
+        resp->setStatusCode(drogon::k404NotFound);
+        resp->setBody("Tile not found");
+        return resp;
+    }
+
     void GalleryController::get(const drogon::HttpRequestPtr& req, Callback_t callback) {
         auto resp = drogon::HttpResponse::newFileResponse(drogon::app().getDocumentRoot() + "/templates/gallery.html");
         callback(resp);
     }
 
     void GalleryController::get_data(const drogon::HttpRequestPtr& req, Callback_t callback) {
-        auto items = GalleryStorage::instance().getAllItems();
-        Json::Value root(Json::arrayValue);
-        for (const auto& item : items) {
-            Json::Value jItem;
-            jItem["id"] = item.id;
-            jItem["name"] = item.name;
-            jItem["quote"] = item.quote;
-            jItem["fileName"] = item.fileName;
-            jItem["previewName"] = item.previewName;
-            jItem["previewUrl"] = "/gallery_previews/" + item.previewName;
-            jItem["imageUrl"] = "/gallery/image/" + item.id;
-            jItem["metadata"]["dateTime"] = item.metadata.dateTime;
-            jItem["metadata"]["model"] = item.metadata.model;
-            jItem["metadata"]["exposure"] = item.metadata.exposure;
-            jItem["metadata"]["iso"] = item.metadata.iso;
-            jItem["metadata"]["width"] = item.metadata.width;
-            jItem["metadata"]["height"] = item.metadata.height;
-            root.append(jItem);
+        auto badRequest = [&callback](const std::string& message) {
+            auto resp = drogon::HttpResponse::newHttpResponse();
+            resp->setStatusCode(drogon::k400BadRequest);
+            resp->setBody(message);
+            callback(resp);
+        };
+
+        FeedQuery query;
+        query.after = req->getParameter("after");
+        const std::string& limit = req->getParameter("limit");
+        if (!limit.empty()) {
+            int value = 0;
+            if (!parseIndex(limit, value) || value == 0) return badRequest("Invalid limit");
+            query.limit = static_cast<size_t>(std::min(value, maxPageItems));
         }
-        auto resp = drogon::HttpResponse::newHttpJsonResponse(root);
+        const std::string& fields = req->getParameter("fields");
+        std::string unknown;
+        if (!GalleryFeed::parseFields(fields, query.fields, unknown)) return badRequest("Unknown field: " + unknown);
+
+        // The ETag names the gallery version and the query, so a revalidation is answered before any body is built
+        auto& feed = GalleryFeed::instance();
+        auto head = feed.head(query);
+        if (!head) return badRequest("Unknown cursor");
+        if (GalleryFeed::etagMatches(req->getHeader("If-None-Match"), head->etag)) {
+            auto resp = feedResponse(head->etag, head->nextCursor, query, fields);
+            resp->setStatusCode(drogon::k304NotModified);
+            callback(resp);
+            return;
+        }
+
+        // Handed over here if the body is built already, and from the feed's builder thread if not
+        feed.body(query, [callback = std::move(callback), acceptEncoding = req->getHeader("Accept-Encoding"), query,
+                          fields](std::shared_ptr<const FeedBody> body) {
+            if (!body) {
+                auto resp = drogon::HttpResponse::newHttpResponse();
+                resp->setStatusCode(drogon::k500InternalServerError);
+                callback(resp);
+                return;
+            }
+            // Already compressed bodies carry Content-Encoding, which Drogon's own gzip/brotli pass leaves alone
+            auto resp = feedResponse(body->etag, body->nextCursor, query, fields);
+            const char* encoding = nullptr;
+            const std::string& bytes = GalleryFeed::encoded(*body, acceptEncoding, encoding);
+            resp->setContentTypeCode(drogon::CT_APPLICATION_JSON);
+            if (encoding) resp->addHeader("Content-Encoding", encoding);
+            resp->setBody(bytes);
+            callback(resp);
+        });
+    }
+
+    void GalleryController::get_query(const drogon::HttpRequestPtr& req, Callback_t callback) {
+        auto badRequest = [&callback](const std::string& message) {
+            auto resp = drogon::HttpResponse::newHttpResponse();
+            resp->setStatusCode(drogon::k400BadRequest);
+            resp->setBody(message);
+            callback(resp);
+        };
+
+        GalleryQuery query;
+        const std::string& sort = req->getParameter("sort");
+        if (!sort.empty() && !indexFieldFromString(sort, query.sort)) return badRequest("Unknown sort field: " + sort);
+        const std::string& order = req->getParameter("order");
+        if (!order.empty() && order != "asc" && order != "desc") return badRequest("Order must be asc or desc");
+        query.descending = order == "desc";
+        const std::string& limit = req->getParameter("limit");
+        if (!limit.empty()) {
+            int value = 0;
+            if (!parseIndex(limit, value) || value == 0) return badRequest("Invalid limit");
+            query.limit = static_cast<size_t>(std::min(value, maxPageItems));
+        }
+
+        // <field>Min / <field>Max, both inclusive
+        for (size_t index = 0; index < numericIndexFields; ++index) {
+            auto field = static_cast<IndexField>(index);
+            for (bool upper : {false, true}) {
+                std::string name = std::string(toString(field)) + (upper ? "Max" : "Min");
+                const std::string& text = req->getParameter(name);
+                if (text.empty()) continue;
+                double& bound = upper ? query.ranges[index].max : query.ranges[index].min;
+                if (!parseBound(field, text, upper, bound)) return badRequest("Invalid " + name + ": " + text);
+            }
+        }
+        query.model = req->getParameter("model");
+
+        uint32_t fields = 0;
+        std::string unknown;
+        if (!GalleryFeed::parseFields(req->getParameter("fields"), fields, unknown)) return badRequest("Unknown field: " + unknown);
+
+        auto snapshot = GalleryStorage::instance().snapshot();
+        auto resp = drogon::HttpResponse::newHttpResponse();
+        resp->setContentTypeCode(drogon::CT_APPLICATION_JSON);
+        resp->addHeader("Cache-Control", "no-cache");
+        resp->setBody(GalleryFeed::instance().render(snapshot->query(query), fields));
+        callback(resp);
+    }
+
+    void GalleryController::get_search(const drogon::HttpRequestPtr& req, Callback_t callback) {
+        auto badRequest = [&callback](const std::string& message) {
+            auto resp = drogon::HttpResponse::newHttpResponse();
+            resp->setStatusCode(drogon::k400BadRequest);
+            resp->setBody(message);
+            callback(resp);
+        };
+
+        const std::string& text = req->getParameter("q");
+        if (tokenize(text).empty()) return badRequest("Missing search words");
+        size_t limit = 20;
+        const std::string& limitText = req->getParameter("limit");
+        if (!limitText.empty()) {
+            int value = 0;
+            if (!parseIndex(limitText, value) || value == 0) return badRequest("Invalid limit");
+            limit = static_cast<size_t>(std::min(value, maxPageItems));
+        }
+
+        uint32_t fields = 0;
+        std::string unknown;
+        if (!GalleryFeed::parseFields(req->getParameter("fields"), fields, unknown)) return badRequest("Unknown field: " + unknown);
+
+        auto snapshot = GalleryStorage::instance().snapshot();
+        auto resp = drogon::HttpResponse::newHttpResponse();
+        resp->setContentTypeCode(drogon::CT_APPLICATION_JSON);
+        resp->addHeader("Cache-Control", "no-cache");
+        resp->setBody(GalleryFeed::instance().render(snapshot->search(text, limit), fields));
         callback(resp);
     }
 
@@ -131,9 +344,24 @@ namespace blutography {
             return;
         }
 
+        // Serve the best encoding the client accepts, falling back to the JPEG
+        std::string stem = filename.substr(0, filename.find_last_of("."));
+        for (auto format : acceptedFormats(req->getHeader("Accept"))) {
+            std::string alternatePath = "gallery_previews/formats/" + stem + "." + image::extension(format);
+            if (std::filesystem::exists(alternatePath)) {
+                auto resp = drogon::HttpResponse::newFileResponse(alternatePath);
+                resp->setContentTypeCode(format == image::Format::Avif ? drogon::CT_IMAGE_AVIF : drogon::CT_IMAGE_WEBP);
+                resp->addHeader("Cache-Control", "public, max-age=31536000, immutable");
+                resp->addHeader("Vary", "Accept");
+                callback(resp);
+                return;
+            }
+        }
+
         auto resp = drogon::HttpResponse::newFileResponse(filePath);
         resp->setContentTypeCode(drogon::CT_IMAGE_JPG);
         resp->addHeader("Cache-Control", "public, max-age=31536000, immutable");
+        resp->addHeader("Vary", "Accept");
         callback(resp);
     }
 
@@ -147,7 +375,7 @@ namespace blutography {
             return;
         }
 
-        auto item = *optItem;
+        auto item = optItem;
         auto b2Service = B2Service::instance();
         if (!b2Service) {
             auto resp = drogon::HttpResponse::newHttpResponse();
@@ -158,12 +386,12 @@ namespace blutography {
         }
 
         auto shared_callback = std::make_shared<std::function<void(const drogon::HttpResponsePtr&)>>(std::move(callback));
-        b2Service->download(item.fileName, [shared_callback, item](bool success, std::string&& content) {
+        b2Service->download(item->fileName, [shared_callback, item](bool success, std::string&& content) {
             if (success) {
                 auto resp = drogon::HttpResponse::newHttpResponse();
                 resp->setBody(std::move(content));
                 resp->setContentTypeCode(drogon::CT_IMAGE_JPG);
-                resp->addHeader("Content-Disposition", "inline; filename=" + item.fileName);
+                resp->addHeader("Content-Disposition", "inline; filename=" + item->fileName);
                 (*shared_callback)(resp);
             } else {
                 auto resp = drogon::HttpResponse::newHttpResponse();
@@ -174,6 +402,60 @@ namespace blutography {
         });
     }
 
+    void GalleryController::get_tile_info(const drogon::HttpRequestPtr& req, Callback_t callback, const std::string& imageId) {
+        auto optItem = GalleryStorage::instance().getItem(imageId);
+        if (!optItem || optItem->tiles.tileSize <= 0) {
+            callback(tileNotFound());
+            return;
+        }
+
+        // DZI descriptor in the JSON form OpenSeadragon accepts as a tile source
+        const auto& tiles = optItem->tiles;
+        Json::Value root;
+        root["Image"]["xmlns"] = "http://schemas.microsoft.com/deepzoom/2008";
+        root["Image"]["Url"] = "/gallery/tiles/" + optItem->id + "/";
+        root["Image"]["Format"] = "jpg";
+        root["Image"]["Overlap"] = std::to_string(tiles.overlap);
+        root["Image"]["TileSize"] = std::to_string(tiles.tileSize);
+        root["Image"]["Size"]["Width"] = std::to_string(tiles.width);
+        root["Image"]["Size"]["Height"] = std::to_string(tiles.height);
+        auto resp = drogon::HttpResponse::newHttpJsonResponse(root);
+        resp->addHeader("Cache-Control", "public, max-age=31536000, immutable");
+        callback(resp);
+    }
+
+    void GalleryController::get_tile(const drogon::HttpRequestPtr& req, Callback_t callback, const std::string& imageId,
+                                     const std::string& level, const std::string& tile) {
+        // Only "<column>_<row>[.jpg]" with numeric parts under a known item, so the path can't escape the tile tree
+        std::string name = tile;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".jpg") == 0) name.resize(name.size() - 4);
+        size_t underscore = name.find('_');
+        int levelIndex = 0, column = 0, row = 0;
+        if (underscore == std::string::npos || !parseIndex(level, levelIndex)
+            || !parseIndex(name.substr(0, underscore), column) || !parseIndex(name.substr(underscore + 1), row)) {
+            callback(tileNotFound());
+            return;
+        }
+
+        auto optItem = GalleryStorage::instance().getItem(imageId);
+        if (!optItem || optItem->tiles.tileSize <= 0 || levelIndex > optItem->tiles.maxLevel) {
+            callback(tileNotFound());
+            return;
+        }
+
+        std::string filePath = "gallery_previews/tiles/" + optItem->id + "/" + std::to_string(levelIndex) + "/"
+                               + std::to_string(column) + "_" + std::to_string(row) + ".jpg";
+        if (!std::filesystem::exists(filePath)) {
+            callback(tileNotFound());
+            return;
+        }
+
+        auto resp = drogon::HttpResponse::newFileResponse(filePath);
+        resp->setContentTypeCode(drogon::CT_IMAGE_JPG);
+        resp->addHeader("Cache-Control", "public, max-age=31536000, immutable");
+        callback(resp);
+    }
+
     void GalleryController::download_bundle(const drogon::HttpRequestPtr& req, Callback_t callback) {
         auto json = req->getJsonObject();
         if (!json || !(*json)["ids"].isArray()) {
@@ -216,15 +498,15 @@ namespace blutography {
                 continue;
             }
 
-            auto item = *optItem;
-            b2Service->download(item.fileName, [item, tempDir, filePaths, mutex, remaining, shared_callback](bool success, std::string&& content) {
+            auto item = optItem;
+            b2Service->download(item->fileName, [item, tempDir, filePaths, mutex, remaining, shared_callback](bool success, std::string&& content) {
                 if (success) {
-                    std::string path = tempDir + "/" + item.fileName;
+                    std::string path = tempDir + "/" + item->fileName;
                     std::ofstream out(path, std::ios::binary);
                     if (out) {
                         out.write(content.data(), content.size());
                         std::lock_guard<std::mutex> lock(*mutex);
-                        filePaths->push_back(item.fileName);
+                        filePaths->push_back(item->fileName);
                     }
                 }
 
@@ -1,5 +1,13 @@
 #include <drogon/drogon.h>
+#include <support/image_executor.hpp>
+#include <support/spool.hpp>
+#include <support/ingest.hpp>
+#include <support/ingest_journal.hpp>
+#include <support/gallery_storage.hpp>
+#include <support/gallery_feed.hpp>
+#include <atomic>
 #include <filesystem>
+#include <thread>
 #include <yaml-cpp/yaml.h>
 
 int main() {
@@ -36,6 +44,24 @@ int main() {
         std::filesystem::create_directory("gallery_previews");
         LOG_INFO << "Created gallery_previews directory";
     }
+    if (!std::filesystem::exists("gallery_previews/ladder")) {
+        std::filesystem::create_directory("gallery_previews/ladder");
+        LOG_INFO << "Created gallery_previews/ladder directory";
+    }
+    if (!std::filesystem::exists("gallery_previews/formats")) {
+        std::filesystem::create_directory("gallery_previews/formats");
+        LOG_INFO << "Created gallery_previews/formats directory";
+    }
+    if (!std::filesystem::exists("gallery_previews/tiles")) {
+        std::filesystem::create_directory("gallery_previews/tiles");
+        LOG_INFO << "Created gallery_previews/tiles directory";
+    }
+
+    // Spooled originals the ingest journal still refers to are resumed once the app is running
+    if (!std::filesystem::exists(blutography::SpooledFile::directory)) {
+        std::filesystem::create_directory(blutography::SpooledFile::directory);
+        LOG_INFO << "Created spool directory";
+    }
 
     try {
         drogon::app().loadConfigFile(configPath);
@@ -47,7 +73,42 @@ int main() {
         return 1;
     }
 
+    // Load the gallery now rather than inside the first request that touches it
+    try {
+        blutography::GalleryStorage::instance();
+        // And serialise it for /gallery/data, which from here on follows the storage off the IO threads
+        blutography::GalleryFeed::instance();
+    } catch (const std::exception& e) {
+        LOG_ERROR << "Failed to load the gallery: " << e.what();
+        return 1;
+    }
+
+    // Recovered before the listeners open, so no upload of this process has spooled yet: recovery
+    // deletes spool files without a journal entry. Resumed once the loops run.
+    auto unfinished = blutography::IngestJournal::instance().recover();
+    drogon::app().registerBeginningAdvice([unfinished = std::move(unfinished)]() mutable {
+        blutography::resumeJournaledIngests(std::move(unfinished));
+    });
+
+    // On SIGTERM/SIGINT, let admitted uploads finish their previews while the event loops
+    // still run their completions, then quit. The drain blocks, so it runs off the loop.
+    // B2 uploads still in flight when the loops stop are resumed from the ingest journal.
+    auto drainThenQuit = [] {
+        drogon::app().getLoop()->queueInLoop([] {
+            static std::atomic<bool> quitting{false};
+            if (quitting.exchange(true)) return;
+            std::thread([] {
+                blutography::ImageExecutor::instance().drain();
+                drogon::app().quit();
+            }).detach();
+        });
+    };
+    drogon::app().setTermSignalHandler(drainThenQuit);
+    drogon::app().setIntSignalHandler(drainThenQuit);
     drogon::app().run();
+
+    // Normally already drained by the signal handler; a no-op then
+    blutography::ImageExecutor::instance().drain();
     
     // parse shutdown_options.yaml
     if (std::filesystem::exists("shutdown_options.yaml")) {
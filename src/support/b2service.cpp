@@ -2,6 +2,7 @@
 #include <drogon/utils/Utilities.h>
 #include <json/json.h>
 #include <ctime>
+#include <algorithm>
 
 namespace blutography {
 
@@ -23,8 +24,39 @@ static void splitUrl(const std::string& url, std::string& host, std::string& pat
     }
 }
 
-B2Service::B2Service(std::string keyId, std::string applicationKey, std::string bucketName)
-    : keyId_(std::move(keyId)), applicationKey_(std::move(applicationKey)), bucketName_(std::move(bucketName)) {}
+// The JSON object of a 200 reply, or null for a failed call or a body that is not one
+static std::shared_ptr<Json::Value> replyObject(drogon::ReqResult result, const drogon::HttpResponsePtr& resp) {
+    if (result != drogon::ReqResult::Ok || !resp || resp->statusCode() != drogon::k200OK) return nullptr;
+    auto json = resp->getJsonObject();
+    return json && json->isObject() ? json : nullptr;
+}
+
+// The URL and token of a b2_get_upload_part_url reply, if it has both
+static std::optional<B2UploadData> partUrlOf(const Json::Value& reply) {
+    B2UploadData partUrl;
+    partUrl.uploadUrl = reply["uploadUrl"].asString();
+    partUrl.uploadAuthToken = reply["authorizationToken"].asString();
+    partUrl.lastUpdated = std::chrono::steady_clock::now();
+    if (partUrl.uploadUrl.empty() || partUrl.uploadAuthToken.empty()) return std::nullopt;
+    return partUrl;
+}
+
+B2Service::B2Service(std::string keyId, std::string applicationKey, std::string bucketName, B2LargeFileOptions largeFile,
+                     HttpClientPoolOptions connections, B2Transport transport)
+    : keyId_(std::move(keyId)), applicationKey_(std::move(applicationKey)), bucketName_(std::move(bucketName)),
+      largeFile_(largeFile), clients_(std::make_shared<HttpClientPool>(connections)), transport_(std::move(transport)),
+      partQueue_(std::max<size_t>(1, largeFile.concurrency), "B2PartQueue") {
+    largeFile_.concurrency = std::max<size_t>(1, largeFile_.concurrency);
+    largeFile_.partSize = std::max<size_t>(5 * 1000 * 1000, largeFile_.partSize);
+    // Below one part there is nothing to split
+    largeFile_.threshold = std::max(largeFile_.threshold, largeFile_.partSize);
+    largeFile_.partAttempts = std::max(1, largeFile_.partAttempts);
+    if (!transport_) {
+        transport_ = [clients = clients_](const std::string& host, const drogon::HttpRequestPtr& req, drogon::HttpReqCallback&& callback) {
+            clients->send(host, req, std::move(callback));
+        };
+    }
+}
 
 std::shared_ptr<B2Service> B2Service::instance() {
     auto customConfig = drogon::app().getCustomConfig();
@@ -39,51 +71,229 @@ std::shared_ptr<B2Service> B2Service::instance() {
         return nullptr;
     }
 
-    static auto service = std::make_shared<B2Service>(keyId, applicationKey, bucketName);
+    B2LargeFileOptions largeFile;
+    const auto& largeConfig = b2Config["large_file"];
+    largeFile.threshold = largeConfig.get("threshold", static_cast<Json::UInt64>(largeFile.threshold)).asUInt64();
+    largeFile.partSize = largeConfig.get("part_size", static_cast<Json::UInt64>(largeFile.partSize)).asUInt64();
+    largeFile.concurrency = largeConfig.get("concurrency", static_cast<Json::UInt64>(largeFile.concurrency)).asUInt64();
+    largeFile.partAttempts = largeConfig.get("part_attempts", largeFile.partAttempts).asInt();
+
+    HttpClientPoolOptions connections;
+    const auto& connectionConfig = b2Config["connections"];
+    connections.maxPerHost = connectionConfig.get("max_per_host", static_cast<Json::UInt64>(connections.maxPerHost)).asUInt64();
+    connections.pipelining = connectionConfig.get("pipelining", static_cast<Json::UInt64>(connections.pipelining)).asUInt64();
+    connections.idleTimeout = std::chrono::seconds(connectionConfig.get("idle_timeout", static_cast<Json::Int64>(connections.idleTimeout.count())).asInt64());
+
+    static auto service = std::make_shared<B2Service>(keyId, applicationKey, bucketName, largeFile, connections);
     return service;
 }
 
-void B2Service::upload(const std::string& fileName, std::string&& content, std::function<void(bool success, std::string fileId)>&& callback) {
+void B2Service::upload(const std::string& fileName, std::shared_ptr<const SpooledFile> content, std::function<void(bool success, std::string fileId)>&& callback) {
     auto self = shared_from_this();
-    auto sharedContent = std::make_shared<std::string>(std::move(content));
-    getAuth([self, fileName, sharedContent, callback = std::move(callback)](bool success, B2AuthResponse auth) mutable {
+    getAuth([self, fileName, content, callback = std::move(callback)](bool success, B2AuthResponse auth) mutable {
         if (!success) {
             callback(false, "");
             return;
         }
-        self->getUpload(auth, [self, auth, fileName, sharedContent, callback = std::move(callback)](bool success, B2UploadData uploadData) mutable {
-            if (!success) {
-                callback(false, "");
-                return;
-            }
-            
-            // We need a copy of the content for the first attempt because uploadFile will move it
-            // Optimization: If the file is small, copy is fine. If large, it's still safer for retry.
-            std::string contentForAttempt = *sharedContent;
-            
-            self->uploadFile(uploadData.uploadUrl, uploadData.uploadAuthToken, fileName, std::move(contentForAttempt), [self, auth, fileName, sharedContent, callback = std::move(callback)](bool success, std::string fileId) mutable {
+        if (content->size() >= self->largeFile_.threshold && content->size() > self->largeFile_.partSize) {
+            self->uploadLarge(auth, fileName, std::move(content), std::move(callback));
+            return;
+        }
+        // The body is copied out of the mapping once, on the part queue rather than the IO loop, and
+        // kept in the request so the retry resends it. The SHA-1 was computed while spooling. Above
+        // large_file.threshold the large-file API bounds each copy to one part instead.
+        self->partQueue_.runTaskInQueue([self, auth, fileName, content, callback = std::move(callback)]() mutable {
+            auto req = fileRequest(fileName, std::string(content->data()), content->sha1());
+            self->getUpload(auth, [self, auth, req, callback = std::move(callback)](bool success, B2UploadData uploadData) mutable {
                 if (!success) {
+                    callback(false, "");
+                    return;
+                }
+                self->sendFile(uploadData, req, [self, auth, req, callback = std::move(callback)](bool success, std::string fileId) mutable {
+                    if (success) {
+                        callback(true, fileId);
+                        return;
+                    }
                     LOG_WARN << "B2 Upload failed with cached URL, retrying with fresh URL...";
                     {
                         std::lock_guard<std::mutex> lock(self->mutex_);
                         self->uploadCache_.reset();
                     }
-                    self->getUpload(auth, [self, fileName, sharedContent, callback = std::move(callback)](bool success, B2UploadData uploadData) mutable {
+                    self->getUpload(auth, [self, req, callback = std::move(callback)](bool success, B2UploadData uploadData) mutable {
                         if (!success) {
                             callback(false, "");
                             return;
                         }
-                        // Second attempt: move the original shared content
-                        self->uploadFile(uploadData.uploadUrl, uploadData.uploadAuthToken, fileName, std::move(*sharedContent), std::move(callback));
+                        self->sendFile(uploadData, req, std::move(callback));
                     });
-                } else {
-                    callback(true, fileId);
+                });
+            });
+        });
+    });
+}
+
+struct B2Service::LargeUpload {
+    B2AuthResponse auth;
+    std::string fileName;
+    std::shared_ptr<const SpooledFile> content;
+    std::function<void(bool success, std::string fileId)> callback;
+    std::string fileId;
+    size_t partCount = 0;
+    std::vector<std::string> partSha1s; // filled as parts are hashed, index = part number - 1
+
+    std::mutex mutex;
+    size_t nextPart = 0;
+    size_t completed = 0;
+    size_t lanes = 0;
+    bool failed = false; // a part ran out of attempts; lanes stop taking new parts
+};
+
+void B2Service::uploadLarge(const B2AuthResponse& auth, const std::string& fileName, std::shared_ptr<const SpooledFile> content,
+                            std::function<void(bool success, std::string fileId)>&& callback) {
+    auto upload = std::make_shared<LargeUpload>();
+    upload->auth = auth;
+    upload->fileName = fileName;
+    upload->partCount = (content->size() + largeFile_.partSize - 1) / largeFile_.partSize;
+    upload->partSha1s.resize(upload->partCount);
+    upload->content = std::move(content);
+    upload->callback = std::move(callback);
+
+    Json::Value body;
+    body["bucketId"] = auth.bucketId;
+    body["fileName"] = fileName;
+    body["contentType"] = "b2/x-auto";
+    auto self = shared_from_this();
+    apiCall(auth, "b2_start_large_file", body, [self, upload](bool success, Json::Value reply) {
+        if (success) upload->fileId = reply["fileId"].asString();
+        if (upload->fileId.empty()) {
+            upload->callback(false, "");
+            return;
+        }
+        size_t lanes = std::min(self->largeFile_.concurrency, upload->partCount);
+        LOG_INFO << "B2 large file " << upload->fileName << ": " << upload->partCount << " parts over " << lanes << " connections";
+        {
+            std::lock_guard<std::mutex> lock(upload->mutex);
+            upload->lanes = lanes;
+        }
+        for (size_t i = 0; i < lanes; ++i) self->startPartLane(upload);
+    });
+}
+
+void B2Service::startPartLane(std::shared_ptr<LargeUpload> upload) {
+    Json::Value body;
+    body["fileId"] = upload->fileId;
+    auto self = shared_from_this();
+    apiCall(upload->auth, "b2_get_upload_part_url", body, [self, upload](bool success, Json::Value reply) {
+        auto partUrl = success ? partUrlOf(reply) : std::nullopt;
+        if (!partUrl) {
+            // The other lanes carry on; the upload is cancelled if none of them finishes the parts
+            self->endPartLane(upload);
+            return;
+        }
+        self->uploadNextPart(upload, std::move(*partUrl));
+    });
+}
+
+void B2Service::uploadNextPart(std::shared_ptr<LargeUpload> upload, B2UploadData partUrl) {
+    size_t index;
+    {
+        std::lock_guard<std::mutex> lock(upload->mutex);
+        if (upload->failed || upload->nextPart >= upload->partCount) index = upload->partCount;
+        else index = upload->nextPart++;
+    }
+    if (index == upload->partCount) {
+        endPartLane(upload);
+        return;
+    }
+    uploadPart(std::move(upload), std::move(partUrl), index, 1);
+}
+
+void B2Service::uploadPart(std::shared_ptr<LargeUpload> upload, B2UploadData partUrl, size_t index, int attempt) {
+    auto self = shared_from_this();
+    // Hashing a part and copying it into the request body are the expensive steps; they run on
+    // the part queue, so every lane's part is hashed in parallel and the IO loops never block
+    partQueue_.runTaskInQueue([self, upload, partUrl = std::move(partUrl), index, attempt]() mutable {
+        size_t offset = index * self->largeFile_.partSize;
+        std::string_view part = upload->content->data().substr(offset, self->largeFile_.partSize);
+        if (upload->partSha1s[index].empty()) upload->partSha1s[index] = drogon::utils::getSha1(part.data(), part.size());
+
+        std::string host, path;
+        splitUrl(partUrl.uploadUrl, host, path);
+        auto req = drogon::HttpRequest::newHttpRequest();
+        req->setPath(path);
+        req->setMethod(drogon::Post);
+        req->addHeader("Authorization", partUrl.uploadAuthToken);
+        req->addHeader("X-Bz-Part-Number", std::to_string(index + 1));
+        req->addHeader("X-Bz-Content-Sha1", upload->partSha1s[index]);
+        req->setBody(std::string(part));
+
+        self->send(host, req, [self, upload, partUrl, index, attempt](drogon::ReqResult result, const drogon::HttpResponsePtr& resp) mutable {
+            if (result == drogon::ReqResult::Ok && resp && resp->statusCode() == drogon::k200OK) {
+                {
+                    std::lock_guard<std::mutex> lock(upload->mutex);
+                    ++upload->completed;
                 }
+                self->uploadNextPart(upload, std::move(partUrl));
+                return;
+            }
+
+            LOG_WARN << "B2 part " << index + 1 << "/" << upload->partCount << " of " << upload->fileName << " failed (attempt "
+                     << attempt << "): " << (resp ? std::string(resp->body()) : "No response");
+            if (attempt >= self->largeFile_.partAttempts) {
+                {
+                    std::lock_guard<std::mutex> lock(upload->mutex);
+                    upload->failed = true;
+                }
+                self->endPartLane(upload);
+                return;
+            }
+
+            // A failed part URL must not be reused; this part retries alone on a fresh one
+            Json::Value body;
+            body["fileId"] = upload->fileId;
+            self->apiCall(upload->auth, "b2_get_upload_part_url", body, [self, upload, index, attempt](bool success, Json::Value reply) {
+                auto freshUrl = success ? partUrlOf(reply) : std::nullopt;
+                if (!freshUrl) {
+                    {
+                        std::lock_guard<std::mutex> lock(upload->mutex);
+                        upload->failed = true;
+                    }
+                    self->endPartLane(upload);
+                    return;
+                }
+                self->uploadPart(upload, std::move(*freshUrl), index, attempt + 1);
             });
         });
     });
 }
 
+void B2Service::endPartLane(std::shared_ptr<LargeUpload> upload) {
+    bool complete;
+    {
+        std::lock_guard<std::mutex> lock(upload->mutex);
+        if (--upload->lanes > 0) return;
+        complete = !upload->failed && upload->completed == upload->partCount;
+    }
+
+    Json::Value body;
+    body["fileId"] = upload->fileId;
+    if (!complete) {
+        LOG_ERROR << "B2 large file upload of " << upload->fileName << " failed after " << upload->completed << "/"
+                  << upload->partCount << " parts, cancelling";
+        apiCall(upload->auth, "b2_cancel_large_file", body, [upload](bool, Json::Value) {
+            upload->callback(false, "");
+        });
+        return;
+    }
+
+    body["partSha1Array"] = Json::Value(Json::arrayValue);
+    for (const auto& sha1 : upload->partSha1s) body["partSha1Array"].append(sha1);
+    apiCall(upload->auth, "b2_finish_large_file", body, [upload](bool success, Json::Value reply) {
+        std::string fileId = success ? reply["fileId"].asString() : "";
+        upload->callback(!fileId.empty(), fileId);
+    });
+}
+
 void B2Service::download(const std::string& fileName, std::function<void(bool success, std::string&& content)>&& callback) {
     auto self = shared_from_this();
     getAuth([self, fileName, callback = std::move(callback)](bool success, B2AuthResponse auth) mutable {
@@ -96,14 +306,13 @@ void B2Service::download(const std::string& fileName, std::function<void(bool su
         std::string host, path;
         splitUrl(downloadUrl, host, path);
 
-        auto client = drogon::HttpClient::newHttpClient(host);
         auto req = drogon::HttpRequest::newHttpRequest();
         req->setPath(path);
         req->setMethod(drogon::Get);
         req->addHeader("Authorization", auth.authorizationToken);
 
-        client->sendRequest(req, [callback = std::move(callback)](drogon::ReqResult result, const drogon::HttpResponsePtr& resp) mutable {
-            if (result == drogon::ReqResult::Ok && resp->statusCode() == drogon::k200OK) {
+        self->send(host, req, [callback = std::move(callback)](drogon::ReqResult result, const drogon::HttpResponsePtr& resp) mutable {
+            if (result == drogon::ReqResult::Ok && resp && resp->statusCode() == drogon::k200OK) {
                 std::string body(resp->body().data(), resp->body().size());
                 callback(true, std::move(body));
             } else {
@@ -204,7 +413,6 @@ void B2Service::runTestSequence(std::function<void(bool success, std::string mes
 }
 
 void B2Service::authorize(std::function<void(bool success, B2AuthResponse auth)>&& callback) {
-    auto client = drogon::HttpClient::newHttpClient("https://api.backblazeb2.com");
     auto req = drogon::HttpRequest::newHttpRequest();
     req->setPath("/b2api/v2/b2_authorize_account");
     req->setMethod(drogon::Get);
@@ -212,20 +420,15 @@ void B2Service::authorize(std::function<void(bool success, B2AuthResponse auth)>
     std::string authStr = keyId_ + ":" + applicationKey_;
     req->addHeader("Authorization", "Basic " + drogon::utils::base64Encode((const unsigned char*)authStr.data(), authStr.size()));
 
-    client->sendRequest(req, [callback = std::move(callback)](drogon::ReqResult result, const drogon::HttpResponsePtr &resp) {
-        if (result != drogon::ReqResult::Ok || !resp || resp->statusCode() != drogon::k200OK) {
+    send("https://api.backblazeb2.com", req, [callback = std::move(callback)](drogon::ReqResult result, const drogon::HttpResponsePtr &resp) {
+        auto json = replyObject(result, resp);
+        if (!json) {
             LOG_ERROR << "B2 Auth Error: " << (resp ? std::to_string(resp->statusCode()) : "No response");
             if (resp) LOG_ERROR << "Body: " << resp->body();
             callback(false, {});
             return;
         }
 
-        auto json = resp->getJsonObject();
-        if (!json) {
-            callback(false, {});
-            return;
-        }
-
         B2AuthResponse auth;
         auth.accountId = (*json)["accountId"].asString();
         auth.apiUrl = (*json)["apiUrl"].asString();
@@ -237,7 +440,6 @@ void B2Service::authorize(std::function<void(bool success, B2AuthResponse auth)>
 }
 
 void B2Service::getUploadUrl(const B2AuthResponse& auth, std::function<void(bool success, std::string uploadUrl, std::string uploadAuthToken)>&& callback) {
-    auto client = drogon::HttpClient::newHttpClient(auth.apiUrl);
     Json::Value body;
     body["bucketId"] = auth.bucketId;
     auto req = drogon::HttpRequest::newHttpJsonRequest(body);
@@ -245,43 +447,77 @@ void B2Service::getUploadUrl(const B2AuthResponse& auth, std::function<void(bool
     req->setMethod(drogon::Post);
     req->addHeader("Authorization", auth.authorizationToken);
 
-    client->sendRequest(req, [callback = std::move(callback)](drogon::ReqResult result, const drogon::HttpResponsePtr &resp) {
-        if (result != drogon::ReqResult::Ok || !resp || resp->statusCode() != drogon::k200OK) {
+    send(auth.apiUrl, req, [callback = std::move(callback)](drogon::ReqResult result, const drogon::HttpResponsePtr &resp) {
+        auto json = replyObject(result, resp);
+        std::string uploadUrl = json ? (*json)["uploadUrl"].asString() : "";
+        std::string uploadAuthToken = json ? (*json)["authorizationToken"].asString() : "";
+        if (uploadUrl.empty() || uploadAuthToken.empty()) {
             LOG_ERROR << "B2 GetUploadUrl Error: " << (resp ? resp->body() : "No response");
             callback(false, "", "");
             return;
         }
-        auto json = resp->getJsonObject();
-        callback(true, (*json)["uploadUrl"].asString(), (*json)["authorizationToken"].asString());
+        callback(true, std::move(uploadUrl), std::move(uploadAuthToken));
     });
 }
 
-void B2Service::uploadFile(const std::string& uploadUrl, const std::string& uploadAuthToken, const std::string& fileName, std::string&& content, std::function<void(bool success, std::string fileId)>&& callback) {
-    std::string host, path;
-    splitUrl(uploadUrl, host, path);
-    auto client = drogon::HttpClient::newHttpClient(host);
+drogon::HttpRequestPtr B2Service::fileRequest(const std::string& fileName, std::string&& content, std::string contentSha1) {
     auto req = drogon::HttpRequest::newHttpRequest();
-    req->setPath(path);
     req->setMethod(drogon::Post);
-    req->addHeader("Authorization", uploadAuthToken);
     req->addHeader("X-Bz-File-Name", drogon::utils::urlEncode(fileName));
     req->addHeader("Content-Type", "b2/x-auto");
-    req->addHeader("X-Bz-Content-Sha1", drogon::utils::getSha1(content));
+    req->addHeader("X-Bz-Content-Sha1", contentSha1.empty() ? drogon::utils::getSha1(content) : contentSha1);
     req->setBody(std::move(content));
+    return req;
+}
 
-    client->sendRequest(req, [callback = std::move(callback)](drogon::ReqResult result, const drogon::HttpResponsePtr &resp) {
-        if (result != drogon::ReqResult::Ok || !resp || resp->statusCode() != drogon::k200OK) {
+void B2Service::sendFile(const B2UploadData& uploadData, const drogon::HttpRequestPtr& req, std::function<void(bool success, std::string fileId)>&& callback) {
+    std::string host, path;
+    splitUrl(uploadData.uploadUrl, host, path);
+    req->setPath(path);
+    req->addHeader("Authorization", uploadData.uploadAuthToken);
+
+    send(host, req, [callback = std::move(callback)](drogon::ReqResult result, const drogon::HttpResponsePtr &resp) {
+        auto json = replyObject(result, resp);
+        std::string fileId = json ? (*json)["fileId"].asString() : "";
+        if (fileId.empty()) {
             LOG_ERROR << "B2 Upload Error: " << (resp ? resp->body() : "No response");
             callback(false, "");
             return;
         }
-        auto json = resp->getJsonObject();
-        callback(true, (*json)["fileId"].asString());
+        callback(true, std::move(fileId));
+    });
+}
+
+void B2Service::uploadFile(const std::string& uploadUrl, const std::string& uploadAuthToken, const std::string& fileName, std::string&& content, std::function<void(bool success, std::string fileId)>&& callback, std::string contentSha1) {
+    B2UploadData uploadData;
+    uploadData.uploadUrl = uploadUrl;
+    uploadData.uploadAuthToken = uploadAuthToken;
+    sendFile(uploadData, fileRequest(fileName, std::move(content), std::move(contentSha1)), std::move(callback));
+}
+
+void B2Service::apiCall(const B2AuthResponse& auth, const std::string& call, const Json::Value& body,
+                        std::function<void(bool success, Json::Value reply)>&& callback) {
+    auto req = drogon::HttpRequest::newHttpJsonRequest(body);
+    req->setPath("/b2api/v2/" + call);
+    req->setMethod(drogon::Post);
+    req->addHeader("Authorization", auth.authorizationToken);
+
+    send(auth.apiUrl, req, [call, callback = std::move(callback)](drogon::ReqResult result, const drogon::HttpResponsePtr &resp) {
+        auto json = replyObject(result, resp);
+        if (!json) {
+            LOG_ERROR << "B2 " << call << " Error: " << (resp ? resp->body() : "No response");
+            callback(false, Json::Value());
+            return;
+        }
+        callback(true, *json);
     });
 }
 
+void B2Service::send(const std::string& host, const drogon::HttpRequestPtr& req, drogon::HttpReqCallback&& callback) {
+    transport_(host, req, std::move(callback));
+}
+
 void B2Service::deleteFile(const B2AuthResponse& auth, const std::string& fileName, const std::string& fileId, std::function<void(bool success)>&& callback) {
-    auto client = drogon::HttpClient::newHttpClient(auth.apiUrl);
     Json::Value body;
     body["fileName"] = fileName;
     body["fileId"] = fileId;
@@ -290,7 +526,7 @@ void B2Service::deleteFile(const B2AuthResponse& auth, const std::string& fileNa
     req->setMethod(drogon::Post);
     req->addHeader("Authorization", auth.authorizationToken);
 
-    client->sendRequest(req, [callback = std::move(callback)](drogon::ReqResult result, const drogon::HttpResponsePtr &resp) {
+    send(auth.apiUrl, req, [callback = std::move(callback)](drogon::ReqResult result, const drogon::HttpResponsePtr &resp) {
         if (result != drogon::ReqResult::Ok || !resp || resp->statusCode() != drogon::k200OK) {
             LOG_ERROR << "B2 Delete Error: " << (resp ? resp->body() : "No response");
             callback(false);
@@ -0,0 +1,54 @@
+#include <support/durable.hpp>
+#include <drogon/drogon.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace blutography {
+
+bool syncDirectory(const std::string& directory) {
+    int fd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+bool writeFileAtomically(const std::string& path, std::string_view data) {
+    std::string temp = path + ".tmp";
+    int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOG_ERROR << "Failed to create " << temp << ": " << std::strerror(errno);
+        return false;
+    }
+
+    bool ok = true;
+    const char* cursor = data.data();
+    size_t left = data.size();
+    while (ok && left > 0) {
+        ssize_t written = ::write(fd, cursor, left);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            ok = false;
+        } else {
+            cursor += written;
+            left -= static_cast<size_t>(written);
+        }
+    }
+    ok = ok && ::fsync(fd) == 0;
+    ok = (::close(fd) == 0) && ok;
+    ok = ok && std::rename(temp.c_str(), path.c_str()) == 0;
+    if (!ok) {
+        LOG_ERROR << "Failed to write " << path << ": " << std::strerror(errno);
+        ::unlink(temp.c_str());
+        return false;
+    }
+
+    size_t slash = path.find_last_of('/');
+    syncDirectory(slash == std::string::npos ? "." : path.substr(0, slash));
+    return true;
+}
+
+}
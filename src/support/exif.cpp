@@ -0,0 +1,424 @@
+#include <support/exif.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace blutography::image::exif {
+
+namespace {
+    enum class Ifd : uint8_t { Primary, Exif, Gps, Interop };
+
+    // What to do with a tag when it is seen in a given IFD.
+    enum class Action : uint8_t {
+        Emit,        // decode into `field`
+        GpsRef,      // N/S or E/W reference for a GPS coordinate
+        EnterExif,   // pointer to the Exif sub-IFD
+        EnterGps,    // pointer to the GPS sub-IFD
+    };
+
+    struct TagSpec {
+        Ifd ifd;
+        uint16_t tag;
+        Action action;
+        Field field;
+    };
+
+    constexpr std::array<TagSpec, 15> kTags = {{
+        {Ifd::Primary, 0x0110, Action::Emit, Model},
+        {Ifd::Primary, 0x0112, Action::Emit, Orientation},
+        {Ifd::Primary, 0x8769, Action::EnterExif, Field{}},
+        {Ifd::Primary, 0x8825, Action::EnterGps, GpsPosition},
+        {Ifd::Exif, 0x829A, Action::Emit, ExposureTime},
+        {Ifd::Exif, 0x829D, Action::Emit, FNumber},
+        {Ifd::Exif, 0x8827, Action::Emit, Iso},
+        {Ifd::Exif, 0x9003, Action::Emit, DateTimeOriginal},
+        {Ifd::Exif, 0x920A, Action::Emit, FocalLength},
+        {Ifd::Exif, 0x9291, Action::Emit, SubSecTimeOriginal},
+        {Ifd::Exif, 0xA434, Action::Emit, LensModel},
+        {Ifd::Gps, 0x0001, Action::GpsRef, GpsPosition},
+        {Ifd::Gps, 0x0002, Action::Emit, GpsPosition},
+        {Ifd::Gps, 0x0003, Action::GpsRef, GpsPosition},
+        {Ifd::Gps, 0x0004, Action::Emit, GpsPosition},
+    }};
+
+    constexpr bool tagLess(const TagSpec& a, const TagSpec& b) {
+        return a.ifd != b.ifd ? a.ifd < b.ifd : a.tag < b.tag;
+    }
+
+    static_assert(std::is_sorted(kTags.begin(), kTags.end(), tagLess), "kTags must be sorted by (ifd, tag)");
+
+    constexpr const TagSpec* findTag(Ifd ifd, uint16_t tag) {
+        TagSpec key{ifd, tag, Action::Emit, Field{}};
+        auto it = std::lower_bound(kTags.begin(), kTags.end(), key, tagLess);
+        return (it != kTags.end() && it->ifd == ifd && it->tag == tag) ? &*it : nullptr;
+    }
+
+    // Fields that can only be found by descending into the given sub-IFD.
+    constexpr FieldMask fieldsIn(Ifd ifd) {
+        FieldMask mask = 0;
+        for (const auto& spec : kTags) {
+            if (spec.ifd == ifd && spec.action != Action::EnterExif && spec.action != Action::EnterGps) mask |= spec.field;
+        }
+        return mask;
+    }
+
+    static_assert(findTag(Ifd::Exif, 0x8827) != nullptr && findTag(Ifd::Exif, 0x0110) == nullptr);
+
+    constexpr int kMaxDepth = 4;
+
+    uint16_t read16(const unsigned char* data, bool isLittleEndian) {
+        if (isLittleEndian) return data[0] | (data[1] << 8);
+        return (data[0] << 8) | data[1];
+    }
+
+    uint32_t read32(const unsigned char* data, bool isLittleEndian) {
+        if (isLittleEndian) return data[0] | (data[1] << 8) | (data[2] << 16) | (data[3] << 24);
+        return (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+    }
+
+    void write16(std::string& out, size_t pos, uint16_t value, bool isLittleEndian) {
+        out[pos] = static_cast<char>(isLittleEndian ? value & 0xFF : value >> 8);
+        out[pos + 1] = static_cast<char>(isLittleEndian ? value >> 8 : value & 0xFF);
+    }
+
+    void write32(std::string& out, size_t pos, uint32_t value, bool isLittleEndian) {
+        for (int i = 0; i < 4; ++i) {
+            int shift = isLittleEndian ? 8 * i : 8 * (3 - i);
+            out[pos + i] = static_cast<char>((value >> shift) & 0xFF);
+        }
+    }
+
+    uint32_t typeSize(uint16_t type) {
+        switch (type) {
+            case 1: case 2: case 6: case 7: return 1;   // BYTE, ASCII, SBYTE, UNDEFINED
+            case 3: case 8: return 2;                   // SHORT, SSHORT
+            case 4: case 9: case 11: case 13: return 4; // LONG, SLONG, FLOAT, IFD
+            case 5: case 10: case 12: return 8;         // RATIONAL, SRATIONAL, DOUBLE
+            default: return 0;
+        }
+    }
+
+    std::string formatDecimal(double value) {
+        char buf[32];
+        if (std::fabs(value - std::round(value)) < 0.05) std::snprintf(buf, sizeof(buf), "%.0f", value);
+        else std::snprintf(buf, sizeof(buf), "%.1f", value);
+        return buf;
+    }
+
+    // A parsed IFD entry. `value` views the inline field or the out-of-line data.
+    struct Entry {
+        uint16_t tag;
+        uint16_t type;
+        uint32_t count;
+        std::string_view value;
+    };
+
+    class Parser {
+    public:
+        Parser(std::string_view tiff, Metadata& meta, FieldMask wanted)
+            : base_(reinterpret_cast<const unsigned char*>(tiff.data())), size_(tiff.size()), meta_(meta), wanted_(wanted) {}
+
+        FieldMask run() {
+            if (size_ < 8 || (base_[0] != 'I' && base_[0] != 'M')) return 0;
+            le_ = base_[0] == 'I';
+            walk(Ifd::Primary, read32(base_ + 4, le_), 0);
+            return found_;
+        }
+
+    private:
+        const unsigned char* base_;
+        size_t size_;
+        Metadata& meta_;
+        FieldMask wanted_;
+        FieldMask found_ = 0;
+        bool le_ = true;
+
+        double latitude_ = 0, longitude_ = 0;
+        double latitudeSign_ = 1, longitudeSign_ = 1;
+        bool latitudeSet_ = false, longitudeSet_ = false;
+
+        bool done() const { return (found_ & wanted_) == wanted_; }
+
+        // The position counts as found once both coordinates are in, so the walk can stop
+        // there. The references sort before their coordinates and are applied again if late.
+        void settleGps() {
+            if (!latitudeSet_ || !longitudeSet_) return;
+            meta_.hasGps = true;
+            meta_.latitude = latitude_ * latitudeSign_;
+            meta_.longitude = longitude_ * longitudeSign_;
+            found_ |= GpsPosition;
+        }
+
+        std::string_view text(const Entry& e) const {
+            std::string_view v = e.value;
+            while (!v.empty() && (v.back() == '\0' || v.back() == ' ')) v.remove_suffix(1);
+            return v;
+        }
+
+        bool rational(const Entry& e, size_t index, double& out) const {
+            if ((e.type != 5 && e.type != 10) || e.value.size() < (index + 1) * 8) return false;
+            const auto* p = reinterpret_cast<const unsigned char*>(e.value.data()) + index * 8;
+            uint32_t num = read32(p, le_), den = read32(p + 4, le_);
+            if (den == 0) return false;
+            out = e.type == 10 ? static_cast<double>(static_cast<int32_t>(num)) / static_cast<int32_t>(den)
+                               : static_cast<double>(num) / den;
+            return true;
+        }
+
+        bool integer(const Entry& e, uint32_t& out) const {
+            if (e.type == 3 && e.value.size() >= 2) { out = read16(reinterpret_cast<const unsigned char*>(e.value.data()), le_); return true; }
+            if (e.type == 4 && e.value.size() >= 4) { out = read32(reinterpret_cast<const unsigned char*>(e.value.data()), le_); return true; }
+            return false;
+        }
+
+        double coordinate(const Entry& e) const {
+            double deg = 0, min = 0, sec = 0;
+            rational(e, 0, deg);
+            rational(e, 1, min);
+            rational(e, 2, sec);
+            return deg + min / 60.0 + sec / 3600.0;
+        }
+
+        void emit(Field field, const Entry& e) {
+            switch (field) {
+                case Model:
+                    if (e.type == 2) { meta_.model.assign(text(e)); found_ |= Model; }
+                    break;
+                case LensModel:
+                    if (e.type == 2) { meta_.lensModel.assign(text(e)); found_ |= LensModel; }
+                    break;
+                case DateTimeOriginal:
+                    if (e.type == 2) { meta_.dateTime.assign(text(e)); found_ |= DateTimeOriginal; }
+                    break;
+                case SubSecTimeOriginal:
+                    if (e.type == 2) { meta_.subSecTime.assign(text(e)); found_ |= SubSecTimeOriginal; }
+                    break;
+                case Orientation: {
+                    uint32_t v;
+                    if (integer(e, v) && v >= 1 && v <= 8) { meta_.orientation = static_cast<int>(v); found_ |= Orientation; }
+                    break;
+                }
+                case Iso: {
+                    uint32_t v;
+                    if (integer(e, v)) { meta_.iso = std::to_string(v); found_ |= Iso; }
+                    break;
+                }
+                case ExposureTime: {
+                    if (e.type != 5 || e.value.size() < 8) break;
+                    const auto* p = reinterpret_cast<const unsigned char*>(e.value.data());
+                    uint32_t num = read32(p, le_), den = read32(p + 4, le_);
+                    if (num == 1 && den > 1) meta_.exposure = "1/" + std::to_string(den);
+                    else if (den > 0) meta_.exposure = std::to_string((float)num/den) + "s";
+                    else break;
+                    found_ |= ExposureTime;
+                    break;
+                }
+                case FNumber: {
+                    double v;
+                    if (rational(e, 0, v) && v > 0) { meta_.aperture = "f/" + formatDecimal(v); found_ |= FNumber; }
+                    break;
+                }
+                case FocalLength: {
+                    double v;
+                    if (rational(e, 0, v) && v > 0) { meta_.focalLength = formatDecimal(v) + "mm"; found_ |= FocalLength; }
+                    break;
+                }
+                case GpsPosition:
+                    if (e.tag == 0x0002) { latitude_ = coordinate(e); latitudeSet_ = true; }
+                    else if (e.tag == 0x0004) { longitude_ = coordinate(e); longitudeSet_ = true; }
+                    settleGps();
+                    break;
+            }
+        }
+
+        void walk(Ifd ifd, uint32_t offset, int depth) {
+            if (depth > kMaxDepth || offset < 8 || static_cast<size_t>(offset) + 2 > size_) return;
+            uint16_t count = read16(base_ + offset, le_);
+            for (uint16_t i = 0; i < count && !done(); ++i) {
+                size_t pos = offset + 2 + static_cast<size_t>(i) * 12;
+                if (pos + 12 > size_) return;
+
+                uint16_t tag = read16(base_ + pos, le_);
+                const TagSpec* spec = findTag(ifd, tag);
+                if (!spec) continue;
+
+                Entry e{tag, read16(base_ + pos + 2, le_), read32(base_ + pos + 4, le_), {}};
+                uint64_t bytes = static_cast<uint64_t>(typeSize(e.type)) * e.count;
+                if (bytes <= 4) {
+                    e.value = std::string_view(reinterpret_cast<const char*>(base_ + pos + 8), bytes);
+                } else {
+                    uint32_t valueOffset = read32(base_ + pos + 8, le_);
+                    if (static_cast<uint64_t>(valueOffset) + bytes > size_) continue;
+                    e.value = std::string_view(reinterpret_cast<const char*>(base_ + valueOffset), bytes);
+                }
+
+                switch (spec->action) {
+                    case Action::Emit:
+                        if (wanted_ & spec->field) emit(spec->field, e);
+                        break;
+                    case Action::GpsRef:
+                        if ((wanted_ & GpsPosition) && !e.value.empty()) {
+                            char ref = e.value[0];
+                            if (ref == 'S') latitudeSign_ = -1;
+                            if (ref == 'W') longitudeSign_ = -1;
+                            settleGps();
+                        }
+                        break;
+                    case Action::EnterExif:
+                        if ((wanted_ & ~found_) & fieldsIn(Ifd::Exif)) walk(Ifd::Exif, read32(base_ + pos + 8, le_), depth + 1);
+                        break;
+                    case Action::EnterGps:
+                        if ((wanted_ & ~found_) & fieldsIn(Ifd::Gps)) walk(Ifd::Gps, read32(base_ + pos + 8, le_), depth + 1);
+                        break;
+                }
+            }
+        }
+    };
+
+    // Rebuilds IFD0 and its Exif/GPS/Interop sub-IFDs, repacking out-of-line values
+    // after each IFD. IFD1 (the thumbnail) and the MakerNote are not carried over.
+    // Exif and GPS are followed only from IFD0 and Interop only from Exif, each IFD is
+    // written at most once, and the output may not outgrow the input, so pointers that
+    // loop or share values cannot inflate the segment.
+    struct Rewriter {
+        const unsigned char* base;
+        size_t size;
+        bool le;
+        bool resetOrientation;
+        bool swapDimensions;
+        std::string out;
+        std::vector<uint32_t> visited;
+        bool overflow = false;
+
+        static bool pointerFollowed(Ifd ifd, uint16_t tag) {
+            if (tag == 0x8769 || tag == 0x8825) return ifd == Ifd::Primary;
+            if (tag == 0xA005) return ifd == Ifd::Exif;
+            return false;
+        }
+
+        static bool isPointer(uint16_t tag) { return tag == 0x8769 || tag == 0x8825 || tag == 0xA005; }
+
+        bool grew() {
+            if (out.size() > size) overflow = true;
+            return overflow;
+        }
+
+        uint32_t writeIfd(uint32_t offset, Ifd ifd) {
+            if (overflow || offset < 8 || static_cast<size_t>(offset) + 2 > size) return 0;
+            if (std::find(visited.begin(), visited.end(), offset) != visited.end()) return 0;
+            visited.push_back(offset);
+            uint16_t count = read16(base + offset, le);
+            if (static_cast<size_t>(offset) + 2 + static_cast<size_t>(count) * 12 > size) return 0;
+
+            std::vector<uint32_t> kept;
+            kept.reserve(count);
+            for (uint16_t i = 0; i < count; ++i) {
+                uint32_t entry = offset + 2 + i * 12;
+                uint16_t tag = read16(base + entry, le);
+                if (tag == 0x927C) continue; // MakerNote
+                if (tag == 0x0201 || tag == 0x0202) continue; // JPEGInterchangeFormat(Length): thumbnail
+                if (isPointer(tag) && !pointerFollowed(ifd, tag)) continue; // a sub-IFD pointer out of place
+                kept.push_back(entry);
+            }
+
+            uint32_t ifdPos = static_cast<uint32_t>(out.size());
+            out.append(2 + kept.size() * 12 + 4, '\0');
+            if (grew()) return 0;
+            write16(out, ifdPos, static_cast<uint16_t>(kept.size()), le);
+
+            size_t xPos = 0, yPos = 0;
+            for (size_t i = 0; i < kept.size(); ++i) {
+                uint32_t entry = kept[i];
+                size_t dst = ifdPos + 2 + i * 12;
+                out.replace(dst, 12, reinterpret_cast<const char*>(base + entry), 12);
+
+                uint16_t tag = read16(base + entry, le);
+                uint16_t type = read16(base + entry + 2, le);
+                uint32_t n = read32(base + entry + 4, le);
+                uint32_t valueOffset = read32(base + entry + 8, le);
+
+                if (tag == 0xA002) xPos = dst + 2;
+                if (tag == 0xA003) yPos = dst + 2;
+
+                if (isPointer(tag)) {
+                    Ifd sub = tag == 0x8769 ? Ifd::Exif : tag == 0x8825 ? Ifd::Gps : Ifd::Interop;
+                    write32(out, dst + 8, writeIfd(valueOffset, sub), le);
+                    if (overflow) return 0;
+                    continue;
+                }
+                if (tag == 0x0112 && resetOrientation && type == 3) {
+                    write16(out, dst + 8, 1, le);
+                    continue;
+                }
+
+                uint64_t bytes = static_cast<uint64_t>(typeSize(type)) * n;
+                if (bytes > 4) {
+                    if (static_cast<uint64_t>(valueOffset) + bytes > size) {
+                        write32(out, dst + 4, 0, le); // drop a value we cannot copy
+                        continue;
+                    }
+                    if (out.size() % 2) out.push_back('\0');
+                    write32(out, dst + 8, static_cast<uint32_t>(out.size()), le);
+                    out.append(reinterpret_cast<const char*>(base + valueOffset), bytes);
+                    if (grew()) return 0;
+                }
+            }
+
+            // PixelXDimension/PixelYDimension follow the pixels through a 90 degree rotation. Either
+            // may be SHORT or LONG, so the type moves with the count and value; the tags stay put
+            if (swapDimensions && xPos && yPos) {
+                std::string x = out.substr(xPos, 10);
+                out.replace(xPos, 10, out, yPos, 10);
+                out.replace(yPos, 10, x);
+            }
+            return ifdPos; // next-IFD offset stays 0: IFD1 is not carried over
+        }
+    };
+}
+
+std::string_view payload(std::string_view segment) {
+    if (segment.size() > 10 && (unsigned char)segment[1] == 0xE1 && std::memcmp(segment.data() + 4, "Exif\0\0", 6) == 0) {
+        return segment.substr(10);
+    }
+    return {};
+}
+
+FieldMask parse(std::string_view tiff, Metadata& meta, FieldMask wanted) {
+    return Parser(tiff, meta, wanted).run();
+}
+
+std::string sanitize(std::string_view segment, bool resetOrientation, bool swapDimensions) {
+    std::string_view tiff = payload(segment);
+    if (tiff.size() < 8) return {};
+
+    Rewriter rewrite;
+    rewrite.base = reinterpret_cast<const unsigned char*>(tiff.data());
+    rewrite.size = tiff.size();
+    rewrite.le = rewrite.base[0] == 'I';
+    rewrite.resetOrientation = resetOrientation;
+    rewrite.swapDimensions = swapDimensions;
+
+    rewrite.out.reserve(tiff.size());
+    rewrite.out.append(tiff.data(), 4); // byte order + magic
+    rewrite.out.append(4, '\0');
+    uint32_t ifd0 = rewrite.writeIfd(read32(rewrite.base + 4, rewrite.le), Ifd::Primary);
+    if (ifd0 == 0 || rewrite.overflow) return {};
+    write32(rewrite.out, 4, ifd0, rewrite.le);
+
+    size_t length = 2 + 6 + rewrite.out.size();
+    if (length > 0xFFFF) return {};
+    std::string result;
+    result.reserve(2 + length);
+    result.push_back(static_cast<char>(0xFF));
+    result.push_back(static_cast<char>(0xE1));
+    result.push_back(static_cast<char>(length >> 8));
+    result.push_back(static_cast<char>(length & 0xFF));
+    result.append("Exif\0\0", 6);
+    result.append(rewrite.out);
+    return result;
+}
+
+}
@@ -0,0 +1,426 @@
+#include <support/gallery_feed.hpp>
+#include <drogon/drogon.h>
+#include <drogon/utils/Utilities.h>
+#include <json/json.h>
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#ifdef BLUTOGRAPHY_HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+namespace blutography {
+
+enum FeedField : size_t {
+    Id, Name, Quote, FileName, PreviewName, PreviewUrl, ImageUrl,
+    Placeholder, DominantColor, Metadata, Variants, Srcset, Sources, TilesUrl
+};
+
+constexpr uint32_t allFields = (1u << GalleryFeed::fieldNames.size()) - 1;
+
+// Bodies smaller than this go out as they are; compressing them saves less than the header costs
+constexpr size_t minCompressedBody = 1024;
+
+// Bodies are compressed once per gallery version, so a higher level than on-the-fly compression is affordable;
+// 11 takes seconds on a large gallery for a few percent more
+constexpr int brotliQuality = 9;
+
+static std::string brotliCompress(const std::string& data) {
+#ifdef BLUTOGRAPHY_HAVE_BROTLI
+    size_t size = BrotliEncoderMaxCompressedSize(data.size());
+    std::string out(size, '\0');
+    if (!BrotliEncoderCompress(brotliQuality, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, data.size(),
+                               reinterpret_cast<const uint8_t*>(data.data()), &size, reinterpret_cast<uint8_t*>(out.data()))) {
+        return {};
+    }
+    out.resize(size);
+    return out;
+#else
+    (void)data;
+    return {};
+#endif
+}
+
+GalleryFeed& GalleryFeed::instance() {
+    static GalleryFeed inst(GalleryStorage::instance());
+    return inst;
+}
+
+// The positions [begin, end) of `query`'s page in `snapshot`; false if its cursor is not an item id
+static bool pageOf(const GallerySnapshot& snapshot, const FeedQuery& query, size_t& begin, size_t& end) {
+    begin = 0;
+    if (!query.after.empty()) {
+        const size_t* after = snapshot.byId.find(query.after);
+        if (!after) return false;
+        begin = *after + 1;
+    }
+    end = query.limit ? std::min(snapshot.items.size(), begin + query.limit) : snapshot.items.size();
+    begin = std::min(begin, end);
+    return true;
+}
+
+static std::string cursorOf(const GallerySnapshot& snapshot, size_t end) {
+    return end > 0 && end < snapshot.items.size() ? snapshot.items[end - 1]->id : std::string();
+}
+
+GalleryFeed::GalleryFeed(GalleryStorage& storage) : storage_(storage), epoch_(drogon::utils::getUuid().substr(0, 8)) {
+    State empty;
+    empty.snapshot = std::make_shared<GallerySnapshot>();
+    state_.store(advance(empty, storage_.snapshot(), {}));
+    watch_ = storage_.watch([this] {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stale_ = true;
+        }
+        wake_.notify_one();
+    });
+    builder_ = std::thread([this] { run(); });
+}
+
+GalleryFeed::~GalleryFeed() {
+    storage_.unwatch(watch_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_one();
+    builder_.join();
+}
+
+bool GalleryFeed::parseFields(std::string_view names, uint32_t& mask, std::string& unknown) {
+    mask = 0;
+    while (!names.empty()) {
+        size_t comma = names.find(',');
+        std::string_view name = names.substr(0, comma);
+        names = comma == std::string_view::npos ? std::string_view() : names.substr(comma + 1);
+        if (name.empty()) continue;
+        size_t field = 0;
+        while (field < fieldNames.size() && name != fieldNames[field]) ++field;
+        if (field == fieldNames.size()) {
+            unknown = std::string(name);
+            return false;
+        }
+        mask |= 1u << field;
+    }
+    return true;
+}
+
+std::shared_ptr<const GalleryFeed::Fragments> GalleryFeed::serialise(std::shared_ptr<const GalleryItem> entry) {
+    const GalleryItem& item = *entry;
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    auto fragment = [&builder](const char* key, const Json::Value& value) {
+        return std::string("\"") + key + "\":" + Json::writeString(builder, value);
+    };
+
+    auto fragments = std::make_shared<Fragments>();
+    auto& fields = fragments->fields;
+    fields[Id] = fragment("id", item.id);
+    fields[Name] = fragment("name", item.name);
+    fields[Quote] = fragment("quote", item.quote);
+    fields[FileName] = fragment("fileName", item.fileName);
+    fields[PreviewName] = fragment("previewName", item.previewName);
+    fields[PreviewUrl] = fragment("previewUrl", "/gallery_previews/" + item.previewName);
+    fields[ImageUrl] = fragment("imageUrl", "/gallery/image/" + item.id);
+    fields[Placeholder] = fragment("placeholder", item.placeholder);
+    fields[DominantColor] = fragment("dominantColor", item.dominantColor);
+
+    Json::Value metadata;
+    metadata["dateTime"] = item.metadata.dateTime;
+    metadata["model"] = item.metadata.model;
+    metadata["exposure"] = item.metadata.exposure;
+    metadata["iso"] = item.metadata.iso;
+    metadata["width"] = item.metadata.width;
+    metadata["height"] = item.metadata.height;
+    metadata["aperture"] = item.metadata.aperture;
+    metadata["focalLength"] = item.metadata.focalLength;
+    metadata["lensModel"] = item.metadata.lensModel;
+    metadata["subSecTime"] = item.metadata.subSecTime;
+    if (item.metadata.hasGps) {
+        metadata["gps"]["latitude"] = item.metadata.latitude;
+        metadata["gps"]["longitude"] = item.metadata.longitude;
+    }
+    fields[Metadata] = fragment("metadata", metadata);
+
+    // Preview ladder: the front end picks the smallest rung that fits via srcset, per format.
+    // `srcset` is the JPEG ladder for the <img>; `sources` has one typed srcset per other
+    // format, in server preference order, for the <source> elements of a <picture>.
+    Json::Value variants(Json::arrayValue);
+    std::array<std::string, 3> srcsets; // indexed by image::Format
+    for (const auto& variant : item.variants) {
+        image::Format format = image::formatOf(variant.fileName);
+        Json::Value jVariant;
+        jVariant["url"] = "/gallery_previews/ladder/" + variant.fileName;
+        jVariant["type"] = image::mimeType(format);
+        jVariant["width"] = variant.width;
+        jVariant["height"] = variant.height;
+        jVariant["bytes"] = static_cast<Json::UInt64>(variant.bytes);
+        variants.append(jVariant);
+        std::string& srcset = srcsets[static_cast<size_t>(format)];
+        if (!srcset.empty()) srcset += ", ";
+        srcset += jVariant["url"].asString() + " " + std::to_string(variant.width) + "w";
+    }
+    Json::Value sources(Json::arrayValue);
+    for (image::Format format : {image::Format::Avif, image::Format::WebP}) {
+        const std::string& srcset = srcsets[static_cast<size_t>(format)];
+        if (srcset.empty()) continue;
+        Json::Value source;
+        source["type"] = image::mimeType(format);
+        source["srcset"] = srcset;
+        sources.append(source);
+    }
+    fields[Variants] = fragment("variants", variants);
+    fields[Srcset] = fragment("srcset", srcsets[static_cast<size_t>(image::Format::Jpeg)]);
+    if (!sources.empty()) fields[Sources] = fragment("sources", sources);
+    if (item.tiles.tileSize > 0) fields[TilesUrl] = fragment("tilesUrl", "/gallery/tiles/" + item.id + "/info");
+
+    fragments->item = std::move(entry);
+    return fragments;
+}
+
+std::string GalleryFeed::splice(const std::vector<std::shared_ptr<const Fragments>>& page, uint32_t mask) {
+    std::string json;
+    json += '[';
+    for (size_t i = 0; i < page.size(); ++i) {
+        if (i > 0) json += ',';
+        json += '{';
+        bool first = true;
+        const auto& fields = page[i]->fields;
+        for (size_t field = 0; field < fields.size(); ++field) {
+            if (!(mask & (1u << field)) || fields[field].empty()) continue;
+            if (!first) json += ',';
+            json += fields[field];
+            first = false;
+        }
+        json += '}';
+    }
+    json += ']';
+    return json;
+}
+
+bool GalleryFeed::etagMatches(std::string_view ifNoneMatch, std::string_view etag) {
+    auto opaque = [](std::string_view tag) { return tag.substr(0, 2) == "W/" ? tag.substr(2) : tag; };
+    std::string_view wanted = opaque(etag);
+    std::string_view rest = ifNoneMatch;
+    while (!rest.empty()) {
+        size_t comma = rest.find(',');
+        std::string_view tag = rest.substr(0, comma);
+        rest = comma == std::string_view::npos ? std::string_view() : rest.substr(comma + 1);
+        tag.remove_prefix(std::min(tag.size(), tag.find_first_not_of(" \t")));
+        tag = tag.substr(0, tag.find_last_not_of(" \t") + 1);
+        if (tag == "*" || opaque(tag) == wanted) return true;
+    }
+    return false;
+}
+
+// Whether an Accept-Encoding header admits `coding`, by name or by "*", with a non-zero q-value
+static bool acceptsEncoding(std::string_view header, std::string_view coding) {
+    bool wildcard = false;
+    while (!header.empty()) {
+        size_t comma = header.find(',');
+        std::string_view range = header.substr(0, comma);
+        header = comma == std::string_view::npos ? std::string_view() : header.substr(comma + 1);
+
+        double q = 1.0;
+        size_t semi = range.find(';');
+        std::string name(range.substr(0, semi));
+        name.erase(0, name.find_first_not_of(" \t"));
+        name.erase(name.find_last_not_of(" \t") + 1);
+        if (semi != std::string_view::npos) {
+            size_t qPos = range.find("q=", semi);
+            if (qPos != std::string_view::npos) q = std::atof(std::string(range.substr(qPos + 2)).c_str());
+        }
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        if (name == coding) return q > 0.0;
+        if (name == "*") wildcard = q > 0.0;
+    }
+    return wildcard;
+}
+
+const std::string& GalleryFeed::encoded(const FeedBody& body, std::string_view acceptEncoding, const char*& contentEncoding) {
+    if (!body.brotli.empty() && acceptsEncoding(acceptEncoding, "br")) {
+        contentEncoding = "br";
+        return body.brotli;
+    }
+    if (!body.gzip.empty() && acceptsEncoding(acceptEncoding, "gzip")) {
+        contentEncoding = "gzip";
+        return body.gzip;
+    }
+    contentEncoding = nullptr;
+    return body.json;
+}
+
+std::string GalleryFeed::key(const FeedQuery& query) {
+    uint32_t mask = query.fields ? query.fields : allFields;
+    return std::to_string(mask) + "/" + query.after + "/" + std::to_string(query.limit);
+}
+
+std::string GalleryFeed::etag(uint64_t version, const std::string& key) const {
+    // Names the gallery version and the query, not the bytes, which differ per encoding
+    return "W/\"" + epoch_ + "-" + std::to_string(version) + "-" + drogon::utils::getMd5(key).substr(0, 8) + "\"";
+}
+
+std::shared_ptr<const FeedBody> GalleryFeed::build(const State& state, const FeedQuery& query) const {
+    size_t begin, end;
+    if (!pageOf(*state.snapshot, query, begin, end)) return nullptr;
+    std::vector<std::shared_ptr<const Fragments>> page;
+    page.reserve(end - begin);
+    for (size_t i = begin; i < end; ++i) page.push_back(state.fragments[i]);
+
+    auto body = std::make_shared<FeedBody>();
+    std::string& json = body->json = splice(page, query.fields ? query.fields : allFields);
+    if (json.size() >= minCompressedBody) {
+        body->gzip = drogon::utils::gzipCompress(json.data(), json.size());
+        body->brotli = brotliCompress(json);
+    }
+    body->etag = etag(state.snapshot->version, key(query));
+    body->nextCursor = cursorOf(*state.snapshot, end);
+    return body;
+}
+
+std::shared_ptr<const GalleryFeed::State> GalleryFeed::advance(const State& previous, std::shared_ptr<const GallerySnapshot> snapshot,
+                                                               const std::vector<FeedQuery>& hot) const {
+    auto next = std::make_shared<State>();
+    next->fragments = previous.fragments;
+    // Items the change did not touch are the same objects as before, and so are their fragments
+    const auto& before = previous.snapshot->items;
+    const auto& items = snapshot->items;
+    size_t serialised = 0;
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (i < before.size() && before[i] == items[i]) continue;
+        if (i < next->fragments.size()) {
+            next->fragments.set(i, serialise(items[i]));
+        } else {
+            next->fragments.push_back(serialise(items[i]));
+        }
+        ++serialised;
+    }
+    next->snapshot = std::move(snapshot);
+    for (const auto& query : hot) {
+        auto body = build(*next, query);
+        if (!body) continue;
+        auto& cached = next->bodies[key(query)];
+        cached.query = query;
+        cached.body = std::move(body);
+    }
+    LOG_DEBUG << "Gallery feed at version " << next->snapshot->version << ": serialised " << serialised << " of "
+              << items.size() << " items, built " << next->bodies.size() << " bodies";
+    return next;
+}
+
+void GalleryFeed::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        wake_.wait(lock, [this] { return stopping_ || stale_ || !waiting_.empty(); });
+        if (stale_ && !stopping_) {
+            stale_ = false;
+            auto current = state_.load();
+            auto snapshot = storage_.snapshot();
+            if (snapshot->version != current->snapshot->version) {
+                // What was asked for under the current state is what will be asked for next
+                std::vector<FeedQuery> hot;
+                for (const auto& [key, cached] : current->bodies) {
+                    if (cached.used.load(std::memory_order_relaxed)) hot.push_back(cached.query);
+                }
+                for (const auto& [key, entry] : built_) hot.push_back(entry.first);
+                for (const auto& [key, entry] : waiting_) hot.push_back(entry.first);
+                if (hot.size() > maxBodies_) hot.resize(maxBodies_);
+                lock.unlock();
+                std::shared_ptr<const State> next;
+                try {
+                    next = advance(*current, std::move(snapshot), hot);
+                } catch (const std::exception& e) {
+                    LOG_ERROR << "Failed to build the gallery feed: " << e.what();
+                }
+                lock.lock();
+                if (next) {
+                    state_.store(std::move(next));
+                    built_.clear();
+                }
+            }
+        }
+
+        if (!waiting_.empty()) {
+            auto waiting = std::move(waiting_);
+            waiting_.clear();
+            auto state = state_.load();
+            lock.unlock();
+            for (auto& [key, entry] : waiting) {
+                std::shared_ptr<const FeedBody> body;
+                auto cached = state->bodies.find(key);
+                if (cached != state->bodies.end()) {
+                    cached->second.used.store(true, std::memory_order_relaxed);
+                    body = cached->second.body;
+                } else {
+                    try {
+                        body = build(*state, entry.first);
+                    } catch (const std::exception& e) {
+                        LOG_ERROR << "Failed to build a gallery feed body: " << e.what();
+                    }
+                    // Kept for the state it was built from only; cursors make the set of queries open-ended
+                    std::lock_guard<std::mutex> relock(mutex_);
+                    if (body && state_.load() == state && built_.size() < maxBodies_) built_.emplace(key, std::make_pair(entry.first, body));
+                }
+                for (auto& done : entry.second) done(body);
+            }
+            lock.lock();
+            continue;
+        }
+        if (stopping_) return;
+    }
+}
+
+std::optional<FeedHead> GalleryFeed::head(const FeedQuery& query) const {
+    auto state = state_.load();
+    size_t begin, end;
+    if (!pageOf(*state->snapshot, query, begin, end)) return std::nullopt;
+    return FeedHead{etag(state->snapshot->version, key(query)), cursorOf(*state->snapshot, end)};
+}
+
+void GalleryFeed::body(const FeedQuery& query, BodyCallback done) {
+    auto state = state_.load();
+    std::string k = key(query);
+    auto cached = state->bodies.find(k);
+    if (cached != state->bodies.end()) {
+        cached->second.used.store(true, std::memory_order_relaxed);
+        done(cached->second.body);
+        return;
+    }
+    size_t begin, end;
+    if (!pageOf(*state->snapshot, query, begin, end)) {
+        done(nullptr);
+        return;
+    }
+
+    std::shared_ptr<const FeedBody> body;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto built = built_.find(k);
+        if (built != built_.end()) {
+            body = built->second.second;
+        } else {
+            // Everyone asking for the same body before it is built gets the one build
+            auto& entry = waiting_[k];
+            entry.first = query;
+            entry.second.push_back(std::move(done));
+            wake_.notify_one();
+            return;
+        }
+    }
+    done(body);
+}
+
+std::string GalleryFeed::render(const std::vector<std::shared_ptr<const GalleryItem>>& items, uint32_t fields) const {
+    auto state = state_.load();
+    const GallerySnapshot& snapshot = *state->snapshot;
+    std::vector<std::shared_ptr<const Fragments>> page;
+    page.reserve(items.size());
+    for (const auto& item : items) {
+        // Items of a newer snapshot than the feed's may not be serialised yet; those are serialised here
+        const size_t* position = snapshot.byId.find(item->id);
+        page.push_back(position && snapshot.items[*position] == item ? state->fragments[*position] : serialise(item));
+    }
+    return splice(page, fields ? fields : allFields);
+}
+
+}
@@ -0,0 +1,437 @@
+#include <support/gallery_file.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace blutography {
+
+namespace {
+
+// A string in the pool. Empty strings are {0, 0} and never stored.
+struct StringRef {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;      // byteOrderMark as written by the producing host
+    uint32_t itemCount;
+    uint32_t variantCount;
+    uint64_t itemsOffset;    // ItemRecord[itemCount]
+    uint64_t variantsOffset; // VariantRecord[variantCount]
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+    uint64_t fileSize;       // catches a truncated copy
+    uint64_t reserved;
+};
+
+struct ItemRecord {
+    StringRef id, name, quote, fileName, previewName, contentHash, placeholder, dominantColor;
+    StringRef dateTime, model, exposure, iso, aperture, focalLength, lensModel, subSecTime;
+    int32_t width, height, orientation;
+    uint32_t flags;
+    double latitude, longitude;
+    int32_t tileWidth, tileHeight, tileSize, tileOverlap, tileMaxLevel;
+    uint32_t firstVariant; // index into the variant table
+    uint32_t variantCount;
+    uint32_t reserved;
+};
+
+struct VariantRecord {
+    StringRef fileName;
+    int32_t width, height;
+    uint64_t bytes;
+};
+
+// The records are copied to and from the file byte for byte, so their layout is the format
+static_assert(std::is_trivially_copyable_v<FileHeader> && sizeof(FileHeader) == 72);
+static_assert(std::is_trivially_copyable_v<ItemRecord> && sizeof(ItemRecord) == 192);
+static_assert(std::is_trivially_copyable_v<VariantRecord> && sizeof(VariantRecord) == 24);
+
+constexpr uint32_t byteOrderMark = 0x01020304;
+constexpr uint32_t hasGpsFlag = 1u << 0;
+
+// Below this many items one thread decodes faster than several can be started
+constexpr size_t parallelDecodeItems = 16384;
+
+// Camera models, lens names and the "[null]" placeholders repeat across most items; each is stored once
+class StringPool {
+public:
+    bool add(const std::string& text, StringRef& ref) {
+        if (text.empty()) {
+            ref = {0, 0};
+            return true;
+        }
+        auto it = offsets_.find(text);
+        if (it != offsets_.end()) {
+            ref = {it->second, static_cast<uint32_t>(text.size())};
+            return true;
+        }
+        if (pool_.size() + text.size() > std::numeric_limits<uint32_t>::max()) return false;
+        ref = {static_cast<uint32_t>(pool_.size()), static_cast<uint32_t>(text.size())};
+        offsets_.emplace(text, ref.offset); // keys view into the items being encoded, which outlive the pool
+        pool_ += text;
+        return true;
+    }
+
+    const std::string& bytes() const { return pool_; }
+
+private:
+    std::string pool_;
+    std::unordered_map<std::string_view, uint32_t> offsets_;
+};
+
+template <typename T>
+void put(std::string& out, const T& value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof value);
+}
+
+template <typename T>
+T readAt(std::string_view data, uint64_t offset) {
+    T value;
+    std::memcpy(&value, data.data() + offset, sizeof value);
+    return value;
+}
+
+class Decoder {
+public:
+    Decoder(std::string_view data, const FileHeader& header) : data_(data), header_(header) {}
+
+    // Decodes items [begin, end) into their slots; false if any of them points outside the file
+    bool decode(size_t begin, size_t end, std::vector<std::shared_ptr<const GalleryItem>>& items) const {
+        for (size_t i = begin; i < end; ++i) {
+            auto record = readAt<ItemRecord>(data_, header_.itemsOffset + i * sizeof(ItemRecord));
+            auto item = std::make_shared<GalleryItem>();
+            bool ok = text(record.id, item->id) && text(record.name, item->name) && text(record.quote, item->quote)
+                && text(record.fileName, item->fileName) && text(record.previewName, item->previewName)
+                && text(record.contentHash, item->contentHash) && text(record.placeholder, item->placeholder)
+                && text(record.dominantColor, item->dominantColor)
+                && text(record.dateTime, item->metadata.dateTime) && text(record.model, item->metadata.model)
+                && text(record.exposure, item->metadata.exposure) && text(record.iso, item->metadata.iso)
+                && text(record.aperture, item->metadata.aperture) && text(record.focalLength, item->metadata.focalLength)
+                && text(record.lensModel, item->metadata.lensModel) && text(record.subSecTime, item->metadata.subSecTime);
+            if (!ok || uint64_t(record.firstVariant) + record.variantCount > header_.variantCount) return false;
+
+            item->metadata.width = record.width;
+            item->metadata.height = record.height;
+            item->metadata.orientation = record.orientation;
+            item->metadata.hasGps = record.flags & hasGpsFlag;
+            item->metadata.latitude = record.latitude;
+            item->metadata.longitude = record.longitude;
+            item->tiles.width = record.tileWidth;
+            item->tiles.height = record.tileHeight;
+            item->tiles.tileSize = record.tileSize;
+            item->tiles.overlap = record.tileOverlap;
+            item->tiles.maxLevel = record.tileMaxLevel;
+
+            item->variants.resize(record.variantCount);
+            for (uint32_t v = 0; v < record.variantCount; ++v) {
+                auto variant = readAt<VariantRecord>(data_, header_.variantsOffset
+                                                     + uint64_t(record.firstVariant + v) * sizeof(VariantRecord));
+                auto& target = item->variants[v];
+                if (!text(variant.fileName, target.fileName)) return false;
+                target.width = variant.width;
+                target.height = variant.height;
+                target.bytes = static_cast<size_t>(variant.bytes);
+            }
+            items[i] = std::move(item);
+        }
+        return true;
+    }
+
+private:
+    bool text(StringRef ref, std::string& out) const {
+        if (uint64_t(ref.offset) + ref.length > header_.stringsSize) return false;
+        out.assign(data_.data() + header_.stringsOffset + ref.offset, ref.length);
+        return true;
+    }
+
+    std::string_view data_;
+    const FileHeader& header_;
+};
+
+}
+
+Json::Value toJson(const GalleryItem& item) {
+    Json::Value jItem;
+    jItem["id"] = item.id;
+    jItem["name"] = item.name;
+    jItem["quote"] = item.quote;
+    jItem["fileName"] = item.fileName;
+    jItem["previewName"] = item.previewName;
+    if (!item.contentHash.empty()) jItem["contentHash"] = item.contentHash;
+    if (!item.placeholder.empty()) jItem["placeholder"] = item.placeholder;
+    if (!item.dominantColor.empty()) jItem["dominantColor"] = item.dominantColor;
+    jItem["metadata"]["dateTime"] = item.metadata.dateTime;
+    jItem["metadata"]["model"] = item.metadata.model;
+    jItem["metadata"]["exposure"] = item.metadata.exposure;
+    jItem["metadata"]["iso"] = item.metadata.iso;
+    jItem["metadata"]["width"] = item.metadata.width;
+    jItem["metadata"]["height"] = item.metadata.height;
+    jItem["metadata"]["orientation"] = item.metadata.orientation;
+    if (!item.metadata.aperture.empty()) jItem["metadata"]["aperture"] = item.metadata.aperture;
+    if (!item.metadata.focalLength.empty()) jItem["metadata"]["focalLength"] = item.metadata.focalLength;
+    if (!item.metadata.lensModel.empty()) jItem["metadata"]["lensModel"] = item.metadata.lensModel;
+    if (!item.metadata.subSecTime.empty()) jItem["metadata"]["subSecTime"] = item.metadata.subSecTime;
+    if (item.metadata.hasGps) {
+        jItem["metadata"]["gps"]["latitude"] = item.metadata.latitude;
+        jItem["metadata"]["gps"]["longitude"] = item.metadata.longitude;
+    }
+    if (!item.variants.empty()) {
+        Json::Value jVariants(Json::arrayValue);
+        for (const auto& variant : item.variants) {
+            Json::Value jVariant;
+            jVariant["fileName"] = variant.fileName;
+            jVariant["width"] = variant.width;
+            jVariant["height"] = variant.height;
+            jVariant["bytes"] = static_cast<Json::UInt64>(variant.bytes);
+            jVariants.append(jVariant);
+        }
+        jItem["variants"] = jVariants;
+    }
+    if (item.tiles.tileSize > 0) {
+        jItem["tiles"]["width"] = item.tiles.width;
+        jItem["tiles"]["height"] = item.tiles.height;
+        jItem["tiles"]["tileSize"] = item.tiles.tileSize;
+        jItem["tiles"]["overlap"] = item.tiles.overlap;
+        jItem["tiles"]["maxLevel"] = item.tiles.maxLevel;
+    }
+    return jItem;
+}
+
+GalleryItem fromJson(const Json::Value& jItem) {
+    GalleryItem item;
+    item.id = jItem["id"].asString();
+    item.name = jItem["name"].asString();
+    item.quote = jItem["quote"].asString();
+    item.fileName = jItem["fileName"].asString();
+    item.previewName = jItem["previewName"].asString();
+    item.contentHash = jItem.get("contentHash", "").asString();
+    item.placeholder = jItem.get("placeholder", "").asString();
+    item.dominantColor = jItem.get("dominantColor", "").asString();
+    item.metadata.dateTime = jItem["metadata"]["dateTime"].asString();
+    item.metadata.model = jItem["metadata"]["model"].asString();
+    item.metadata.exposure = jItem["metadata"].get("exposure", "[null]").asString();
+    item.metadata.iso = jItem["metadata"].get("iso", "[null]").asString();
+    item.metadata.width = jItem["metadata"]["width"].asInt();
+    item.metadata.height = jItem["metadata"]["height"].asInt();
+    item.metadata.orientation = jItem["metadata"].get("orientation", 1).asInt();
+    item.metadata.aperture = jItem["metadata"].get("aperture", "").asString();
+    item.metadata.focalLength = jItem["metadata"].get("focalLength", "").asString();
+    item.metadata.lensModel = jItem["metadata"].get("lensModel", "").asString();
+    item.metadata.subSecTime = jItem["metadata"].get("subSecTime", "").asString();
+    if (jItem["metadata"].isMember("gps")) {
+        item.metadata.hasGps = true;
+        item.metadata.latitude = jItem["metadata"]["gps"]["latitude"].asDouble();
+        item.metadata.longitude = jItem["metadata"]["gps"]["longitude"].asDouble();
+    }
+    for (const auto& jVariant : jItem["variants"]) {
+        image::PreviewVariant variant;
+        variant.fileName = jVariant["fileName"].asString();
+        variant.width = jVariant["width"].asInt();
+        variant.height = jVariant["height"].asInt();
+        variant.bytes = jVariant["bytes"].asUInt64();
+        item.variants.push_back(variant);
+    }
+    if (jItem.isMember("tiles")) {
+        item.tiles.width = jItem["tiles"]["width"].asInt();
+        item.tiles.height = jItem["tiles"]["height"].asInt();
+        item.tiles.tileSize = jItem["tiles"]["tileSize"].asInt();
+        item.tiles.overlap = jItem["tiles"].get("overlap", 0).asInt();
+        item.tiles.maxLevel = jItem["tiles"]["maxLevel"].asInt();
+    }
+    return item;
+}
+
+std::string encodeGallery(const std::vector<std::shared_ptr<const GalleryItem>>& items) {
+    size_t variantCount = 0;
+    for (const auto& item : items) variantCount += item->variants.size();
+    if (items.size() > std::numeric_limits<uint32_t>::max() || variantCount > std::numeric_limits<uint32_t>::max()) return {};
+
+    StringPool pool;
+    std::vector<ItemRecord> records(items.size(), ItemRecord{});
+    std::vector<VariantRecord> variants;
+    variants.reserve(variantCount);
+    for (size_t i = 0; i < items.size(); ++i) {
+        const GalleryItem& item = *items[i];
+        ItemRecord& record = records[i];
+        bool ok = pool.add(item.id, record.id) && pool.add(item.name, record.name) && pool.add(item.quote, record.quote)
+            && pool.add(item.fileName, record.fileName) && pool.add(item.previewName, record.previewName)
+            && pool.add(item.contentHash, record.contentHash) && pool.add(item.placeholder, record.placeholder)
+            && pool.add(item.dominantColor, record.dominantColor)
+            && pool.add(item.metadata.dateTime, record.dateTime) && pool.add(item.metadata.model, record.model)
+            && pool.add(item.metadata.exposure, record.exposure) && pool.add(item.metadata.iso, record.iso)
+            && pool.add(item.metadata.aperture, record.aperture) && pool.add(item.metadata.focalLength, record.focalLength)
+            && pool.add(item.metadata.lensModel, record.lensModel) && pool.add(item.metadata.subSecTime, record.subSecTime);
+        if (!ok) return {};
+
+        record.width = item.metadata.width;
+        record.height = item.metadata.height;
+        record.orientation = item.metadata.orientation;
+        record.flags = item.metadata.hasGps ? hasGpsFlag : 0;
+        record.latitude = item.metadata.latitude;
+        record.longitude = item.metadata.longitude;
+        record.tileWidth = item.tiles.width;
+        record.tileHeight = item.tiles.height;
+        record.tileSize = item.tiles.tileSize;
+        record.tileOverlap = item.tiles.overlap;
+        record.tileMaxLevel = item.tiles.maxLevel;
+        record.firstVariant = static_cast<uint32_t>(variants.size());
+        record.variantCount = static_cast<uint32_t>(item.variants.size());
+        for (const auto& variant : item.variants) {
+            VariantRecord entry{};
+            if (!pool.add(variant.fileName, entry.fileName)) return {};
+            entry.width = variant.width;
+            entry.height = variant.height;
+            entry.bytes = variant.bytes;
+            variants.push_back(entry);
+        }
+    }
+
+    FileHeader header{};
+    std::memcpy(header.magic, galleryFileMagic, sizeof header.magic);
+    header.version = galleryFileVersion;
+    header.byteOrder = byteOrderMark;
+    header.itemCount = static_cast<uint32_t>(records.size());
+    header.variantCount = static_cast<uint32_t>(variants.size());
+    header.itemsOffset = sizeof(FileHeader);
+    header.variantsOffset = header.itemsOffset + records.size() * sizeof(ItemRecord);
+    header.stringsOffset = header.variantsOffset + variants.size() * sizeof(VariantRecord);
+    header.stringsSize = pool.bytes().size();
+    header.fileSize = header.stringsOffset + header.stringsSize;
+
+    std::string out;
+    out.reserve(header.fileSize);
+    put(out, header);
+    out.append(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(ItemRecord));
+    out.append(reinterpret_cast<const char*>(variants.data()), variants.size() * sizeof(VariantRecord));
+    out += pool.bytes();
+    return out;
+}
+
+std::string encodeGalleryJson(const std::vector<std::shared_ptr<const GalleryItem>>& items) {
+    Json::Value root(Json::arrayValue);
+    for (const auto& item : items) root.append(toJson(*item));
+    Json::StreamWriterBuilder builder;
+    return Json::writeString(builder, root);
+}
+
+bool isBinaryGallery(std::string_view data) {
+    return data.size() >= sizeof galleryFileMagic && std::memcmp(data.data(), galleryFileMagic, sizeof galleryFileMagic) == 0;
+}
+
+bool decodeGallery(std::string_view data, std::vector<std::shared_ptr<const GalleryItem>>& items, std::string& error) {
+    if (data.size() < sizeof(FileHeader) || !isBinaryGallery(data)) {
+        error = "not a binary gallery snapshot";
+        return false;
+    }
+    auto header = readAt<FileHeader>(data, 0);
+    if (header.byteOrder != byteOrderMark) {
+        error = "snapshot was written on a host of the other byte order";
+        return false;
+    }
+    if (header.version != galleryFileVersion) {
+        error = "unsupported snapshot version " + std::to_string(header.version);
+        return false;
+    }
+    // Offsets are bounded by the file first, so the sums below cannot wrap
+    bool consistent = header.fileSize == data.size()
+        && header.itemsOffset <= data.size() && header.variantsOffset <= data.size()
+        && header.stringsOffset <= data.size() && header.stringsSize <= data.size()
+        && header.itemsOffset >= sizeof(FileHeader)
+        && header.itemsOffset + uint64_t(header.itemCount) * sizeof(ItemRecord) <= header.variantsOffset
+        && header.variantsOffset + uint64_t(header.variantCount) * sizeof(VariantRecord) <= header.stringsOffset
+        && header.stringsOffset + header.stringsSize <= data.size();
+    if (!consistent) {
+        error = "snapshot is truncated or its tables overlap";
+        return false;
+    }
+
+    std::vector<std::shared_ptr<const GalleryItem>> decoded(header.itemCount);
+    Decoder decoder(data, header);
+    bool ok;
+    size_t workers = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), header.itemCount / parallelDecodeItems);
+    if (workers <= 1) {
+        ok = decoder.decode(0, decoded.size(), decoded);
+    } else {
+        // Records are fixed-size and independent, so each thread takes a contiguous slice
+        std::atomic<bool> failed{false};
+        std::vector<std::thread> threads;
+        size_t slice = (decoded.size() + workers - 1) / workers;
+        for (size_t begin = 0; begin < decoded.size(); begin += slice) {
+            size_t end = std::min(decoded.size(), begin + slice);
+            threads.emplace_back([&, begin, end] {
+                if (!decoder.decode(begin, end, decoded)) failed = true;
+            });
+        }
+        for (auto& thread : threads) thread.join();
+        ok = !failed;
+    }
+    if (!ok) {
+        error = "snapshot has a record pointing outside the file";
+        return false;
+    }
+    items = std::move(decoded);
+    return true;
+}
+
+bool readGalleryFile(const std::string& path, std::vector<std::shared_ptr<const GalleryItem>>& items, std::string& error) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error = std::strerror(errno);
+        return false;
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+        error = std::strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    if (info.st_size == 0) {
+        error = "file is empty";
+        ::close(fd);
+        return false;
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        error = std::strerror(errno);
+        return false;
+    }
+    // Every page is about to be read, most likely by several threads at once
+    ::madvise(mapping, size, MADV_WILLNEED);
+
+    std::string_view data(static_cast<const char*>(mapping), size);
+    bool ok;
+    if (isBinaryGallery(data)) {
+        ok = decodeGallery(data, items, error);
+    } else {
+        Json::Value root;
+        std::unique_ptr<Json::CharReader> reader(Json::CharReaderBuilder().newCharReader());
+        ok = reader->parse(data.data(), data.data() + data.size(), &root, &error) && root.isArray();
+        if (ok) {
+            items.clear();
+            items.reserve(root.size());
+            for (const auto& jItem : root) items.push_back(std::make_shared<const GalleryItem>(fromJson(jItem)));
+        } else if (error.empty()) {
+            error = "expected an array of items";
+        }
+    }
+    ::munmap(mapping, size);
+    return ok;
+}
+
+}
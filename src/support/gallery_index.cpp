@@ -0,0 +1,266 @@
+#include <support/gallery_index.hpp>
+#include <support/gallery_storage.hpp>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+
+namespace blutography {
+
+static constexpr double missing = std::numeric_limits<double>::quiet_NaN();
+
+const char* toString(IndexField field) {
+    switch (field) {
+        case IndexField::DateTime: return "dateTime";
+        case IndexField::Iso: return "iso";
+        case IndexField::Exposure: return "exposure";
+        case IndexField::Megapixels: return "megapixels";
+        case IndexField::Aspect: return "aspect";
+        case IndexField::Model: return "model";
+    }
+    return "unknown";
+}
+
+bool indexFieldFromString(std::string_view name, IndexField& field) {
+    for (auto candidate : {IndexField::DateTime, IndexField::Iso, IndexField::Exposure,
+                           IndexField::Megapixels, IndexField::Aspect, IndexField::Model}) {
+        if (name == toString(candidate)) {
+            field = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Reads exactly `digits` decimal digits at `offset`.
+static bool readDigits(std::string_view text, size_t offset, size_t digits, int& value) {
+    if (offset + digits > text.size()) return false;
+    auto [end, ec] = std::from_chars(text.data() + offset, text.data() + offset + digits, value);
+    return ec == std::errc() && end == text.data() + offset + digits;
+}
+
+// Days since 1970-01-01 in the proleptic Gregorian calendar (H. Hinnant's days_from_civil).
+static int64_t daysFromCivil(int year, int month, int day) {
+    year -= month <= 2;
+    const int64_t era = (year >= 0 ? year : year - 399) / 400;
+    const int64_t yearOfEra = year - era * 400;
+    const int64_t dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    const int64_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+
+std::optional<double> parseCaptureTime(std::string_view dateTime, std::string_view subSecTime) {
+    int year, month, day, hour = 0, minute = 0, second = 0;
+    if (!readDigits(dateTime, 0, 4, year) || !readDigits(dateTime, 5, 2, month) || !readDigits(dateTime, 8, 2, day)) return std::nullopt;
+    char separator = dateTime[4];
+    if ((separator != ':' && separator != '-') || dateTime[7] != separator) return std::nullopt;
+    if (month < 1 || month > 12 || day < 1 || day > 31) return std::nullopt;
+
+    if (dateTime.size() > 10) {
+        if ((dateTime[10] != ' ' && dateTime[10] != 'T') || !readDigits(dateTime, 11, 2, hour)
+            || dateTime.size() < 16 || dateTime[13] != ':' || !readDigits(dateTime, 14, 2, minute)) {
+            return std::nullopt;
+        }
+        if (dateTime.size() >= 19 && (dateTime[16] != ':' || !readDigits(dateTime, 17, 2, second))) return std::nullopt;
+        if (hour > 23 || minute > 59 || second > 60) return std::nullopt;
+    }
+
+    // SubSecTimeOriginal holds the digits after the decimal point
+    double fraction = 0.0, scale = 0.1;
+    for (char c : subSecTime) {
+        if (c < '0' || c > '9') break;
+        fraction += (c - '0') * scale;
+        scale /= 10;
+    }
+    int64_t seconds = daysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+    return (static_cast<double>(seconds) + fraction) * 1000.0;
+}
+
+std::optional<double> parseExposure(std::string_view exposure) {
+    std::string text(exposure);
+    const char* begin = text.c_str();
+    char* end = nullptr;
+    double value = std::strtod(begin, &end);
+    if (end == begin) return std::nullopt;
+    if (*end == '/') {
+        const char* denominatorBegin = end + 1;
+        double denominator = std::strtod(denominatorBegin, &end);
+        if (end == denominatorBegin || denominator <= 0.0) return std::nullopt;
+        value /= denominator;
+    }
+    if (*end == 's') ++end; // "2s"
+    if (*end != '\0' || !(value > 0.0) || !std::isfinite(value)) return std::nullopt;
+    return value;
+}
+
+std::optional<double> parseIso(std::string_view iso) {
+    int value = 0;
+    auto [end, ec] = std::from_chars(iso.data(), iso.data() + iso.size(), value);
+    if (ec != std::errc() || end != iso.data() + iso.size() || value <= 0) return std::nullopt;
+    return value;
+}
+
+ItemKeys ItemKeys::of(const GalleryItem& item) {
+    ItemKeys keys;
+    keys.numbers.fill(missing);
+    const auto& metadata = item.metadata;
+    auto set = [&keys](IndexField field, std::optional<double> value) {
+        if (value) keys.numbers[static_cast<size_t>(field)] = *value;
+    };
+    set(IndexField::DateTime, parseCaptureTime(metadata.dateTime, metadata.subSecTime));
+    set(IndexField::Iso, parseIso(metadata.iso));
+    set(IndexField::Exposure, parseExposure(metadata.exposure));
+    if (metadata.width > 0 && metadata.height > 0) {
+        // As displayed: orientations 5-8 turn the stored frame on its side
+        bool swaps = metadata.orientation >= 5 && metadata.orientation <= 8;
+        double width = swaps ? metadata.height : metadata.width;
+        double height = swaps ? metadata.width : metadata.height;
+        set(IndexField::Megapixels, width * height / 1e6);
+        set(IndexField::Aspect, width / height);
+    }
+    if (metadata.model != "[null]") keys.model = metadata.model;
+    return keys;
+}
+
+void GalleryIndexes::rebuild(const GalleryItems& items) {
+    keys_.clear();
+    std::array<std::vector<SortedIndex<double>::Entry>, numericIndexFields> numeric;
+    std::vector<SortedIndex<std::string_view>::Entry> model;
+    for (size_t position = 0; position < items.size(); ++position) {
+        keys_.push_back(ItemKeys::of(*items[position]));
+        const ItemKeys& keys = keys_.back();
+        for (size_t field = 0; field < numericIndexFields; ++field) {
+            if (!std::isnan(keys.numbers[field])) numeric[field].emplace_back(keys.numbers[field], static_cast<uint32_t>(position));
+        }
+        if (!keys.model.empty()) model.emplace_back(keys.model, static_cast<uint32_t>(position));
+    }
+    for (size_t field = 0; field < numericIndexFields; ++field) numeric_[field].assign(std::move(numeric[field]));
+    model_.assign(std::move(model));
+}
+
+void GalleryIndexes::put(const GalleryItem* previous, const GalleryItem& item, size_t position) {
+    auto slot = static_cast<uint32_t>(position);
+    if (previous && position < keys_.size()) {
+        // The old entries view into `previous`, which outlives this call
+        const ItemKeys& old = keys_[position];
+        for (size_t field = 0; field < numericIndexFields; ++field) {
+            if (!std::isnan(old.numbers[field])) numeric_[field].erase(old.numbers[field], slot);
+        }
+        if (!old.model.empty()) model_.erase(old.model, slot);
+    }
+    if (position >= keys_.size()) keys_.resize(position + 1);
+
+    keys_.set(position, ItemKeys::of(item));
+    const ItemKeys& keys = keys_[position];
+    for (size_t field = 0; field < numericIndexFields; ++field) {
+        if (!std::isnan(keys.numbers[field])) numeric_[field].insert(keys.numbers[field], slot);
+    }
+    if (!keys.model.empty()) model_.insert(keys.model, slot);
+}
+
+bool GalleryIndexes::matches(size_t position, const GalleryQuery& query) const {
+    const ItemKeys& keys = keys_[position];
+    for (size_t field = 0; field < numericIndexFields; ++field) {
+        const auto& range = query.ranges[field];
+        if (!range.active()) continue;
+        double value = keys.numbers[field];
+        if (std::isnan(value) || value < range.min || value > range.max) return false;
+    }
+    return query.model.empty() || keys.model == query.model;
+}
+
+std::vector<size_t> GalleryIndexes::query(const GalleryQuery& query) const {
+    std::vector<size_t> result;
+    if (query.limit == 0) return result;
+
+    auto numericRange = [&](size_t field) { return numeric_[field].range(query.ranges[field].min, query.ranges[field].max); };
+    auto modelRange = [&]() {
+        return query.model.empty() ? std::make_pair(model_.begin(), model_.end())
+                                   : model_.range(query.model, query.model);
+    };
+
+    // The narrowest filter, by how many entries its range holds
+    std::optional<IndexField> narrowest;
+    size_t narrowestSize = std::numeric_limits<size_t>::max();
+    for (size_t field = 0; field < numericIndexFields; ++field) {
+        if (!query.ranges[field].active()) continue;
+        auto [begin, end] = numericRange(field);
+        size_t size = static_cast<size_t>(end - begin);
+        if (size < narrowestSize) {
+            narrowest = static_cast<IndexField>(field);
+            narrowestSize = size;
+        }
+    }
+    if (!query.model.empty()) {
+        auto [begin, end] = modelRange();
+        size_t size = static_cast<size_t>(end - begin);
+        if (size < narrowestSize) {
+            narrowest = IndexField::Model;
+            narrowestSize = size;
+        }
+    }
+
+    // Walks a range of the sort index in the requested order until the limit is reached
+    auto walkSorted = [&](auto begin, auto end) {
+        if (!query.descending) {
+            for (auto it = begin; it != end && result.size() < query.limit; ++it) {
+                if (matches(it->second, query)) result.push_back(it->second);
+            }
+        } else {
+            for (auto it = end; it != begin && result.size() < query.limit;) {
+                --it;
+                if (matches(it->second, query)) result.push_back(it->second);
+            }
+        }
+    };
+
+    size_t sortField = static_cast<size_t>(query.sort);
+    bool sortByModel = query.sort == IndexField::Model;
+    size_t sortSize;
+    if (sortByModel) {
+        auto [begin, end] = modelRange();
+        sortSize = static_cast<size_t>(end - begin);
+    } else {
+        auto [begin, end] = numericRange(sortField);
+        sortSize = static_cast<size_t>(end - begin);
+    }
+
+    if (!narrowest || sortSize <= narrowestSize) {
+        if (sortByModel) {
+            auto [begin, end] = modelRange();
+            walkSorted(begin, end);
+        } else {
+            auto [begin, end] = numericRange(sortField);
+            walkSorted(begin, end);
+        }
+        return result;
+    }
+
+    // A filter on another field is narrower: take its matches and keep the best `limit` by the sort key
+    auto collect = [&](auto begin, auto end) {
+        for (auto it = begin; it != end; ++it) {
+            size_t position = it->second;
+            bool hasSortKey = sortByModel ? !keys_[position].model.empty() : !std::isnan(keys_[position].numbers[sortField]);
+            if (hasSortKey && matches(position, query)) result.push_back(position);
+        }
+    };
+    if (*narrowest == IndexField::Model) {
+        auto [begin, end] = modelRange();
+        collect(begin, end);
+    } else {
+        auto [begin, end] = numericRange(static_cast<size_t>(*narrowest));
+        collect(begin, end);
+    }
+
+    // The order the sort index holds them in, ties by position
+    auto less = [&](size_t a, size_t b) {
+        return sortByModel ? std::make_pair(keys_[a].model, a) < std::make_pair(keys_[b].model, b)
+                           : std::make_pair(keys_[a].numbers[sortField], a) < std::make_pair(keys_[b].numbers[sortField], b);
+    };
+    auto before = [&](size_t a, size_t b) { return query.descending ? less(b, a) : less(a, b); };
+    size_t keep = std::min(query.limit, result.size());
+    std::partial_sort(result.begin(), result.begin() + keep, result.end(), before);
+    result.resize(keep);
+    return result;
+}
+
+}
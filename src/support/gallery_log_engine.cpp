@@ -0,0 +1,243 @@
+#include <support/gallery_log_engine.hpp>
+#include <support/gallery_storage.hpp>
+#include <support/durable.hpp>
+#include <support/gallery_file.hpp>
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <drogon/drogon.h>
+
+namespace blutography {
+
+static bool writeAll(int fd, const std::string& data) {
+    const char* cursor = data.data();
+    size_t left = data.size();
+    while (left > 0) {
+        ssize_t written = ::write(fd, cursor, left);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        cursor += written;
+        left -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+static int openLog(const std::string& path) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) LOG_ERROR << "Failed to open " << path << ": " << std::strerror(errno);
+    return fd;
+}
+
+LogGalleryEngine::LogGalleryEngine(std::string snapshotPath, std::string logPath, std::string legacyPath, LogEngineOptions options)
+    : snapshotPath_(std::move(snapshotPath)), logPath_(std::move(logPath)), legacyPath_(std::move(legacyPath)), options_(options) {}
+
+LogGalleryEngine::~LogGalleryEngine() {
+    {
+        std::lock_guard<std::mutex> lock(logMutex_);
+        stopping_ = true;
+    }
+    logWake_.notify_all();
+    if (writer_.joinable()) writer_.join();
+    if (compactor_.joinable()) compactor_.join();
+    if (logFd_ >= 0) ::close(logFd_);
+}
+
+std::vector<std::shared_ptr<const GalleryItem>> LogGalleryEngine::load() {
+    // The snapshot is binary unless it was handed over as JSON; either way the file is mapped and read in place
+    std::string path = snapshotPath_;
+    if (!std::filesystem::exists(path) && !legacyPath_.empty() && std::filesystem::exists(legacyPath_)) {
+        path = legacyPath_;
+        migrated_ = true;
+    }
+
+    std::vector<std::shared_ptr<const GalleryItem>> items;
+    std::string error;
+    // Starting from the log alone would compact the snapshot's items away
+    if (std::filesystem::exists(path) && !readGalleryFile(path, items, error)) {
+        throw std::runtime_error("cannot read " + path + ": " + error);
+    }
+    replay(logPath_ + ".old", items);
+    replay(logPath_, items);
+    return items;
+}
+
+void LogGalleryEngine::start(std::function<std::shared_ptr<const GallerySnapshot>()> current) {
+    current_ = std::move(current);
+
+    // A compaction that died after rotating the log: its snapshot may never have been written.
+    // A gallery read from the JSON snapshot gets its binary one now, so the next start skips the parse.
+    std::string rotated = logPath_ + ".old";
+    bool recovering = std::filesystem::exists(rotated);
+    if ((recovering || migrated_) && writeSnapshot(*current_())) {
+        if (recovering) std::filesystem::remove(rotated);
+        if (migrated_) LOG_INFO << "Wrote " << snapshotPath_ << " from " << legacyPath_ << "; the latter is no longer updated";
+    }
+
+    logFd_ = openLog(logPath_);
+    writer_ = std::thread([this] { commitLoop(); });
+}
+
+bool LogGalleryEngine::writeSnapshot(const GallerySnapshot& snapshot) {
+    std::string data = encodeGallery({snapshot.items.begin(), snapshot.items.end()});
+    if (data.empty()) {
+        LOG_ERROR << "Gallery of " << snapshot.items.size() << " items does not fit the snapshot format";
+        return false;
+    }
+    return writeFileAtomically(snapshotPath_, data);
+}
+
+void LogGalleryEngine::replay(const std::string& path, std::vector<std::shared_ptr<const GalleryItem>>& items) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) return;
+
+    std::unique_ptr<Json::CharReader> reader(Json::CharReaderBuilder().newCharReader());
+    std::string line;
+    std::streamoff good = 0;
+    size_t records = 0;
+    while (std::getline(in, line)) {
+        Json::Value record;
+        std::string errs;
+        // A line without its newline is an append the process did not finish; so is one that does not parse
+        if (in.eof() || !reader->parse(line.data(), line.data() + line.size(), &record, &errs) || !record.isMember("put")) {
+            LOG_WARN << "Discarding torn record at offset " << good << " of " << path;
+            std::error_code ec;
+            std::filesystem::resize_file(path, static_cast<uintmax_t>(good), ec);
+            break;
+        }
+        items.push_back(std::make_shared<const GalleryItem>(fromJson(record["put"])));
+        good = in.tellg();
+        ++records;
+    }
+    logRecords_ += records;
+}
+
+uint64_t LogGalleryEngine::write(const GalleryItem& item) {
+    Json::Value record;
+    record["put"] = toJson(item);
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    std::string line = Json::writeString(builder, record);
+    line += '\n';
+
+    std::lock_guard<std::mutex> lock(logMutex_);
+    pendingLog_ += line;
+    ++pendingRecords_;
+    logWake_.notify_one();
+    return ++queuedSequence_;
+}
+
+bool LogGalleryEngine::wait(uint64_t ticket) {
+    std::unique_lock<std::mutex> lock(logMutex_);
+    logDurable_.wait(lock, [this, ticket] { return settledSequence_ >= ticket; });
+    return failed_.erase(ticket) == 0;
+}
+
+void LogGalleryEngine::commitLoop() {
+    std::unique_lock<std::mutex> lock(logMutex_);
+    while (true) {
+        logWake_.wait(lock, [this] { return stopping_ || !pendingLog_.empty(); });
+        if (pendingLog_.empty()) break; // stopping, nothing left to write
+
+        if (!stopping_) {
+            // Let inserts arriving right behind this one share its fsync
+            lock.unlock();
+            std::this_thread::sleep_for(options_.groupCommitWindow);
+            lock.lock();
+        }
+        std::string batch;
+        batch.swap(pendingLog_);
+        size_t records = std::exchange(pendingRecords_, 0);
+        uint64_t first = settledSequence_ + 1;
+        uint64_t sequence = queuedSequence_;
+        lock.unlock();
+
+        bool written;
+        int error = 0;
+        {
+            std::lock_guard<std::mutex> file(fileMutex_);
+            off_t start = logFd_ >= 0 ? ::lseek(logFd_, 0, SEEK_END) : -1;
+            written = start >= 0 && writeAll(logFd_, batch) && ::fsync(logFd_) == 0;
+            if (!written) {
+                error = errno;
+                // Cut off whatever part of the batch did reach the file, so a later batch does not
+                // follow a torn line; if even that fails, no later batch can be trusted to the file
+                if (logFd_ >= 0 && (start < 0 || ::ftruncate(logFd_, start) != 0 || ::fsync(logFd_) != 0)) {
+                    LOG_ERROR << "Failed to roll back " << logPath_ << "; the gallery log is closed until restart";
+                    ::close(logFd_);
+                    logFd_ = -1;
+                }
+            }
+            writtenSequence_ = sequence;
+        }
+        if (!written) LOG_ERROR << "Failed to commit " << records << " gallery records to " << logPath_ << ": " << std::strerror(error);
+        size_t items = current_()->items.size();
+
+        lock.lock();
+        if (written) {
+            logRecords_ += records;
+        } else {
+            for (uint64_t failed = first; failed <= sequence; ++failed) failed_.insert(failed);
+        }
+        settledSequence_ = sequence;
+        logDurable_.notify_all();
+
+        // Rewriting the snapshot costs O(items); doing it once the log is as long keeps inserts O(1) amortised
+        if (!compacting_ && !stopping_ && logRecords_ >= options_.compactMinRecords && logRecords_ >= items) {
+            compacting_ = true;
+            if (compactor_.joinable()) compactor_.join();
+            compactor_ = std::thread([this] { compact(); });
+        }
+    }
+}
+
+void LogGalleryEngine::compact() {
+    std::string rotated = logPath_ + ".old";
+    uint64_t through;
+    {
+        // fileMutex_ keeps a batch from being half written across the rotation
+        std::lock_guard<std::mutex> file(fileMutex_);
+        through = writtenSequence_;
+        if (!std::filesystem::exists(rotated)) {
+            // Renamed while still open, so a failure leaves the log as it was and in use
+            if (std::rename(logPath_.c_str(), rotated.c_str()) != 0) {
+                LOG_ERROR << "Failed to rotate " << logPath_ << ", compaction abandoned: " << std::strerror(errno);
+                std::lock_guard<std::mutex> log(logMutex_);
+                compacting_ = false;
+                return;
+            }
+            if (logFd_ >= 0) ::close(logFd_);
+            logFd_ = openLog(logPath_);
+            syncDirectory(std::filesystem::path(logPath_).parent_path().string());
+            std::lock_guard<std::mutex> log(logMutex_);
+            logRecords_ = 0;
+        }
+    }
+    // A record is published once its writer has seen it commit, a little after it is in the log;
+    // the snapshot must hold every record in the rotated log before it can replace it
+    auto items = current_();
+    for (int waited = 0; items->ticket < through && waited < 5000; ++waited) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        items = current_();
+    }
+
+    if (items->ticket < through) {
+        LOG_WARN << "Gallery snapshot still behind the rotated log; compaction left for later";
+    } else if (writeSnapshot(*items)) {
+        std::error_code ec;
+        std::filesystem::remove(rotated, ec);
+        LOG_INFO << "Compacted gallery log into a snapshot of " << items->items.size() << " items";
+    }
+
+    std::lock_guard<std::mutex> log(logMutex_);
+    compacting_ = false;
+}
+
+}
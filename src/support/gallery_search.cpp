@@ -0,0 +1,153 @@
+#include <support/gallery_search.hpp>
+#include <support/gallery_storage.hpp>
+#include <algorithm>
+#include <unordered_map>
+
+namespace blutography {
+
+static bool isWordByte(unsigned char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80;
+}
+
+std::vector<std::string> tokenize(std::string_view text) {
+    std::vector<std::string> words;
+    std::string word;
+    for (size_t i = 0; i <= text.size(); ++i) {
+        auto c = i < text.size() ? static_cast<unsigned char>(text[i]) : '\0';
+        if (isWordByte(c)) {
+            word += static_cast<char>(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+        } else if (!word.empty()) {
+            words.push_back(std::move(word));
+            word.clear();
+        }
+    }
+    std::sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+    return words;
+}
+
+void GalleryTextIndex::rebuild(const GalleryItems& items) {
+    using Entry = SortedIndex<std::string_view>::Entry;
+    words_.clear();
+    // Most words repeat across items, so postings are grouped by word and only the distinct words
+    // sorted; each entry still views into its own item's list, which outlives every other item's
+    std::unordered_map<std::string_view, std::vector<Entry>> byWord;
+    byWord.reserve(items.size());
+    for (size_t position = 0; position < items.size(); ++position) {
+        ItemWords words{std::make_shared<const Words>(tokenize(items[position]->name)),
+                        std::make_shared<const Words>(tokenize(items[position]->quote))};
+        auto posting = static_cast<uint32_t>(position) << 1;
+        for (const auto& word : *words.name) byWord[word].emplace_back(word, posting | 1);
+        for (const auto& word : *words.quote) byWord[word].emplace_back(word, posting);
+        words_.push_back(std::move(words));
+    }
+    std::vector<std::pair<std::string_view, std::vector<Entry>*>> distinct;
+    distinct.reserve(byWord.size());
+    size_t total = 0;
+    for (auto& [word, postings] : byWord) {
+        distinct.emplace_back(word, &postings);
+        total += postings.size();
+    }
+    std::sort(distinct.begin(), distinct.end());
+    std::vector<Entry> entries;
+    entries.reserve(total);
+    for (const auto& [word, postings] : distinct) {
+        // In position order already, but for a word in both an item's name and its quote
+        std::sort(postings->begin(), postings->end(), [](const Entry& a, const Entry& b) { return a.second < b.second; });
+        entries.insert(entries.end(), postings->begin(), postings->end());
+    }
+    postings_.assign(std::move(entries));
+}
+
+void GalleryTextIndex::add(const Words& words, uint32_t posting) {
+    for (const auto& word : words) postings_.insert(word, posting);
+}
+
+void GalleryTextIndex::remove(const Words& words, uint32_t posting) {
+    for (const auto& word : words) postings_.erase(word, posting);
+}
+
+void GalleryTextIndex::put(const GalleryItem* previous, const GalleryItem& item, size_t position) {
+    auto slot = static_cast<uint32_t>(position);
+    ItemWords words = position < words_.size() ? words_[position] : ItemWords{};
+    if (!previous || !words.name) words = {};
+    // Most replacements are new images or metadata under the same words, and a rename keeps the quote
+    bool sameName = words.name && previous->name == item.name;
+    bool sameQuote = words.quote && previous->quote == item.quote;
+    if (sameName && sameQuote) return;
+
+    if (!sameName) {
+        if (words.name) remove(*words.name, slot << 1 | 1);
+        words.name = std::make_shared<const Words>(tokenize(item.name));
+        add(*words.name, slot << 1 | 1);
+    }
+    if (!sameQuote) {
+        if (words.quote) remove(*words.quote, slot << 1);
+        words.quote = std::make_shared<const Words>(tokenize(item.quote));
+        add(*words.quote, slot << 1);
+    }
+    if (position >= words_.size()) words_.resize(position + 1);
+    words_.set(position, std::move(words));
+}
+
+// A whole word scores 2 and a prefix 1, plus 2 when it is in the name
+static uint32_t score(std::string_view word, const std::string& term, bool inName) {
+    return (word.size() == term.size() ? 2 : 1) + (inName ? 2 : 0);
+}
+
+std::vector<size_t> GalleryTextIndex::search(std::string_view query, size_t limit) const {
+    std::vector<size_t> result;
+    auto terms = tokenize(query);
+    if (terms.empty() || limit == 0) return result;
+
+    // The postings of the words a term prefixes are contiguous; find the shortest such run
+    using Range = std::pair<SortedIndex<std::string_view>::const_iterator, SortedIndex<std::string_view>::const_iterator>;
+    Range narrowest;
+    size_t narrowestTerm = 0;
+    for (size_t i = 0; i < terms.size(); ++i) {
+        const std::string& term = terms[i];
+        auto begin = postings_.partition([&term](const auto& entry) { return entry.first < term; });
+        auto end = postings_.partition([&term](const auto& entry) { return entry.first < term || entry.first.starts_with(term); });
+        if (begin == end) return result;
+        if (i == 0 || end - begin < narrowest.second - narrowest.first) {
+            narrowest = {begin, end};
+            narrowestTerm = i;
+        }
+    }
+
+    // (position, score) of the candidates, best score per position
+    std::vector<std::pair<uint32_t, uint32_t>> hits;
+    for (auto it = narrowest.first; it != narrowest.second; ++it) {
+        hits.emplace_back(it->second >> 1, score(it->first, terms[narrowestTerm], it->second & 1));
+    }
+    std::sort(hits.begin(), hits.end());
+    auto last = std::unique(hits.rbegin(), hits.rend(), [](const auto& a, const auto& b) { return a.first == b.first; });
+    hits.erase(hits.begin(), last.base());
+
+    // The other terms are checked against each candidate's own words rather than walking their runs
+    for (size_t i = 0; i < terms.size(); ++i) {
+        if (i == narrowestTerm) continue;
+        const std::string& term = terms[i];
+        std::erase_if(hits, [&](auto& hit) {
+            const ItemWords& words = words_[hit.first];
+            uint32_t best = 0;
+            for (const auto& word : *words.name) {
+                if (word.starts_with(term)) best = std::max(best, score(word, term, true));
+            }
+            for (const auto& word : *words.quote) {
+                if (word.starts_with(term)) best = std::max(best, score(word, term, false));
+            }
+            hit.second += best;
+            return best == 0;
+        });
+    }
+
+    auto better = [](const auto& a, const auto& b) { return a.second != b.second ? a.second > b.second : a.first > b.first; };
+    size_t keep = std::min(limit, hits.size());
+    std::partial_sort(hits.begin(), hits.begin() + keep, hits.end(), better);
+    result.reserve(keep);
+    for (size_t i = 0; i < keep; ++i) result.push_back(hits[i].first);
+    return result;
+}
+
+}
@@ -0,0 +1,166 @@
+#include <support/gallery_sqlite_engine.hpp>
+#include <support/gallery_storage.hpp>
+#include <support/gallery_file.hpp>
+#include <atomic>
+#include <stdexcept>
+#include <utility>
+#include <drogon/drogon.h>
+#include <drogon/orm/Exception.h>
+
+namespace blutography {
+
+using drogon::orm::DrogonDbException;
+using drogon::orm::Result;
+
+// An edit keeps the row, and with it the item's place in insertion order
+static constexpr const char* upsertSql =
+    "INSERT INTO gallery_items (id, content_hash, data) VALUES (?, ?, ?) "
+    "ON CONFLICT(id) DO UPDATE SET content_hash = excluded.content_hash, data = excluded.data";
+static constexpr const char* selectSql = "SELECT data FROM gallery_items ORDER BY position";
+
+SqliteGalleryEngine::SqliteGalleryEngine(std::string databasePath, std::unique_ptr<GalleryEngine> seed)
+    : databasePath_(std::move(databasePath)), seed_(std::move(seed)) {}
+
+SqliteGalleryEngine::~SqliteGalleryEngine() {
+    // Writers are gone by now; let the transactions already sent finish before the client goes
+    std::unique_lock<std::mutex> lock(mutex_);
+    durable_.wait(lock, [this] { return settledSequence_ >= queuedSequence_; });
+}
+
+bool SqliteGalleryEngine::open() {
+    try {
+        client_ = drogon::orm::DbClient::newSqlite3Client("filename=" + databasePath_, 1);
+        client_->execSqlSync("PRAGMA journal_mode = WAL");
+        client_->execSqlSync("PRAGMA synchronous = FULL");
+        client_->execSqlSync("CREATE TABLE IF NOT EXISTS gallery_items ("
+                             "position INTEGER PRIMARY KEY, id TEXT NOT NULL UNIQUE, content_hash TEXT NOT NULL, data TEXT NOT NULL)");
+        client_->execSqlSync("CREATE INDEX IF NOT EXISTS gallery_items_content_hash ON gallery_items (content_hash)");
+        return true;
+    } catch (const DrogonDbException& e) {
+        LOG_ERROR << "Failed to open " << databasePath_ << ": " << e.base().what();
+        client_.reset();
+        return false;
+    }
+}
+
+static std::string encodeRow(const GalleryItem& item) {
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    return Json::writeString(builder, toJson(item));
+}
+
+std::vector<std::shared_ptr<const GalleryItem>> SqliteGalleryEngine::load() {
+    std::vector<std::shared_ptr<const GalleryItem>> items;
+    if (!open()) throw std::runtime_error("cannot open " + databasePath_);
+
+    try {
+        Result rows = client_->execSqlSync(selectSql);
+        items.reserve(rows.size());
+        std::unique_ptr<Json::CharReader> reader(Json::CharReaderBuilder().newCharReader());
+        for (const auto& row : rows) {
+            std::string data = row["data"].as<std::string>();
+            Json::Value value;
+            std::string errs;
+            if (!reader->parse(data.data(), data.data() + data.size(), &value, &errs)) {
+                LOG_ERROR << "Skipping unreadable gallery row in " << databasePath_ << ": " << errs;
+                continue;
+            }
+            items.push_back(std::make_shared<const GalleryItem>(fromJson(value)));
+        }
+    } catch (const DrogonDbException& e) {
+        throw std::runtime_error("cannot read " + databasePath_ + ": " + e.base().what());
+    }
+
+    // The seed is kept until it is in the database, so a start that could not import it tries again
+    if (items.empty() && seed_) items = import();
+    seed_.reset();
+    return items;
+}
+
+std::vector<std::shared_ptr<const GalleryItem>> SqliteGalleryEngine::import() {
+    auto items = seed_->load();
+    if (items.empty()) return items;
+
+    // One transaction: a crash half way leaves the database empty, and the next start imports again
+    try {
+        auto transaction = client_->newTransaction();
+        for (const auto& item : items) transaction->execSqlSync(upsertSql, item->id, item->contentHash, encodeRow(*item));
+    } catch (const DrogonDbException& e) {
+        throw std::runtime_error(std::string("cannot import the ") + seed_->name() + " gallery into " + databasePath_ + ": " + e.base().what());
+    }
+    LOG_INFO << "Imported " << items.size() << " gallery records from the " << seed_->name() << " engine into "
+             << databasePath_ << "; its files are no longer updated";
+    return items;
+}
+
+uint64_t SqliteGalleryEngine::write(const GalleryItem& item) {
+    Row row{item.id, item.contentHash, encodeRow(item)};
+    std::vector<Row> batch;
+    uint64_t sequence;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.push_back(std::move(row));
+        sequence = ++queuedSequence_;
+        if (sending_) return sequence; // goes out with the next transaction
+        sending_ = true;
+        batch.swap(pending_);
+    }
+    send(std::move(batch), sequence);
+    return sequence;
+}
+
+bool SqliteGalleryEngine::wait(uint64_t ticket) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    durable_.wait(lock, [this, ticket] { return settledSequence_ >= ticket; });
+    return failed_.erase(ticket) == 0;
+}
+
+void SqliteGalleryEngine::send(std::vector<Row> rows, uint64_t sequence) {
+    size_t count = rows.size();
+    if (!client_) {
+        settle(sequence, count, false);
+        return;
+    }
+
+    // A failed statement rolls the transaction back without a commit callback; whichever comes first settles
+    auto settled = std::make_shared<std::atomic<bool>>(false);
+    auto once = [this, settled, sequence, count](bool committed) {
+        if (!settled->exchange(true)) settle(sequence, count, committed);
+    };
+    client_->newTransactionAsync([rows = std::move(rows), once](const std::shared_ptr<drogon::orm::Transaction>& transaction) {
+        if (!transaction) {
+            once(false);
+            return;
+        }
+        transaction->setCommitCallback(once);
+        for (const auto& row : rows) {
+            transaction->execSqlAsync(upsertSql, [](const Result&) {}, [once](const DrogonDbException&) { once(false); },
+                                      row.id, row.contentHash, row.data);
+        }
+        // The transaction commits once the last reference to it, held by the statements, is gone
+    });
+}
+
+void SqliteGalleryEngine::settle(uint64_t sequence, size_t rows, bool committed) {
+    if (!committed) LOG_ERROR << "Failed to commit " << rows << " gallery records to " << databasePath_;
+    std::vector<Row> batch;
+    uint64_t next;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // A transaction carries the rows queued since the one before it, so its tickets run up to `sequence`
+        if (!committed) {
+            for (uint64_t failed = sequence - rows + 1; failed <= sequence; ++failed) failed_.insert(failed);
+        }
+        settledSequence_ = sequence;
+        durable_.notify_all();
+        if (pending_.empty()) {
+            sending_ = false;
+            return;
+        }
+        batch.swap(pending_);
+        next = queuedSequence_;
+    }
+    send(std::move(batch), next);
+}
+
+}
@@ -1,90 +1,210 @@
 #include <support/gallery_storage.hpp>
-#include <fstream>
+#include <support/gallery_log_engine.hpp>
+#include <support/gallery_sqlite_engine.hpp>
+#include <chrono>
+#include <utility>
 #include <drogon/drogon.h>
 
 namespace blutography {
 
+std::shared_ptr<const GalleryItem> GallerySnapshot::find(std::string_view id) const {
+    const size_t* position = byId.find(id);
+    return position ? items[*position] : nullptr;
+}
+
+std::vector<std::shared_ptr<const GalleryItem>> GallerySnapshot::query(const GalleryQuery& query) const {
+    std::vector<std::shared_ptr<const GalleryItem>> result;
+    for (size_t position : indexes->query(query)) result.push_back(items[position]);
+    return result;
+}
+
+std::vector<std::shared_ptr<const GalleryItem>> GallerySnapshot::search(std::string_view text, size_t limit) const {
+    std::vector<std::shared_ptr<const GalleryItem>> result;
+    for (size_t position : this->text->search(text, limit)) result.push_back(items[position]);
+    return result;
+}
+
 GalleryStorage& GalleryStorage::instance() {
-    static GalleryStorage inst;
+    static GalleryStorage inst([] () -> std::unique_ptr<GalleryEngine> {
+        const auto& config = drogon::app().getCustomConfig()["gallery"];
+        std::string engine = config.get("engine", "log").asString();
+        auto log = std::make_unique<LogGalleryEngine>("gallery_data.bin", "gallery_data.log", "gallery_data.json");
+        if (engine == "sqlite") {
+            // The log engine's files are only read, once, to seed an empty database
+            return std::make_unique<SqliteGalleryEngine>(config["sqlite"].get("file", "gallery.db").asString(), std::move(log));
+        }
+        if (engine != "log") LOG_WARN << "Unknown gallery engine \"" << engine << "\", using the log";
+        return log;
+    }());
     return inst;
 }
 
-GalleryStorage::GalleryStorage() {
-    load();
+GalleryStorage::GalleryStorage(std::string storagePath, std::string logPath, std::string legacyPath)
+    : GalleryStorage(std::make_unique<LogGalleryEngine>(std::move(storagePath), std::move(logPath), std::move(legacyPath))) {}
+
+GalleryStorage::GalleryStorage(std::unique_ptr<GalleryEngine> engine) : engine_(std::move(engine)) {
+    auto started = std::chrono::steady_clock::now();
+    auto items = engine_->load();
+    auto draft = std::make_shared<GallerySnapshot>();
+    draft->byId.reserve(items.size());
+    draft->byHash.reserve(items.size());
+    // Earlier builds appended duplicates under the same id, and logs replay edits; the last one wins
+    for (auto& item : items) place(*draft, std::move(item));
+
+    // Sorted once here; placing items one at a time into sorted indexes would be quadratic
+    auto indexes = std::make_shared<GalleryIndexes>();
+    indexes->rebuild(draft->items);
+    draft->indexes = std::move(indexes);
+    auto text = std::make_shared<GalleryTextIndex>();
+    text->rebuild(draft->items);
+    draft->text = std::move(text);
+    publish(draft);
+    LOG_INFO << "Loaded " << draft->items.size() << " gallery items from the " << engine_->name() << " engine in "
+             << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count() << " ms";
+
+    engine_->start([this] { return snapshot(); });
 }
 
-void GalleryStorage::addItem(const GalleryItem& item) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    items_.push_back(item);
-    save();
+GalleryStorage::~GalleryStorage() = default;
+
+std::shared_ptr<const GallerySnapshot> GalleryStorage::snapshot() const {
+    return snapshot_.load();
 }
 
-std::vector<GalleryItem> GalleryStorage::getAllItems() {
+void GalleryStorage::publish(std::shared_ptr<const GallerySnapshot> next) {
+    snapshot_.store(std::move(next));
+    for (const auto& [id, listener] : watchers_) listener();
+}
+
+size_t GalleryStorage::watch(std::function<void()> listener) {
     std::lock_guard<std::mutex> lock(mutex_);
-    return items_;
+    watchers_.emplace(nextWatcher_, std::move(listener));
+    return nextWatcher_++;
 }
 
-std::optional<GalleryItem> GalleryStorage::getItem(const std::string& id) {
+void GalleryStorage::unwatch(size_t id) {
     std::lock_guard<std::mutex> lock(mutex_);
-    for (const auto& item : items_) {
-        if (item.id == id) return item;
+    watchers_.erase(id);
+}
+
+bool GalleryStorage::addItem(const GalleryItem& item) {
+    uint64_t ticket;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ticket = write(std::make_shared<const GalleryItem>(item));
     }
-    return std::nullopt;
+    return settle(ticket, engine_->wait(ticket));
 }
 
-void GalleryStorage::load() {
-    std::ifstream ifile(storagePath_);
-    if (!ifile.is_open()) return;
+uint64_t GalleryStorage::write(std::shared_ptr<const GalleryItem> item) {
+    // Called with mutex_ held, so tickets and pending_ share one order
+    uint64_t ticket = engine_->write(*item);
+    pending_.push_back({ticket, std::move(item)});
+    return ticket;
+}
 
-    Json::Value root;
-    Json::CharReaderBuilder builder;
-    std::string errs;
-    if (!Json::parseFromStream(builder, ifile, &root, &errs)) {
-        LOG_ERROR << "Failed to parse gallery_data.json: " << errs;
-        return;
+bool GalleryStorage::settle(uint64_t ticket, bool committed) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (auto& write : pending_) {
+        if (write.ticket == ticket) {
+            write.state = committed ? PendingWrite::State::Committed : PendingWrite::State::Failed;
+            break;
+        }
     }
+    if (!committed) LOG_ERROR << "Gallery item " << ticket << " was not stored by the " << engine_->name() << " engine";
 
-    items_.clear();
-    for (const auto& jItem : root) {
-        GalleryItem item;
-        item.id = jItem["id"].asString();
-        item.name = jItem["name"].asString();
-        item.quote = jItem["quote"].asString();
-        item.fileName = jItem["fileName"].asString();
-        item.previewName = jItem["previewName"].asString();
-        item.metadata.dateTime = jItem["metadata"]["dateTime"].asString();
-        item.metadata.model = jItem["metadata"]["model"].asString();
-        item.metadata.exposure = jItem["metadata"].get("exposure", "[null]").asString();
-        item.metadata.iso = jItem["metadata"].get("iso", "[null]").asString();
-        item.metadata.width = jItem["metadata"]["width"].asInt();
-        item.metadata.height = jItem["metadata"]["height"].asInt();
-        items_.push_back(item);
+    // Writes settle in ticket order inside the engine, but their callers get here in any order;
+    // whoever finds the front settled publishes every settled write behind it in one snapshot
+    if (pending_.front().state != PendingWrite::State::Waiting) {
+        auto current = snapshot();
+        auto next = std::make_shared<GallerySnapshot>(*current);
+        std::shared_ptr<GalleryIndexes> indexes;
+        std::shared_ptr<GalleryTextIndex> text;
+        while (!pending_.empty() && pending_.front().state != PendingWrite::State::Waiting) {
+            PendingWrite write = std::move(pending_.front());
+            pending_.pop_front();
+            next->ticket = write.ticket;
+            if (write.state == PendingWrite::State::Failed) continue;
+            if (!indexes) {
+                indexes = std::make_shared<GalleryIndexes>(*current->indexes);
+                text = std::make_shared<GalleryTextIndex>(*current->text);
+            }
+            // Index keys view into the stored copy; keep the one replaced alive until its keys are gone
+            auto previous = next->find(write.item->id);
+            place(*next, write.item);
+            size_t position = *next->byId.find(write.item->id);
+            indexes->put(previous.get(), *write.item, position);
+            text->put(previous.get(), *write.item, position);
+        }
+        // A snapshot that only moves past failed writes shows the same items under the same version
+        if (indexes) {
+            next->indexes = std::move(indexes);
+            next->text = std::move(text);
+            next->version = current->version + 1;
+        }
+        publish(std::move(next));
+        published_.notify_all();
     }
+    // Return once the write is visible, as it was before the engine got it
+    published_.wait(lock, [this, ticket] { return snapshot()->ticket >= ticket; });
+    return committed;
 }
 
-void GalleryStorage::save() {
-    Json::Value root(Json::arrayValue);
-    for (const auto& item : items_) {
-        Json::Value jItem;
-        jItem["id"] = item.id;
-        jItem["name"] = item.name;
-        jItem["quote"] = item.quote;
-        jItem["fileName"] = item.fileName;
-        jItem["previewName"] = item.previewName;
-        jItem["metadata"]["dateTime"] = item.metadata.dateTime;
-        jItem["metadata"]["model"] = item.metadata.model;
-        jItem["metadata"]["exposure"] = item.metadata.exposure;
-        jItem["metadata"]["iso"] = item.metadata.iso;
-        jItem["metadata"]["width"] = item.metadata.width;
-        jItem["metadata"]["height"] = item.metadata.height;
-        root.append(jItem);
+void GalleryStorage::place(GallerySnapshot& draft, std::shared_ptr<const GalleryItem> item) {
+    size_t position;
+    if (const size_t* existing = draft.byId.find(item->id)) {
+        position = *existing;
+        // The keys view into the item being replaced; re-key them on the new one
+        const auto& previous = *draft.items[position];
+        draft.byId.erase(previous.id);
+        if (!previous.contentHash.empty()) draft.byHash.erase(previous.contentHash);
+        draft.items.set(position, std::move(item));
+    } else {
+        position = draft.items.size();
+        draft.items.push_back(std::move(item));
     }
+    const auto& placed = *draft.items[position];
+    draft.byId.insert_or_assign(placed.id, position);
+    if (!placed.contentHash.empty()) draft.byHash.insert_or_assign(placed.contentHash, position);
+}
+
+std::shared_ptr<const GalleryItem> GalleryStorage::getItem(const std::string& id) const {
+    return snapshot()->find(id);
+}
+
+std::shared_ptr<const GalleryItem> GalleryStorage::findByHash(const std::string& contentHash) const {
+    auto current = snapshot();
+    if (const size_t* position = current->byHash.find(contentHash)) return current->items[*position];
+
+    // Items stored before the full hash was recorded only have the 12-digit id
+    auto legacy = current->find(std::string_view(contentHash).substr(0, 12));
+    if (legacy && legacy->contentHash.empty()) return legacy;
+    return nullptr;
+}
 
-    std::ofstream ofile(storagePath_);
-    if (ofile.is_open()) {
-        Json::StreamWriterBuilder builder;
-        ofile << Json::writeString(builder, root);
+std::shared_ptr<const GalleryItem> GalleryStorage::updateDetails(const std::string& id, const std::optional<std::string>& name,
+                                                                 const std::optional<std::string>& quote) {
+    std::shared_ptr<const GalleryItem> updated;
+    uint64_t ticket = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // A version still being written is newer than the published one; build on it so neither change is lost
+        for (auto it = pending_.rbegin(); it != pending_.rend() && !updated; ++it) {
+            if (it->item->id == id && it->state != PendingWrite::State::Failed) updated = it->item;
+        }
+        if (!updated) updated = snapshot()->find(id);
+        if (!updated) return nullptr;
+        bool changed = (name && *name != updated->name) || (quote && *quote != updated->quote);
+        if (changed) {
+            auto item = std::make_shared<GalleryItem>(*updated);
+            if (name) item->name = *name;
+            if (quote) item->quote = *quote;
+            updated = item;
+            ticket = write(updated);
+        }
     }
+    if (ticket && !settle(ticket, engine_->wait(ticket))) return nullptr;
+    return updated;
 }
 
 }
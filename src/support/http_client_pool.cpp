@@ -0,0 +1,150 @@
+#include <support/http_client_pool.hpp>
+#include <drogon/drogon.h>
+#include <algorithm>
+
+namespace blutography {
+
+HttpClientPool::HttpClientPool(HttpClientPoolOptions options) : options_(options) {
+    options_.maxPerHost = std::max<size_t>(1, options_.maxPerHost);
+    options_.pipelining = std::max<size_t>(1, options_.pipelining);
+    options_.idleTimeout = std::max(options_.idleTimeout, std::chrono::seconds(1));
+}
+
+trantor::EventLoop* HttpClientPool::pickLoop() {
+    auto& app = drogon::app();
+    auto* current = trantor::EventLoop::getEventLoopOfCurrentThread();
+    if (current && current == app.getLoop()) return current;
+    size_t threads = app.getThreadNum();
+    for (size_t i = 0; i < threads; ++i) {
+        if (app.getIOLoop(i) == current) return current;
+    }
+    // Off the IO loops (the part queue, the image executor): spread over them
+    static std::atomic<size_t> next{0};
+    auto* loop = threads > 0 ? app.getIOLoop(next++ % threads) : nullptr;
+    return loop ? loop : app.getLoop(); // before run() there are no IO loops yet
+}
+
+std::shared_ptr<HttpClientPool::Connection> HttpClientPool::acquire(const std::string& host, const drogon::HttpRequestPtr& req,
+                                                                    drogon::HttpReqCallback& callback) {
+    bool idempotent = req->method() == drogon::Get || req->method() == drogon::Head;
+    auto* loop = pickLoop();
+    Key key{host, loop};
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& pool = connections_[key];
+
+    std::shared_ptr<Connection> chosen, leastBusy;
+    for (const auto& connection : pool) {
+        if (connection->inFlight == 0) {
+            chosen = connection;
+            break;
+        }
+        if (!connection->unsafeInFlight && connection->inFlight < options_.pipelining
+            && (!leastBusy || connection->inFlight < leastBusy->inFlight)) {
+            leastBusy = connection;
+        }
+    }
+    if (!chosen && idempotent && leastBusy && pool.size() >= options_.maxPerHost) {
+        chosen = leastBusy;
+        ++pipelined_;
+    }
+    if (!chosen && !idempotent && pool.size() >= options_.maxPerHost) {
+        // release() hands it the next connection to come free
+        waiting_[key].push_back({req, std::move(callback)});
+        ++queued_;
+        return nullptr;
+    }
+    if (!chosen) {
+        chosen = std::make_shared<Connection>();
+        chosen->key = key;
+        chosen->loop = loop;
+        chosen->client = drogon::HttpClient::newHttpClient(host, loop);
+        chosen->client->setPipeliningDepth(options_.pipelining);
+        // Called for every socket the client opens, so reconnects after the server hung up count too
+        chosen->client->setSockOptCallback([weak = weak_from_this()](int) {
+            if (auto self = weak.lock()) ++self->handshakes_;
+        });
+        pool.push_back(chosen);
+    }
+    ++chosen->inFlight;
+    if (!idempotent) chosen->unsafeInFlight = true;
+    chosen->lastUsed = std::chrono::steady_clock::now();
+
+    if (!sweeping_) {
+        sweeping_ = true;
+        drogon::app().getLoop()->runEvery(std::chrono::duration<double>(options_.idleTimeout), [weak = weak_from_this()] {
+            if (auto self = weak.lock()) self->sweep();
+        });
+    }
+    return chosen;
+}
+
+void HttpClientPool::release(const std::shared_ptr<Connection>& connection) {
+    Waiting next;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --connection->inFlight;
+        connection->unsafeInFlight = false; // nothing was sent alongside it
+        connection->lastUsed = std::chrono::steady_clock::now();
+        auto waiting = waiting_.find(connection->key);
+        if (connection->inFlight > 0 || waiting == waiting_.end()) return;
+        next = std::move(waiting->second.front());
+        waiting->second.pop_front();
+        if (waiting->second.empty()) waiting_.erase(waiting);
+        ++connection->inFlight;
+        connection->unsafeInFlight = true;
+    }
+    dispatch(connection, next.req, std::move(next.callback));
+}
+
+void HttpClientPool::dispatch(const std::shared_ptr<Connection>& connection, const drogon::HttpRequestPtr& req,
+                              drogon::HttpReqCallback&& callback) {
+    connection->client->sendRequest(req, [self = shared_from_this(), connection, callback = std::move(callback)](
+                                             drogon::ReqResult result, const drogon::HttpResponsePtr& resp) {
+        self->release(connection);
+        callback(result, resp);
+    });
+}
+
+void HttpClientPool::send(const std::string& host, const drogon::HttpRequestPtr& req, drogon::HttpReqCallback&& callback) {
+    ++requests_;
+    if (auto connection = acquire(host, req, callback)) dispatch(connection, req, std::move(callback));
+}
+
+void HttpClientPool::sweep() {
+    std::vector<std::shared_ptr<Connection>> idle;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto cutoff = std::chrono::steady_clock::now() - options_.idleTimeout;
+        for (auto it = connections_.begin(); it != connections_.end();) {
+            std::erase_if(it->second, [&](const std::shared_ptr<Connection>& connection) {
+                if (connection->inFlight > 0 || connection->lastUsed > cutoff) return false;
+                idle.push_back(connection);
+                return true;
+            });
+            it = it->second.empty() ? connections_.erase(it) : std::next(it);
+        }
+    }
+    if (idle.empty()) return;
+    evicted_ += idle.size();
+    LOG_DEBUG << "Closing " << idle.size() << " idle HTTP connections";
+    // A client is torn down on the loop it runs on
+    for (auto& connection : idle) {
+        auto* loop = connection->loop;
+        loop->queueInLoop([connection = std::move(connection)] {});
+    }
+}
+
+size_t HttpClientPool::connections() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t count = 0;
+    for (const auto& [key, pool] : connections_) count += pool.size();
+    return count;
+}
+
+double HttpClientPool::reuseRatio() const {
+    uint64_t requests = requests_.load();
+    if (requests == 0) return 0.0;
+    return 1.0 - static_cast<double>(std::min(handshakes_.load(), requests)) / static_cast<double>(requests);
+}
+
+}
@@ -0,0 +1,363 @@
+#include <support/image_decoders.hpp>
+#include <support/exif.hpp>
+#include <drogon/drogon.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#ifdef BLUTOGRAPHY_HAVE_PNG
+#include <png.h>
+#endif
+#ifdef BLUTOGRAPHY_HAVE_TIFF
+#include <tiffio.h>
+#endif
+#ifdef BLUTOGRAPHY_HAVE_HEIF
+#include <libheif/heif.h>
+#endif
+
+namespace blutography::image {
+
+// Refuse to allocate for anything larger; a small compressed file can claim huge dimensions.
+static constexpr uint64_t kMaxPixels = 1ull << 28; // 268 MP
+
+static uint32_t readBe32(const unsigned char* data) {
+    return (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) | (uint32_t(data[2]) << 8) | data[3];
+}
+
+[[maybe_unused]] static bool sizeAllowed(uint64_t width, uint64_t height) {
+    return width > 0 && height > 0 && width * height <= kMaxPixels;
+}
+
+// Composites straight alpha onto white while packing RGBA down to RGB.
+[[maybe_unused]] static void compositeRgba(const unsigned char* src, unsigned char* dst, size_t count) {
+    for (size_t i = 0; i < count; ++i, src += 4, dst += 3) {
+        unsigned a = src[3];
+        dst[0] = static_cast<unsigned char>((src[0] * a + 255 * (255 - a) + 127) / 255);
+        dst[1] = static_cast<unsigned char>((src[1] * a + 255 * (255 - a) + 127) / 255);
+        dst[2] = static_cast<unsigned char>((src[2] * a + 255 * (255 - a) + 127) / 255);
+    }
+}
+
+// Wraps a bare EXIF TIFF payload in an APP1 segment so it can be spliced into the JPEG preview.
+[[maybe_unused]] static std::string wrapExif(std::string_view tiff, bool resetOrientation) {
+    size_t length = 2 + 6 + tiff.size();
+    if (tiff.size() < 8 || length > 0xFFFF) return {};
+    std::string segment;
+    segment.reserve(2 + length);
+    segment.push_back(static_cast<char>(0xFF));
+    segment.push_back(static_cast<char>(0xE1));
+    segment.push_back(static_cast<char>(length >> 8));
+    segment.push_back(static_cast<char>(length & 0xFF));
+    segment.append("Exif\0\0", 6);
+    segment.append(tiff);
+    if (!resetOrientation) return segment;
+    return exif::sanitize(segment, true, false);
+}
+
+Container sniffContainer(std::string_view data) {
+    const auto* p = reinterpret_cast<const unsigned char*>(data.data());
+    if (data.size() >= 3 && p[0] == 0xFF && p[1] == 0xD8 && p[2] == 0xFF) return Container::Jpeg;
+    if (data.size() >= 8 && std::memcmp(p, "\x89PNG\r\n\x1a\n", 8) == 0) return Container::Png;
+    if (data.size() >= 4 && (std::memcmp(p, "II*\0", 4) == 0 || std::memcmp(p, "MM\0*", 4) == 0)) return Container::Tiff;
+    if (data.size() >= 12 && std::memcmp(p + 4, "ftyp", 4) == 0) {
+        std::string_view brand = data.substr(8, 4);
+        for (std::string_view known : {"heic", "heix", "heim", "heis", "hevc", "hevx", "mif1", "msf1", "avif"}) {
+            if (brand == known) return Container::Heif;
+        }
+    }
+    return Container::Unknown;
+}
+
+bool canDecode(Container container) {
+    switch (container) {
+        case Container::Jpeg: return true;
+#ifdef BLUTOGRAPHY_HAVE_PNG
+        case Container::Png: return true;
+#endif
+#ifdef BLUTOGRAPHY_HAVE_TIFF
+        case Container::Tiff: return true;
+#endif
+#ifdef BLUTOGRAPHY_HAVE_HEIF
+        case Container::Heif: return true;
+#endif
+        default: return false;
+    }
+}
+
+// PNG: the chunk list is walked directly for IHDR and eXIf, which libpng's
+// simplified API does not expose. Nothing is copied.
+static bool readPngInfo(std::string_view data, Metadata& meta, std::string_view& exifTiff) {
+    const auto* p = reinterpret_cast<const unsigned char*>(data.data());
+    size_t pos = 8;
+    bool haveHeader = false;
+    while (pos + 12 <= data.size()) {
+        uint32_t length = readBe32(p + pos);
+        std::string_view type = data.substr(pos + 4, 4);
+        if (length > data.size() - pos - 12) break;
+        const unsigned char* body = p + pos + 8;
+
+        if (type == "IHDR" && length >= 8) {
+            meta.width = static_cast<int>(readBe32(body));
+            meta.height = static_cast<int>(readBe32(body + 4));
+            haveHeader = true;
+        } else if (type == "eXIf") {
+            exifTiff = data.substr(pos + 8, length);
+            exif::parse(exifTiff, meta);
+        } else if (type == "IEND") {
+            break;
+        }
+        pos += 12 + static_cast<size_t>(length);
+    }
+    return haveHeader;
+}
+
+#ifdef BLUTOGRAPHY_HAVE_TIFF
+namespace {
+    // Read-only libtiff client over an in-memory file; the map callback hands
+    // libtiff the buffer itself so strips are read without copying.
+    struct MemoryTiff {
+        const char* data;
+        toff_t size;
+        toff_t pos = 0;
+
+        static tmsize_t read(thandle_t h, void* buf, tmsize_t n) {
+            auto* m = static_cast<MemoryTiff*>(h);
+            if (m->pos >= m->size) return 0;
+            tmsize_t count = static_cast<tmsize_t>(std::min<toff_t>(static_cast<toff_t>(n), m->size - m->pos));
+            std::memcpy(buf, m->data + m->pos, count);
+            m->pos += count;
+            return count;
+        }
+        static tmsize_t write(thandle_t, void*, tmsize_t) { return -1; }
+        static toff_t seek(thandle_t h, toff_t off, int whence) {
+            auto* m = static_cast<MemoryTiff*>(h);
+            switch (whence) {
+                case SEEK_SET: m->pos = off; break;
+                case SEEK_CUR: m->pos += off; break;
+                case SEEK_END: m->pos = m->size + off; break;
+            }
+            return m->pos;
+        }
+        static int close(thandle_t) { return 0; }
+        static toff_t sizeOf(thandle_t h) { return static_cast<MemoryTiff*>(h)->size; }
+        static int map(thandle_t h, void** base, toff_t* size) {
+            auto* m = static_cast<MemoryTiff*>(h);
+            *base = const_cast<char*>(m->data);
+            *size = m->size;
+            return 1;
+        }
+        static void unmap(thandle_t, void*, toff_t) {}
+    };
+
+    struct TiffCloser {
+        void operator()(TIFF* tif) const { TIFFClose(tif); }
+    };
+
+    std::unique_ptr<TIFF, TiffCloser> openTiff(MemoryTiff& stream) {
+        return std::unique_ptr<TIFF, TiffCloser>(TIFFClientOpen("memory", "r", &stream,
+            MemoryTiff::read, MemoryTiff::write, MemoryTiff::seek, MemoryTiff::close,
+            MemoryTiff::sizeOf, MemoryTiff::map, MemoryTiff::unmap));
+    }
+}
+#endif
+
+#ifdef BLUTOGRAPHY_HAVE_HEIF
+namespace {
+    struct HeifDeleter {
+        void operator()(heif_context* ctx) const { heif_context_free(ctx); }
+        void operator()(heif_image_handle* handle) const { heif_image_handle_release(handle); }
+        void operator()(heif_image* image) const { heif_image_release(image); }
+    };
+
+    // The primary image's EXIF block, without libheif's 4-byte offset prefix.
+    std::string heifExif(heif_image_handle* handle) {
+        heif_item_id id;
+        if (heif_image_handle_get_list_of_metadata_block_IDs(handle, "Exif", &id, 1) < 1) return {};
+        size_t size = heif_image_handle_get_metadata_size(handle, id);
+        if (size < 4) return {};
+        std::string block(size, '\0');
+        if (heif_image_handle_get_metadata(handle, id, block.data()).code != heif_error_Ok) return {};
+        uint32_t offset = readBe32(reinterpret_cast<const unsigned char*>(block.data()));
+        if (offset > size - 4) return {};
+        return block.substr(4 + offset);
+    }
+
+    bool openHeif(std::string_view data, std::unique_ptr<heif_context, HeifDeleter>& ctx,
+                  std::unique_ptr<heif_image_handle, HeifDeleter>& handle) {
+        ctx.reset(heif_context_alloc());
+        if (!ctx) return false;
+        heif_error err = heif_context_read_from_memory_without_copy(ctx.get(), data.data(), data.size(), nullptr);
+        if (err.code != heif_error_Ok) {
+            LOG_ERROR << "libheif could not read the container: " << err.message;
+            return false;
+        }
+        heif_image_handle* primary = nullptr;
+        if (heif_context_get_primary_image_handle(ctx.get(), &primary).code != heif_error_Ok) return false;
+        handle.reset(primary);
+        return true;
+    }
+}
+#endif
+
+bool readImageInfo(Container container, std::string_view data, Metadata& meta) {
+    switch (container) {
+        case Container::Png: {
+            std::string_view exifTiff;
+            return readPngInfo(data, meta, exifTiff);
+        }
+        case Container::Tiff: {
+            // A TIFF file is itself an EXIF-style IFD chain
+            exif::parse(data, meta);
+#ifdef BLUTOGRAPHY_HAVE_TIFF
+            MemoryTiff stream{data.data(), data.size()};
+            auto tif = openTiff(stream);
+            if (!tif) return false;
+            uint32_t width = 0, height = 0;
+            TIFFGetField(tif.get(), TIFFTAG_IMAGEWIDTH, &width);
+            TIFFGetField(tif.get(), TIFFTAG_IMAGELENGTH, &height);
+            meta.width = static_cast<int>(width);
+            meta.height = static_cast<int>(height);
+            return true;
+#else
+            return false;
+#endif
+        }
+        case Container::Heif: {
+#ifdef BLUTOGRAPHY_HAVE_HEIF
+            std::unique_ptr<heif_context, HeifDeleter> ctx;
+            std::unique_ptr<heif_image_handle, HeifDeleter> handle;
+            if (!openHeif(data, ctx, handle)) return false;
+            meta.width = heif_image_handle_get_width(handle.get());
+            meta.height = heif_image_handle_get_height(handle.get());
+            std::string tiff = heifExif(handle.get());
+            if (!tiff.empty()) exif::parse(tiff, meta);
+            meta.orientation = 1; // libheif applies irot/imir itself
+            return true;
+#else
+            return false;
+#endif
+        }
+        default:
+            return false;
+    }
+}
+
+bool decodeImage(Container container, [[maybe_unused]] std::string_view data, Workspace& ws, [[maybe_unused]] Metadata& meta) {
+    ws.exif.clear();
+    switch (container) {
+#ifdef BLUTOGRAPHY_HAVE_PNG
+        case Container::Png: {
+            std::string_view exifTiff;
+            if (!readPngInfo(data, meta, exifTiff)) return false;
+            if (!exifTiff.empty()) ws.exif = wrapExif(exifTiff, false);
+
+            png_image image;
+            std::memset(&image, 0, sizeof(image));
+            image.version = PNG_IMAGE_VERSION;
+            if (!png_image_begin_read_from_memory(&image, data.data(), data.size())) {
+                LOG_ERROR << "libpng could not read the header: " << image.message;
+                return false;
+            }
+            if (!sizeAllowed(image.width, image.height)) {
+                png_image_free(&image);
+                return false;
+            }
+            image.format = PNG_FORMAT_RGB;
+            png_color white = {255, 255, 255};
+            unsigned char* pixels = ws.pixels.reserve(PNG_IMAGE_SIZE(image));
+            if (!png_image_finish_read(&image, &white, pixels, 0, nullptr)) {
+                LOG_ERROR << "libpng decode failed: " << image.message;
+                return false;
+            }
+            meta.width = static_cast<int>(image.width);
+            meta.height = static_cast<int>(image.height);
+            return true;
+        }
+#endif
+#ifdef BLUTOGRAPHY_HAVE_TIFF
+        case Container::Tiff: {
+            exif::parse(data, meta);
+            MemoryTiff stream{data.data(), data.size()};
+            auto tif = openTiff(stream);
+            if (!tif) return false;
+            uint32_t width = 0, height = 0;
+            uint16_t orientation = ORIENTATION_TOPLEFT;
+            TIFFGetField(tif.get(), TIFFTAG_IMAGEWIDTH, &width);
+            TIFFGetField(tif.get(), TIFFTAG_IMAGELENGTH, &height);
+            TIFFGetFieldDefaulted(tif.get(), TIFFTAG_ORIENTATION, &orientation);
+            if (!sizeAllowed(width, height)) return false;
+
+            // Ask for the stored orientation so the rows come back as stored: libtiff
+            // only flips, it cannot transpose 5-8. The orientation parsed from IFD0 above
+            // stays in `meta` and is applied later like any JPEG's.
+            size_t count = static_cast<size_t>(width) * height;
+            auto* raster = reinterpret_cast<uint32_t*>(ws.scratch[0].reserve(count * 4));
+            if (!TIFFReadRGBAImageOriented(tif.get(), width, height, raster, orientation, 0)) {
+                LOG_ERROR << "libtiff decode failed";
+                return false;
+            }
+            // ABGR words to RGBA bytes, then onto white
+            unsigned char* rgba = reinterpret_cast<unsigned char*>(raster);
+            for (size_t i = 0; i < count; ++i) {
+                uint32_t px = raster[i];
+                rgba[i * 4] = TIFFGetR(px);
+                rgba[i * 4 + 1] = TIFFGetG(px);
+                rgba[i * 4 + 2] = TIFFGetB(px);
+                rgba[i * 4 + 3] = TIFFGetA(px);
+            }
+            compositeRgba(rgba, ws.pixels.reserve(count * 3), count);
+            meta.width = static_cast<int>(width);
+            meta.height = static_cast<int>(height);
+            return true;
+        }
+#endif
+#ifdef BLUTOGRAPHY_HAVE_HEIF
+        case Container::Heif: {
+            std::unique_ptr<heif_context, HeifDeleter> ctx;
+            std::unique_ptr<heif_image_handle, HeifDeleter> handle;
+            if (!openHeif(data, ctx, handle)) return false;
+
+            std::string tiff = heifExif(handle.get());
+            if (!tiff.empty()) {
+                exif::parse(tiff, meta);
+                ws.exif = wrapExif(tiff, true);
+            }
+            meta.orientation = 1; // libheif applies irot/imir while decoding
+
+            int width = heif_image_handle_get_width(handle.get());
+            int height = heif_image_handle_get_height(handle.get());
+            if (!sizeAllowed(width, height)) return false;
+
+            bool alpha = heif_image_handle_has_alpha_channel(handle.get());
+            heif_image* decoded = nullptr;
+            heif_error err = heif_decode_image(handle.get(), &decoded, heif_colorspace_RGB,
+                                               alpha ? heif_chroma_interleaved_RGBA : heif_chroma_interleaved_RGB, nullptr);
+            if (err.code != heif_error_Ok) {
+                LOG_ERROR << "libheif decode failed: " << err.message;
+                return false;
+            }
+            std::unique_ptr<heif_image, HeifDeleter> image(decoded);
+            width = heif_image_get_width(decoded, heif_channel_interleaved);
+            height = heif_image_get_height(decoded, heif_channel_interleaved);
+            int stride = 0;
+            const uint8_t* plane = heif_image_get_plane_readonly(decoded, heif_channel_interleaved, &stride);
+            if (!plane) return false;
+
+            unsigned char* pixels = ws.pixels.reserve(static_cast<size_t>(width) * height * 3);
+            for (int y = 0; y < height; ++y) {
+                unsigned char* row = pixels + static_cast<size_t>(y) * width * 3;
+                if (alpha) compositeRgba(plane + static_cast<size_t>(y) * stride, row, width);
+                else std::memcpy(row, plane + static_cast<size_t>(y) * stride, static_cast<size_t>(width) * 3);
+            }
+            meta.width = width;
+            meta.height = height;
+            return true;
+        }
+#endif
+        default:
+            return false;
+    }
+}
+
+}
@@ -0,0 +1,139 @@
+#include <support/image_encoders.hpp>
+#include <drogon/drogon.h>
+#include <algorithm>
+#include <thread>
+
+#ifdef BLUTOGRAPHY_HAVE_AVIF
+#include <avif/avif.h>
+#endif
+#ifdef BLUTOGRAPHY_HAVE_WEBP
+#include <webp/encode.h>
+#endif
+
+namespace blutography::image {
+
+const char* mimeType(Format format) {
+    switch (format) {
+        case Format::Avif: return "image/avif";
+        case Format::WebP: return "image/webp";
+        case Format::Jpeg: return "image/jpeg";
+    }
+    return "application/octet-stream";
+}
+
+const char* extension(Format format) {
+    switch (format) {
+        case Format::Avif: return "avif";
+        case Format::WebP: return "webp";
+        case Format::Jpeg: return "jpg";
+    }
+    return "";
+}
+
+Format formatOf(std::string_view fileName) {
+    size_t dot = fileName.find_last_of('.');
+    if (dot == std::string_view::npos) return Format::Jpeg;
+    std::string_view ext = fileName.substr(dot + 1);
+    for (Format format : {Format::Avif, Format::WebP}) {
+        if (ext == extension(format)) return format;
+    }
+    return Format::Jpeg;
+}
+
+bool canEncode(Format format) {
+    switch (format) {
+#ifdef BLUTOGRAPHY_HAVE_AVIF
+        case Format::Avif: return true;
+#endif
+#ifdef BLUTOGRAPHY_HAVE_WEBP
+        case Format::WebP: return true;
+#endif
+        case Format::Jpeg: return true;
+        default: return false;
+    }
+}
+
+std::string encodeAvif(const unsigned char* rgb, int width, int height, const AvifOptions& options, std::string_view exif) {
+#ifdef BLUTOGRAPHY_HAVE_AVIF
+    avifImage* image = avifImageCreate(width, height, 8, AVIF_PIXEL_FORMAT_YUV420);
+    if (!image) return {};
+
+    avifRGBImage rgbImage;
+    avifRGBImageSetDefaults(&rgbImage, image);
+    rgbImage.format = AVIF_RGB_FORMAT_RGB;
+    rgbImage.pixels = const_cast<uint8_t*>(rgb);
+    rgbImage.rowBytes = static_cast<uint32_t>(width) * 3;
+
+    std::string result;
+    if (avifImageRGBToYUV(image, &rgbImage) != AVIF_RESULT_OK) {
+        LOG_ERROR << "AVIF colour conversion failed";
+        avifImageDestroy(image);
+        return result;
+    }
+    if (!exif.empty()) {
+        avifImageSetMetadataExif(image, reinterpret_cast<const uint8_t*>(exif.data()), exif.size());
+    }
+
+    avifEncoder* encoder = avifEncoderCreate();
+    if (encoder) {
+        encoder->quality = std::clamp(options.quality, 0, 100);
+        encoder->speed = std::clamp(options.speed, AVIF_SPEED_SLOWEST, AVIF_SPEED_FASTEST);
+        encoder->maxThreads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+
+        avifRWData output = AVIF_DATA_EMPTY;
+        avifResult res = avifEncoderWrite(encoder, image, &output);
+        if (res == AVIF_RESULT_OK) {
+            result.assign(reinterpret_cast<const char*>(output.data), output.size);
+        } else {
+            LOG_ERROR << "AVIF encode failed: " << avifResultToString(res);
+        }
+        avifRWDataFree(&output);
+        avifEncoderDestroy(encoder);
+    }
+    avifImageDestroy(image);
+    return result;
+#else
+    (void)rgb; (void)width; (void)height; (void)options; (void)exif;
+    return {};
+#endif
+}
+
+std::string encodeWebp(const unsigned char* rgb, int width, int height, const WebpOptions& options) {
+#ifdef BLUTOGRAPHY_HAVE_WEBP
+    if (width > WEBP_MAX_DIMENSION || height > WEBP_MAX_DIMENSION) return {};
+
+    WebPConfig config;
+    if (!WebPConfigPreset(&config, WEBP_PRESET_PHOTO, static_cast<float>(std::clamp(options.quality, 0, 100)))) return {};
+    config.method = std::clamp(options.method, 0, 6);
+    config.thread_level = 1;
+
+    WebPPicture picture;
+    if (!WebPPictureInit(&picture)) return {};
+    picture.width = width;
+    picture.height = height;
+    if (!WebPPictureImportRGB(&picture, rgb, width * 3)) {
+        WebPPictureFree(&picture);
+        return {};
+    }
+
+    WebPMemoryWriter writer;
+    WebPMemoryWriterInit(&writer);
+    picture.writer = WebPMemoryWrite;
+    picture.custom_ptr = &writer;
+
+    std::string result;
+    if (WebPEncode(&config, &picture)) {
+        result.assign(reinterpret_cast<const char*>(writer.mem), writer.size);
+    } else {
+        LOG_ERROR << "WebP encode failed: error " << picture.error_code;
+    }
+    WebPMemoryWriterClear(&writer);
+    WebPPictureFree(&picture);
+    return result;
+#else
+    (void)rgb; (void)width; (void)height; (void)options;
+    return {};
+#endif
+}
+
+}
@@ -0,0 +1,142 @@
+#include <support/image_executor.hpp>
+#include <drogon/drogon.h>
+#include <algorithm>
+
+namespace blutography {
+
+// Index of the worker running on this thread, or -1 off the pool.
+static thread_local long currentWorker = -1;
+
+ImageExecutor& ImageExecutor::instance() {
+    static ImageExecutor executor([] {
+        ExecutorOptions options;
+        const auto& config = drogon::app().getCustomConfig()["executor"];
+        options.threads = config.get("threads", static_cast<Json::UInt64>(options.threads)).asUInt64();
+        options.maxQueue = config.get("max_queue", static_cast<Json::UInt64>(options.maxQueue)).asUInt64();
+        options.retryAfter = config.get("retry_after", options.retryAfter).asInt();
+        return options;
+    }());
+    return executor;
+}
+
+ImageExecutor::ImageExecutor(const ExecutorOptions& options) : options_(options) {
+    if (options_.threads == 0) options_.threads = std::max(1u, std::thread::hardware_concurrency());
+    options_.maxQueue = std::max<size_t>(1, options_.maxQueue);
+
+    workers_.reserve(options_.threads);
+    for (size_t i = 0; i < options_.threads; ++i) workers_.push_back(std::make_unique<Worker>());
+    for (size_t i = 0; i < options_.threads; ++i) {
+        workers_[i]->thread = std::thread([this, i] { run(i); });
+    }
+    LOG_INFO << "Image executor started with " << options_.threads << " workers, queue limit " << options_.maxQueue;
+}
+
+ImageExecutor::~ImageExecutor() {
+    drain();
+}
+
+bool ImageExecutor::reserve(size_t count) {
+    if (draining_) return false;
+    size_t current = admitted_.load();
+    do {
+        // A batch larger than the whole queue still gets in when nothing else is running
+        if (current > 0 && current + count > options_.maxQueue) return false;
+    } while (!admitted_.compare_exchange_weak(current, current + count));
+    return true;
+}
+
+void ImageExecutor::cancel(size_t count) {
+    if (count == 0) return;
+    if (admitted_.fetch_sub(count) == count) {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        idle_.notify_all();
+    }
+}
+
+void ImageExecutor::submit(std::function<void()> work, std::function<void(bool)> done) {
+    trantor::EventLoop* loop = trantor::EventLoop::getEventLoopOfCurrentThread();
+    Task task = [work = std::move(work), done = std::move(done), loop]() mutable {
+        bool succeeded = false;
+        try {
+            work();
+            succeeded = true;
+        } catch (const std::exception& e) {
+            LOG_ERROR << "Image task failed: " << e.what();
+        } catch (...) {
+            LOG_ERROR << "Image task failed with a non-standard exception";
+        }
+        if (!done) return;
+        if (loop) {
+            loop->queueInLoop([done = std::move(done), succeeded]() { done(succeeded); });
+        } else {
+            done(succeeded);
+        }
+    };
+
+    size_t index = currentWorker >= 0 ? static_cast<size_t>(currentWorker) : next_++ % workers_.size();
+    {
+        std::lock_guard<std::mutex> lock(workers_[index]->mutex);
+        workers_[index]->tasks.push_back(std::move(task));
+    }
+    ++queued_;
+    std::lock_guard<std::mutex> lock(sleepMutex_);
+    wake_.notify_one();
+}
+
+// Own deque newest-first (its data is likeliest to be warm), then the oldest task of any other worker.
+bool ImageExecutor::take(size_t index, Task& task) {
+    {
+        Worker& own = *workers_[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (size_t offset = 1; offset < workers_.size(); ++offset) {
+        Worker& victim = *workers_[(index + offset) % workers_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ImageExecutor::run(size_t index) {
+    currentWorker = static_cast<long>(index);
+    for (;;) {
+        Task task;
+        if (take(index, task)) {
+            --queued_;
+            ++running_;
+            task();
+            --running_;
+            cancel(1);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        wake_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+        if (stopping_ && queued_ == 0) return;
+    }
+}
+
+void ImageExecutor::drain() {
+    draining_ = true;
+    {
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        if (admitted_ > 0) LOG_INFO << "Draining image executor: " << admitted_ << " tasks left";
+        idle_.wait(lock, [this] { return admitted_ == 0; });
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) {
+        if (worker->thread.joinable()) worker->thread.join();
+    }
+}
+
+}
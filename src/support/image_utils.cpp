@@ -1,14 +1,21 @@
 #include <support/image_utils.hpp>
+#include <support/image_workspace.hpp>
+#include <support/image_encoders.hpp>
+#include <support/exif.hpp>
+#include <support/image_decoders.hpp>
+#include <support/quality_search.hpp>
+#include <support/resample.hpp>
 #include <turbojpeg.h>
 #include <drogon/drogon.h>
 #include <vector>
 #include <cstring>
+#include <algorithm>
 
 namespace blutography::image {
 
-// Helper to extract APP segments from JPEG
-static std::vector<std::string> extractAppSegments(const std::string& data) {
-    std::vector<std::string> segments;
+// Helper to extract APP segments from JPEG. The views point into `data`.
+static std::vector<std::string_view> extractAppSegments(std::string_view data) {
+    std::vector<std::string_view> segments;
     if (data.size() < 4) return segments;
     if ((unsigned char)data[0] != 0xFF || (unsigned char)data[1] != 0xD8) return segments;
 
@@ -32,38 +39,26 @@ static std::vector<std::string> extractAppSegments(const std::string& data) {
     return segments;
 }
 
-// Helper to insert APP segments into JPEG
-static std::string insertAppSegments(const std::string& jpegData, const std::vector<std::string>& segments) {
-    if (jpegData.size() < 2 || segments.empty()) return jpegData;
-
+// Builds the final JPEG: the encoder's SOI, then the original APP segments, then
+// the rest of the encoded stream. One allocation, straight from the encoder buffer.
+static std::string assembleJpeg(const unsigned char* jpeg, size_t jpegSize, const std::vector<std::string_view>& segments) {
     std::string result;
-    result.reserve(jpegData.size() + 2048);
-    result.append(jpegData.substr(0, 2)); // SOI (FF D8)
+    if (jpegSize < 2) return result;
+
+    size_t total = jpegSize;
+    for (const auto& seg : segments) total += seg.size();
+    result.reserve(total);
 
-    // Append our segments
+    result.append((const char*)jpeg, 2); // SOI (FF D8)
     for (const auto& seg : segments) {
-        // Skip APP0 (JFIF) from original if we want to use the new one?
-        // Actually, just append all, many JPEGs have multiple.
         result.append(seg);
     }
+    result.append((const char*)jpeg + 2, jpegSize - 2);
 
-    // Append the rest of the new JPEG, skipping its own SOI
-    result.append(jpegData.substr(2));
-    
     return result;
 }
 
-static uint16_t read16(const unsigned char* data, bool isLittleEndian) {
-    if (isLittleEndian) return data[0] | (data[1] << 8);
-    return (data[0] << 8) | data[1];
-}
-
-static uint32_t read32(const unsigned char* data, bool isLittleEndian) {
-    if (isLittleEndian) return data[0] | (data[1] << 8) | (data[2] << 16) | (data[3] << 24);
-    return (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
-}
-
-Metadata extractMetadata(const std::string& inputData) {
+static Metadata emptyMetadata() {
     Metadata meta;
     meta.dateTime = "[null]";
     meta.model = "[null]";
@@ -71,137 +66,492 @@ Metadata extractMetadata(const std::string& inputData) {
     meta.iso = "[null]";
     meta.width = 0;
     meta.height = 0;
+    return meta;
+}
 
-    tjhandle decompressor = tjInitDecompress();
-    if (decompressor) {
-        int width, height, subsamp, colorspace;
-        if (tjDecompressHeader3(decompressor, (const unsigned char*)inputData.data(), inputData.size(), &width, &height, &subsamp, &colorspace) >= 0) {
-            meta.width = width;
-            meta.height = height;
-        } else {
-            LOG_ERROR << "TurboJPEG DecompressHeader failed: " << tjGetErrorStr2(decompressor);
+static void parseExif(const std::vector<std::string_view>& segments, Metadata& meta, exif::FieldMask wanted) {
+    wanted &= exif::kAllFields;
+    exif::FieldMask found = 0;
+    for (const auto& seg : segments) {
+        if ((found & wanted) == wanted) break;
+        std::string_view tiff = exif::payload(seg);
+        if (tiff.empty()) continue;
+        found |= exif::parse(tiff, meta, wanted & ~found);
+    }
+}
+
+// Decodes are capped at this long edge (JPEG via DCT scaling, other formats by resampling).
+static constexpr int kMaxDecodeEdge = 8000;
+
+// Dimensions of a width x height image scaled so its long edge is `edge`.
+static void fitLongEdge(int width, int height, int edge, int& outWidth, int& outHeight) {
+    if (width >= height) {
+        outWidth = edge;
+        outHeight = std::max(1, static_cast<int>((static_cast<long long>(height) * edge + width / 2) / width));
+    } else {
+        outHeight = edge;
+        outWidth = std::max(1, static_cast<int>((static_cast<long long>(width) * edge + height / 2) / height));
+    }
+}
+
+// The DCT scaling factor to decode at: the smallest decode whose long edge still
+// reaches `targetEdge` (0 = as large as possible), never above kMaxDecodeEdge
+// unless no factor gets below it.
+static tjscalingfactor pickScalingFactor(int width, int height, int targetEdge) {
+    int count = 0;
+    tjscalingfactor* factors = tjGetScalingFactors(&count);
+    const int longEdge = std::max(width, height);
+
+    tjscalingfactor best = {1, 1};
+    int bestEdge = -1;
+    tjscalingfactor smallest = {1, 1};
+    int smallestEdge = longEdge;
+    for (int i = 0; factors && i < count; ++i) {
+        const tjscalingfactor& f = factors[i];
+        if (f.num > f.denom) continue; // never upscale in the decoder
+        int edge = TJSCALED(longEdge, f);
+        if (edge < smallestEdge) {
+            smallest = f;
+            smallestEdge = edge;
+        }
+        if (edge > kMaxDecodeEdge) continue;
+        if (targetEdge > 0 && edge < targetEdge) continue;
+        bool better = bestEdge < 0 || (targetEdge > 0 ? edge < bestEdge : edge > bestEdge);
+        if (better) {
+            best = f;
+            bestEdge = edge;
         }
-        tjDestroy(decompressor);
     }
+    if (bestEdge >= 0) return best;
 
-    auto segments = extractAppSegments(inputData);
-    for (const auto& seg : segments) {
-        if ((unsigned char)seg[1] == 0xE1 && seg.size() > 10) { // APP1
-            if (std::memcmp(&seg[4], "Exif\0\0", 6) == 0) {
-                const unsigned char* tiffBase = (const unsigned char*)&seg[10];
-                size_t tiffSize = seg.size() - 10;
-                
-                bool isLittleEndian = (tiffBase[0] == 'I');
-                uint32_t firstIfdOffset = read32(tiffBase + 4, isLittleEndian);
-                
-                auto parseIfd = [&](uint32_t offset, auto& self) -> void {
-                    if (offset + 2 > tiffSize) return;
-                    uint16_t numEntries = read16(tiffBase + offset, isLittleEndian);
-                    for (int i = 0; i < numEntries; ++i) {
-                        uint32_t entryOffset = offset + 2 + i * 12;
-                        if (entryOffset + 12 > tiffSize) break;
-                        
-                        uint16_t tag = read16(tiffBase + entryOffset, isLittleEndian);
-                        uint16_t type = read16(tiffBase + entryOffset + 2, isLittleEndian);
-                        uint32_t count = read32(tiffBase + entryOffset + 4, isLittleEndian);
-                        uint32_t valOffset = read32(tiffBase + entryOffset + 8, isLittleEndian);
-                        
-                        if (tag == 0x0110) { // Model
-                            if (type == 2 && valOffset + count <= tiffSize) {
-                                meta.model = std::string((const char*)tiffBase + valOffset, count);
-                                if (!meta.model.empty() && meta.model.back() == '\0') meta.model.pop_back();
-                            }
-                        } else if (tag == 0x8769) { // Exif Offset
-                            self(valOffset, self);
-                        } else if (tag == 0x9003) { // DateTimeOriginal
-                            if (type == 2 && valOffset + count <= tiffSize) {
-                                meta.dateTime = std::string((const char*)tiffBase + valOffset, count);
-                                if (!meta.dateTime.empty() && meta.dateTime.back() == '\0') meta.dateTime.pop_back();
-                            }
-                        } else if (tag == 0x829a) { // ExposureTime
-                            if (type == 5 && valOffset + 8 <= tiffSize) {
-                                uint32_t num = read32(tiffBase + valOffset, isLittleEndian);
-                                uint32_t den = read32(tiffBase + valOffset + 4, isLittleEndian);
-                                if (num == 1 && den > 1) meta.exposure = "1/" + std::to_string(den);
-                                else if (den > 0) meta.exposure = std::to_string((float)num/den) + "s";
-                            }
-                        } else if (tag == 0x8827) { // ISO
-                            if (type == 3) {
-                                meta.iso = std::to_string(read16(tiffBase + entryOffset + 8, isLittleEndian));
-                            }
-                        }
-                    }
-                };
-                parseIfd(firstIfdOffset, parseIfd);
-            }
+    // The target is above the cap: the largest decode within the cap, or failing that the smallest decode there is
+    bestEdge = -1;
+    for (int i = 0; factors && i < count; ++i) {
+        const tjscalingfactor& f = factors[i];
+        if (f.num > f.denom) continue;
+        int edge = TJSCALED(longEdge, f);
+        if (edge <= kMaxDecodeEdge && edge > bestEdge) {
+            best = f;
+            bestEdge = edge;
         }
     }
+    return bestEdge >= 0 ? best : smallest;
+}
 
-    return meta;
+// Reads the header and APP segments into `analysis`, parsing only the `exifFields`
+// wanted. Returns false if TurboJPEG cannot parse the header.
+static bool readHeader(Workspace& ws, std::string_view inputData, Analysis& analysis, exif::FieldMask exifFields) {
+    analysis.metadata = emptyMetadata();
+    analysis.appSegments = extractAppSegments(inputData);
+    parseExif(analysis.appSegments, analysis.metadata, exifFields);
+
+    if (!ws.decompressor) return false;
+    int width, height, subsamp, colorspace;
+    if (tjDecompressHeader3(ws.decompressor, (const unsigned char*)inputData.data(), inputData.size(), &width, &height, &subsamp, &colorspace) < 0) {
+        LOG_ERROR << "TurboJPEG DecompressHeader failed: " << tjGetErrorStr2(ws.decompressor);
+        return false;
+    }
+    analysis.metadata.width = width;
+    analysis.metadata.height = height;
+    analysis.subsamp = subsamp;
+    return true;
 }
 
-std::string createGalleryPreview(const std::string& inputData, const std::string& fileName) {
-    if (inputData.size() < 4) return inputData;
-    
-    // Basic JPEG detection
-    bool isJpeg = ((unsigned char)inputData[0] == 0xFF && (unsigned char)inputData[1] == 0xD8);
-    
-    if (!isJpeg) {
-        LOG_DEBUG << "File " << fileName << " is not a JPEG, skipping compression.";
-        return inputData; 
+Metadata extractMetadata(std::string_view inputData) {
+    Container container = sniffContainer(inputData);
+    if (container != Container::Jpeg) {
+        Metadata meta = emptyMetadata();
+        readImageInfo(container, inputData, meta);
+        return meta;
     }
+    Analysis analysis;
+    readHeader(workspace(), inputData, analysis, exif::kAllFields);
+    return analysis.metadata;
+}
 
-    // 1. Extract APP segments (EXIF etc) from original
-    auto appSegments = extractAppSegments(inputData);
+Analysis analyze(std::string_view inputData, int targetEdge, uint32_t exifFields) {
+    Analysis analysis;
+    Workspace& ws = workspace();
+    analysis.container = sniffContainer(inputData);
+    if (analysis.container != Container::Jpeg) {
+        analysis.metadata = emptyMetadata();
+        if (analysis.container == Container::Unknown || !canDecode(analysis.container)) return analysis;
+        if (!decodeImage(analysis.container, inputData, ws, analysis.metadata)) return analysis;
 
-    tjhandle decompressor = tjInitDecompress();
-    if (!decompressor) return inputData;
+        int width = analysis.metadata.width;
+        int height = analysis.metadata.height;
+        int scaledWidth = width, scaledHeight = height;
+        // No DCT scaling to lean on here: resample oversized decodes down to the
+        // same bound the JPEG path reaches, so the preview is capped whatever the upload.
+        int bound = targetEdge > 0 ? std::min(targetEdge, kMaxDecodeEdge) : kMaxDecodeEdge;
+        if (std::max(width, height) > bound) {
+            fitLongEdge(width, height, bound, scaledWidth, scaledHeight);
+            unsigned char* bounded = ws.scratch[0].reserve(static_cast<size_t>(scaledWidth) * scaledHeight * 3);
+            resampleRgb(ws.pixels.data(), width, height, bounded, scaledWidth, scaledHeight, ws.resample);
+            std::swap(ws.pixels, ws.scratch[0]);
+        }
 
-    int width, height, subsamp, colorspace;
-    if (tjDecompressHeader3(decompressor, (const unsigned char*)inputData.data(), inputData.size(), &width, &height, &subsamp, &colorspace) < 0) {
-        tjDestroy(decompressor);
-        return inputData;
+        if (!ws.exif.empty()) analysis.appSegments.push_back(ws.exif);
+        analysis.subsamp = TJSAMP_420;
+        analysis.decoded = true;
+        analysis.width = scaledWidth;
+        analysis.height = scaledHeight;
+        analysis.pixels = ws.pixels.data();
+        return analysis;
     }
+    if (!readHeader(ws, inputData, analysis, exifFields)) return analysis;
 
-    tjscalingfactor scalingFactor = {1, 1};
-    if (width > 8000 || height > 8000) {
-        scalingFactor = {1, 2};
-    }
+    int width = analysis.metadata.width;
+    int height = analysis.metadata.height;
+    tjscalingfactor scalingFactor = pickScalingFactor(width, height, targetEdge);
 
     int scaledWidth = TJSCALED(width, scalingFactor);
     int scaledHeight = TJSCALED(height, scalingFactor);
 
-    std::vector<unsigned char> rawBuffer(scaledWidth * scaledHeight * 3); // RGB
-    if (tjDecompress2(decompressor, (const unsigned char*)inputData.data(), inputData.size(), rawBuffer.data(), scaledWidth, 0, scaledHeight, TJPF_RGB, TJFLAG_FASTDCT) < 0) {
-        tjDestroy(decompressor);
-        return inputData;
+    unsigned char* pixels = ws.pixels.reserve(static_cast<size_t>(scaledWidth) * scaledHeight * 3); // RGB
+    if (tjDecompress2(ws.decompressor, (const unsigned char*)inputData.data(), inputData.size(), pixels, scaledWidth, 0, scaledHeight, TJPF_RGB, TJFLAG_FASTDCT) < 0) {
+        LOG_ERROR << "TurboJPEG Decompress failed: " << tjGetErrorStr2(ws.decompressor);
+        return analysis;
+    }
+
+    analysis.decoded = true;
+    analysis.width = scaledWidth;
+    analysis.height = scaledHeight;
+    analysis.pixels = pixels;
+    return analysis;
+}
+
+// Turns packed RGB upright according to an EXIF orientation (2-8). For 5-8 the
+// output is height x width.
+static void orientRgb(const unsigned char* src, int width, int height, int orientation, unsigned char* dst) {
+    const bool swaps = orientation >= 5;
+    const int dstWidth = swaps ? height : width;
+    for (int y = 0; y < height; ++y) {
+        const unsigned char* row = src + static_cast<size_t>(y) * width * 3;
+        for (int x = 0; x < width; ++x) {
+            int dx = x, dy = y;
+            switch (orientation) {
+                case 2: dx = width - 1 - x; break;
+                case 3: dx = width - 1 - x; dy = height - 1 - y; break;
+                case 4: dy = height - 1 - y; break;
+                case 5: dx = y; dy = x; break;
+                case 6: dx = height - 1 - y; dy = x; break;
+                case 7: dx = height - 1 - y; dy = width - 1 - x; break;
+                case 8: dx = y; dy = width - 1 - x; break;
+                default: break;
+            }
+            std::memcpy(dst + (static_cast<size_t>(dy) * dstWidth + dx) * 3, row + x * 3, 3);
+        }
+    }
+}
+
+static int transformOp(int orientation) {
+    switch (orientation) {
+        case 2: return TJXOP_HFLIP;
+        case 3: return TJXOP_ROT180;
+        case 4: return TJXOP_VFLIP;
+        case 5: return TJXOP_TRANSPOSE;
+        case 6: return TJXOP_ROT90;
+        case 7: return TJXOP_TRANSVERSE;
+        case 8: return TJXOP_ROT270;
+        default: return TJXOP_NONE;
     }
-    tjDestroy(decompressor);
+}
 
-    tjhandle compressor = tjInitCompress();
-    if (!compressor) return inputData;
+static std::string ladderName(const std::string& fileName, int longEdge, Format format = Format::Jpeg) {
+    std::string stem = fileName;
+    size_t lastDot = stem.find_last_of(".");
+    if (lastDot != std::string::npos) stem = stem.substr(0, lastDot);
+    return stem + "_" + std::to_string(longEdge) + "." + extension(format);
+}
 
+// AVIF and WebP encodings of the same pixels, for whichever encoders are enabled and built in.
+static std::vector<AlternatePreview> encodeAlternates(const unsigned char* pixels, int width, int height,
+                                                      const PreviewOptions& options, std::string_view exifTiff) {
+    std::vector<AlternatePreview> alternates;
+    if (options.avif.enabled && canEncode(Format::Avif)) {
+        std::string avif = encodeAvif(pixels, width, height, options.avif, exifTiff);
+        if (!avif.empty()) alternates.push_back({Format::Avif, std::move(avif)});
+    }
+    if (options.webp.enabled && canEncode(Format::WebP)) {
+        std::string webp = encodeWebp(pixels, width, height, options.webp);
+        if (!webp.empty()) alternates.push_back({Format::WebP, std::move(webp)});
+    }
+    return alternates;
+}
+
+// The TIFF payload of the first EXIF APP1 segment, without the "Exif\0\0" header.
+static std::string_view exifPayload(const std::vector<std::string_view>& segments) {
+    for (const auto& seg : segments) {
+        std::string_view tiff = exif::payload(seg);
+        if (!tiff.empty()) return tiff;
+    }
+    return {};
+}
+
+const char* toString(PreviewPath path) {
+    switch (path) {
+        case PreviewPath::None: return "none";
+        case PreviewPath::Reencoded: return "reencoded";
+        case PreviewPath::Lossless: return "lossless";
+    }
+    return "";
+}
+
+std::string createGalleryPreview(std::string_view inputData, const std::string& fileName) {
+    PreviewOptions options;
+    options.ladder.clear();
+    options.lossless.enabled = false;
+    options.avif.enabled = false;
+    options.webp.enabled = false;
+    // Only the orientation matters for a bare preview: the EXIF walk can stop there
+    return createPreviewSet(analyze(inputData, options.maxEdge, exif::Orientation), inputData, fileName, options).preview;
+}
+
+PreviewSet createPreviewSet(std::string_view inputData, const std::string& fileName, const PreviewOptions& options) {
+    return createPreviewSet(analyze(inputData, options.maxEdge), inputData, fileName, options);
+}
+
+PreviewSet createPreviewSet(const Analysis& analysis, std::string_view inputData, const std::string& fileName, const PreviewOptions& options) {
+    PreviewSet set;
+    if (!analysis.decoded) {
+        LOG_WARN << "File " << fileName << " could not be decoded, no preview generated.";
+        return set;
+    }
+
+    Workspace& ws = workspace();
+    if (!ws.compressor) return set;
+
+    const int width = analysis.metadata.width;
+    const int height = analysis.metadata.height;
+    const int orientation = analysis.metadata.orientation;
+    const bool rotates = orientation >= 2 && orientation <= 8;
+    const bool swaps = orientation >= 5 && orientation <= 8;
+
+    // Every JPEG we write carries the original APP segments, except that EXIF loses
+    // its thumbnail and MakerNote, and its orientation is reset once the pixels
+    // themselves are upright.
+    std::vector<std::string_view> segments;
+    segments.reserve(analysis.appSegments.size());
+    std::string sanitizedExif;
+    for (const auto& seg : analysis.appSegments) {
+        bool isExif = !exif::payload(seg).empty();
+        if (isExif && sanitizedExif.empty()) {
+            sanitizedExif = exif::sanitize(seg, rotates, swaps);
+            if (!sanitizedExif.empty()) segments.push_back(sanitizedExif);
+            else if (!rotates) segments.push_back(seg);
+            continue;
+        }
+        segments.push_back(seg);
+    }
+
+    // Preview-sized, upright pixels for everything derived from the decode. The
+    // decode was already DCT-scaled close to max_edge; Lanczos takes it the rest of the way.
+    const unsigned char* pixels = analysis.pixels;
+    int scaledWidth = analysis.width;
+    int scaledHeight = analysis.height;
+    if (options.maxEdge > 0 && std::max(scaledWidth, scaledHeight) > options.maxEdge) {
+        int targetWidth, targetHeight;
+        fitLongEdge(scaledWidth, scaledHeight, options.maxEdge, targetWidth, targetHeight);
+        unsigned char* resized = ws.preview.reserve(static_cast<size_t>(targetWidth) * targetHeight * 3);
+        resampleRgb(pixels, scaledWidth, scaledHeight, resized, targetWidth, targetHeight, ws.resample);
+        pixels = resized;
+        scaledWidth = targetWidth;
+        scaledHeight = targetHeight;
+    }
+    if (rotates) {
+        unsigned char* upright = ws.oriented.reserve(static_cast<size_t>(scaledWidth) * scaledHeight * 3);
+        orientRgb(pixels, scaledWidth, scaledHeight, orientation, upright);
+        if (swaps) std::swap(scaledWidth, scaledHeight);
+        pixels = upright;
+    }
+
+    unsigned long capacity = 0;
     unsigned char* compressedData = nullptr;
     unsigned long compressedSize = 0;
-    int quality = 90; 
-    
-    if (tjCompress2(compressor, rawBuffer.data(), scaledWidth, 0, scaledHeight, TJPF_RGB, &compressedData, &compressedSize, subsamp, quality, TJFLAG_FASTDCT) < 0) {
-        if (compressedData) tjFree(compressedData);
-        tjDestroy(compressor);
-        return inputData;
+
+    // Lossless path: re-pack the original coefficients (optimised Huffman tables,
+    // orientation applied as a lossless rotation). Cheaper than a re-encode and free
+    // of generation loss, so it wins whenever the result fits the byte cap and the
+    // re-encode's byte budget: a re-encode held to the same budget can only be worse.
+    bool fullResolution = analysis.width == width && analysis.height == height
+                          && (options.maxEdge <= 0 || std::max(width, height) <= options.maxEdge);
+    if (analysis.container == Container::Jpeg && options.lossless.enabled && ws.transformer && fullResolution && std::max(width, height) <= options.lossless.maxEdge) {
+        tjtransform xform;
+        std::memset(&xform, 0, sizeof(xform));
+        xform.op = transformOp(orientation);
+        xform.options = TJXOPT_COPYNONE | (xform.op != TJXOP_NONE ? TJXOPT_TRIM : 0);
+#ifdef TJXOPT_OPTIMIZE
+        xform.options |= TJXOPT_OPTIMIZE;
+#else
+        xform.options |= TJXOPT_PROGRESSIVE; // progressive scans always use optimised Huffman tables
+#endif
+        compressedData = ws.jpegBuffer(width, height, TJSAMP_444, capacity);
+        compressedSize = capacity;
+        if (compressedData && tjTransform(ws.transformer, (const unsigned char*)inputData.data(), inputData.size(), 1, &compressedData, &compressedSize, &xform, TJFLAG_NOREALLOC) == 0) {
+            size_t total = compressedSize;
+            for (const auto& seg : segments) total += seg.size();
+            size_t cap = options.lossless.maxBytes;
+            if (options.quality.targetBytes > 0 && (cap == 0 || options.quality.targetBytes < cap)) cap = options.quality.targetBytes;
+            // TJXOPT_TRIM drops partial MCUs at the edges a rotation would move; read back what is left
+            int losslessWidth = 0, losslessHeight = 0, losslessSubsamp = 0, losslessColorspace = 0;
+            if (tjDecompressHeader3(ws.decompressor, compressedData, compressedSize, &losslessWidth, &losslessHeight, &losslessSubsamp, &losslessColorspace) < 0) {
+                LOG_WARN << "Lossless preview for " << fileName << " is unreadable: " << tjGetErrorStr2(ws.decompressor) << "; re-encoding";
+            } else if (cap == 0 || total <= cap) {
+                set.preview = assembleJpeg(compressedData, compressedSize, segments);
+                set.path = PreviewPath::Lossless;
+                set.width = losslessWidth;
+                set.height = losslessHeight;
+            } else {
+                LOG_DEBUG << "Lossless preview for " << fileName << " is " << total / 1024 << "KB, over the cap; re-encoding";
+            }
+        } else {
+            LOG_WARN << "TurboJPEG Transform failed for " << fileName << ": " << tjGetErrorStr2(ws.transformer);
+        }
     }
 
-    std::string compressedStr((char*)compressedData, compressedSize);
-    tjFree(compressedData);
-    tjDestroy(compressor);
+    if (set.path != PreviewPath::Lossless) {
+        size_t overhead = 0;
+        for (const auto& seg : segments) overhead += seg.size();
 
-    // 2. Insert original APP segments back into the compressed JPEG
-    std::string result = insertAppSegments(compressedStr, appSegments);
+        auto encode = [&](int q) {
+            compressedData = ws.jpegBuffer(scaledWidth, scaledHeight, analysis.subsamp, capacity);
+            compressedSize = capacity;
+            return compressedData && tjCompress2(ws.compressor, pixels, scaledWidth, 0, scaledHeight, TJPF_RGB, &compressedData, &compressedSize, analysis.subsamp, q, TJFLAG_FASTDCT | TJFLAG_NOREALLOC) == 0;
+        };
+
+        // Targeted quality: trial encodes on a small probe pick the level, so the
+        // full-size image is normally encoded once.
+        const QualityOptions& qo = options.quality;
+        int quality = qo.fixed;
+        std::vector<QualityTrial> trials;
+        double bytesScale = 1.0;
+        if (qo.targetBytes > 0 || qo.targetSsim > 0.0) {
+            int probeEdge = std::max(64, qo.probeEdge);
+            int probeWidth = scaledWidth, probeHeight = scaledHeight;
+            const unsigned char* probe = pixels;
+            if (std::max(scaledWidth, scaledHeight) > probeEdge) {
+                fitLongEdge(scaledWidth, scaledHeight, probeEdge, probeWidth, probeHeight);
+                unsigned char* scaled = ws.scratch[0].reserve(static_cast<size_t>(probeWidth) * probeHeight * 3);
+                resampleRgb(pixels, scaledWidth, scaledHeight, scaled, probeWidth, probeHeight, ws.resample, ResampleFilter::Area);
+                probe = scaled;
+            }
+            bytesScale = (static_cast<double>(scaledWidth) * scaledHeight) / (static_cast<double>(probeWidth) * probeHeight);
+            trials = runQualityTrials(probe, probeWidth, probeHeight, analysis.subsamp, qo, qo.targetBytes == 0);
+            quality = pickQuality(trials, qo, bytesScale, overhead);
+        }
 
-    LOG_INFO << "Generated preview for " << fileName << " (" << width << "x" << height << "): " 
-             << inputData.size() / 1024 << "KB -> " << result.size() / 1024 << "KB (EXIF preserved)";
+        if (!encode(quality)) {
+            LOG_ERROR << "TurboJPEG Compress failed for " << fileName << ": " << tjGetErrorStr2(ws.compressor);
+            return set;
+        }
+
+        // The size model missed the budget: rescale it by the observed error and
+        // encode once more at the corrected level.
+        if (qo.targetBytes > 0 && compressedSize + overhead > qo.targetBytes) {
+            auto it = std::find_if(trials.begin(), trials.end(), [&](const QualityTrial& t) { return t.quality == quality; });
+            if (it != trials.end() && it->bytes > 0) {
+                double correction = static_cast<double>(compressedSize) / (static_cast<double>(it->bytes) * bytesScale);
+                int corrected = pickQuality(trials, qo, bytesScale * correction, overhead);
+                if (corrected < quality) {
+                    LOG_DEBUG << "Preview for " << fileName << " at q" << quality << " is " << (compressedSize + overhead) / 1024
+                              << "KB, over budget; retrying at q" << corrected;
+                    quality = corrected;
+                    if (!encode(quality)) {
+                        LOG_ERROR << "TurboJPEG Compress failed for " << fileName << ": " << tjGetErrorStr2(ws.compressor);
+                        return set;
+                    }
+                }
+            }
+        }
+
+        // Insert original APP segments (EXIF etc) into the compressed JPEG
+        set.preview = assembleJpeg(compressedData, compressedSize, segments);
+        set.path = PreviewPath::Reencoded;
+        set.width = scaledWidth;
+        set.height = scaledHeight;
+        set.quality = quality;
+    }
+
+    LOG_INFO << "Generated " << toString(set.path) << " preview for " << fileName << " (" << set.width << "x" << set.height << "): " 
+             << inputData.size() / 1024 << "KB -> " << set.preview.size() / 1024 << "KB"
+             << (set.quality ? " at q" + std::to_string(set.quality) : std::string()) << " (EXIF preserved)";
+
+    // Alternate encodings of the same pixels for clients that accept them
+    set.alternates = encodeAlternates(pixels, scaledWidth, scaledHeight, options, exifPayload(segments));
+    for (const auto& alternate : set.alternates) {
+        LOG_INFO << "Generated " << extension(alternate.format) << " preview for " << fileName << ": " << alternate.data.size() / 1024 << "KB";
+    }
+
+    // Derive the ladder from the buffer we already decoded, largest rung first so
+    // each rung is downscaled from the previous one rather than from full size.
+    std::vector<int> edges;
+    int sourceLongEdge = std::max(scaledWidth, scaledHeight);
+    for (int edge : options.ladder) {
+        if (edge > 0 && edge < sourceLongEdge) edges.push_back(edge);
+    }
+    std::sort(edges.begin(), edges.end(), std::greater<int>());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+    // Rungs ping-pong between the two scratch buffers, so the decoded image in
+    // the analysis is left intact.
+    const unsigned char* source = pixels;
+    int sourceWidth = scaledWidth, sourceHeight = scaledHeight;
+    int nextTarget = 0;
+    for (int edge : edges) {
+        int rungWidth, rungHeight;
+        fitLongEdge(scaledWidth, scaledHeight, edge, rungWidth, rungHeight);
+
+        unsigned char* rung = ws.scratch[nextTarget].reserve(static_cast<size_t>(rungWidth) * rungHeight * 3);
+        resampleRgb(source, sourceWidth, sourceHeight, rung, rungWidth, rungHeight, ws.resample);
+
+        compressedData = ws.jpegBuffer(rungWidth, rungHeight, TJSAMP_420, capacity);
+        compressedSize = capacity;
+        if (tjCompress2(ws.compressor, rung, rungWidth, 0, rungHeight, TJPF_RGB, &compressedData, &compressedSize, TJSAMP_420, 82, TJFLAG_FASTDCT | TJFLAG_NOREALLOC) < 0) {
+            LOG_ERROR << "Failed to encode " << edge << "px rung for " << fileName << ": " << tjGetErrorStr2(ws.compressor);
+            continue;
+        }
+
+        PreviewRendition rendition;
+        rendition.data.assign((const char*)compressedData, compressedSize);
+        rendition.variant.fileName = ladderName(fileName, edge);
+        rendition.variant.width = rungWidth;
+        rendition.variant.height = rungHeight;
+        rendition.variant.bytes = compressedSize;
+        set.ladder.push_back(std::move(rendition));
+
+        // The rung in every other format, so each size can be offered by type as well
+        for (auto& alternate : encodeAlternates(rung, rungWidth, rungHeight, options, {})) {
+            PreviewRendition encoded;
+            encoded.variant.fileName = ladderName(fileName, edge, alternate.format);
+            encoded.variant.width = rungWidth;
+            encoded.variant.height = rungHeight;
+            encoded.variant.bytes = alternate.data.size();
+            encoded.data = std::move(alternate.data);
+            set.ladderAlternates.push_back(std::move(encoded));
+        }
+
+        // The next (smaller) rung is derived from this one.
+        source = rung;
+        sourceWidth = rungWidth;
+        sourceHeight = rungHeight;
+        nextTarget ^= 1;
+    }
+
+    // The smallest rung (or the decode itself if there is no ladder) is plenty for a 32px placeholder
+    set.placeholder = computePlaceholder(source, sourceWidth, sourceHeight);
+
+    std::reverse(set.ladder.begin(), set.ladder.end());
+    std::stable_sort(set.ladderAlternates.begin(), set.ladderAlternates.end(), [](const PreviewRendition& a, const PreviewRendition& b) {
+        return a.variant.width < b.variant.width;
+    });
+    if (!set.ladder.empty()) {
+        LOG_INFO << "Generated " << set.ladder.size() << " ladder rungs for " << fileName
+                 << " (smallest " << set.ladder.front().variant.bytes / 1024 << "KB)"
+                 << (set.ladderAlternates.empty() ? std::string() : ", " + std::to_string(set.ladderAlternates.size()) + " in other formats");
+    }
     
-    return result;
+    return set;
 }
 
 }
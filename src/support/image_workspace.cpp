@@ -0,0 +1,84 @@
+#include <support/image_workspace.hpp>
+#include <turbojpeg.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace blutography::image {
+
+unsigned char* ScratchBuffer::reserve(size_t size) {
+    if (size > capacity_) {
+        data_.reset(new unsigned char[size]);
+        capacity_ = size;
+    }
+    return data_.get();
+}
+
+Workspace::Workspace() : decompressor(tjInitDecompress()), compressor(tjInitCompress()), transformer(tjInitTransform()) {}
+
+Workspace::~Workspace() {
+    if (decompressor) tjDestroy(decompressor);
+    if (compressor) tjDestroy(compressor);
+    if (transformer) tjDestroy(transformer);
+    if (jpeg_) tjFree(jpeg_);
+}
+
+unsigned char* Workspace::jpegBuffer(int width, int height, int subsamp, unsigned long& capacity) {
+    unsigned long needed = tjBufSize(width, height, subsamp);
+    if (needed > jpegCapacity_) {
+        if (jpeg_) tjFree(jpeg_);
+        jpeg_ = tjAlloc(static_cast<int>(needed));
+        jpegCapacity_ = jpeg_ ? needed : 0;
+    }
+    capacity = jpegCapacity_;
+    return jpeg_;
+}
+
+namespace {
+    class WorkspacePool {
+    public:
+        std::unique_ptr<Workspace> acquire() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!free_.empty()) {
+                    auto ws = std::move(free_.back());
+                    free_.pop_back();
+                    return ws;
+                }
+            }
+            return std::make_unique<Workspace>();
+        }
+
+        void release(std::unique_ptr<Workspace> ws) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            // Keep roughly one warm workspace per core; anything beyond that only pins memory.
+            if (free_.size() < std::max(1u, std::thread::hardware_concurrency())) {
+                free_.push_back(std::move(ws));
+            }
+        }
+
+    private:
+        std::mutex mutex_;
+        std::vector<std::unique_ptr<Workspace>> free_;
+    };
+
+    WorkspacePool& pool() {
+        static WorkspacePool inst;
+        return inst;
+    }
+
+    struct ThreadWorkspace {
+        std::unique_ptr<Workspace> ws;
+        ~ThreadWorkspace() {
+            if (ws) pool().release(std::move(ws));
+        }
+    };
+}
+
+Workspace& workspace() {
+    thread_local ThreadWorkspace local;
+    if (!local.ws) local.ws = pool().acquire();
+    return *local.ws;
+}
+
+}
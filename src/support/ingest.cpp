@@ -0,0 +1,303 @@
+#include <support/ingest.hpp>
+#include <support/b2service.hpp>
+#include <support/gallery_storage.hpp>
+#include <support/image_executor.hpp>
+#include <support/ingest_journal.hpp>
+#include <support/tiles.hpp>
+#include <drogon/drogon.h>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+
+namespace blutography {
+
+image::PreviewOptions previewOptionsFromConfig() {
+    image::PreviewOptions options;
+    const auto& config = drogon::app().getCustomConfig()["previews"];
+    if (config.isMember("ladder") && config["ladder"].isArray()) {
+        options.ladder.clear();
+        for (const auto& edge : config["ladder"]) options.ladder.push_back(edge.asInt());
+    }
+    options.maxEdge = config.get("max_edge", options.maxEdge).asInt();
+    const auto& lossless = config["lossless"];
+    options.lossless.enabled = lossless.get("enabled", options.lossless.enabled).asBool();
+    options.lossless.maxEdge = lossless.get("max_edge", options.lossless.maxEdge).asInt();
+    options.lossless.maxBytes = lossless.get("max_bytes", static_cast<Json::UInt64>(options.lossless.maxBytes)).asUInt64();
+    const auto& quality = config["quality"];
+    options.quality.fixed = quality.get("fixed", options.quality.fixed).asInt();
+    options.quality.targetBytes = quality.get("target_bytes", static_cast<Json::UInt64>(options.quality.targetBytes)).asUInt64();
+    options.quality.targetSsim = quality.get("target_ssim", options.quality.targetSsim).asDouble();
+    options.quality.minQuality = quality.get("min", options.quality.minQuality).asInt();
+    options.quality.maxQuality = quality.get("max", options.quality.maxQuality).asInt();
+    options.quality.probeEdge = quality.get("probe_edge", options.quality.probeEdge).asInt();
+    const auto& avif = config["avif"];
+    options.avif.enabled = avif.get("enabled", options.avif.enabled).asBool();
+    options.avif.quality = avif.get("quality", options.avif.quality).asInt();
+    options.avif.speed = avif.get("speed", options.avif.speed).asInt();
+    const auto& webp = config["webp"];
+    options.webp.enabled = webp.get("enabled", options.webp.enabled).asBool();
+    options.webp.quality = webp.get("quality", options.webp.quality).asInt();
+    options.webp.method = webp.get("method", options.webp.method).asInt();
+    const auto& tiles = config["tiles"];
+    options.tiles.enabled = tiles.get("enabled", options.tiles.enabled).asBool();
+    options.tiles.minEdge = tiles.get("min_edge", options.tiles.minEdge).asInt();
+    options.tiles.tileSize = tiles.get("tile_size", options.tiles.tileSize).asInt();
+    options.tiles.quality = tiles.get("quality", options.tiles.quality).asInt();
+    return options;
+}
+
+UploadRetryOptions uploadRetryFromConfig() {
+    UploadRetryOptions retry;
+    const auto& config = drogon::app().getCustomConfig()["journal"];
+    retry.attempts = std::max(1, config.get("upload_attempts", retry.attempts).asInt());
+    retry.firstDelay = std::chrono::seconds(std::max<Json::Int64>(1, config.get("retry_delay", static_cast<Json::Int64>(retry.firstDelay.count())).asInt64()));
+    retry.maxDelay = std::max(retry.firstDelay, std::chrono::seconds(config.get("retry_max_delay", static_cast<Json::Int64>(retry.maxDelay.count())).asInt64()));
+    return retry;
+}
+
+namespace {
+    void attemptUpload(std::shared_ptr<B2Service> b2Service, std::string fileName, std::shared_ptr<const SpooledFile> content,
+                       UploadRetryOptions retry, int attempt, std::chrono::seconds delay,
+                       std::function<void(bool success, std::string fileId)> done) {
+        auto service = b2Service;
+        service->upload(fileName, content, [b2Service = std::move(b2Service), fileName, content, retry, attempt, delay,
+                                            done = std::move(done)](bool success, std::string fileId) mutable {
+            if (success) {
+                IngestJournal::instance().complete(content->path());
+                done(true, std::move(fileId));
+                return;
+            }
+            if (attempt >= retry.attempts) {
+                LOG_WARN << "Upload of " << fileName << " to B2 failed " << attempt << " times; it stays in the ingest journal";
+                done(false, "");
+                return;
+            }
+            LOG_WARN << "Upload of " << fileName << " to B2 failed (attempt " << attempt << "), retrying in " << delay.count() << "s";
+            auto next = std::min(delay * 2, retry.maxDelay);
+            drogon::app().getLoop()->runAfter(static_cast<double>(delay.count()), [b2Service = std::move(b2Service), fileName = std::move(fileName),
+                                                                                    content, retry, attempt, next, done = std::move(done)]() mutable {
+                attemptUpload(std::move(b2Service), std::move(fileName), std::move(content), retry, attempt + 1, next, std::move(done));
+            });
+        });
+    }
+}
+
+void uploadOriginal(std::shared_ptr<B2Service> b2Service, const std::string& fileName, std::shared_ptr<const SpooledFile> content,
+                    std::function<void(bool success, std::string fileId)> done) {
+    auto retry = uploadRetryFromConfig();
+    attemptUpload(std::move(b2Service), fileName, std::move(content), retry, 1, retry.firstDelay, std::move(done));
+}
+
+image::PreviewPath ingestOriginal(const IngestFile& file, const image::PreviewOptions& options,
+                                  const std::function<void(UploadStage)>& onStage) {
+    image::PreviewPath path = image::PreviewPath::None;
+
+    // 1. Single ingest pass: metadata and decoded pixels
+    image::Analysis analysis = image::analyze(file.content->data(), options.maxEdge);
+    image::Metadata metadata = analysis.metadata;
+
+    // 2. Generate and save preview (and its size ladder) locally for the server-side gallery
+    std::string previewName = file.fileName;
+    std::vector<image::PreviewVariant> variants;
+    image::Placeholder placeholder;
+    try {
+        image::PreviewSet previews = image::createPreviewSet(analysis, file.content->data(), file.fileName, options);
+        if (!previews.preview.empty()) {
+            size_t lastDot = previewName.find_last_of(".");
+            if (lastDot != std::string::npos) {
+                previewName = previewName.substr(0, lastDot) + ".jpg";
+            } else {
+                previewName += ".jpg";
+            }
+
+            std::string previewPath = "gallery_previews/" + previewName;
+            std::ofstream out(previewPath, std::ios::binary);
+            if (out) {
+                out.write(previews.preview.data(), previews.preview.size());
+                LOG_DEBUG << "Gallery preview saved: " << previewPath;
+            }
+        }
+
+        // AVIF/WebP siblings, picked by get_preview_image from the Accept header
+        std::string previewStem = previewName.substr(0, previewName.find_last_of("."));
+        for (const auto& alternate : previews.alternates) {
+            std::string alternatePath = "gallery_previews/formats/" + previewStem + "." + image::extension(alternate.format);
+            std::ofstream out(alternatePath, std::ios::binary);
+            if (out) {
+                out.write(alternate.data.data(), alternate.data.size());
+            }
+        }
+
+        placeholder = previews.placeholder;
+        path = previews.path;
+        // The lossless preview is the original frame, less any edge a rotation trimmed: lay it out at that size
+        if (path == image::PreviewPath::Lossless) {
+            metadata.width = previews.width;
+            metadata.height = previews.height;
+        }
+        // JPEG rungs first, then their AVIF/WebP siblings; the feed groups them by format
+        for (const auto* rungs : {&previews.ladder, &previews.ladderAlternates}) {
+            for (const auto& rendition : *rungs) {
+                std::string rungPath = "gallery_previews/ladder/" + rendition.variant.fileName;
+                std::ofstream out(rungPath, std::ios::binary);
+                if (out) {
+                    out.write(rendition.data.data(), rendition.data.size());
+                    variants.push_back(rendition.variant);
+                }
+            }
+        }
+    } catch (const std::exception& e) {
+        LOG_ERROR << "Gallery preview generation failed for " << file.fileName << ": " << e.what();
+    }
+
+    // 2b. Deep-zoom tiles for originals too large to show at full resolution
+    image::TileLayout tiles;
+    if (options.tiles.enabled) {
+        std::string tileRoot = "gallery_previews/tiles/" + file.imageId;
+        std::error_code ec;
+        std::filesystem::remove_all(tileRoot, ec);
+        auto writeTile = [&tileRoot](int level, int column, int row, const unsigned char* data, size_t size) {
+            std::string levelDir = tileRoot + "/" + std::to_string(level);
+            std::error_code dirError;
+            std::filesystem::create_directories(levelDir, dirError);
+            std::ofstream out(levelDir + "/" + std::to_string(column) + "_" + std::to_string(row) + ".jpg", std::ios::binary);
+            if (!out) return false;
+            out.write(reinterpret_cast<const char*>(data), size);
+            return static_cast<bool>(out);
+        };
+        try {
+            if (image::buildTilePyramid(file.content->data(), analysis, options.tiles, tiles, writeTile)) {
+                LOG_INFO << "Generated " << tiles.maxLevel + 1 << " tile levels for " << file.fileName;
+            } else {
+                tiles = {};
+                std::filesystem::remove_all(tileRoot, ec);
+            }
+        } catch (const std::exception& e) {
+            LOG_ERROR << "Tile generation failed for " << file.fileName << ": " << e.what();
+            tiles = {};
+            std::filesystem::remove_all(tileRoot, ec);
+        }
+    }
+
+    // 3. Store in GalleryStorage
+    if (onStage) onStage(UploadStage::Storage);
+    GalleryItem item;
+    item.id = file.imageId;
+    item.name = file.name;
+    item.quote = file.quote;
+    item.fileName = file.fileName;
+    item.previewName = previewName;
+    item.metadata = metadata;
+    item.variants = std::move(variants);
+    item.placeholder = placeholder.blurHash;
+    item.dominantColor = placeholder.dominantColor;
+    item.contentHash = file.contentHash;
+    item.tiles = tiles;
+    if (!GalleryStorage::instance().addItem(item)) {
+        throw std::runtime_error("the gallery could not store " + file.fileName);
+    }
+    return path;
+}
+
+namespace {
+    // Journaled originals waiting to be resumed, and how many are running
+    struct ResumeQueue {
+        std::mutex mutex;
+        std::deque<JournalEntry> pending;
+        size_t active = 0;
+        size_t limit = 2;
+    };
+
+    void resumeNext(const std::shared_ptr<ResumeQueue>& queue) {
+        JournalEntry entry;
+        {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            if (queue->pending.empty() || queue->active >= queue->limit) return;
+            entry = std::move(queue->pending.front());
+            queue->pending.pop_front();
+            ++queue->active;
+        }
+        auto next = [queue]() {
+            {
+                std::lock_guard<std::mutex> lock(queue->mutex);
+                --queue->active;
+            }
+            resumeNext(queue);
+        };
+
+        auto content = SpooledFile::open(entry.spoolPath, entry.contentHash);
+        if (!content) {
+            LOG_ERROR << "Cannot map journaled original " << entry.spoolPath << " of " << entry.fileName << "; dropping it";
+            IngestJournal::instance().complete(entry.spoolPath);
+            next();
+            return;
+        }
+
+        auto b2Service = B2Service::instance();
+        if (!b2Service) {
+            LOG_WARN << "B2 Service not configured; " << entry.fileName << " stays in the ingest journal";
+            next();
+            return;
+        }
+
+        auto upload = [b2Service, entry, content, next]() {
+            uploadOriginal(b2Service, entry.fileName, content, [fileName = entry.fileName, next](bool success, std::string fileId) {
+                if (success) LOG_INFO << "Resumed upload of " << fileName << " finished, file ID " << fileId;
+                next();
+            });
+        };
+
+        // The item may have been stored just before the crash, ahead of the journal catching up
+        if (entry.stage == JournalStage::Stored || GalleryStorage::instance().findByHash(entry.contentHash)) {
+            upload();
+            return;
+        }
+
+        auto& executor = ImageExecutor::instance();
+        if (!executor.reserve(1)) {
+            {
+                std::lock_guard<std::mutex> lock(queue->mutex);
+                queue->pending.push_front(std::move(entry));
+                --queue->active;
+            }
+            drogon::app().getLoop()->runAfter(executor.options().retryAfter, [queue]() { resumeNext(queue); });
+            return;
+        }
+
+        IngestFile file;
+        file.contentHash = entry.contentHash;
+        file.imageId = entry.contentHash.substr(0, 12);
+        file.name = entry.name;
+        file.quote = entry.quote;
+        file.fileName = entry.fileName;
+        file.content = content;
+        auto options = std::make_shared<const image::PreviewOptions>(previewOptionsFromConfig());
+        executor.submit([file, options]() {
+            ingestOriginal(file, *options);
+            IngestJournal::instance().advance(file.content->path(), JournalStage::Stored);
+        }, [upload, next, fileName = entry.fileName](bool stored) {
+            if (stored) {
+                upload();
+                return;
+            }
+            LOG_WARN << "Resumed ingest of " << fileName << " failed; it stays in the ingest journal";
+            next();
+        });
+    }
+}
+
+void resumeJournaledIngests(std::vector<JournalEntry> entries) {
+    if (entries.empty()) return;
+
+    auto queue = std::make_shared<ResumeQueue>();
+    const auto& config = drogon::app().getCustomConfig()["journal"];
+    queue->limit = std::max<size_t>(1, config.get("resume_concurrency", static_cast<Json::UInt64>(queue->limit)).asUInt64());
+    queue->pending.assign(std::make_move_iterator(entries.begin()), std::make_move_iterator(entries.end()));
+    LOG_INFO << "Resuming " << queue->pending.size() << " unfinished uploads from the ingest journal, "
+             << queue->limit << " at a time";
+    for (size_t i = 0; i < queue->limit; ++i) resumeNext(queue);
+}
+
+}
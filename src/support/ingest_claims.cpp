@@ -0,0 +1,43 @@
+#include <support/ingest_claims.hpp>
+#include <utility>
+
+namespace blutography {
+
+IngestClaims::Claim::Claim(Claim&& other) noexcept
+    : owner_(std::exchange(other.owner_, nullptr)), contentHash_(std::move(other.contentHash_)) {}
+
+IngestClaims::Claim& IngestClaims::Claim::operator=(Claim&& other) noexcept {
+    if (this != &other) {
+        release();
+        owner_ = std::exchange(other.owner_, nullptr);
+        contentHash_ = std::move(other.contentHash_);
+    }
+    return *this;
+}
+
+void IngestClaims::Claim::release() {
+    if (!owner_) return;
+    {
+        std::lock_guard<std::mutex> lock(owner_->mutex_);
+        owner_->held_.erase(contentHash_);
+    }
+    owner_ = nullptr;
+}
+
+IngestClaims& IngestClaims::instance() {
+    static IngestClaims claims;
+    return claims;
+}
+
+IngestClaims::Claim IngestClaims::claim(const std::string& contentHash) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!held_.insert(contentHash).second) return {};
+    return Claim(this, contentHash);
+}
+
+bool IngestClaims::held(const std::string& contentHash) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return held_.count(contentHash) > 0;
+}
+
+}
@@ -0,0 +1,111 @@
+#include <support/ingest_journal.hpp>
+#include <support/durable.hpp>
+#include <drogon/drogon.h>
+#include <json/json.h>
+#include <filesystem>
+#include <fstream>
+#include <unordered_set>
+
+namespace blutography {
+
+static std::string journalPath(const std::string& spoolPath) {
+    return std::filesystem::path(spoolPath).replace_extension(".journal").string();
+}
+
+static const char* toString(JournalStage stage) {
+    return stage == JournalStage::Stored ? "stored" : "spooled";
+}
+
+IngestJournal& IngestJournal::instance() {
+    static IngestJournal inst(SpooledFile::directory);
+    return inst;
+}
+
+IngestJournal::IngestJournal(std::string directory) : directory_(std::move(directory)) {}
+
+bool IngestJournal::write(const JournalEntry& entry) {
+    Json::Value record;
+    record["spoolPath"] = entry.spoolPath;
+    record["fileName"] = entry.fileName;
+    record["name"] = entry.name;
+    record["quote"] = entry.quote;
+    record["contentHash"] = entry.contentHash;
+    record["stage"] = toString(entry.stage);
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    return writeFileAtomically(journalPath(entry.spoolPath), Json::writeString(builder, record));
+}
+
+bool IngestJournal::begin(SpooledFile& content, JournalEntry entry) {
+    entry.spoolPath = content.path();
+    entry.contentHash = content.sha1();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!write(entry)) return false;
+    content.persist();
+    entries_[entry.spoolPath] = std::move(entry);
+    return true;
+}
+
+void IngestJournal::advance(const std::string& spoolPath, JournalStage stage) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(spoolPath);
+    if (it == entries_.end() || it->second.stage == stage) return;
+    it->second.stage = stage;
+    write(it->second);
+}
+
+void IngestJournal::complete(const std::string& spoolPath) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.erase(spoolPath);
+    // The record goes first: a crash in between leaves an orphan spool file, which recover() deletes
+    std::error_code ec;
+    std::filesystem::remove(journalPath(spoolPath), ec);
+    std::filesystem::remove(spoolPath, ec);
+}
+
+std::vector<JournalEntry> IngestJournal::recover() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<JournalEntry> unfinished;
+    std::unordered_set<std::string> kept;
+    std::error_code ec;
+
+    for (const auto& file : std::filesystem::directory_iterator(directory_, ec)) {
+        if (file.path().extension() != ".journal") continue;
+        std::ifstream in(file.path());
+        Json::Value record;
+        Json::CharReaderBuilder builder;
+        std::string errs;
+        if (!Json::parseFromStream(builder, in, &record, &errs)) {
+            LOG_ERROR << "Dropping unreadable journal entry " << file.path() << ": " << errs;
+            std::filesystem::remove(file.path(), ec);
+            continue;
+        }
+
+        JournalEntry entry;
+        entry.spoolPath = record["spoolPath"].asString();
+        entry.fileName = record["fileName"].asString();
+        entry.name = record["name"].asString();
+        entry.quote = record["quote"].asString();
+        entry.contentHash = record["contentHash"].asString();
+        entry.stage = record["stage"].asString() == "stored" ? JournalStage::Stored : JournalStage::Spooled;
+        if (!std::filesystem::exists(entry.spoolPath)) {
+            LOG_ERROR << "Journal entry for " << entry.fileName << " has lost its original; dropping it";
+            std::filesystem::remove(file.path(), ec);
+            continue;
+        }
+        kept.insert(std::filesystem::path(entry.spoolPath).filename().string());
+        entries_[entry.spoolPath] = entry;
+        unfinished.push_back(std::move(entry));
+    }
+
+    // Spooled but never journaled (duplicates, refused batches) or half-written temp files
+    for (const auto& file : std::filesystem::directory_iterator(directory_, ec)) {
+        auto extension = file.path().extension();
+        if ((extension == ".part" && !kept.count(file.path().filename().string())) || extension == ".tmp") {
+            std::filesystem::remove(file.path(), ec);
+        }
+    }
+    return unfinished;
+}
+
+}
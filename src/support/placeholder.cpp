@@ -0,0 +1,182 @@
+#include <support/placeholder.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <numbers>
+#include <vector>
+
+namespace blutography::image {
+
+static constexpr int kThumbEdge = 32;
+static constexpr int kComponentsX = 4;
+static constexpr int kComponentsY = 3;
+
+// Box-reduces `rgb` to at most kThumbEdge on the long edge. Rows are summed
+// column-wise into `columnSums` first, which keeps the per-pixel work in one
+// contiguous loop over bytes.
+static std::vector<unsigned char> thumbnail(const unsigned char* rgb, int width, int height, int& thumbWidth, int& thumbHeight) {
+    if (width >= height) {
+        thumbWidth = std::min(width, kThumbEdge);
+        thumbHeight = std::max(1, static_cast<int>(static_cast<long long>(height) * thumbWidth / width));
+    } else {
+        thumbHeight = std::min(height, kThumbEdge);
+        thumbWidth = std::max(1, static_cast<int>(static_cast<long long>(width) * thumbHeight / height));
+    }
+
+    const size_t rowBytes = static_cast<size_t>(width) * 3;
+    std::vector<uint32_t> columnSums(rowBytes);
+    std::vector<unsigned char> thumb(static_cast<size_t>(thumbWidth) * thumbHeight * 3);
+
+    for (int ty = 0; ty < thumbHeight; ++ty) {
+        int y0 = static_cast<int>(static_cast<long long>(ty) * height / thumbHeight);
+        int y1 = std::max(y0 + 1, static_cast<int>(static_cast<long long>(ty + 1) * height / thumbHeight));
+
+        std::fill(columnSums.begin(), columnSums.end(), 0u);
+        for (int y = y0; y < y1; ++y) {
+            const unsigned char* row = rgb + static_cast<size_t>(y) * rowBytes;
+            uint32_t* sums = columnSums.data();
+            for (size_t i = 0; i < rowBytes; ++i) sums[i] += row[i];
+        }
+
+        for (int tx = 0; tx < thumbWidth; ++tx) {
+            int x0 = static_cast<int>(static_cast<long long>(tx) * width / thumbWidth);
+            int x1 = std::max(x0 + 1, static_cast<int>(static_cast<long long>(tx + 1) * width / thumbWidth));
+            uint64_t r = 0, g = 0, b = 0;
+            for (int x = x0; x < x1; ++x) {
+                r += columnSums[x * 3];
+                g += columnSums[x * 3 + 1];
+                b += columnSums[x * 3 + 2];
+            }
+            uint64_t count = static_cast<uint64_t>(y1 - y0) * (x1 - x0);
+            unsigned char* out = thumb.data() + (static_cast<size_t>(ty) * thumbWidth + tx) * 3;
+            out[0] = static_cast<unsigned char>((r + count / 2) / count);
+            out[1] = static_cast<unsigned char>((g + count / 2) / count);
+            out[2] = static_cast<unsigned char>((b + count / 2) / count);
+        }
+    }
+    return thumb;
+}
+
+static const std::array<float, 256>& srgbToLinearTable() {
+    static const std::array<float, 256> table = [] {
+        std::array<float, 256> t{};
+        for (int i = 0; i < 256; ++i) {
+            float v = i / 255.0f;
+            t[i] = v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+        }
+        return t;
+    }();
+    return table;
+}
+
+static int linearToSrgb(float value) {
+    float v = std::clamp(value, 0.0f, 1.0f);
+    if (v <= 0.0031308f) return static_cast<int>(v * 12.92f * 255.0f + 0.5f);
+    return static_cast<int>((1.055f * std::pow(v, 1.0f / 2.4f) - 0.055f) * 255.0f + 0.5f);
+}
+
+static void encode83(int value, int length, std::string& out) {
+    static const char chars[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz#$%*+,-.:;=?@[]^_{|}~";
+    int divisor = 1;
+    for (int i = 1; i < length; ++i) divisor *= 83;
+    for (int i = 0; i < length; ++i) {
+        out.push_back(chars[(value / divisor) % 83]);
+        divisor /= 83;
+    }
+}
+
+static float signPow(float value, float exp) {
+    return std::copysign(std::pow(std::fabs(value), exp), value);
+}
+
+static std::string blurHash(const unsigned char* thumb, int width, int height) {
+    const auto& toLinear = srgbToLinearTable();
+    std::array<std::array<float, 3>, kComponentsX * kComponentsY> factors{};
+
+    std::vector<float> cosX(static_cast<size_t>(kComponentsX) * width);
+    std::vector<float> cosY(static_cast<size_t>(kComponentsY) * height);
+    for (int i = 0; i < kComponentsX; ++i)
+        for (int x = 0; x < width; ++x) cosX[i * width + x] = std::cos(std::numbers::pi_v<float> * i * x / width);
+    for (int j = 0; j < kComponentsY; ++j)
+        for (int y = 0; y < height; ++y) cosY[j * height + y] = std::cos(std::numbers::pi_v<float> * j * y / height);
+
+    for (int j = 0; j < kComponentsY; ++j) {
+        for (int i = 0; i < kComponentsX; ++i) {
+            float r = 0, g = 0, b = 0;
+            for (int y = 0; y < height; ++y) {
+                for (int x = 0; x < width; ++x) {
+                    float basis = cosX[i * width + x] * cosY[j * height + y];
+                    const unsigned char* px = thumb + (static_cast<size_t>(y) * width + x) * 3;
+                    r += basis * toLinear[px[0]];
+                    g += basis * toLinear[px[1]];
+                    b += basis * toLinear[px[2]];
+                }
+            }
+            float scale = (i == 0 && j == 0 ? 1.0f : 2.0f) / (width * height);
+            factors[j * kComponentsX + i] = {r * scale, g * scale, b * scale};
+        }
+    }
+
+    std::string hash;
+    encode83((kComponentsX - 1) + (kComponentsY - 1) * 9, 1, hash);
+
+    float maximumValue = 1.0f;
+    float actualMax = 0.0f;
+    for (size_t k = 1; k < factors.size(); ++k)
+        for (float c : factors[k]) actualMax = std::max(actualMax, std::fabs(c));
+    if (factors.size() > 1) {
+        int quantisedMax = std::clamp(static_cast<int>(std::floor(actualMax * 166 - 0.5f)), 0, 82);
+        maximumValue = (quantisedMax + 1) / 166.0f;
+        encode83(quantisedMax, 1, hash);
+    } else {
+        encode83(0, 1, hash);
+    }
+
+    const auto& dc = factors[0];
+    encode83((linearToSrgb(dc[0]) << 16) + (linearToSrgb(dc[1]) << 8) + linearToSrgb(dc[2]), 4, hash);
+
+    for (size_t k = 1; k < factors.size(); ++k) {
+        auto quant = [&](float v) {
+            return std::clamp(static_cast<int>(std::floor(signPow(v / maximumValue, 0.5f) * 9 + 9.5f)), 0, 18);
+        };
+        encode83(quant(factors[k][0]) * 19 * 19 + quant(factors[k][1]) * 19 + quant(factors[k][2]), 2, hash);
+    }
+    return hash;
+}
+
+// Most populated bin of a 4-bit-per-channel histogram, reported as the mean of
+// the pixels in that bin so the colour is not quantised.
+static std::string dominantColor(const unsigned char* thumb, int width, int height) {
+    std::array<uint32_t, 4096> counts{};
+    std::array<std::array<uint32_t, 3>, 4096> sums{};
+    const int pixels = width * height;
+    for (int p = 0; p < pixels; ++p) {
+        const unsigned char* px = thumb + static_cast<size_t>(p) * 3;
+        int bin = ((px[0] >> 4) << 8) | ((px[1] >> 4) << 4) | (px[2] >> 4);
+        ++counts[bin];
+        sums[bin][0] += px[0];
+        sums[bin][1] += px[1];
+        sums[bin][2] += px[2];
+    }
+
+    int best = static_cast<int>(std::max_element(counts.begin(), counts.end()) - counts.begin());
+    uint32_t n = std::max(1u, counts[best]);
+    char buf[8];
+    std::snprintf(buf, sizeof(buf), "#%02x%02x%02x", sums[best][0] / n, sums[best][1] / n, sums[best][2] / n);
+    return buf;
+}
+
+Placeholder computePlaceholder(const unsigned char* rgb, int width, int height) {
+    Placeholder placeholder;
+    if (!rgb || width <= 0 || height <= 0) return placeholder;
+
+    int thumbWidth = 0, thumbHeight = 0;
+    auto thumb = thumbnail(rgb, width, height, thumbWidth, thumbHeight);
+    placeholder.blurHash = blurHash(thumb.data(), thumbWidth, thumbHeight);
+    placeholder.dominantColor = dominantColor(thumb.data(), thumbWidth, thumbHeight);
+    return placeholder;
+}
+
+}
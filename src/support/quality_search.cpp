@@ -0,0 +1,109 @@
+#include <support/quality_search.hpp>
+#include <support/image_workspace.hpp>
+#include <turbojpeg.h>
+#include <algorithm>
+#include <limits>
+
+namespace blutography::image {
+
+static constexpr int kQualityStep = 5;
+
+static void runTrial(const unsigned char* rgb, int width, int height, int subsamp, bool measureSsim, QualityTrial& trial) {
+    trial.bytes = std::numeric_limits<size_t>::max();
+    Workspace& ws = workspace();
+    if (!ws.compressor) return;
+
+    unsigned long capacity = 0;
+    unsigned char* jpeg = ws.jpegBuffer(width, height, subsamp, capacity);
+    unsigned long size = capacity;
+    if (!jpeg || tjCompress2(ws.compressor, rgb, width, 0, height, TJPF_RGB, &jpeg, &size, subsamp, trial.quality, TJFLAG_FASTDCT | TJFLAG_NOREALLOC) < 0) {
+        return;
+    }
+    trial.bytes = size;
+
+    if (measureSsim && ws.decompressor) {
+        unsigned char* decoded = ws.scratch[1].reserve(static_cast<size_t>(width) * height * 3);
+        if (tjDecompress2(ws.decompressor, jpeg, size, decoded, width, 0, height, TJPF_RGB, TJFLAG_FASTDCT) == 0) {
+            trial.ssim = lumaSsim(rgb, decoded, width, height);
+        }
+    }
+}
+
+std::vector<QualityTrial> runQualityTrials(const unsigned char* rgb, int width, int height, int subsamp,
+                                           const QualityOptions& options, bool measureSsim) {
+    int maxQuality = std::clamp(options.maxQuality, 1, 100);
+    int minQuality = std::clamp(options.minQuality, 1, maxQuality);
+
+    std::vector<QualityTrial> trials;
+    for (int q = maxQuality; q > minQuality; q -= kQualityStep) trials.push_back({q, 0, 0.0});
+    trials.push_back({minQuality, 0, 0.0});
+
+    // On the calling worker: the executor bounds the encoding threads, and other uploads fill the other workers
+    for (auto& trial : trials) runTrial(rgb, width, height, subsamp, measureSsim, trial);
+    return trials;
+}
+
+int pickQuality(const std::vector<QualityTrial>& trials, const QualityOptions& options, double bytesScale, size_t overhead) {
+    if (trials.empty()) return options.fixed;
+
+    if (options.targetBytes > 0) {
+        // Highest quality predicted to fit; the lowest tried if none does
+        for (const auto& trial : trials) {
+            if (trial.bytes == std::numeric_limits<size_t>::max()) continue;
+            double predicted = static_cast<double>(trial.bytes) * bytesScale + static_cast<double>(overhead);
+            if (predicted <= static_cast<double>(options.targetBytes)) return trial.quality;
+        }
+        return trials.back().quality;
+    }
+
+    if (options.targetSsim > 0.0) {
+        // Lowest quality that still reaches the target; the highest tried if none does
+        int chosen = trials.front().quality;
+        for (const auto& trial : trials) {
+            if (trial.ssim >= options.targetSsim) chosen = trial.quality;
+        }
+        return chosen;
+    }
+
+    return options.fixed;
+}
+
+double lumaSsim(const unsigned char* a, const unsigned char* b, int width, int height) {
+    constexpr double c1 = (0.01 * 255) * (0.01 * 255);
+    constexpr double c2 = (0.03 * 255) * (0.03 * 255);
+    constexpr int block = 8;
+
+    auto luma = [](const unsigned char* px) {
+        return 0.299 * px[0] + 0.587 * px[1] + 0.114 * px[2];
+    };
+
+    double total = 0.0;
+    long blocks = 0;
+    for (int by = 0; by + block <= height; by += block) {
+        for (int bx = 0; bx + block <= width; bx += block) {
+            double sumA = 0, sumB = 0, sumAA = 0, sumBB = 0, sumAB = 0;
+            for (int y = by; y < by + block; ++y) {
+                size_t row = (static_cast<size_t>(y) * width + bx) * 3;
+                for (int x = 0; x < block; ++x) {
+                    double ya = luma(a + row + x * 3);
+                    double yb = luma(b + row + x * 3);
+                    sumA += ya;
+                    sumB += yb;
+                    sumAA += ya * ya;
+                    sumBB += yb * yb;
+                    sumAB += ya * yb;
+                }
+            }
+            constexpr double n = block * block;
+            double meanA = sumA / n, meanB = sumB / n;
+            double varA = sumAA / n - meanA * meanA;
+            double varB = sumBB / n - meanB * meanB;
+            double cov = sumAB / n - meanA * meanB;
+            total += ((2 * meanA * meanB + c1) * (2 * cov + c2)) / ((meanA * meanA + meanB * meanB + c1) * (varA + varB + c2));
+            ++blocks;
+        }
+    }
+    return blocks ? total / blocks : 1.0;
+}
+
+}
@@ -0,0 +1,263 @@
+#include <support/resample.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <numbers>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BLUTOGRAPHY_RESAMPLE_X86 1
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define BLUTOGRAPHY_RESAMPLE_NEON 1
+#endif
+
+namespace blutography::image {
+
+namespace {
+    // Weights are fixed point with this many fractional bits. With Lanczos3's
+    // negative lobes the absolute weights sum to ~1.3, so 255 * 1.3 * 2^22 still
+    // fits an int32 accumulator.
+    constexpr int kPrecision = 22;
+    constexpr int32_t kRound = 1 << (kPrecision - 1);
+
+    double sinc(double x) {
+        if (x == 0.0) return 1.0;
+        x *= std::numbers::pi;
+        return std::sin(x) / x;
+    }
+
+    double lanczos3(double x) {
+        return (x > -3.0 && x < 3.0) ? sinc(x) * sinc(x / 3.0) : 0.0;
+    }
+
+    double box(double x) {
+        return (x >= -0.5 && x < 0.5) ? 1.0 : 0.0;
+    }
+
+    // For each output index: the first source index it reads and its taps.
+    struct Contributions {
+        std::vector<int> start;
+        std::vector<int> count;
+        std::vector<int32_t> weights; // `taps` per output index
+        int taps = 0;
+    };
+
+    Contributions contributions(int srcSize, int dstSize, ResampleFilter filter) {
+        const double scale = static_cast<double>(srcSize) / dstSize;
+        const double stretch = std::max(scale, 1.0);
+        const double support = (filter == ResampleFilter::Lanczos3 ? 3.0 : 0.5) * stretch;
+        auto kernel = filter == ResampleFilter::Lanczos3 ? lanczos3 : box;
+
+        Contributions c;
+        c.taps = static_cast<int>(std::ceil(support)) * 2 + 1;
+        c.start.resize(dstSize);
+        c.count.resize(dstSize);
+        c.weights.assign(static_cast<size_t>(dstSize) * c.taps, 0);
+
+        std::vector<double> w(c.taps);
+        for (int i = 0; i < dstSize; ++i) {
+            double center = (i + 0.5) * scale;
+            int left = std::max(0, static_cast<int>(std::floor(center - support)));
+            int right = std::min(srcSize, static_cast<int>(std::ceil(center + support)));
+            int n = std::min(right - left, c.taps);
+
+            double sum = 0.0;
+            for (int j = 0; j < n; ++j) {
+                w[j] = kernel((left + j + 0.5 - center) / stretch);
+                sum += w[j];
+            }
+            if (sum == 0.0) { // only possible at the very edge with a box filter
+                w[0] = 1.0;
+                sum = 1.0;
+                n = std::max(n, 1);
+            }
+
+            // Quantise and put the rounding error on the largest tap so the
+            // weights sum to exactly 1.0 and flat areas stay flat.
+            int32_t* out = c.weights.data() + static_cast<size_t>(i) * c.taps;
+            int32_t total = 0;
+            int largest = 0;
+            for (int j = 0; j < n; ++j) {
+                out[j] = static_cast<int32_t>(std::lround(w[j] / sum * (1 << kPrecision)));
+                total += out[j];
+                if (out[j] > out[largest]) largest = j;
+            }
+            out[largest] += (1 << kPrecision) - total;
+
+            // Drop zero taps at both ends
+            int first = 0;
+            while (first < n - 1 && out[first] == 0) ++first;
+            while (n - 1 > first && out[n - 1] == 0) --n;
+            if (first > 0) std::copy(out + first, out + n, out);
+            c.start[i] = left + first;
+            c.count[i] = n - first;
+        }
+        return c;
+    }
+
+    inline unsigned char clampPixel(int32_t acc) {
+        acc = (acc + kRound) >> kPrecision;
+        return static_cast<unsigned char>(std::clamp(acc, 0, 255));
+    }
+
+    void horizontalPass(const unsigned char* src, int srcWidth, int height, unsigned char* dst, int dstWidth, const Contributions& c) {
+        for (int y = 0; y < height; ++y) {
+            const unsigned char* row = src + static_cast<size_t>(y) * srcWidth * 3;
+            unsigned char* out = dst + static_cast<size_t>(y) * dstWidth * 3;
+            for (int x = 0; x < dstWidth; ++x) {
+                const int32_t* w = c.weights.data() + static_cast<size_t>(x) * c.taps;
+                const unsigned char* p = row + static_cast<size_t>(c.start[x]) * 3;
+                int32_t r = 0, g = 0, b = 0;
+                for (int k = 0; k < c.count[x]; ++k, p += 3) {
+                    r += p[0] * w[k];
+                    g += p[1] * w[k];
+                    b += p[2] * w[k];
+                }
+                out[x * 3] = clampPixel(r);
+                out[x * 3 + 1] = clampPixel(g);
+                out[x * 3 + 2] = clampPixel(b);
+            }
+        }
+    }
+
+    // One output row of the vertical pass: a weighted sum of `count` source rows,
+    // each `bytes` wide. The SIMD versions handle 8 bytes per step and leave the
+    // tail to this one.
+    void verticalRowScalar(const unsigned char* src, size_t stride, int count, const int32_t* w, unsigned char* out, size_t from, size_t bytes) {
+        for (size_t i = from; i < bytes; ++i) {
+            int32_t acc = 0;
+            const unsigned char* p = src + i;
+            for (int k = 0; k < count; ++k, p += stride) acc += *p * w[k];
+            out[i] = clampPixel(acc);
+        }
+    }
+
+#ifdef BLUTOGRAPHY_RESAMPLE_X86
+    __attribute__((target("avx2")))
+    void verticalRowAvx2(const unsigned char* src, size_t stride, int count, const int32_t* w, unsigned char* out, size_t bytes) {
+        const __m256i round = _mm256_set1_epi32(kRound);
+        size_t i = 0;
+        for (; i + 8 <= bytes; i += 8) {
+            __m256i acc = round;
+            const unsigned char* p = src + i;
+            for (int k = 0; k < count; ++k, p += stride) {
+                __m256i px = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+                acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(px, _mm256_set1_epi32(w[k])));
+            }
+            acc = _mm256_srai_epi32(acc, kPrecision);
+            __m128i packed16 = _mm_packs_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(packed16, packed16));
+        }
+        verticalRowScalar(src, stride, count, w, out, i, bytes);
+    }
+#endif
+
+#ifdef BLUTOGRAPHY_RESAMPLE_NEON
+    void verticalRowNeon(const unsigned char* src, size_t stride, int count, const int32_t* w, unsigned char* out, size_t bytes) {
+        size_t i = 0;
+        for (; i + 8 <= bytes; i += 8) {
+            int32x4_t lo = vdupq_n_s32(kRound), hi = vdupq_n_s32(kRound);
+            const unsigned char* p = src + i;
+            for (int k = 0; k < count; ++k, p += stride) {
+                int16x8_t px = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(p)));
+                lo = vmlaq_n_s32(lo, vmovl_s16(vget_low_s16(px)), w[k]);
+                hi = vmlaq_n_s32(hi, vmovl_s16(vget_high_s16(px)), w[k]);
+            }
+            int16x8_t packed16 = vcombine_s16(vqshrn_n_s32(lo, 16), vqshrn_n_s32(hi, 16));
+            vst1_u8(out + i, vqshrun_n_s16(packed16, kPrecision - 16));
+        }
+        verticalRowScalar(src, stride, count, w, out, i, bytes);
+    }
+#endif
+
+    using VerticalRow = void (*)(const unsigned char*, size_t, int, const int32_t*, unsigned char*, size_t);
+
+    void verticalRowPortable(const unsigned char* src, size_t stride, int count, const int32_t* w, unsigned char* out, size_t bytes) {
+        verticalRowScalar(src, stride, count, w, out, 0, bytes);
+    }
+
+    struct Kernel {
+        VerticalRow row;
+        const char* name;
+    };
+
+    constexpr Kernel kScalar{verticalRowPortable, "scalar"};
+#ifdef BLUTOGRAPHY_RESAMPLE_X86
+    constexpr Kernel kAvx2{verticalRowAvx2, "avx2"};
+#endif
+#ifdef BLUTOGRAPHY_RESAMPLE_NEON
+    constexpr Kernel kNeon{verticalRowNeon, "neon"};
+#endif
+
+    const Kernel* selectKernel() {
+#ifdef BLUTOGRAPHY_RESAMPLE_X86
+        if (__builtin_cpu_supports("avx2")) return &kAvx2;
+#endif
+#ifdef BLUTOGRAPHY_RESAMPLE_NEON
+        return &kNeon;
+#endif
+        return &kScalar;
+    }
+
+    std::atomic<const Kernel*>& selected() {
+        static std::atomic<const Kernel*> kernel{selectKernel()};
+        return kernel;
+    }
+
+    const Kernel& kernel() {
+        return *selected().load(std::memory_order_relaxed);
+    }
+}
+
+void resampleRgb(const unsigned char* src, int srcWidth, int srcHeight,
+                 unsigned char* dst, int dstWidth, int dstHeight,
+                 ScratchBuffer& temp, ResampleFilter filter) {
+    if (srcWidth <= 0 || srcHeight <= 0 || dstWidth <= 0 || dstHeight <= 0) return;
+
+    Contributions horizontal = contributions(srcWidth, dstWidth, filter);
+    Contributions vertical = contributions(srcHeight, dstHeight, filter);
+
+    unsigned char* mid = temp.reserve(static_cast<size_t>(dstWidth) * srcHeight * 3);
+    horizontalPass(src, srcWidth, srcHeight, mid, dstWidth, horizontal);
+
+    const size_t stride = static_cast<size_t>(dstWidth) * 3;
+    VerticalRow row = kernel().row;
+    for (int y = 0; y < dstHeight; ++y) {
+        row(mid + static_cast<size_t>(vertical.start[y]) * stride, stride, vertical.count[y],
+            vertical.weights.data() + static_cast<size_t>(y) * vertical.taps, dst + y * stride, stride);
+    }
+}
+
+const char* resampleKernel() {
+    return kernel().name;
+}
+
+bool setResampleKernel(std::string_view name) {
+    if (name == "native") {
+        selected() = selectKernel();
+        return true;
+    }
+    if (name == kScalar.name) {
+        selected() = &kScalar;
+        return true;
+    }
+#ifdef BLUTOGRAPHY_RESAMPLE_X86
+    if (name == kAvx2.name && __builtin_cpu_supports("avx2")) {
+        selected() = &kAvx2;
+        return true;
+    }
+#endif
+#ifdef BLUTOGRAPHY_RESAMPLE_NEON
+    if (name == kNeon.name) {
+        selected() = &kNeon;
+        return true;
+    }
+#endif
+    return false;
+}
+
+}
@@ -0,0 +1,89 @@
+#include <support/spool.hpp>
+#include <drogon/drogon.h>
+#include <drogon/utils/Utilities.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+namespace blutography {
+
+static bool writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = ::write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+std::shared_ptr<SpooledFile> SpooledFile::create(std::string_view data, std::string sha1, const std::string& in) {
+    std::shared_ptr<SpooledFile> file(new SpooledFile());
+    file->path_ = in + "/" + drogon::utils::getUuid() + ".part";
+
+    int fd = ::open(file->path_.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        LOG_ERROR << "Failed to create spool file " << file->path_ << ": " << std::strerror(errno);
+        return nullptr;
+    }
+
+    bool ok = writeAll(fd, data.data(), data.size());
+    // The ingest journal may point at this file across a crash, so it has to be on disk first
+    ok = ok && ::fsync(fd) == 0;
+    ok = (::close(fd) == 0) && ok;
+
+    if (!ok) {
+        LOG_ERROR << "Failed to spool upload to " << file->path_ << ": " << std::strerror(errno);
+        ::unlink(file->path_.c_str());
+        return nullptr;
+    }
+
+    file->sha1_ = std::move(sha1);
+    file->size_ = data.size();
+    if (!file->map()) return nullptr;
+    return file;
+}
+
+std::shared_ptr<SpooledFile> SpooledFile::open(const std::string& path, std::string sha1) {
+    struct stat info;
+    if (::stat(path.c_str(), &info) != 0) return nullptr;
+    std::shared_ptr<SpooledFile> file(new SpooledFile());
+    file->path_ = path;
+    file->sha1_ = std::move(sha1);
+    file->size_ = static_cast<size_t>(info.st_size);
+    file->persistent_ = true;
+    if (!file->map()) return nullptr;
+    return file;
+}
+
+bool SpooledFile::map() {
+    if (size_ == 0) return true;
+    int fd = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_ERROR << "Failed to open spool file " << path_ << ": " << std::strerror(errno);
+        return false;
+    }
+    void* mapping = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        LOG_ERROR << "Failed to map spool file " << path_ << ": " << std::strerror(errno);
+        return false;
+    }
+    // Decoders and the SHA-1 of the B2 upload both read front to back
+    ::madvise(mapping, size_, MADV_SEQUENTIAL);
+    data_ = static_cast<const char*>(mapping);
+    return true;
+}
+
+SpooledFile::~SpooledFile() {
+    if (data_) ::munmap(const_cast<char*>(data_), size_);
+    if (!path_.empty() && !persistent_) ::unlink(path_.c_str());
+}
+
+}
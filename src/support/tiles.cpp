@@ -0,0 +1,135 @@
+#include <support/tiles.hpp>
+#include <support/image_workspace.hpp>
+#include <support/resample.hpp>
+#include <turbojpeg.h>
+#include <drogon/drogon.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace blutography::image {
+
+static constexpr uint64_t kMaxLevelPixels = 1ull << 28; // largest decoded level, 268 MP
+
+// Cuts one full-resolution tile row out of the original's coefficients. TurboJPEG
+// allocates the outputs; each is handed to the sink and freed.
+static bool cropRow(Workspace& ws, std::string_view inputData, const TileLayout& layout, int row, const TileSink& sink) {
+    const int columns = (layout.width + layout.tileSize - 1) / layout.tileSize;
+    const int y = row * layout.tileSize;
+    const int tileHeight = std::min(layout.tileSize, layout.height - y);
+
+    std::vector<tjtransform> xforms(columns);
+    std::vector<unsigned char*> buffers(columns, nullptr);
+    std::vector<unsigned long> sizes(columns, 0);
+    for (int column = 0; column < columns; ++column) {
+        tjtransform& xform = xforms[column];
+        std::memset(&xform, 0, sizeof(xform));
+        xform.op = TJXOP_NONE;
+        xform.r.x = column * layout.tileSize;
+        xform.r.y = y;
+        xform.r.w = std::min(layout.tileSize, layout.width - xform.r.x);
+        xform.r.h = tileHeight;
+        xform.options = TJXOPT_CROP | TJXOPT_COPYNONE;
+#ifdef TJXOPT_OPTIMIZE
+        xform.options |= TJXOPT_OPTIMIZE;
+#else
+        xform.options |= TJXOPT_PROGRESSIVE;
+#endif
+    }
+
+    bool ok = tjTransform(ws.transformer, (const unsigned char*)inputData.data(), inputData.size(), columns,
+                          buffers.data(), sizes.data(), xforms.data(), 0) == 0;
+    if (!ok) LOG_ERROR << "TurboJPEG Transform failed on tile row " << row << ": " << tjGetErrorStr2(ws.transformer);
+    for (int column = 0; column < columns; ++column) {
+        if (ok && buffers[column]) ok = sink(layout.maxLevel, column, row, buffers[column], sizes[column]);
+        tjFree(buffers[column]);
+    }
+    return ok;
+}
+
+// Encodes every tile of one decoded level straight out of the level image.
+static bool encodeLevel(Workspace& ws, const unsigned char* rgb, int width, int height, int level,
+                        const TileLayout& layout, int quality, const TileSink& sink) {
+    const int pitch = width * 3;
+    for (int y = 0, row = 0; y < height; y += layout.tileSize, ++row) {
+        const int tileHeight = std::min(layout.tileSize, height - y);
+        for (int x = 0, column = 0; x < width; x += layout.tileSize, ++column) {
+            const int tileWidth = std::min(layout.tileSize, width - x);
+            unsigned long capacity = 0;
+            unsigned char* compressedData = ws.jpegBuffer(tileWidth, tileHeight, TJSAMP_420, capacity);
+            unsigned long compressedSize = capacity;
+            const unsigned char* origin = rgb + static_cast<size_t>(y) * pitch + static_cast<size_t>(x) * 3;
+            if (!compressedData || tjCompress2(ws.compressor, origin, tileWidth, pitch, tileHeight, TJPF_RGB, &compressedData, &compressedSize,
+                                               TJSAMP_420, quality, TJFLAG_FASTDCT | TJFLAG_NOREALLOC) < 0) {
+                LOG_ERROR << "TurboJPEG Compress failed on tile " << level << "/" << column << "_" << row << ": " << tjGetErrorStr2(ws.compressor);
+                return false;
+            }
+            if (!sink(level, column, row, compressedData, compressedSize)) return false;
+        }
+    }
+    return true;
+}
+
+bool buildTilePyramid(std::string_view inputData, const Analysis& analysis, const TileOptions& options,
+                      TileLayout& layout, const TileSink& sink) {
+    if (!options.enabled || analysis.container != Container::Jpeg || analysis.metadata.orientation != 1) return false;
+
+    Workspace& ws = workspace();
+    if (!ws.decompressor || !ws.compressor || !ws.transformer) return false;
+
+    int width = 0, height = 0, subsamp = 0, colorspace = 0;
+    if (tjDecompressHeader3(ws.decompressor, (const unsigned char*)inputData.data(), inputData.size(), &width, &height, &subsamp, &colorspace) < 0) {
+        LOG_ERROR << "TurboJPEG DecompressHeader failed: " << tjGetErrorStr2(ws.decompressor);
+        return false;
+    }
+    if (std::max(width, height) < options.minEdge) return false;
+
+    // Lossless crops must start on an MCU boundary, so the tile size is a multiple of the largest MCU side.
+    int mcu = 16;
+    if (subsamp >= 0 && subsamp < 6) mcu = std::max({mcu, tjMCUWidth[subsamp], tjMCUHeight[subsamp]});
+    layout.tileSize = std::max(mcu, options.tileSize / mcu * mcu);
+    layout.width = width;
+    layout.height = height;
+    layout.overlap = 0;
+    layout.maxLevel = 0;
+    while ((1 << layout.maxLevel) < std::max(width, height)) ++layout.maxLevel;
+
+    const tjscalingfactor half = {1, 2};
+    int levelWidth = TJSCALED(width, half);
+    int levelHeight = TJSCALED(height, half);
+    if (static_cast<uint64_t>(levelWidth) * levelHeight > kMaxLevelPixels) {
+        LOG_WARN << "Original of " << width << "x" << height << " is too large to tile";
+        return false;
+    }
+
+    const int rows = (height + layout.tileSize - 1) / layout.tileSize;
+    for (int row = 0; row < rows; ++row) {
+        if (!cropRow(ws, inputData, layout, row, sink)) return false;
+    }
+
+    unsigned char* level = ws.scratch[0].reserve(static_cast<size_t>(levelWidth) * levelHeight * 3);
+    if (tjDecompress2(ws.decompressor, (const unsigned char*)inputData.data(), inputData.size(), level, levelWidth, 0, levelHeight, TJPF_RGB, TJFLAG_FASTDCT) < 0) {
+        LOG_ERROR << "TurboJPEG Decompress failed: " << tjGetErrorStr2(ws.decompressor);
+        return false;
+    }
+
+    // Each level is the one above halved (rounding up), matching the DZI level sizes.
+    int target = 1;
+    for (int index = layout.maxLevel - 1; index >= 0; --index) {
+        if (!encodeLevel(ws, level, levelWidth, levelHeight, index, layout, options.quality, sink)) return false;
+        if (index == 0) break;
+
+        int nextWidth = (levelWidth + 1) / 2;
+        int nextHeight = (levelHeight + 1) / 2;
+        unsigned char* next = ws.scratch[target].reserve(static_cast<size_t>(nextWidth) * nextHeight * 3);
+        resampleRgb(level, levelWidth, levelHeight, next, nextWidth, nextHeight, ws.resample, ResampleFilter::Area);
+        level = next;
+        levelWidth = nextWidth;
+        levelHeight = nextHeight;
+        target ^= 1;
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,140 @@
+#include <support/upload_jobs.hpp>
+#include <drogon/drogon.h>
+#include <drogon/utils/Utilities.h>
+
+namespace blutography {
+
+const char* toString(UploadStage stage) {
+    switch (stage) {
+        case UploadStage::Queued: return "queued";
+        case UploadStage::Hashing: return "hashing";
+        case UploadStage::Preview: return "preview";
+        case UploadStage::Storage: return "storage";
+        case UploadStage::B2: return "b2";
+        case UploadStage::Done: return "done";
+    }
+    return "unknown";
+}
+
+static long long millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+UploadJob::UploadJob(std::string id, std::vector<std::string> fileNames)
+    : id_(std::move(id)), created_(std::chrono::steady_clock::now()), remaining_(fileNames.size()) {
+    files_.resize(fileNames.size());
+    for (size_t i = 0; i < files_.size(); ++i) {
+        files_[i].fileName = std::move(fileNames[i]);
+        files_[i].stageStart = created_;
+    }
+}
+
+Json::Value UploadJob::describe(size_t file) const {
+    const File& entry = files_[file];
+    Json::Value data;
+    data["file"] = static_cast<Json::UInt64>(file);
+    data["fileName"] = entry.fileName;
+    data["stage"] = toString(entry.stage);
+    data["timings"] = entry.timings;
+    if (!entry.result.isNull()) data["result"] = entry.result;
+    return data;
+}
+
+void UploadJob::publish(const char* event, const Json::Value& data) {
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    std::string frame = std::string("event: ") + event + "\ndata: " + Json::writeString(builder, data) + "\n\n";
+
+    // send() fails once the client has gone; drop those streams
+    std::erase_if(subscribers_, [&frame](const auto& stream) { return !stream->send(frame); });
+    events_.push_back(std::move(frame));
+}
+
+void UploadJob::stage(size_t file, UploadStage stage) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    File& entry = files_[file];
+    if (entry.stage == UploadStage::Done) return;
+    entry.timings[toString(entry.stage)] = static_cast<Json::Int64>(millisecondsSince(entry.stageStart));
+    entry.stage = stage;
+    entry.stageStart = std::chrono::steady_clock::now();
+    publish("stage", describe(file));
+}
+
+void UploadJob::finish(size_t file, Json::Value result) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    File& entry = files_[file];
+    if (entry.stage == UploadStage::Done) return;
+    entry.timings[toString(entry.stage)] = static_cast<Json::Int64>(millisecondsSince(entry.stageStart));
+    entry.stage = UploadStage::Done;
+    entry.result = std::move(result);
+    publish("file", describe(file));
+
+    if (--remaining_ > 0) return;
+    finishedAt_ = std::chrono::steady_clock::now();
+    Json::Value summary;
+    summary["id"] = id_;
+    summary["elapsedMs"] = static_cast<Json::Int64>(millisecondsSince(created_));
+    summary["results"] = Json::Value(Json::arrayValue);
+    for (const auto& done : files_) summary["results"].append(done.result);
+    publish("done", summary);
+    for (const auto& stream : subscribers_) stream->close();
+    subscribers_.clear();
+}
+
+void UploadJob::subscribe(drogon::ResponseStreamPtr stream) {
+    std::shared_ptr<drogon::ResponseStream> subscriber(std::move(stream));
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& frame : events_) {
+        if (!subscriber->send(frame)) return;
+    }
+    if (remaining_ == 0) {
+        subscriber->close();
+        return;
+    }
+    subscribers_.push_back(std::move(subscriber));
+}
+
+Json::Value UploadJob::snapshot() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Json::Value root;
+    root["id"] = id_;
+    root["done"] = remaining_ == 0;
+    root["files"] = Json::Value(Json::arrayValue);
+    for (size_t i = 0; i < files_.size(); ++i) root["files"].append(describe(i));
+    return root;
+}
+
+bool UploadJob::done() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return remaining_ == 0;
+}
+
+std::chrono::steady_clock::time_point UploadJob::finishedAt() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return finishedAt_;
+}
+
+UploadJobs& UploadJobs::instance() {
+    static UploadJobs inst;
+    return inst;
+}
+
+std::shared_ptr<UploadJob> UploadJobs::create(std::vector<std::string> fileNames) {
+    auto job = std::make_shared<UploadJob>(drogon::utils::getUuid(), std::move(fileNames));
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Forget jobs that finished long enough ago; nobody is watching them any more
+    auto now = std::chrono::steady_clock::now();
+    std::erase_if(jobs_, [this, now](const auto& entry) {
+        return entry.second->done() && now - entry.second->finishedAt() > retain_;
+    });
+    jobs_.emplace(job->id(), job);
+    return job;
+}
+
+std::shared_ptr<UploadJob> UploadJobs::find(const std::string& id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = jobs_.find(id);
+    return it == jobs_.end() ? nullptr : it->second;
+}
+
+}
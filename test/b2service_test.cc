@@ -0,0 +1,254 @@
+#include <drogon/drogon_test.h>
+#include <support/b2service.hpp>
+#include <support/spool.hpp>
+#include <drogon/utils/Utilities.h>
+#include "test_support.hpp"
+#include <chrono>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace blutography;
+
+namespace {
+    // Answers B2 calls in place of the network, recording what was sent; `reply` can override any path
+    struct FakeB2 {
+        std::mutex mutex;
+        std::map<std::string, int> calls;                      // by path
+        std::map<int, std::vector<std::string>> partTokens;    // part number -> the token of each attempt
+        std::map<int, size_t> partSizes;
+        std::vector<std::string> finishedSha1s;
+        std::function<drogon::HttpResponsePtr(const drogon::HttpRequestPtr&, int attempt)> reply;
+
+        B2Transport transport() {
+            return [this](const std::string&, const drogon::HttpRequestPtr& req, drogon::HttpReqCallback&& callback) {
+                callback(drogon::ReqResult::Ok, answer(req));
+            };
+        }
+
+        drogon::HttpResponsePtr answer(const drogon::HttpRequestPtr& req) {
+            std::unique_lock<std::mutex> lock(mutex);
+            const std::string path = req->path();
+            int attempt = ++calls[path];
+            if (path == "/b2api/v2/b2_upload_part/large") {
+                int part = std::stoi(req->getHeader("X-Bz-Part-Number"));
+                partTokens[part].push_back(req->getHeader("Authorization"));
+                partSizes[part] = req->body().size();
+            }
+            if (reply) {
+                if (auto overridden = reply(req, attempt)) return overridden;
+            }
+            Json::Value body;
+            if (path == "/b2api/v2/b2_authorize_account") {
+                body["apiUrl"] = "https://api.example";
+                body["authorizationToken"] = "account";
+                body["downloadUrl"] = "https://f000.example";
+                body["allowed"]["bucketId"] = "bucket";
+            } else if (path == "/b2api/v2/b2_get_upload_url") {
+                body["uploadUrl"] = "https://pod.example/b2api/v2/b2_upload_file/bucket";
+                body["authorizationToken"] = "upload";
+            } else if (path == "/b2api/v2/b2_upload_file/bucket") {
+                body["fileId"] = "small";
+            } else if (path == "/b2api/v2/b2_start_large_file") {
+                body["fileId"] = "large";
+            } else if (path == "/b2api/v2/b2_get_upload_part_url") {
+                body["uploadUrl"] = "https://pod.example/b2api/v2/b2_upload_part/large";
+                body["authorizationToken"] = "part" + std::to_string(attempt);
+            } else if (path == "/b2api/v2/b2_upload_part/large") {
+                body["partNumber"] = std::stoi(req->getHeader("X-Bz-Part-Number"));
+            } else if (path == "/b2api/v2/b2_finish_large_file") {
+                auto json = req->getJsonObject();
+                for (const auto& sha1 : (*json)["partSha1Array"]) finishedSha1s.push_back(sha1.asString());
+                body["fileId"] = "large";
+            } else if (path == "/b2api/v2/b2_cancel_large_file") {
+                body["fileId"] = "large";
+            }
+            return drogon::HttpResponse::newHttpJsonResponse(body);
+        }
+
+        int count(const std::string& call) {
+            std::lock_guard<std::mutex> lock(mutex);
+            return calls["/b2api/v2/" + call];
+        }
+    };
+
+    drogon::HttpResponsePtr failure() {
+        auto resp = drogon::HttpResponse::newHttpResponse();
+        resp->setStatusCode(drogon::k500InternalServerError);
+        return resp;
+    }
+
+    // A 200 whose body is not JSON
+    drogon::HttpResponsePtr garbled() {
+        auto resp = drogon::HttpResponse::newHttpResponse();
+        resp->setBody("<html>gateway</html>");
+        return resp;
+    }
+
+    // Uploads `content` and waits (bounded) for the callback
+    std::pair<bool, std::string> upload(B2Service& service, std::shared_ptr<const SpooledFile> content) {
+        auto promise = std::make_shared<std::promise<std::pair<bool, std::string>>>();
+        auto future = promise->get_future();
+        service.upload("photo.jpg", std::move(content), [promise](bool success, std::string fileId) {
+            promise->set_value({success, std::move(fileId)});
+        });
+        if (future.wait_for(std::chrono::seconds(30)) != std::future_status::ready) return {false, "timed out"};
+        return future.get();
+    }
+
+    // Kept for the whole run: the last reference could otherwise drop on one of the service's own part queue threads
+    std::shared_ptr<B2Service> service(FakeB2& fake, B2LargeFileOptions options) {
+        static std::vector<std::shared_ptr<B2Service>> services;
+        services.push_back(std::make_shared<B2Service>("key", "secret", "bucket", options, HttpClientPoolOptions{}, fake.transport()));
+        return services.back();
+    }
+}
+
+DROGON_TEST(B2SplitsLargeFilesIntoParts)
+{
+    testing::TempDirectory spool("b2_test", "split");
+    std::string original(12 * 1000 * 1000, '\0');
+    for (size_t i = 0; i < original.size(); ++i) original[i] = static_cast<char>(i * 7 + (i >> 16));
+    auto content = SpooledFile::create(original, "SHA1", spool.path.string());
+    REQUIRE(content != nullptr);
+
+    // Both below B2's 5 MB minimum part: raised to it, and the threshold along with it
+    FakeB2 fake;
+    B2LargeFileOptions options;
+    options.threshold = 1;
+    options.partSize = 1;
+    options.concurrency = 2;
+    auto b2 = service(fake, options);
+
+    auto [success, fileId] = upload(*b2, content);
+    CHECK(success);
+    CHECK(fileId == "large");
+    CHECK(fake.count("b2_start_large_file") == 1);
+    CHECK(fake.count("b2_get_upload_part_url") == 2);
+    CHECK(fake.partSizes == (std::map<int, size_t>{{1, 5000000}, {2, 5000000}, {3, 2000000}}));
+    REQUIRE(fake.finishedSha1s.size() == 3);
+    CHECK(fake.finishedSha1s[2] == drogon::utils::getSha1(original.data() + 10000000, 2000000));
+    CHECK(fake.count("b2_cancel_large_file") == 0);
+
+    // One part's worth goes up whole
+    auto small = SpooledFile::create(std::string_view(original).substr(0, 5000000), "SHA1", spool.path.string());
+    REQUIRE(small != nullptr);
+    auto [smallSuccess, smallId] = upload(*b2, small);
+    CHECK(smallSuccess);
+    CHECK(smallId == "small");
+    CHECK(fake.count("b2_start_large_file") == 1);
+}
+
+DROGON_TEST(B2RetriesAPartOnAFreshUrl)
+{
+    testing::TempDirectory spool("b2_test", "retry");
+    auto content = SpooledFile::create(std::string(11 * 1000 * 1000, 'x'), "SHA1", spool.path.string());
+    REQUIRE(content != nullptr);
+
+    FakeB2 fake;
+    bool failedOnce = false;
+    fake.reply = [&failedOnce](const drogon::HttpRequestPtr& req, int) -> drogon::HttpResponsePtr {
+        if (req->path() != "/b2api/v2/b2_upload_part/large" || req->getHeader("X-Bz-Part-Number") != "2" || failedOnce) return nullptr;
+        failedOnce = true;
+        return failure();
+    };
+    B2LargeFileOptions options;
+    options.threshold = 1;
+    options.partSize = 5 * 1000 * 1000;
+    options.concurrency = 1;
+    options.partAttempts = 2;
+    auto b2 = service(fake, options);
+
+    auto [success, fileId] = upload(*b2, content);
+    CHECK(success);
+    CHECK(fileId == "large");
+    // The lane's URL, then a fresh one for the retry, which the lane then keeps
+    CHECK(fake.count("b2_get_upload_part_url") == 2);
+    REQUIRE(fake.partTokens[2].size() == 2);
+    CHECK(fake.partTokens[2][0] == "part1");
+    CHECK(fake.partTokens[2][1] == "part2");
+    CHECK(fake.partTokens[3] == (std::vector<std::string>{"part2"}));
+    CHECK(fake.finishedSha1s.size() == 3);
+}
+
+DROGON_TEST(B2CancelsWhenAPartGivesUp)
+{
+    testing::TempDirectory spool("b2_test", "cancel");
+    auto content = SpooledFile::create(std::string(11 * 1000 * 1000, 'x'), "SHA1", spool.path.string());
+    REQUIRE(content != nullptr);
+
+    FakeB2 fake;
+    fake.reply = [](const drogon::HttpRequestPtr& req, int) -> drogon::HttpResponsePtr {
+        if (req->path() == "/b2api/v2/b2_upload_part/large" && req->getHeader("X-Bz-Part-Number") == "3") return failure();
+        return nullptr;
+    };
+    B2LargeFileOptions options;
+    options.threshold = 1;
+    options.partSize = 5 * 1000 * 1000;
+    options.concurrency = 2;
+    options.partAttempts = 2;
+    auto b2 = service(fake, options);
+
+    auto [success, fileId] = upload(*b2, content);
+    CHECK(!success);
+    CHECK(fileId.empty());
+    CHECK(fake.partTokens[3].size() == 2);
+    CHECK(fake.count("b2_cancel_large_file") == 1);
+    CHECK(fake.count("b2_finish_large_file") == 0);
+
+    // A part URL reply without a URL fails the lanes rather than uploading to nowhere
+    FakeB2 urlless;
+    urlless.reply = [](const drogon::HttpRequestPtr& req, int) -> drogon::HttpResponsePtr {
+        return req->path() == "/b2api/v2/b2_get_upload_part_url" ? drogon::HttpResponse::newHttpJsonResponse(Json::Value(Json::objectValue))
+                                                                 : nullptr;
+    };
+    auto lanes = service(urlless, options);
+    auto [urlSuccess, urlFileId] = upload(*lanes, content);
+    CHECK(!urlSuccess);
+    CHECK(urlless.partTokens.empty());
+    CHECK(urlless.count("b2_cancel_large_file") == 1);
+}
+
+DROGON_TEST(B2FailsOnRepliesThatAreNotJson)
+{
+    testing::TempDirectory spool("b2_test", "garbled");
+    auto content = SpooledFile::create("small original", "SHA1", spool.path.string());
+    REQUIRE(content != nullptr);
+
+    // An upload URL reply that does not parse fails the upload
+    FakeB2 urlGarbled;
+    urlGarbled.reply = [](const drogon::HttpRequestPtr& req, int) -> drogon::HttpResponsePtr {
+        return req->path() == "/b2api/v2/b2_get_upload_url" ? garbled() : nullptr;
+    };
+    auto [urlSuccess, urlFileId] = upload(*service(urlGarbled, {}), content);
+    CHECK(!urlSuccess);
+    CHECK(urlFileId.empty());
+    CHECK(urlGarbled.count("b2_upload_file/bucket") == 0);
+
+    // So does an upload reply, once more on a fresh URL
+    FakeB2 uploadGarbled;
+    uploadGarbled.reply = [](const drogon::HttpRequestPtr& req, int) -> drogon::HttpResponsePtr {
+        return req->path() == "/b2api/v2/b2_upload_file/bucket" ? garbled() : nullptr;
+    };
+    auto [uploadSuccess, uploadFileId] = upload(*service(uploadGarbled, {}), content);
+    CHECK(!uploadSuccess);
+    CHECK(uploadGarbled.count("b2_upload_file/bucket") == 2);
+    CHECK(uploadGarbled.count("b2_get_upload_url") == 2);
+
+    // And a finish reply without the file's id
+    FakeB2 finishGarbled;
+    finishGarbled.reply = [](const drogon::HttpRequestPtr& req, int) -> drogon::HttpResponsePtr {
+        return req->path() == "/b2api/v2/b2_finish_large_file" ? garbled() : nullptr;
+    };
+    B2LargeFileOptions options;
+    options.threshold = 1;
+    options.partSize = 5 * 1000 * 1000;
+    auto large = SpooledFile::create(std::string(6 * 1000 * 1000, 'x'), "SHA1", spool.path.string());
+    REQUIRE(large != nullptr);
+    auto [finishSuccess, finishFileId] = upload(*service(finishGarbled, options), large);
+    CHECK(!finishSuccess);
+    CHECK(finishFileId.empty());
+}
@@ -0,0 +1,194 @@
+#include <drogon/drogon_test.h>
+#include <support/chunked.hpp>
+#include <support/gallery_index.hpp>
+#include <support/gallery_search.hpp>
+#include <support/gallery_storage.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace blutography;
+
+namespace {
+    // Deterministic pseudo-random numbers for the reference comparisons
+    struct Xorshift {
+        uint32_t state = 2463534242u;
+        uint32_t operator()(uint32_t bound) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            return state % bound;
+        }
+    };
+
+    template <typename Key>
+    std::vector<std::pair<Key, uint32_t>> entries(const SortedIndex<Key>& index) {
+        return {index.begin(), index.end()};
+    }
+}
+
+DROGON_TEST(ChunkedVectorCopiesAreIndependent)
+{
+    ChunkedVector<int, 4> original;
+    for (int i = 0; i < 10; ++i) original.push_back(i);
+    REQUIRE(original.size() == 10);
+    CHECK(original.back() == 9);
+
+    ChunkedVector<int, 4> copy = original;
+    copy.set(5, 50);
+    copy.push_back(10);
+    copy.resize(13);
+    CHECK(original[5] == 5);
+    CHECK(original.size() == 10);
+    CHECK(copy[5] == 50);
+    CHECK(copy[10] == 10);
+    CHECK(copy[12] == 0);
+    CHECK(copy.size() == 13);
+
+    // Changing the original afterwards leaves the copy alone too
+    original.set(0, -1);
+    CHECK(copy[0] == 0);
+
+    std::vector<int> walked(original.begin(), original.end());
+    CHECK(walked == (std::vector<int>{-1, 1, 2, 3, 4, 5, 6, 7, 8, 9}));
+    CHECK(original.end() - original.begin() == 10);
+    CHECK(*(original.begin() + 7) == 7);
+}
+
+DROGON_TEST(ChunkedMapGrowsAndShares)
+{
+    std::vector<std::string> keys;
+    for (int i = 0; i < 2000; ++i) keys.push_back("key" + std::to_string(i));
+
+    ChunkedMap<std::string_view, size_t> map;
+    for (size_t i = 0; i < keys.size(); ++i) map.insert_or_assign(keys[i], i);
+    CHECK(map.size() == keys.size());
+    bool found = true;
+    for (size_t i = 0; i < keys.size(); ++i) found = found && map.find(keys[i]) && *map.find(keys[i]) == i;
+    CHECK(found);
+    CHECK(map.find("missing") == nullptr);
+
+    auto copy = map;
+    copy.insert_or_assign(keys[7], 700);
+    CHECK(copy.erase(keys[8]));
+    CHECK(!copy.erase(keys[8]));
+    CHECK(*map.find(keys[7]) == 7);
+    CHECK(map.find(keys[8]) != nullptr);
+    CHECK(*copy.find(keys[7]) == 700);
+    CHECK(copy.find(keys[8]) == nullptr);
+    CHECK(copy.size() == keys.size() - 1);
+    CHECK(map.size() == keys.size());
+}
+
+DROGON_TEST(SortedIndexMatchesReference)
+{
+    // Enough entries to split chunks many times over, and enough erasures to empty some
+    Xorshift random;
+    SortedIndex<double> index;
+    std::multiset<std::pair<double, uint32_t>> reference;
+    SortedIndex<double> before;
+    std::vector<std::pair<double, uint32_t>> beforeEntries;
+    for (uint32_t step = 0; step < 6000; ++step) {
+        if (step == 3000) {
+            before = index;
+            beforeEntries = entries(before);
+        }
+        double key = random(200);
+        uint32_t position = random(50);
+        if (random(3) == 0) {
+            index.erase(key, position);
+            auto it = reference.find({key, position});
+            if (it != reference.end()) reference.erase(it);
+        } else if (!reference.contains({key, position})) {
+            index.insert(key, position);
+            reference.emplace(key, position);
+        }
+    }
+    CHECK(index.size() == reference.size());
+    std::vector<std::pair<double, uint32_t>> expected(reference.begin(), reference.end());
+    CHECK(entries(index) == expected);
+
+    // A copy taken half way is unaffected by everything after it
+    CHECK(entries(before) == beforeEntries);
+    CHECK(before.size() == beforeEntries.size());
+
+    for (auto [min, max] : {std::pair{10.0, 20.0}, std::pair{-5.0, 0.0}, std::pair{199.0, 500.0}, std::pair{50.5, 49.5}}) {
+        auto [begin, end] = index.range(min, max);
+        auto inRange = std::count_if(reference.begin(), reference.end(),
+                                     [&](const auto& entry) { return entry.first >= min && entry.first <= max; });
+        CHECK(end - begin == inRange);
+        bool inside = true;
+        for (auto it = begin; it != end; ++it) inside = inside && it->first >= min && it->first <= max;
+        CHECK(inside);
+        if (begin != end) {
+            // Walking back from the end reaches the same entries
+            auto last = end;
+            --last;
+            CHECK(last->first <= max);
+            CHECK(begin + (end - begin - 1) == last);
+        }
+    }
+}
+
+DROGON_TEST(SortedIndexAssignAndEmpty)
+{
+    SortedIndex<std::string_view> index;
+    CHECK(index.size() == 0);
+    CHECK(index.begin() == index.end());
+    auto [begin, end] = index.range("a", "z");
+    CHECK(begin == end);
+    index.erase("nothing", 1);
+
+    std::vector<std::string> words;
+    for (int i = 0; i < 1000; ++i) words.push_back("w" + std::to_string(i));
+    std::vector<SortedIndex<std::string_view>::Entry> all;
+    for (uint32_t i = 0; i < words.size(); ++i) all.emplace_back(words[i], i);
+    index.assign(all);
+    CHECK(index.size() == words.size());
+    CHECK(std::is_sorted(index.begin(), index.end()));
+    auto first = index.partition([](const auto& entry) { return entry.first < "w5"; });
+    CHECK(first->first == "w5");
+
+    for (const auto& word : words) index.erase(word, static_cast<uint32_t>(&word - words.data()));
+    CHECK(index.size() == 0);
+    CHECK(index.begin() == index.end());
+    index.insert("again", 0);
+    CHECK(index.size() == 1);
+    CHECK(index.begin()->first == "again");
+}
+
+DROGON_TEST(TextIndexCopiesFollowTheirOwnRenames)
+{
+    GalleryItems items;
+    for (int i = 0; i < 600; ++i) {
+        auto item = std::make_shared<GalleryItem>();
+        item->name = "Harbour " + std::to_string(i);
+        item->quote = i == 599 ? "morning fog over the water" : "evening";
+        items.push_back(std::move(item));
+    }
+    GalleryTextIndex index;
+    index.rebuild(items);
+
+    // Rename 599 in a copy; its quote's words stay indexed, and the original still has the old name
+    GalleryTextIndex renamed = index;
+    GalleryItem next = *items[599];
+    next.name = "Lighthouse";
+    renamed.put(items[599].get(), next, 599);
+    CHECK(renamed.search("lighthouse", 10) == std::vector<size_t>{599});
+    CHECK(renamed.search("fog", 10) == std::vector<size_t>{599});
+    CHECK(renamed.search("harbour 599", 10).empty());
+    CHECK(index.search("lighthouse", 10).empty());
+    CHECK(index.search("harbour 599", 10) == std::vector<size_t>{599});
+
+    // And a new quote under the new name
+    GalleryItem quoted = next;
+    quoted.quote = "storm";
+    renamed.put(&next, quoted, 599);
+    CHECK(renamed.search("fog", 10).empty());
+    CHECK(renamed.search("light storm", 10) == std::vector<size_t>{599});
+    CHECK(index.search("fog", 10) == std::vector<size_t>{599});
+}
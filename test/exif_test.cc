@@ -0,0 +1,308 @@
+#include <drogon/drogon_test.h>
+#include <support/exif.hpp>
+#include <support/image_decoders.hpp>
+#include <cstdint>
+#include <string>
+
+using namespace blutography::image;
+
+namespace {
+    // Little-endian TIFF: IFD0 (Model, Orientation, Exif pointer) then an Exif IFD (ISO, FNumber)
+    struct Tiff {
+        std::string data;
+
+        void u16(uint16_t v) { data.push_back(static_cast<char>(v & 0xFF)); data.push_back(static_cast<char>(v >> 8)); }
+        void u32(uint32_t v) { for (int i = 0; i < 4; ++i) data.push_back(static_cast<char>((v >> (8 * i)) & 0xFF)); }
+        void entry(uint16_t tag, uint16_t type, uint32_t count, uint32_t value) { u16(tag); u16(type); u32(count); u32(value); }
+        void put32(size_t pos, uint32_t v) { for (int i = 0; i < 4; ++i) data[pos + i] = static_cast<char>((v >> (8 * i)) & 0xFF); }
+
+        // Offsets of fields the malformed cases overwrite
+        size_t ifd0Count = 0;
+        size_t exifPointer = 0;
+        size_t modelOffset = 0;
+
+        Tiff() {
+            data = "II*";
+            data.push_back('\0');
+            u32(8);
+
+            ifd0Count = data.size();
+            u16(3);
+            entry(0x0110, 2, 10, 0);          // Model, out of line
+            modelOffset = data.size() - 4;
+            entry(0x0112, 3, 1, 6);           // Orientation 6
+            entry(0x8769, 4, 1, 0);           // Exif IFD
+            exifPointer = data.size() - 4;
+            u32(0);
+
+            put32(modelOffset, static_cast<uint32_t>(data.size()));
+            data.append("Canon R5\0\0", 10);
+
+            put32(exifPointer, static_cast<uint32_t>(data.size()));
+            u16(2);
+            entry(0x829D, 5, 1, static_cast<uint32_t>(data.size() + 24 + 4)); // FNumber, out of line
+            entry(0x8827, 3, 1, 400);         // ISO
+            u32(0);
+            u32(28);                          // 28/10
+            u32(10);
+        }
+    };
+
+    // A TIFF built entry by entry, from the byte order mark on
+    struct Builder : Tiff {
+        Builder() {
+            data = "II*";
+            data.push_back('\0');
+            u32(8);
+        }
+        void rational(uint32_t num, uint32_t den) { u32(num); u32(den); }
+    };
+
+    // The TIFF wrapped in an APP1 EXIF segment
+    std::string exifSegment(const std::string& tiff) {
+        size_t length = 2 + 6 + tiff.size();
+        std::string s = "\xFF\xE1";
+        s.push_back(static_cast<char>(length >> 8));
+        s.push_back(static_cast<char>(length & 0xFF));
+        s.append("Exif\0\0", 6);
+        return s + tiff;
+    }
+}
+
+DROGON_TEST(ExifParsesWellFormedIfds)
+{
+    Tiff tiff;
+    Metadata meta;
+    exif::FieldMask found = exif::parse(tiff.data, meta);
+    CHECK(found == (exif::Model | exif::Orientation | exif::Iso | exif::FNumber));
+    CHECK(meta.model == "Canon R5");
+    CHECK(meta.orientation == 6);
+    CHECK(meta.iso == "400");
+    CHECK(meta.aperture == "f/2.8");
+
+    // Only what was asked for, and the Exif IFD is skipped when nothing in it is wanted
+    Metadata some;
+    CHECK(exif::parse(tiff.data, some, exif::Orientation) == exif::Orientation);
+    CHECK(some.model.empty());
+    CHECK(some.iso.empty());
+}
+
+DROGON_TEST(ExifSurvivesTruncation)
+{
+    Tiff tiff;
+    Metadata full;
+    exif::FieldMask all = exif::parse(tiff.data, full);
+    for (size_t length = 0; length < tiff.data.size(); ++length) {
+        Metadata meta;
+        exif::FieldMask found = exif::parse(std::string_view(tiff.data).substr(0, length), meta);
+        // A cut can lose fields but never invent one
+        CHECK((found & ~all) == 0);
+        if (found & exif::Model) CHECK(meta.model == "Canon R5");
+        if (found & exif::Iso) CHECK(meta.iso == "400");
+    }
+    Metadata meta;
+    CHECK(exif::parse(std::string_view(tiff.data).substr(0, 7), meta) == 0);
+    CHECK(exif::sanitize(std::string_view(), false, false).empty());
+}
+
+DROGON_TEST(ExifRejectsMalformedIfds)
+{
+    {
+        // An entry count running past the end of the data
+        Tiff tiff;
+        tiff.data[tiff.ifd0Count] = '\xFF';
+        tiff.data[tiff.ifd0Count + 1] = '\xFF';
+        Metadata meta;
+        exif::FieldMask found = exif::parse(tiff.data, meta);
+        CHECK((found & ~(exif::Model | exif::Orientation | exif::Iso | exif::FNumber)) == 0);
+    }
+    {
+        // Sub-IFD offsets at the very end of the 32-bit range must not wrap around
+        for (uint32_t offset : {0xFFFFFFFFu, 0xFFFFFFFEu, 0xFFFFFFF0u}) {
+            Tiff tiff;
+            tiff.put32(tiff.exifPointer, offset);
+            Metadata meta;
+            exif::FieldMask found = exif::parse(tiff.data, meta);
+            CHECK(found == (exif::Model | exif::Orientation));
+        }
+    }
+    {
+        // An out-of-line value past the end is skipped, not read
+        Tiff tiff;
+        tiff.put32(tiff.modelOffset, 0xFFFFFFF8u);
+        Metadata meta;
+        exif::FieldMask found = exif::parse(tiff.data, meta);
+        CHECK((found & exif::Model) == 0);
+        CHECK(meta.model.empty());
+        CHECK(found & exif::Iso);
+    }
+    {
+        // An Exif IFD pointing back at IFD0 ends at the depth limit
+        Tiff tiff;
+        tiff.put32(tiff.exifPointer, 8);
+        Metadata meta;
+        exif::FieldMask found = exif::parse(tiff.data, meta);
+        CHECK(found == (exif::Model | exif::Orientation));
+    }
+    {
+        // A byte order mark that is neither "II" nor "MM"
+        Tiff tiff;
+        tiff.data[0] = tiff.data[1] = 'X';
+        Metadata meta;
+        CHECK(exif::parse(tiff.data, meta) == 0);
+    }
+}
+
+DROGON_TEST(ExifSanitizeHandlesMalformedSegments)
+{
+    auto segment = exifSegment;
+
+    Tiff tiff;
+    std::string clean = exif::sanitize(segment(tiff.data), true, false);
+    REQUIRE(!clean.empty());
+    Metadata meta;
+    exif::parse(exif::payload(clean), meta);
+    CHECK(meta.orientation == 1);
+    CHECK(meta.model == "Canon R5");
+    CHECK(meta.iso == "400");
+
+    for (size_t length = 0; length < tiff.data.size(); ++length) {
+        std::string cut = exif::sanitize(segment(tiff.data.substr(0, length)), true, true);
+        if (!cut.empty()) CHECK(exif::payload(cut).size() >= 8);
+    }
+
+    Tiff wrapped;
+    wrapped.put32(wrapped.exifPointer, 0xFFFFFFFFu);
+    Metadata rewrapped;
+    exif::parse(exif::payload(exif::sanitize(segment(wrapped.data), false, false)), rewrapped);
+    CHECK(rewrapped.model == "Canon R5");
+    CHECK(rewrapped.iso.empty());
+}
+
+DROGON_TEST(ExifStopsOnceWantedFieldsAreFound)
+{
+    // IFD0: Model and a GPS pointer. GPS: S 47.5, W 122.25, then a stray second latitude
+    Builder tiff;
+    tiff.u16(2);
+    tiff.entry(0x0110, 2, 4, 0x004B494E); // "NIK\0", inline
+    tiff.entry(0x8825, 4, 1, 38);
+    tiff.u32(0);
+    tiff.u16(5);
+    tiff.entry(0x0001, 2, 2, 'S');
+    tiff.entry(0x0002, 5, 3, 104);
+    tiff.entry(0x0003, 2, 2, 'W');
+    tiff.entry(0x0004, 5, 3, 128);
+    tiff.entry(0x0002, 5, 3, 152);
+    tiff.u32(0);
+    REQUIRE(tiff.data.size() == 104);
+    tiff.rational(47, 1); tiff.rational(30, 1); tiff.rational(0, 1);
+    tiff.rational(122, 1); tiff.rational(15, 1); tiff.rational(0, 1);
+    tiff.rational(10, 1); tiff.rational(0, 1); tiff.rational(0, 1);
+
+    // The position is complete after the first pair, so the walk ends before the stray entry
+    Metadata meta;
+    CHECK(exif::parse(tiff.data, meta, exif::Model | exif::GpsPosition) == (exif::Model | exif::GpsPosition));
+    CHECK(meta.model == "NIK");
+    CHECK(meta.hasGps);
+    CHECK(meta.latitude == -47.5);
+    CHECK(meta.longitude == -122.25);
+
+    // Asked for on its own, the position is found just the same
+    Metadata gps;
+    CHECK(exif::parse(tiff.data, gps, exif::GpsPosition) == exif::GpsPosition);
+    CHECK(gps.latitude == -47.5);
+    CHECK(gps.model.empty());
+}
+
+DROGON_TEST(ExifSanitizeFollowsEachIfdOnce)
+{
+    {
+        // An Exif pointer back at IFD0
+        Tiff tiff;
+        tiff.put32(tiff.exifPointer, 8);
+        std::string clean = exif::sanitize(exifSegment(tiff.data), false, false);
+        REQUIRE(!clean.empty());
+        CHECK(exif::payload(clean).size() <= tiff.data.size());
+        Metadata meta;
+        CHECK(exif::parse(exif::payload(clean), meta) == (exif::Model | exif::Orientation));
+    }
+    {
+        // IFD0 -> Exif; the Exif IFD points at itself as Exif and at IFD0 as Interop
+        Builder tiff;
+        tiff.u16(2);
+        tiff.entry(0x0110, 2, 4, 0x004B494E); // "NIK\0", inline
+        tiff.entry(0x8769, 4, 1, 38);
+        tiff.u32(0);
+        tiff.u16(3);
+        tiff.entry(0x8769, 4, 1, 38);
+        tiff.entry(0x8827, 3, 1, 800);
+        tiff.entry(0xA005, 4, 1, 8);
+        tiff.u32(0);
+        std::string clean = exif::sanitize(exifSegment(tiff.data), false, false);
+        REQUIRE(!clean.empty());
+        CHECK(exif::payload(clean).size() <= tiff.data.size());
+        Metadata meta;
+        CHECK(exif::parse(exif::payload(clean), meta) == (exif::Model | exif::Iso));
+        CHECK(meta.iso == "800");
+    }
+    {
+        // Twenty entries sharing one 200-byte value would copy it twenty times: refused
+        Builder tiff;
+        tiff.u16(20);
+        uint32_t value = 8 + 2 + 20 * 12 + 4;
+        for (uint16_t tag = 0x9000; tag < 0x9000 + 20; ++tag) tiff.entry(tag, 7, 200, value);
+        tiff.u32(0);
+        tiff.data.append(200, 'x');
+        CHECK(exif::sanitize(exifSegment(tiff.data), false, false).empty());
+    }
+}
+
+DROGON_TEST(ExifSanitizeSwapsPixelDimensionsWithTheirTypes)
+{
+    // IFD0 -> Exif: PixelXDimension 6000 as SHORT, PixelYDimension 4000 as LONG
+    Builder tiff;
+    tiff.u16(1);
+    tiff.entry(0x8769, 4, 1, 26);
+    tiff.u32(0);
+    tiff.u16(2);
+    tiff.entry(0xA002, 3, 1, 6000);
+    tiff.entry(0xA003, 4, 1, 4000);
+    tiff.u32(0);
+
+    std::string out(exif::payload(exif::sanitize(exifSegment(tiff.data), false, true)));
+    REQUIRE(out.size() >= 26 + 2 + 2 * 12);
+    auto u16 = [&out](size_t pos) { return static_cast<uint16_t>((unsigned char)out[pos] | (unsigned char)out[pos + 1] << 8); };
+    auto u32 = [&u16](size_t pos) { return static_cast<uint32_t>(u16(pos) | u16(pos + 2) << 16); };
+    REQUIRE(u16(8) == 1);
+    size_t exifIfd = u32(8 + 2 + 8);
+    REQUIRE(exifIfd + 2 + 2 * 12 <= out.size());
+    REQUIRE(u16(exifIfd) == 2);
+
+    // The tags stay in order; each takes the other's type, count and value
+    size_t x = exifIfd + 2, y = exifIfd + 2 + 12;
+    CHECK(u16(x) == 0xA002);
+    CHECK(u16(x + 2) == 4);
+    CHECK(u32(x + 4) == 1);
+    CHECK(u32(x + 8) == 4000);
+    CHECK(u16(y) == 0xA003);
+    CHECK(u16(y + 2) == 3);
+    CHECK(u32(y + 4) == 1);
+    CHECK(u16(y + 8) == 6000);
+
+    // Not asked to, nothing moves
+    std::string kept(exif::payload(exif::sanitize(exifSegment(tiff.data), false, false)));
+    REQUIRE(kept.size() == out.size());
+    CHECK(kept.compare(exifIfd, 2 + 2 * 12, tiff.data, 26, 2 + 2 * 12) == 0);
+}
+
+DROGON_TEST(TiffKeepsItsStoredOrientation)
+{
+    // A TIFF upload is its own IFD chain: the orientation is read from IFD0 and left for the
+    // pipeline to apply, since the pixels come back as stored
+    Tiff tiff;
+    REQUIRE(sniffContainer(tiff.data) == Container::Tiff);
+    Metadata meta;
+    readImageInfo(Container::Tiff, tiff.data, meta); // dimensions need libtiff, the tags do not
+    CHECK(meta.orientation == 6);
+    CHECK(meta.model == "Canon R5");
+}
@@ -0,0 +1,223 @@
+#include <drogon/drogon_test.h>
+#include <support/gallery_feed.hpp>
+#include <support/gallery_log_engine.hpp>
+#include <support/gallery_storage.hpp>
+#include "test_support.hpp"
+#include <json/json.h>
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+
+using namespace blutography;
+
+namespace {
+    // A gallery of `items` items in a private directory
+    struct FeedGallery {
+        testing::TempDirectory directory;
+        std::unique_ptr<GalleryStorage> storage;
+
+        FeedGallery(const std::string& name, int items)
+            : directory("feed_test", name), storage(std::make_unique<GalleryStorage>(testing::logEngine(directory))) {
+            for (int n = 0; n < items; ++n) {
+                GalleryItem item = testing::numberedItem(n);
+                item.quote = "A caption long enough that a page of these is worth compressing";
+                item.previewName = item.id + ".jpg";
+                storage->addItem(item);
+            }
+        }
+    };
+
+    // The body for `query`, waited for; `on` is set to the thread it was handed over on
+    std::shared_ptr<const FeedBody> bodyOf(GalleryFeed& feed, const FeedQuery& query, std::thread::id* on = nullptr) {
+        std::promise<std::shared_ptr<const FeedBody>> promise;
+        auto future = promise.get_future();
+        feed.body(query, [&promise, on](std::shared_ptr<const FeedBody> body) {
+            if (on) *on = std::this_thread::get_id();
+            promise.set_value(std::move(body));
+        });
+        return future.get();
+    }
+
+    // The feed follows the storage on its own thread; wait (bounded) until the ETag moves off `etag`
+    std::string nextEtag(const GalleryFeed& feed, const FeedQuery& query, const std::string& etag) {
+        for (int i = 0; i < 1000; ++i) {
+            auto head = feed.head(query);
+            if (head && head->etag != etag) return head->etag;
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        return etag;
+    }
+}
+
+DROGON_TEST(FeedEtagRevalidatesWithoutABody)
+{
+    FeedGallery gallery("etag", 5);
+    GalleryFeed feed(*gallery.storage);
+
+    FeedQuery query;
+    query.limit = 2;
+    auto head = feed.head(query);
+    REQUIRE(head.has_value());
+    CHECK(head->nextCursor == "id1");
+    auto body = bodyOf(feed, query);
+    REQUIRE(body != nullptr);
+    CHECK(body->etag == head->etag);
+    CHECK(body->nextCursor == "id1");
+
+    // The same tag, weak or strong, alone or in a list, or "*" revalidates; anything else does not
+    std::string opaque = head->etag.substr(2);
+    CHECK(GalleryFeed::etagMatches(head->etag, head->etag));
+    CHECK(GalleryFeed::etagMatches(opaque, head->etag));
+    CHECK(GalleryFeed::etagMatches("\"other\", " + head->etag, head->etag));
+    CHECK(GalleryFeed::etagMatches("*", head->etag));
+    CHECK(!GalleryFeed::etagMatches("", head->etag));
+    CHECK(!GalleryFeed::etagMatches("W/\"other\"", head->etag));
+
+    // Each query has its own tag, and an unknown cursor has none
+    FeedQuery second = query;
+    second.after = "id1";
+    auto secondHead = feed.head(second);
+    REQUIRE(secondHead.has_value());
+    CHECK(secondHead->etag != head->etag);
+    CHECK(secondHead->nextCursor == "id3");
+    FeedQuery unknown;
+    unknown.after = "missing";
+    CHECK(!feed.head(unknown).has_value());
+    CHECK(bodyOf(feed, unknown) == nullptr);
+
+    // A change moves the tag on; the old one no longer revalidates and the new body shows the change
+    REQUIRE(gallery.storage->updateDetails("id0", std::string("Renamed"), std::nullopt) != nullptr);
+    std::string changed = nextEtag(feed, query, head->etag);
+    CHECK(changed != head->etag);
+    CHECK(!GalleryFeed::etagMatches(head->etag, changed));
+    auto renamed = bodyOf(feed, query);
+    REQUIRE(renamed != nullptr);
+    CHECK(renamed->etag == changed);
+    CHECK(renamed->json.find("\"name\":\"Renamed\"") != std::string::npos);
+}
+
+DROGON_TEST(FeedBodiesAreBuiltOffTheCallingThread)
+{
+    FeedGallery gallery("builder", 30);
+    GalleryFeed feed(*gallery.storage);
+    FeedQuery query;
+
+    // Not built yet: built and handed over by the builder thread
+    std::thread::id on;
+    auto first = bodyOf(feed, query, &on);
+    REQUIRE(first != nullptr);
+    CHECK(on != std::this_thread::get_id());
+
+    // Built now: handed over at once
+    CHECK(bodyOf(feed, query, &on) == first);
+    CHECK(on == std::this_thread::get_id());
+
+    // Asked for under the last version, so built before the next one is published along with it
+    auto head = feed.head(query);
+    REQUIRE(gallery.storage->updateDetails("id3", std::nullopt, std::string("New quote")) != nullptr);
+    std::string changed = nextEtag(feed, query, head->etag);
+    CHECK(changed != head->etag);
+    auto rebuilt = bodyOf(feed, query, &on);
+    CHECK(on == std::this_thread::get_id());
+    REQUIRE(rebuilt != nullptr);
+    CHECK(rebuilt->etag == changed);
+    CHECK(rebuilt->json.find("New quote") != std::string::npos);
+
+    // Results outside the feed's pages are rendered from the same fragments
+    auto rendered = feed.render({gallery.storage->getItem("id3")}, 0);
+    CHECK(rendered.find("\"quote\":\"New quote\"") != std::string::npos);
+}
+
+DROGON_TEST(FeedNegotiatesAcceptEncoding)
+{
+    FeedBody body;
+    body.json = "[]";
+    body.gzip = "gzip bytes";
+    body.brotli = "brotli bytes";
+    const char* encoding = nullptr;
+
+    CHECK(GalleryFeed::encoded(body, "gzip, deflate, br", encoding) == body.brotli);
+    CHECK(std::string(encoding) == "br");
+    CHECK(GalleryFeed::encoded(body, "gzip, br;q=0", encoding) == body.gzip);
+    CHECK(std::string(encoding) == "gzip");
+    CHECK(GalleryFeed::encoded(body, "GZIP", encoding) == body.gzip);
+    CHECK(GalleryFeed::encoded(body, "*", encoding) == body.brotli);
+    CHECK(GalleryFeed::encoded(body, "*;q=0", encoding) == body.json);
+    CHECK(encoding == nullptr);
+    CHECK(GalleryFeed::encoded(body, "", encoding) == body.json);
+    CHECK(GalleryFeed::encoded(body, "identity", encoding) == body.json);
+
+    // Without a brotli encoder in the build, br falls through to gzip
+    body.brotli.clear();
+    CHECK(GalleryFeed::encoded(body, "br, gzip", encoding) == body.gzip);
+    CHECK(std::string(encoding) == "gzip");
+    // And a body too small to compress goes out as it is
+    body.gzip.clear();
+    CHECK(GalleryFeed::encoded(body, "br, gzip", encoding) == body.json);
+    CHECK(encoding == nullptr);
+
+    // A full page is large enough to have been compressed
+    FeedGallery gallery("encoding", 30);
+    GalleryFeed feed(*gallery.storage);
+    auto page = bodyOf(feed, FeedQuery{});
+    REQUIRE(page != nullptr);
+    CHECK(page->json.size() >= 1024);
+    CHECK(!page->gzip.empty());
+    CHECK(GalleryFeed::encoded(*page, "gzip", encoding) == page->gzip);
+}
+
+DROGON_TEST(FeedOffersEachRungByType)
+{
+    CHECK(image::formatOf("a_320.avif") == image::Format::Avif);
+    CHECK(image::formatOf("a_320.webp") == image::Format::WebP);
+    CHECK(image::formatOf("a_320.jpg") == image::Format::Jpeg);
+    CHECK(image::formatOf("noextension") == image::Format::Jpeg);
+
+    FeedGallery gallery("sources", 1);
+    GalleryItem item;
+    item.id = "laddered";
+    item.fileName = "laddered.jpg";
+    item.previewName = "laddered.jpg";
+    item.variants = {{"l_320.jpg", 320, 213, 1000}, {"l_800.jpg", 800, 533, 4000},
+                     {"l_320.avif", 320, 213, 400}, {"l_320.webp", 320, 213, 600},
+                     {"l_800.avif", 800, 533, 1500}, {"l_800.webp", 800, 533, 2500}};
+    REQUIRE(gallery.storage->addItem(item));
+    GalleryFeed feed(*gallery.storage);
+
+    auto pageOf = [&feed](const FeedQuery& query) {
+        Json::Value page;
+        auto body = bodyOf(feed, query);
+        std::unique_ptr<Json::CharReader> reader(Json::CharReaderBuilder().newCharReader());
+        if (body) reader->parse(body->json.data(), body->json.data() + body->json.size(), &page, nullptr);
+        return page;
+    };
+    Json::Value page = pageOf(FeedQuery{});
+    REQUIRE(page.size() == 2);
+
+    // The fixture's item has no ladder and so no sources
+    const Json::Value& laddered = page[0]["id"] == "laddered" ? page[0] : page[1];
+    const Json::Value& bare = page[0]["id"] == "laddered" ? page[1] : page[0];
+    CHECK(laddered["srcset"].asString() == "/gallery_previews/ladder/l_320.jpg 320w, /gallery_previews/ladder/l_800.jpg 800w");
+    REQUIRE(laddered["sources"].size() == 2);
+    CHECK(laddered["sources"][0]["type"].asString() == "image/avif");
+    CHECK(laddered["sources"][0]["srcset"].asString() == "/gallery_previews/ladder/l_320.avif 320w, /gallery_previews/ladder/l_800.avif 800w");
+    CHECK(laddered["sources"][1]["type"].asString() == "image/webp");
+    CHECK(laddered["sources"][1]["srcset"].asString() == "/gallery_previews/ladder/l_320.webp 320w, /gallery_previews/ladder/l_800.webp 800w");
+    REQUIRE(laddered["variants"].size() == 6);
+    CHECK(laddered["variants"][2]["type"].asString() == "image/avif");
+    CHECK(laddered["variants"][0]["type"].asString() == "image/jpeg");
+    CHECK(!bare.isMember("sources"));
+    CHECK(bare["srcset"].asString().empty());
+
+    // The sources can be asked for on their own
+    FeedQuery only;
+    std::string unknown;
+    REQUIRE(GalleryFeed::parseFields("id,sources", only.fields, unknown));
+    Json::Value narrow = pageOf(only);
+    REQUIRE(narrow.size() == 2);
+    const Json::Value& picked = narrow[0]["id"] == "laddered" ? narrow[0] : narrow[1];
+    CHECK(picked["sources"] == laddered["sources"]);
+    CHECK(!picked.isMember("srcset"));
+    CHECK(!picked.isMember("variants"));
+}
@@ -0,0 +1,180 @@
+#include <drogon/drogon_test.h>
+#include <support/gallery_file.hpp>
+#include <unistd.h>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace blutography;
+
+namespace {
+    using Items = std::vector<std::shared_ptr<const GalleryItem>>;
+
+    // Every field set, so a field the format drops or swaps shows up in the comparison
+    std::shared_ptr<const GalleryItem> fullItem(int n) {
+        auto item = std::make_shared<GalleryItem>();
+        item->id = "id" + std::to_string(n);
+        item->name = "Name " + std::to_string(n);
+        item->quote = "Quote " + std::to_string(n);
+        item->fileName = item->id + ".jpg";
+        item->previewName = item->id + "_preview.jpg";
+        item->placeholder = "LEHV6nWB2yk8";
+        item->dominantColor = "#a1b2c3";
+        item->contentHash = "hash" + std::to_string(n);
+        item->metadata.dateTime = "2024:05:06 07:08:09";
+        item->metadata.model = "Canon EOS R5"; // shared by both items, so pooled once
+        item->metadata.exposure = "1/250";
+        item->metadata.iso = "400";
+        item->metadata.width = 8192 + n;
+        item->metadata.height = 5464;
+        item->metadata.orientation = 6;
+        item->metadata.aperture = "f/2.8";
+        item->metadata.focalLength = "85mm";
+        item->metadata.lensModel = "RF85mm F1.2 L USM";
+        item->metadata.subSecTime = "42";
+        item->metadata.hasGps = true;
+        item->metadata.latitude = 47.5 + n;
+        item->metadata.longitude = -122.25;
+        item->variants = {{item->id + "_480.webp", 480, 320, 12345}, {item->id + "_960.webp", 960, 640, 45678}};
+        item->tiles.width = 8192;
+        item->tiles.height = 5464;
+        item->tiles.tileSize = 254;
+        item->tiles.overlap = 1;
+        item->tiles.maxLevel = 14;
+        return item;
+    }
+
+    bool sameItem(const GalleryItem& a, const GalleryItem& b) {
+        bool variants = a.variants.size() == b.variants.size();
+        for (size_t v = 0; variants && v < a.variants.size(); ++v) {
+            variants = a.variants[v].fileName == b.variants[v].fileName && a.variants[v].width == b.variants[v].width
+                && a.variants[v].height == b.variants[v].height && a.variants[v].bytes == b.variants[v].bytes;
+        }
+        const auto& m = a.metadata;
+        const auto& n = b.metadata;
+        return variants && a.id == b.id && a.name == b.name && a.quote == b.quote && a.fileName == b.fileName
+            && a.previewName == b.previewName && a.placeholder == b.placeholder && a.dominantColor == b.dominantColor
+            && a.contentHash == b.contentHash && m.dateTime == n.dateTime && m.model == n.model && m.exposure == n.exposure
+            && m.iso == n.iso && m.width == n.width && m.height == n.height && m.orientation == n.orientation
+            && m.aperture == n.aperture && m.focalLength == n.focalLength && m.lensModel == n.lensModel
+            && m.subSecTime == n.subSecTime && m.hasGps == n.hasGps && m.latitude == n.latitude
+            && m.longitude == n.longitude && a.tiles.width == b.tiles.width && a.tiles.height == b.tiles.height
+            && a.tiles.tileSize == b.tiles.tileSize && a.tiles.overlap == b.tiles.overlap
+            && a.tiles.maxLevel == b.tiles.maxLevel;
+    }
+
+    template <typename T>
+    T fieldAt(const std::string& data, size_t offset) {
+        T value;
+        std::memcpy(&value, data.data() + offset, sizeof value);
+        return value;
+    }
+
+    // A file in the temporary directory, removed when the test ends
+    struct TempFile {
+        std::filesystem::path path;
+
+        TempFile(const std::string& name, const std::string& contents) {
+            path = std::filesystem::temp_directory_path() / ("blutography_file_test_" + std::to_string(::getpid()) + "_" + name);
+            std::ofstream(path, std::ios::binary) << contents;
+        }
+        ~TempFile() {
+            std::error_code ec;
+            std::filesystem::remove(path, ec);
+        }
+    };
+}
+
+DROGON_TEST(GalleryFileRoundTrip)
+{
+    auto bare = std::make_shared<GalleryItem>();
+    bare->id = "bare"; // every other string empty, no variants, no GPS, not tiled
+    Items items{fullItem(0), bare, fullItem(1)};
+
+    std::string data = encodeGallery(items);
+    REQUIRE(isBinaryGallery(data));
+    Items decoded;
+    std::string error;
+    REQUIRE(decodeGallery(data, decoded, error));
+    REQUIRE(decoded.size() == items.size());
+    bool same = true;
+    for (size_t i = 0; i < items.size(); ++i) same = same && sameItem(*items[i], *decoded[i]);
+    CHECK(same);
+
+    // Both forms read back from a file, and agree
+    TempFile binary("roundtrip.bin", data);
+    TempFile json("roundtrip.json", encodeGalleryJson(items));
+    Items fromBinary, fromJson;
+    REQUIRE(readGalleryFile(binary.path.string(), fromBinary, error));
+    REQUIRE(readGalleryFile(json.path.string(), fromJson, error));
+    REQUIRE(fromBinary.size() == items.size());
+    REQUIRE(fromJson.size() == items.size());
+    for (size_t i = 0; i < items.size(); ++i) same = same && sameItem(*fromBinary[i], *items[i]) && sameItem(*fromJson[i], *items[i]);
+    CHECK(same);
+}
+
+DROGON_TEST(GalleryFileLayout)
+{
+    Items items{fullItem(0), fullItem(1)};
+    std::string data = encodeGallery(items);
+
+    // Header: magic, version, byte order, counts, then the table offsets and sizes
+    REQUIRE(data.size() >= 72);
+    CHECK(std::memcmp(data.data(), galleryFileMagic, sizeof galleryFileMagic) == 0);
+    CHECK(fieldAt<uint32_t>(data, 8) == galleryFileVersion);
+    CHECK(fieldAt<uint32_t>(data, 12) == 0x01020304u);
+    CHECK(fieldAt<uint32_t>(data, 16) == 2);  // items
+    CHECK(fieldAt<uint32_t>(data, 20) == 4);  // variants
+    auto itemsOffset = fieldAt<uint64_t>(data, 24);
+    auto variantsOffset = fieldAt<uint64_t>(data, 32);
+    auto stringsOffset = fieldAt<uint64_t>(data, 40);
+    auto stringsSize = fieldAt<uint64_t>(data, 48);
+    CHECK(itemsOffset == 72);
+    CHECK(variantsOffset == itemsOffset + 2 * 192);
+    CHECK(stringsOffset == variantsOffset + 4 * 24);
+    CHECK(stringsOffset + stringsSize == data.size());
+    CHECK(fieldAt<uint64_t>(data, 56) == data.size());
+
+    // The first record's id points into the pool; the repeated camera model is stored once
+    auto idOffset = fieldAt<uint32_t>(data, itemsOffset);
+    auto idLength = fieldAt<uint32_t>(data, itemsOffset + 4);
+    CHECK(data.substr(stringsOffset + idOffset, idLength) == "id0");
+    std::string pool = data.substr(stringsOffset);
+    auto model = pool.find("Canon EOS R5");
+    CHECK(model != std::string::npos);
+    CHECK(pool.find("Canon EOS R5", model + 1) == std::string::npos);
+
+    // Damage is reported, not misread
+    Items decoded;
+    std::string error;
+    CHECK(!decodeGallery(data.substr(0, data.size() - 1), decoded, error));
+    std::string otherVersion = data;
+    otherVersion[8] = 2;
+    CHECK(!decodeGallery(otherVersion, decoded, error));
+    std::string outside = data;
+    uint32_t past = static_cast<uint32_t>(stringsSize);
+    std::memcpy(outside.data() + itemsOffset, &past, sizeof past);
+    CHECK(!decodeGallery(outside, decoded, error));
+    CHECK(decoded.empty());
+}
+
+DROGON_TEST(GalleryFileReadErrors)
+{
+    Items items;
+    std::string error;
+    CHECK(!readGalleryFile((std::filesystem::temp_directory_path() / "blutography_file_test_missing").string(), items, error));
+    CHECK(!error.empty());
+
+    TempFile empty("empty.bin", "");
+    error.clear();
+    CHECK(!readGalleryFile(empty.path.string(), items, error));
+    CHECK(error == "file is empty");
+
+    TempFile notAnArray("object.json", "{\"id\": \"x\"}");
+    error.clear();
+    CHECK(!readGalleryFile(notAnArray.path.string(), items, error));
+    CHECK(!error.empty());
+}
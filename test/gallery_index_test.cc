@@ -0,0 +1,211 @@
+#include <drogon/drogon_test.h>
+#include <support/gallery_index.hpp>
+#include <support/gallery_storage.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace blutography;
+
+namespace {
+    // Deterministic pseudo-random numbers for the reference comparisons
+    struct Xorshift {
+        uint32_t state = 88172645u;
+        uint32_t operator()(uint32_t bound) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            return state % bound;
+        }
+    };
+
+    const char* models[] = {"Canon EOS R5", "Canon EOS 5D Mark III", "NIKON Z 8", "[null]", ""};
+
+    // An item with a few values of each key, some missing or unparseable, so ties and gaps are common
+    std::shared_ptr<const GalleryItem> randomItem(Xorshift& random, int n) {
+        auto item = std::make_shared<GalleryItem>();
+        item->id = "id" + std::to_string(n);
+        auto& metadata = item->metadata;
+        if (random(10) != 0) {
+            char dateTime[20];
+            std::snprintf(dateTime, sizeof dateTime, "20%02u:%02u:%02u 12:00:00", 20 + random(4), 1 + random(12), 1 + random(28));
+            metadata.dateTime = dateTime;
+        }
+        metadata.iso = random(8) == 0 ? "Auto" : std::to_string(100u << random(6));
+        metadata.exposure = random(8) == 0 ? "" : "1/" + std::to_string(30u << random(6));
+        if (random(6) != 0) {
+            metadata.width = random(2) ? 6000 : 4000;
+            metadata.height = random(2) ? 4000 : 3000;
+            metadata.orientation = random(4) == 0 ? 6 : 1;
+        }
+        metadata.model = models[random(5)];
+        return item;
+    }
+
+    // What GalleryIndexes::query should return, worked out by looking at every item
+    std::vector<size_t> reference(const std::vector<ItemKeys>& keys, const GalleryQuery& query) {
+        size_t sortField = static_cast<size_t>(query.sort);
+        bool sortByModel = query.sort == IndexField::Model;
+        std::vector<size_t> result;
+        for (size_t position = 0; position < keys.size(); ++position) {
+            const ItemKeys& key = keys[position];
+            bool match = sortByModel ? !key.model.empty() : !std::isnan(key.numbers[sortField]);
+            for (size_t field = 0; field < numericIndexFields; ++field) {
+                const auto& range = query.ranges[field];
+                if (!range.active()) continue;
+                double value = key.numbers[field];
+                match = match && !std::isnan(value) && value >= range.min && value <= range.max;
+            }
+            if (!query.model.empty()) match = match && key.model == query.model;
+            if (match) result.push_back(position);
+        }
+        auto less = [&](size_t a, size_t b) {
+            return sortByModel ? std::make_pair(keys[a].model, a) < std::make_pair(keys[b].model, b)
+                               : std::make_pair(keys[a].numbers[sortField], a) < std::make_pair(keys[b].numbers[sortField], b);
+        };
+        std::sort(result.begin(), result.end(), less);
+        if (query.descending) std::reverse(result.begin(), result.end());
+        if (result.size() > query.limit) result.resize(query.limit);
+        return result;
+    }
+
+    // A random mix of filters, sort key, order and limit, narrow and wide
+    GalleryQuery randomQuery(Xorshift& random) {
+        GalleryQuery query;
+        if (random(2)) query.ranges[static_cast<size_t>(IndexField::Iso)] = {200, 200.0 * (1u << random(4))};
+        if (random(3) == 0) query.ranges[static_cast<size_t>(IndexField::Exposure)].max = 1.0 / (30u << random(6));
+        if (random(3) == 0) query.ranges[static_cast<size_t>(IndexField::Aspect)].min = 1.4;
+        if (random(4) == 0) query.ranges[static_cast<size_t>(IndexField::Megapixels)] = {15.0, 20.0};
+        if (random(4) == 0) {
+            query.ranges[static_cast<size_t>(IndexField::DateTime)].min = *parseCaptureTime("2021-06-01");
+            query.ranges[static_cast<size_t>(IndexField::DateTime)].max = *parseCaptureTime("2022-01-31");
+        }
+        if (random(4) == 0) query.model = models[random(3)];
+        query.sort = static_cast<IndexField>(random(6));
+        query.descending = random(2);
+        query.limit = random(3) == 0 ? 1000 : 1 + random(20);
+        return query;
+    }
+}
+
+DROGON_TEST(IndexParsesMetadataKeys)
+{
+    CHECK(parseCaptureTime("1970:01:01 00:00:00") == 0.0);
+    CHECK(parseCaptureTime("2025:06:28 05:07:50") == parseCaptureTime("2025-06-28T05:07:50"));
+    CHECK(*parseCaptureTime("2025-06-28") == *parseCaptureTime("2025:06:28 00:00:00"));
+    CHECK(*parseCaptureTime("2025:06:28 05:07:50", "25") - *parseCaptureTime("2025:06:28 05:07:50") == 250.0);
+    CHECK(*parseCaptureTime("2000:03:01 00:00:00") - *parseCaptureTime("2000:02:28 00:00:00") == 2 * 86400000.0);
+    CHECK(!parseCaptureTime("2025:13:01 00:00:00"));
+    CHECK(!parseCaptureTime("2025/06/28"));
+    CHECK(!parseCaptureTime("2025:06:28 25:00"));
+    CHECK(!parseCaptureTime("[null]"));
+
+    CHECK(parseExposure("1/800") == 1.0 / 800);
+    CHECK(parseExposure("0.5") == 0.5);
+    CHECK(parseExposure("2s") == 2.0);
+    CHECK(!parseExposure("1/0"));
+    CHECK(!parseExposure("1/"));
+    CHECK(!parseExposure("fast"));
+    CHECK(!parseExposure("0"));
+
+    CHECK(parseIso("1250") == 1250.0);
+    CHECK(!parseIso("Auto"));
+    CHECK(!parseIso("100 "));
+    CHECK(!parseIso("0"));
+
+    GalleryItem item;
+    item.metadata.width = 6000;
+    item.metadata.height = 4000;
+    item.metadata.orientation = 6; // shown turned on its side
+    item.metadata.model = "[null]";
+    auto keys = ItemKeys::of(item);
+    CHECK(keys.numbers[static_cast<size_t>(IndexField::Megapixels)] == 24.0);
+    CHECK(keys.numbers[static_cast<size_t>(IndexField::Aspect)] == 4000.0 / 6000.0);
+    CHECK(std::isnan(keys.numbers[static_cast<size_t>(IndexField::DateTime)]));
+    CHECK(keys.model.empty());
+}
+
+DROGON_TEST(IndexQueriesMatchReference)
+{
+    Xorshift random;
+    std::vector<std::shared_ptr<const GalleryItem>> owned;
+    GalleryItems items;
+    for (int n = 0; n < 3000; ++n) {
+        owned.push_back(randomItem(random, n));
+        items.push_back(owned.back());
+    }
+    GalleryIndexes indexes;
+    indexes.rebuild(items);
+
+    auto check = [&](int queries) {
+        std::vector<ItemKeys> keys;
+        for (const auto& item : owned) keys.push_back(ItemKeys::of(*item));
+        int mismatches = 0;
+        for (int i = 0; i < queries; ++i) {
+            GalleryQuery query = randomQuery(random);
+            if (indexes.query(query) != reference(keys, query)) ++mismatches;
+        }
+        CHECK(mismatches == 0);
+    };
+    check(400);
+
+    // Replaced and added items move in every index, and a copy taken before keeps the old order
+    GalleryIndexes before = indexes;
+    auto beforeOwned = owned;
+    for (int n = 0; n < 300; ++n) {
+        size_t position = random(static_cast<uint32_t>(owned.size() + 1));
+        auto item = randomItem(random, n);
+        if (position == owned.size()) {
+            owned.push_back(item);
+            indexes.put(nullptr, *item, position);
+        } else {
+            indexes.put(owned[position].get(), *item, position);
+            owned[position] = item;
+        }
+    }
+    check(400);
+
+    std::vector<ItemKeys> beforeKeys;
+    for (const auto& item : beforeOwned) beforeKeys.push_back(ItemKeys::of(*item));
+    GalleryQuery newest;
+    newest.descending = true;
+    newest.limit = 50;
+    CHECK(before.query(newest) == reference(beforeKeys, newest));
+}
+
+DROGON_TEST(IndexQueryEdges)
+{
+    GalleryItems items;
+    std::vector<std::shared_ptr<const GalleryItem>> owned;
+    for (int n = 0; n < 5; ++n) {
+        auto item = std::make_shared<GalleryItem>();
+        item->metadata.iso = std::to_string(100 * (n + 1));
+        item->metadata.dateTime = n == 2 ? "" : "2024:01:0" + std::to_string(n + 1) + " 00:00:00";
+        owned.push_back(item);
+        items.push_back(item);
+    }
+    GalleryIndexes indexes;
+    indexes.rebuild(items);
+
+    GalleryQuery query;
+    query.limit = 0;
+    CHECK(indexes.query(query).empty());
+
+    // Items without the sort key are left out
+    query.limit = 10;
+    CHECK(indexes.query(query) == (std::vector<size_t>{0, 1, 3, 4}));
+
+    // Bounds are inclusive, and an empty range matches nothing
+    query.sort = IndexField::Iso;
+    query.ranges[static_cast<size_t>(IndexField::Iso)] = {200, 400};
+    CHECK(indexes.query(query) == (std::vector<size_t>{1, 2, 3}));
+    query.descending = true;
+    CHECK(indexes.query(query) == (std::vector<size_t>{3, 2, 1}));
+    query.ranges[static_cast<size_t>(IndexField::Iso)] = {400, 200};
+    CHECK(indexes.query(query).empty());
+    query.ranges[static_cast<size_t>(IndexField::Iso)] = {};
+    query.model = "Unknown camera";
+    CHECK(indexes.query(query).empty());
+}
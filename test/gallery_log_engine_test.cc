@@ -0,0 +1,169 @@
+#include <drogon/drogon_test.h>
+#include <support/gallery_log_engine.hpp>
+#include <support/gallery_storage.hpp>
+#include "test_support.hpp"
+#include <sys/resource.h>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace blutography;
+
+namespace {
+    using testing::numberedItem;
+
+    // A private directory for one gallery's snapshot and log
+    struct GalleryDirectory : testing::TempDirectory {
+        explicit GalleryDirectory(const std::string& name) : TempDirectory("log_test", name) {}
+
+        std::string snapshot() const { return file("gallery.bin"); }
+        std::string log() const { return file("gallery.log"); }
+
+        std::unique_ptr<GalleryStorage> open(LogEngineOptions options = {}) const {
+            return std::make_unique<GalleryStorage>(testing::logEngine(*this, options));
+        }
+    };
+}
+
+DROGON_TEST(LogReplayDropsTornLastRecord)
+{
+    GalleryDirectory dir("torn");
+    {
+        auto storage = dir.open();
+        for (int i = 0; i < 3; ++i) CHECK(storage->addItem(numberedItem(i)));
+    }
+    auto good = std::filesystem::file_size(dir.log());
+    // The process died halfway through appending an edit
+    std::ofstream(dir.log(), std::ios::binary | std::ios::app) << "{\"put\":{\"id\":\"id1\",\"name\":\"Ren";
+
+    auto storage = dir.open();
+    auto snapshot = storage->snapshot();
+    CHECK(snapshot->items.size() == 3);
+    REQUIRE(snapshot->find("id1") != nullptr);
+    CHECK(snapshot->find("id1")->name == "Item 1");
+    CHECK(std::filesystem::file_size(dir.log()) == good);
+
+    // Appends after the cut land on a clean line
+    CHECK(storage->addItem(numberedItem(3)));
+    storage.reset();
+    CHECK(dir.open()->snapshot()->items.size() == 4);
+}
+
+DROGON_TEST(LogCompactsIntoSnapshot)
+{
+    GalleryDirectory dir("compact");
+    LogEngineOptions options;
+    options.compactMinRecords = 4;
+    {
+        auto storage = dir.open(options);
+        for (int i = 0; i < 10; ++i) CHECK(storage->addItem(numberedItem(i)));
+        REQUIRE(storage->updateDetails("id2", std::string("Renamed"), std::nullopt) != nullptr);
+
+        // Compaction runs on its own thread; wait (bounded) for it to finish
+        for (int i = 0; i < 500 && !std::filesystem::exists(dir.snapshot()); ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        for (int i = 0; i < 500 && std::filesystem::exists(dir.log() + ".old"); ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        CHECK(std::filesystem::exists(dir.snapshot()));
+        CHECK(!std::filesystem::exists(dir.log() + ".old"));
+    }
+
+    auto snapshot = dir.open(options)->snapshot();
+    CHECK(snapshot->items.size() == 10);
+    REQUIRE(snapshot->find("id2") != nullptr);
+    CHECK(snapshot->find("id2")->name == "Renamed");
+    CHECK(snapshot->find("id9") != nullptr);
+}
+
+DROGON_TEST(LogCompactionStopsWhenTheRotationFails)
+{
+    GalleryDirectory dir("rotate");
+    LogEngineOptions options;
+    options.compactMinRecords = 4;
+    auto storage = dir.open(options);
+    CHECK(storage->addItem(numberedItem(0)));
+
+    // With the log gone from under the open engine there is nothing to rename
+    std::filesystem::remove(dir.log());
+    for (int i = 1; i < 10; ++i) CHECK(storage->addItem(numberedItem(i)));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    // No snapshot over a log that was never rotated, and no fresh log in its place; the engine carries on
+    CHECK(!std::filesystem::exists(dir.snapshot()));
+    CHECK(!std::filesystem::exists(dir.log()));
+    CHECK(storage->addItem(numberedItem(10)));
+    CHECK(storage->snapshot()->items.size() == 11);
+}
+
+DROGON_TEST(LogFailedCommitIsNotPublished)
+{
+    GalleryDirectory dir("failure");
+    auto storage = dir.open();
+    CHECK(storage->addItem(numberedItem(0)));
+    CHECK(storage->addItem(numberedItem(1)));
+    uint64_t version = storage->snapshot()->version;
+
+    // Cap file sizes just past the log's end, so the next record only partly fits
+    struct rlimit before{};
+    REQUIRE(::getrlimit(RLIMIT_FSIZE, &before) == 0);
+    auto previousHandler = std::signal(SIGXFSZ, SIG_IGN);
+    struct rlimit capped = before;
+    capped.rlim_cur = static_cast<rlim_t>(std::filesystem::file_size(dir.log()) + 16);
+    REQUIRE(::setrlimit(RLIMIT_FSIZE, &capped) == 0);
+    bool stored = storage->addItem(numberedItem(2, std::string(200, 'x')));
+    auto renamed = storage->updateDetails("id0", std::string(200, 'y'), std::nullopt);
+    ::setrlimit(RLIMIT_FSIZE, &before);
+    std::signal(SIGXFSZ, previousHandler);
+
+    CHECK(!stored);
+    CHECK(renamed == nullptr);
+    auto snapshot = storage->snapshot();
+    CHECK(snapshot->find("id2") == nullptr);
+    CHECK(snapshot->find("id0")->name == "Item 0");
+    CHECK(snapshot->version == version);
+
+    // The log was rolled back to its last whole record and takes appends again
+    CHECK(storage->addItem(numberedItem(3)));
+    storage.reset();
+    auto reloaded = dir.open()->snapshot();
+    CHECK(reloaded->items.size() == 3);
+    CHECK(reloaded->find("id2") == nullptr);
+    CHECK(reloaded->find("id3") != nullptr);
+    CHECK(reloaded->find("id0")->name == "Item 0");
+}
+
+DROGON_TEST(LogConcurrentWritersAllPublished)
+{
+    GalleryDirectory dir("concurrent");
+    LogEngineOptions options;
+    options.compactMinRecords = 16;
+    {
+        auto storage = dir.open(options);
+        std::vector<std::thread> writers;
+        for (int t = 0; t < 4; ++t) {
+            writers.emplace_back([&storage, t] {
+                for (int i = 0; i < 25; ++i) {
+                    int n = t * 25 + i;
+                    storage->addItem(numberedItem(n));
+                    // Visible as soon as addItem returns
+                    if (!storage->getItem("id" + std::to_string(n))) std::abort();
+                    storage->updateDetails("id" + std::to_string(n), std::nullopt, std::string("Quote"));
+                }
+            });
+        }
+        for (auto& writer : writers) writer.join();
+        auto snapshot = storage->snapshot();
+        CHECK(snapshot->items.size() == 100);
+        CHECK(snapshot->find("id57")->quote == "Quote");
+    }
+    auto reloaded = dir.open(options)->snapshot();
+    CHECK(reloaded->items.size() == 100);
+    CHECK(reloaded->find("id99")->quote == "Quote");
+}
@@ -0,0 +1,92 @@
+#include <drogon/drogon_test.h>
+#include <support/gallery_search.hpp>
+#include <support/gallery_storage.hpp>
+#include <string>
+#include <vector>
+
+using namespace blutography;
+
+namespace {
+    using Words = std::vector<std::string>;
+    using Positions = std::vector<size_t>;
+
+    GalleryItems itemsOf(const std::vector<std::pair<std::string, std::string>>& details) {
+        GalleryItems items;
+        for (const auto& [name, quote] : details) {
+            auto item = std::make_shared<GalleryItem>();
+            item->name = name;
+            item->quote = quote;
+            items.push_back(std::move(item));
+        }
+        return items;
+    }
+}
+
+DROGON_TEST(TokenizerSplitsAndFolds)
+{
+    CHECK(tokenize("Hello, World! hello") == (Words{"hello", "world"}));
+    CHECK(tokenize("f/2.8 at 1/800s") == (Words{"1", "2", "8", "800s", "at", "f"}));
+    CHECK(tokenize("snake_case-and.dots") == (Words{"and", "case", "dots", "snake"}));
+    CHECK(tokenize("").empty());
+    CHECK(tokenize(" ,.;!? ").empty());
+
+    // Non-ASCII bytes belong to words and are left as they are; only ASCII is folded
+    CHECK(tokenize("\xC3\x8Ele-de-France") == (Words{"de", "france", "\xC3\x8Ele"}));
+    CHECK(tokenize("Caf\xC3\xA9 CAF\xC3\x89") == (Words{"caf\xC3\x89", "caf\xC3\xA9"}));
+}
+
+DROGON_TEST(SearchRanksWholeWordsNamesAndNewerItems)
+{
+    GalleryTextIndex index;
+    index.rebuild(itemsOf({
+        {"Harbour at dawn", "Fog"},           // 0
+        {"Dawn patrol", "Harbour lights"},    // 1
+        {"Harbourside", ""},                  // 2
+        {"City", "harbour"},                  // 3
+        {"Fog", "fog over the fog"},          // 4
+    }));
+
+    // Whole word in a name, prefix in a name, then whole words in quotes, newer first among equals
+    CHECK(index.search("harbour", 10) == (Positions{0, 2, 3, 1}));
+    CHECK(index.search("HARBOUR", 2) == (Positions{0, 2}));
+
+    // Every word must match, each as a prefix of some word of the item
+    CHECK(index.search("harb dawn", 10) == (Positions{0, 1}));
+    CHECK(index.search("dawn harbour lights", 10) == (Positions{1}));
+    CHECK(index.search("harbour zebra", 10).empty());
+
+    // A word in both the name and the quote counts once, at its best
+    CHECK(index.search("fog", 10) == (Positions{4, 0}));
+
+    // Prefixes only, not inner substrings
+    CHECK(index.search("bour", 10).empty());
+    CHECK(index.search("harboursides", 10).empty());
+
+    CHECK(index.search("", 10).empty());
+    CHECK(index.search("!!!", 10).empty());
+    CHECK(index.search("harbour", 0).empty());
+}
+
+DROGON_TEST(SearchFollowsPuts)
+{
+    auto items = itemsOf({{"Old mill", "river"}, {"Bridge", "river at night"}});
+    GalleryTextIndex index;
+    index.rebuild(items);
+
+    // A new item, then a rename of the first: the old name's words go, its quote's stay
+    auto added = std::make_shared<GalleryItem>();
+    added->name = "Mill pond";
+    index.put(nullptr, *added, 2);
+    CHECK(index.search("mill", 10) == (Positions{2, 0}));
+
+    GalleryItem renamed = *items[0];
+    renamed.name = "Watermill";
+    index.put(items[0].get(), renamed, 0);
+    CHECK(index.search("mill", 10) == (Positions{2}));
+    CHECK(index.search("water", 10) == (Positions{0}));
+    CHECK(index.search("river", 10) == (Positions{1, 0}));
+
+    // The same words again change nothing
+    index.put(&renamed, renamed, 0);
+    CHECK(index.search("watermill river", 10) == (Positions{0}));
+}
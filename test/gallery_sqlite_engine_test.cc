@@ -0,0 +1,88 @@
+#include <drogon/drogon_test.h>
+#include <drogon/orm/DbClient.h>
+#include <support/gallery_log_engine.hpp>
+#include <support/gallery_sqlite_engine.hpp>
+#include <support/gallery_storage.hpp>
+#include "test_support.hpp"
+#include <string>
+
+using namespace blutography;
+
+namespace {
+    using testing::numberedItem;
+
+    // A private directory for one database and the log gallery seeding it
+    struct DatabaseDirectory : testing::TempDirectory {
+        explicit DatabaseDirectory(const std::string& name) : TempDirectory("sqlite_test", name) {}
+
+        std::string database() const { return file("gallery.db"); }
+
+        std::unique_ptr<LogGalleryEngine> log() const { return testing::logEngine(*this); }
+        std::unique_ptr<GalleryStorage> open(bool seeded = true) const {
+            return std::make_unique<GalleryStorage>(std::make_unique<SqliteGalleryEngine>(database(), seeded ? log() : nullptr));
+        }
+
+        // Runs statements on the database behind the engine's back
+        void exec(const std::string& sql) const {
+            drogon::orm::DbClient::newSqlite3Client("filename=" + database(), 1)->execSqlSync(sql);
+        }
+    };
+}
+
+DROGON_TEST(SqliteImportsSeedOnce)
+{
+    DatabaseDirectory dir("seed");
+    {
+        GalleryStorage seed(dir.log());
+        for (int i = 0; i < 3; ++i) CHECK(seed.addItem(numberedItem(i)));
+    }
+    {
+        auto storage = dir.open();
+        CHECK(storage->snapshot()->items.size() == 3);
+        CHECK(storage->addItem(numberedItem(3)));
+        REQUIRE(storage->updateDetails("id0", std::string("Renamed"), std::nullopt) != nullptr);
+    }
+
+    // Once imported, the database is the gallery; the seed is not read again
+    auto storage = dir.open(false);
+    auto snapshot = storage->snapshot();
+    REQUIRE(snapshot->items.size() == 4);
+    CHECK(snapshot->items[0]->id == "id0");
+    CHECK(snapshot->items[0]->name == "Renamed");
+    CHECK(snapshot->items[3]->id == "id3");
+}
+
+DROGON_TEST(SqliteFailedImportFailsLoad)
+{
+    DatabaseDirectory dir("import");
+    {
+        GalleryStorage seed(dir.log());
+        CHECK(seed.addItem(numberedItem(0)));
+    }
+    dir.exec("CREATE TABLE gallery_items (position INTEGER PRIMARY KEY, id TEXT NOT NULL UNIQUE, "
+             "content_hash TEXT NOT NULL, data TEXT NOT NULL CHECK (0))");
+    CHECK_THROWS(dir.open());
+
+    // Nothing was imported, so a later start with a usable table imports the seed
+    dir.exec("DROP TABLE gallery_items");
+    CHECK(dir.open()->snapshot()->items.size() == 1);
+}
+
+DROGON_TEST(SqliteRolledBackWriteIsNotPublished)
+{
+    DatabaseDirectory dir("rollback");
+    auto storage = dir.open(false);
+    CHECK(storage->addItem(numberedItem(0)));
+    dir.exec("CREATE TRIGGER refuse BEFORE INSERT ON gallery_items WHEN NEW.id = 'id1' "
+             "BEGIN SELECT RAISE(ABORT, 'refused'); END");
+
+    CHECK(!storage->addItem(numberedItem(1)));
+    CHECK(storage->getItem("id1") == nullptr);
+    CHECK(storage->addItem(numberedItem(2)));
+    CHECK(storage->getItem("id2") != nullptr);
+    storage.reset();
+
+    auto snapshot = dir.open(false)->snapshot();
+    CHECK(snapshot->items.size() == 2);
+    CHECK(snapshot->find("id1") == nullptr);
+}
@@ -0,0 +1,98 @@
+#include <drogon/drogon_test.h>
+#include <drogon/drogon.h>
+#include <support/http_client_pool.hpp>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <thread>
+
+using namespace blutography;
+
+namespace {
+    // The test server started by test_main
+    const std::string host = "http://127.0.0.1:8080";
+
+    // Sends `count` requests at once from the main loop, so they share one pool, and waits (bounded) for every reply
+    bool sendFromMainLoop(const std::shared_ptr<HttpClientPool>& pool, drogon::HttpMethod method, int count) {
+        auto done = std::make_shared<std::promise<void>>();
+        auto future = done->get_future();
+        auto remaining = std::make_shared<std::atomic<int>>(count);
+        drogon::app().getLoop()->queueInLoop([pool, method, count, done, remaining] {
+            for (int i = 0; i < count; ++i) {
+                auto req = drogon::HttpRequest::newHttpRequest();
+                req->setMethod(method);
+                req->setPath("/config.json");
+                pool->send(host, req, [done, remaining](drogon::ReqResult, const drogon::HttpResponsePtr&) {
+                    if (--*remaining == 0) done->set_value();
+                });
+            }
+        });
+        return future.wait_for(std::chrono::seconds(10)) == std::future_status::ready;
+    }
+}
+
+DROGON_TEST(PoolReusesKeptAliveConnections)
+{
+    auto pool = std::make_shared<HttpClientPool>();
+    for (int i = 0; i < 3; ++i) REQUIRE(sendFromMainLoop(pool, drogon::Get, 1));
+
+    // One handshake, then the same connection each time
+    CHECK(pool->requests() == 3);
+    CHECK(pool->handshakes() == 1);
+    CHECK(pool->connections() == 1);
+    CHECK(pool->pipelined() == 0);
+    CHECK(pool->reuseRatio() > 0.6);
+}
+
+DROGON_TEST(PoolPipelinesGetsPastTheCap)
+{
+    HttpClientPoolOptions options;
+    options.maxPerHost = 1;
+    options.pipelining = 4;
+    auto pool = std::make_shared<HttpClientPool>(options);
+
+    // At the cap, the next three GETs go out behind the first on its connection
+    REQUIRE(sendFromMainLoop(pool, drogon::Get, 4));
+    CHECK(pool->connections() == 1);
+    CHECK(pool->pipelined() == 3);
+    CHECK(pool->queued() == 0);
+
+    // A fifth finds every pipeline full and opens a connection over the cap
+    REQUIRE(sendFromMainLoop(pool, drogon::Get, 5));
+    CHECK(pool->connections() == 2);
+}
+
+DROGON_TEST(PoolQueuesPostsOverTheCap)
+{
+    HttpClientPoolOptions options;
+    options.maxPerHost = 2;
+    auto pool = std::make_shared<HttpClientPool>(options);
+
+    // Two connections, each with one POST at a time; the other three wait for them and all are answered
+    REQUIRE(sendFromMainLoop(pool, drogon::Post, 5));
+    CHECK(pool->requests() == 5);
+    CHECK(pool->connections() == 2);
+    CHECK(pool->queued() == 3);
+    CHECK(pool->pipelined() == 0);
+}
+
+DROGON_TEST(PoolClosesIdleConnections)
+{
+    HttpClientPoolOptions options;
+    options.idleTimeout = std::chrono::seconds(1);
+    auto pool = std::make_shared<HttpClientPool>(options);
+    REQUIRE(sendFromMainLoop(pool, drogon::Get, 2));
+    REQUIRE(pool->connections() >= 1);
+    size_t opened = pool->connections();
+
+    // The sweep runs every idleTimeout and closes what has been idle that long
+    for (int i = 0; i < 100 && pool->connections() > 0; ++i) std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(pool->connections() == 0);
+    CHECK(pool->evicted() == opened);
+
+    // And a later request opens a fresh one
+    REQUIRE(sendFromMainLoop(pool, drogon::Get, 1));
+    CHECK(pool->connections() == 1);
+    CHECK(pool->handshakes() == opened + 1);
+}
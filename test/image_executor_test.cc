@@ -0,0 +1,98 @@
+#include <drogon/drogon_test.h>
+#include <support/image_executor.hpp>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+using namespace blutography;
+
+namespace {
+    ExecutorOptions small(size_t threads, size_t maxQueue) {
+        ExecutorOptions options;
+        options.threads = threads;
+        options.maxQueue = maxQueue;
+        return options;
+    }
+
+    // Waits (bounded) until the executor has nothing admitted
+    bool settles(const ImageExecutor& executor) {
+        for (int i = 0; i < 500 && executor.admitted() > 0; ++i) std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        return executor.admitted() == 0;
+    }
+}
+
+DROGON_TEST(ExecutorReserveIsAllOrNone)
+{
+    ImageExecutor executor(small(1, 4));
+    CHECK(executor.reserve(3));
+    CHECK(executor.admitted() == 3);
+    CHECK(!executor.reserve(2)); // 5 > 4: refused whole, nothing claimed
+    CHECK(executor.admitted() == 3);
+    CHECK(executor.reserve(1));
+    CHECK(!executor.reserve(1));
+
+    executor.cancel(2);
+    CHECK(executor.admitted() == 2);
+    CHECK(executor.reserve(2));
+    executor.cancel(4);
+    CHECK(executor.admitted() == 0);
+
+    // A batch larger than the whole queue gets in when nothing else is admitted
+    CHECK(executor.reserve(10));
+    CHECK(!executor.reserve(1));
+    executor.cancel(10);
+    CHECK(executor.admitted() == 0);
+}
+
+DROGON_TEST(ExecutorSlotsReturnWhenTasksFinish)
+{
+    ImageExecutor executor(small(2, 2));
+    std::promise<void> gate;
+    std::shared_future<void> open = gate.get_future().share();
+    REQUIRE(executor.reserve(2));
+    executor.submit([open] { open.wait(); });
+    executor.submit([open] { open.wait(); });
+    CHECK(!executor.reserve(1)); // both slots busy until the tasks end
+    gate.set_value();
+    CHECK(settles(executor));
+    CHECK(executor.reserve(2));
+    executor.cancel(2);
+}
+
+DROGON_TEST(ExecutorDoneReportsOutcome)
+{
+    ImageExecutor executor(small(2, 8));
+    REQUIRE(executor.reserve(3));
+
+    std::promise<bool> ok, threw, threwOther;
+    auto okResult = ok.get_future();
+    auto threwResult = threw.get_future();
+    auto otherResult = threwOther.get_future();
+    executor.submit([] {}, [&ok](bool succeeded) { ok.set_value(succeeded); });
+    executor.submit([] { throw std::runtime_error("decode failed"); }, [&threw](bool succeeded) { threw.set_value(succeeded); });
+    executor.submit([] { throw 42; }, [&threwOther](bool succeeded) { threwOther.set_value(succeeded); });
+
+    CHECK(okResult.get());
+    CHECK(!threwResult.get());
+    CHECK(!otherResult.get());
+    CHECK(settles(executor));
+}
+
+DROGON_TEST(ExecutorDrainRefusesNewWork)
+{
+    ImageExecutor executor(small(2, 8));
+    std::atomic<int> ran{0};
+    REQUIRE(executor.reserve(4));
+    for (int i = 0; i < 4; ++i) {
+        executor.submit([&ran] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            ++ran;
+        });
+    }
+    executor.drain();
+    CHECK(ran == 4); // everything admitted finished first
+    CHECK(executor.admitted() == 0);
+    CHECK(!executor.reserve(1));
+}
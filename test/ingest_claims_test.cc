@@ -0,0 +1,78 @@
+#include <drogon/drogon_test.h>
+#include <support/ingest_claims.hpp>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace blutography;
+
+DROGON_TEST(IngestClaimIsExclusive)
+{
+    IngestClaims claims;
+    auto first = claims.claim("aa");
+    CHECK(static_cast<bool>(first));
+    CHECK(claims.held("aa"));
+
+    auto second = claims.claim("aa");
+    CHECK(!second);
+    second.release(); // an empty claim must not free someone else's hash
+    CHECK(claims.held("aa"));
+
+    CHECK(static_cast<bool>(claims.claim("bb")));
+    CHECK(!claims.held("bb")); // the temporary released it again
+
+    first.release();
+    CHECK(!claims.held("aa"));
+    CHECK(static_cast<bool>(claims.claim("aa")));
+}
+
+DROGON_TEST(IngestClaimReleasedWhateverTheOutcome)
+{
+    IngestClaims claims;
+
+    // Moved into a task that throws, as the upload handler does
+    auto claim = std::make_shared<IngestClaims::Claim>(claims.claim("cc"));
+    std::function<void()> task = [claim]() {
+        IngestClaims::Claim held = std::move(*claim);
+        throw std::runtime_error("decode failed");
+    };
+    CHECK(claims.held("cc"));
+    CHECK_THROWS(task());
+    CHECK(!claims.held("cc"));
+
+    // A task dropped without running frees its claim with the task
+    auto dropped = std::make_shared<IngestClaims::Claim>(claims.claim("dd"));
+    std::function<void()> never = [dropped]() { IngestClaims::Claim held = std::move(*dropped); };
+    dropped.reset();
+    CHECK(claims.held("dd"));
+    never = nullptr;
+    CHECK(!claims.held("dd"));
+
+    // Move assignment releases what the target held
+    auto a = claims.claim("ee");
+    auto b = claims.claim("ff");
+    a = std::move(b);
+    CHECK(!claims.held("ee"));
+    CHECK(claims.held("ff"));
+}
+
+DROGON_TEST(IngestClaimConcurrentUploads)
+{
+    IngestClaims claims;
+    std::atomic<int> winners{0};
+    std::vector<std::thread> threads;
+    std::vector<IngestClaims::Claim> held(8);
+    for (int i = 0; i < 8; ++i) {
+        threads.emplace_back([&, i] {
+            held[i] = claims.claim("same bytes");
+            if (held[i]) ++winners;
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    CHECK(winners == 1);
+    held.clear();
+    CHECK(!claims.held("same bytes"));
+}
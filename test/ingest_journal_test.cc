@@ -0,0 +1,101 @@
+#include <drogon/drogon_test.h>
+#include <support/ingest_journal.hpp>
+#include <support/spool.hpp>
+#include "test_support.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <string>
+
+using namespace blutography;
+
+namespace {
+    // Journals a spool file the way the upload handler does
+    std::string journal(IngestJournal& journal, const testing::TempDirectory& spool, const std::string& name, const std::string& fileName) {
+        std::string path = spool.write(name + ".part", "original bytes of " + fileName);
+        auto content = SpooledFile::open(path, "SHA1OF" + fileName);
+        JournalEntry entry;
+        entry.fileName = fileName;
+        entry.name = "Name of " + fileName;
+        entry.quote = "Quote of " + fileName;
+        journal.begin(*content, entry);
+        return path;
+    }
+}
+
+DROGON_TEST(JournalRecoversUnfinishedIngests)
+{
+    testing::TempDirectory spool("journal_test", "recover");
+    {
+        IngestJournal before(spool.path.string());
+        journal(before, spool, "a", "a.jpg");
+        std::string stored = journal(before, spool, "b", "b.jpg");
+        std::string uploaded = journal(before, spool, "c", "c.jpg");
+        before.advance(stored, JournalStage::Stored);
+        before.complete(uploaded);
+        CHECK(spool.has("a.part"));
+        CHECK(!spool.has("c.part"));
+        CHECK(!spool.has("c.journal"));
+    }
+
+    // The next process sees what the crashed one left
+    IngestJournal after(spool.path.string());
+    auto entries = after.recover();
+    REQUIRE(entries.size() == 2);
+    std::sort(entries.begin(), entries.end(), [](const JournalEntry& x, const JournalEntry& y) { return x.fileName < y.fileName; });
+    CHECK(entries[0].fileName == "a.jpg");
+    CHECK(entries[0].stage == JournalStage::Spooled);
+    CHECK(entries[0].name == "Name of a.jpg");
+    CHECK(entries[0].quote == "Quote of a.jpg");
+    CHECK(entries[0].contentHash == "SHA1OFa.jpg");
+    CHECK(entries[1].fileName == "b.jpg");
+    CHECK(entries[1].stage == JournalStage::Stored);
+
+    // Recovered entries can be finished like fresh ones
+    after.complete(entries[0].spoolPath);
+    CHECK(!spool.has("a.part"));
+    CHECK(!spool.has("a.journal"));
+    CHECK(IngestJournal(spool.path.string()).recover().size() == 1);
+}
+
+DROGON_TEST(JournalRecoveryCleansUp)
+{
+    testing::TempDirectory spool("journal_test", "cleanup");
+    {
+        IngestJournal before(spool.path.string());
+        journal(before, spool, "kept", "kept.jpg");
+        std::string lost = journal(before, spool, "lost", "lost.jpg");
+        std::filesystem::remove(lost); // the original went missing behind the journal's back
+    }
+    spool.write("orphan.part", "spooled, never journaled");
+    spool.write("half.journal.tmp", "{\"spoolPath\":");
+    spool.write("torn.journal", "{\"spoolPath\": \"spool/x.part\", \"fileN");
+
+    auto entries = IngestJournal(spool.path.string()).recover();
+    REQUIRE(entries.size() == 1);
+    CHECK(entries[0].fileName == "kept.jpg");
+    CHECK(spool.has("kept.part"));
+    CHECK(spool.has("kept.journal"));
+    CHECK(!spool.has("lost.journal"));
+    CHECK(!spool.has("orphan.part"));
+    CHECK(!spool.has("half.journal.tmp"));
+    CHECK(!spool.has("torn.journal"));
+}
+
+DROGON_TEST(JournalKeepsSpoolFilesAlive)
+{
+    testing::TempDirectory spool("journal_test", "persist");
+    IngestJournal journalled(spool.path.string());
+    std::string path = spool.write("p.part", "bytes");
+    {
+        auto content = SpooledFile::open(path, "SHA1");
+        REQUIRE(content != nullptr);
+        CHECK(content->data() == "bytes");
+        JournalEntry entry;
+        entry.fileName = "p.jpg";
+        CHECK(journalled.begin(*content, entry));
+    }
+    // A journaled original stays on disk until B2 has it
+    CHECK(spool.has("p.part"));
+    journalled.complete(path);
+    CHECK(!spool.has("p.part"));
+}
@@ -0,0 +1,100 @@
+#include <drogon/drogon_test.h>
+#include <support/quality_search.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+using namespace blutography::image;
+
+namespace {
+    // Smooth gradients under a little noise: compresses like a photo, so size and SSIM both follow quality
+    std::vector<unsigned char> photo(int width, int height) {
+        std::vector<unsigned char> rgb(static_cast<size_t>(width) * height * 3);
+        uint32_t state = 2463534242u;
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                unsigned char* px = rgb.data() + (static_cast<size_t>(y) * width + x) * 3;
+                int noise = static_cast<int>(state % 24) - 12;
+                px[0] = static_cast<unsigned char>(std::clamp(x * 255 / width + noise, 0, 255));
+                px[1] = static_cast<unsigned char>(std::clamp(y * 255 / height + noise, 0, 255));
+                px[2] = static_cast<unsigned char>(std::clamp(128 + noise * 3, 0, 255));
+            }
+        }
+        return rgb;
+    }
+
+    QualityTrial trial(int quality, size_t bytes, double ssim) { return {quality, bytes, ssim}; }
+}
+
+DROGON_TEST(QualityTrialsCoverTheRange)
+{
+    auto rgb = photo(160, 120);
+    QualityOptions options;
+    options.minQuality = 52;
+    options.maxQuality = 90;
+
+    auto trials = runQualityTrials(rgb.data(), 160, 120, 2, options, true);
+
+    // Every fifth level from the top, and the bottom of the range, highest first
+    std::vector<int> qualities;
+    for (const auto& t : trials) qualities.push_back(t.quality);
+    CHECK(qualities == (std::vector<int>{90, 85, 80, 75, 70, 65, 60, 55, 52}));
+
+    bool measured = true, shrinking = true;
+    for (size_t i = 0; i < trials.size(); ++i) {
+        measured = measured && trials[i].bytes > 0 && trials[i].bytes != std::numeric_limits<size_t>::max();
+        measured = measured && trials[i].ssim > 0.5 && trials[i].ssim <= 1.0;
+        if (i > 0) shrinking = shrinking && trials[i].bytes <= trials[i - 1].bytes;
+    }
+    CHECK(measured);
+    CHECK(shrinking);
+    CHECK(trials.front().ssim > trials.back().ssim);
+
+    // Without SSIM only the sizes are measured, and they are the same
+    auto sizes = runQualityTrials(rgb.data(), 160, 120, 2, options, false);
+    REQUIRE(sizes.size() == trials.size());
+    CHECK(sizes.front().bytes == trials.front().bytes);
+    CHECK(sizes.front().ssim == 0.0);
+
+    // A degenerate range is one trial
+    options.minQuality = options.maxQuality = 75;
+    CHECK(runQualityTrials(rgb.data(), 160, 120, 2, options, false).size() == 1);
+}
+
+DROGON_TEST(QualityPickMeetsTheTarget)
+{
+    std::vector<QualityTrial> trials = {
+        trial(95, 4000, 0.990), trial(90, 3000, 0.985), trial(85, 2000, 0.970),
+        trial(80, std::numeric_limits<size_t>::max(), 0.0), trial(75, 1000, 0.940),
+    };
+
+    // Bytes: the highest quality whose scaled size plus overhead fits; failed trials are skipped
+    QualityOptions options;
+    options.targetBytes = 2500;
+    CHECK(pickQuality(trials, options, 1.0, 0) == 85);
+    CHECK(pickQuality(trials, options, 1.0, 600) == 75);
+    CHECK(pickQuality(trials, options, 0.75, 0) == 90);
+    options.targetBytes = 10;
+    CHECK(pickQuality(trials, options, 1.0, 0) == 75);
+
+    // SSIM: the lowest quality that still reaches it, the top one if none does
+    options.targetBytes = 0;
+    options.targetSsim = 0.98;
+    CHECK(pickQuality(trials, options, 1.0, 0) == 90);
+    options.targetSsim = 0.999;
+    CHECK(pickQuality(trials, options, 1.0, 0) == 95);
+
+    // Neither target, or nothing tried: the fixed level
+    options.targetSsim = 0.0;
+    options.fixed = 82;
+    CHECK(pickQuality(trials, options, 1.0, 0) == 82);
+    options.targetBytes = 2500;
+    CHECK(pickQuality({}, options, 1.0, 0) == 82);
+
+    auto rgb = photo(64, 64);
+    CHECK(lumaSsim(rgb.data(), rgb.data(), 64, 64) == 1.0);
+}
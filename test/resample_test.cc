@@ -0,0 +1,83 @@
+#include <drogon/drogon_test.h>
+#include <support/resample.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace blutography::image;
+
+namespace {
+    // Deterministic RGB noise with hard edges, so Lanczos' negative lobes over- and undershoot
+    std::vector<unsigned char> pattern(int width, int height) {
+        std::vector<unsigned char> rgb(static_cast<size_t>(width) * height * 3);
+        uint32_t state = 2463534242u;
+        for (size_t i = 0; i < rgb.size(); ++i) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            size_t pixel = i / 3;
+            bool block = ((pixel % width) / 7 + (pixel / width) / 5) % 2;
+            rgb[i] = block ? static_cast<unsigned char>(state & 0xFF) : (state & 0x100 ? 255 : 0);
+        }
+        return rgb;
+    }
+
+    std::vector<unsigned char> resample(const char* kernel, const std::vector<unsigned char>& src, int srcWidth, int srcHeight,
+                                        int dstWidth, int dstHeight, ResampleFilter filter) {
+        setResampleKernel(kernel);
+        ScratchBuffer temp;
+        std::vector<unsigned char> dst(static_cast<size_t>(dstWidth) * dstHeight * 3);
+        resampleRgb(src.data(), srcWidth, srcHeight, dst.data(), dstWidth, dstHeight, temp, filter);
+        return dst;
+    }
+}
+
+DROGON_TEST(ResampleSimdMatchesScalar)
+{
+    REQUIRE(setResampleKernel("native"));
+    std::string native = resampleKernel();
+
+    struct Case { int srcWidth, srcHeight, dstWidth, dstHeight; };
+    // Odd widths leave a tail for the scalar loop after the 8-byte SIMD steps; upscales too
+    const Case cases[] = {
+        {640, 480, 320, 240}, {641, 479, 97, 61}, {333, 222, 333, 111}, {50, 37, 151, 113}, {9, 9, 3, 1}, {1, 1, 5, 5},
+    };
+    for (ResampleFilter filter : {ResampleFilter::Lanczos3, ResampleFilter::Area}) {
+        for (const Case& c : cases) {
+            auto src = pattern(c.srcWidth, c.srcHeight);
+            auto scalar = resample("scalar", src, c.srcWidth, c.srcHeight, c.dstWidth, c.dstHeight, filter);
+            auto simd = resample(native.c_str(), src, c.srcWidth, c.srcHeight, c.dstWidth, c.dstHeight, filter);
+            CHECK(scalar == simd);
+        }
+    }
+    setResampleKernel("native");
+    CHECK(resampleKernel() == native);
+}
+
+DROGON_TEST(ResampleKernelSelection)
+{
+    CHECK(setResampleKernel("scalar"));
+    CHECK(std::string(resampleKernel()) == "scalar");
+    CHECK(!setResampleKernel("sse9"));
+    CHECK(std::string(resampleKernel()) == "scalar");
+    CHECK(setResampleKernel("native"));
+}
+
+DROGON_TEST(ResampleKeepsFlatColour)
+{
+    // Weights sum to one: a flat image stays flat through either filter and any scale
+    std::vector<unsigned char> flat(static_cast<size_t>(123) * 77 * 3);
+    for (size_t i = 0; i < flat.size(); i += 3) {
+        flat[i] = 200;
+        flat[i + 1] = 17;
+        flat[i + 2] = 99;
+    }
+    for (ResampleFilter filter : {ResampleFilter::Lanczos3, ResampleFilter::Area}) {
+        auto out = resample("native", flat, 123, 77, 40, 90, filter);
+        bool same = true;
+        for (size_t i = 0; i < out.size(); i += 3) {
+            same = same && out[i] == 200 && out[i + 1] == 17 && out[i + 2] == 99;
+        }
+        CHECK(same);
+    }
+}
@@ -0,0 +1,63 @@
+#include <drogon/drogon_test.h>
+#include <support/spool.hpp>
+#include "test_support.hpp"
+#include <filesystem>
+#include <string>
+
+using namespace blutography;
+
+DROGON_TEST(SpoolWritesMapsAndRemoves)
+{
+    testing::TempDirectory spool("spool_test", "create");
+    std::string original(3 << 20, '\0');
+    for (size_t i = 0; i < original.size(); ++i) original[i] = static_cast<char>(i * 31 + (i >> 12));
+
+    auto file = SpooledFile::create(original, "HASH", spool.path.string());
+    REQUIRE(file != nullptr);
+    CHECK(file->size() == original.size());
+    CHECK(file->data() == original);
+    CHECK(file->sha1() == "HASH");
+    CHECK(std::filesystem::path(file->path()).parent_path() == spool.path);
+    CHECK(file->path().size() > 5);
+    CHECK(file->path().substr(file->path().size() - 5) == ".part");
+    CHECK(std::filesystem::file_size(file->path()) == original.size());
+
+    // Each upload gets its own file, and an empty one maps to an empty view
+    auto empty = SpooledFile::create({}, "EMPTY", spool.path.string());
+    REQUIRE(empty != nullptr);
+    CHECK(empty->path() != file->path());
+    CHECK(empty->data().empty());
+    CHECK(spool.files() == 2);
+
+    // Gone with the last reference
+    std::string path = file->path();
+    file.reset();
+    empty.reset();
+    CHECK(!std::filesystem::exists(path));
+    CHECK(spool.files() == 0);
+}
+
+DROGON_TEST(SpoolPersistsForTheJournal)
+{
+    testing::TempDirectory spool("spool_test", "persist");
+    std::string path;
+    {
+        auto file = SpooledFile::create("original bytes", "HASH", spool.path.string());
+        REQUIRE(file != nullptr);
+        file->persist();
+        path = file->path();
+    }
+    REQUIRE(std::filesystem::exists(path));
+
+    // Reopened by a later process with the hash the journal recorded; still not removed when dropped
+    {
+        auto reopened = SpooledFile::open(path, "RECORDED");
+        REQUIRE(reopened != nullptr);
+        CHECK(reopened->data() == "original bytes");
+        CHECK(reopened->sha1() == "RECORDED");
+    }
+    CHECK(std::filesystem::exists(path));
+
+    CHECK(SpooledFile::open((spool.path / "missing.part").string(), "HASH") == nullptr);
+    CHECK(SpooledFile::create("bytes", "HASH", (spool.path / "missing").string()) == nullptr);
+}
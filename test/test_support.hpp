@@ -0,0 +1,75 @@
+#ifndef BLUTOGRAPHY_TEST_SUPPORT_HPP
+#define BLUTOGRAPHY_TEST_SUPPORT_HPP
+
+#include <support/gallery_log_engine.hpp>
+#include <support/gallery_storage.hpp>
+#include <unistd.h>
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+
+// Fixtures shared by the unit tests and the benchmarks
+namespace blutography::testing {
+
+/**
+ * @brief A private directory under the system temp directory, removed with the object.
+ *
+ * Named blutography_<suite>_<pid>[_<name>], so concurrent runs and the tests of
+ * one run stay apart. Anything left over from an earlier run of the same name is
+ * removed first.
+ */
+struct TempDirectory {
+    std::filesystem::path path;
+
+    explicit TempDirectory(const std::string& suite, const std::string& name = {}) {
+        path = std::filesystem::temp_directory_path()
+               / ("blutography_" + suite + "_" + std::to_string(::getpid()) + (name.empty() ? "" : "_" + name));
+        std::filesystem::remove_all(path);
+        std::filesystem::create_directories(path);
+    }
+    ~TempDirectory() {
+        std::error_code ec;
+        std::filesystem::remove_all(path, ec);
+    }
+    TempDirectory(const TempDirectory&) = delete;
+    TempDirectory& operator=(const TempDirectory&) = delete;
+
+    std::string file(const std::string& name) const { return (path / name).string(); }
+    bool has(const std::string& name) const { return std::filesystem::exists(path / name); }
+
+    // Writes `contents` to `name`, replacing it, and returns its full path
+    std::string write(const std::string& name, const std::string& contents = {}) const {
+        std::string full = file(name);
+        std::ofstream(full, std::ios::binary) << contents;
+        return full;
+    }
+
+    size_t files() const {
+        size_t count = 0;
+        for (const auto& entry : std::filesystem::directory_iterator(path)) count += entry.is_regular_file();
+        return count;
+    }
+};
+
+// A log engine over gallery.bin and gallery.log in `directory` that commits each write at once
+inline std::unique_ptr<LogGalleryEngine> logEngine(const TempDirectory& directory, LogEngineOptions options = {}) {
+    options.groupCommitWindow = std::chrono::milliseconds(0);
+    return std::make_unique<LogGalleryEngine>(directory.file("gallery.bin"), directory.file("gallery.log"), std::string(), options);
+}
+
+// Item `n`: id "id<n>", named "<name> <n>", with a file name and content hash of its own
+inline GalleryItem numberedItem(int n, const std::string& name = "Item") {
+    GalleryItem item;
+    item.id = "id" + std::to_string(n);
+    item.name = name + " " + std::to_string(n);
+    item.fileName = item.id + ".jpg";
+    item.contentHash = "hash" + std::to_string(n);
+    return item;
+}
+
+}
+
+#endif // BLUTOGRAPHY_TEST_SUPPORT_HPP
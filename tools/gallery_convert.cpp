@@ -0,0 +1,38 @@
+// Converts a gallery snapshot between the binary form GalleryStorage writes and JSON.
+//
+//   gallery_convert gallery_data.bin gallery_data.json   # binary -> JSON, for reading or editing
+//   gallery_convert gallery_data.json gallery_data.bin   # JSON -> binary
+//
+// The input's form is detected from its contents; the output is JSON when its name ends
+// in ".json" and binary otherwise. Stop the server first: it would overwrite the binary
+// snapshot at its next compaction, and items still only in gallery_data.log are not included.
+
+#include <support/durable.hpp>
+#include <support/gallery_file.hpp>
+#include <iostream>
+#include <string>
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        std::cerr << "usage: " << argv[0] << " <input> <output>" << std::endl;
+        return 2;
+    }
+    std::string input = argv[1];
+    std::string output = argv[2];
+
+    std::vector<std::shared_ptr<const blutography::GalleryItem>> items;
+    std::string error;
+    if (!blutography::readGalleryFile(input, items, error)) {
+        std::cerr << "Failed to read " << input << ": " << error << std::endl;
+        return 1;
+    }
+
+    bool json = output.size() >= 5 && output.compare(output.size() - 5, 5, ".json") == 0;
+    std::string data = json ? blutography::encodeGalleryJson(items) : blutography::encodeGallery(items);
+    if (data.empty() || !blutography::writeFileAtomically(output, data)) {
+        std::cerr << "Failed to write " << output << std::endl;
+        return 1;
+    }
+    std::cout << "Wrote " << items.size() << " items to " << output << (json ? " (JSON)" : " (binary)") << std::endl;
+    return 0;
+}